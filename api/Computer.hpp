@@ -14,13 +14,17 @@
 extern "C" {
 #include <lua.h>
 }
+#include <atomic>
 #include <csetjmp>
 #include <cstdint>
 #include <condition_variable>
 #include <functional>
+#include <future>
 #include <list>
 #include <map>
+#include <memory>
 #include <queue>
+#include <streambuf>
 #include <string>
 #include <tuple>
 #include <unordered_map>
@@ -135,6 +139,14 @@ struct Computer {
     // The following fields are available in API version 10.9 and later.
     std::vector<std::filesystem::path> droppedFiles; // List of files that were dropped in the current drop set
 
+    // The following fields are available in API version 10.10 and later.
+    std::shared_ptr<void> mountIndex; // Internal index of mounts used to resolve paths quickly (don't touch this - call invalidateMountCache after changing mounts instead)
+    std::unordered_set<std::streambuf*> pendingWrites; // Write handles whose flushed data hasn't been written out yet; they're synced when the computer waits for an event
+    std::shared_ptr<void> diskUsage; // Internal counter of the space used by the computer's data directory, in standards mode (don't touch this)
+    std::shared_ptr<void> listingCache; // Internal cache of directory listings for fs.list and fs.find (don't touch this)
+    std::atomic<bool> cancelIO {false}; // Set when the computer is being freed, to stop its asynchronous fs calls early (don't touch this)
+    std::shared_future<void> storeMigration; // Ready once the data directory has been moved into the content store, which happens in the background at startup; wait for it before changing files there
+
 private:
     // The constructor is marked private to avoid having to implement it in this file.
     // It isn't necessary to construct a Computer directly; just use the startComputer function instead.
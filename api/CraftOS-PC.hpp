@@ -127,7 +127,10 @@ struct PluginFunctions {
     bool (*addMount)(Computer * comp, const path_t& real_path, const char * comp_path, bool read_only);
 
     /**
-     * Adds a virtual mount to a computer.
+     * Adds a virtual mount to a computer. The tree is indexed and copied the
+     * first time it's read from, so it only has to stay alive while it's
+     * mounted. If the tree is changed after that, call
+     * `invalidateVirtualMount` (API version 10.10) so the change is seen.
      * @param comp The computer to mount on
      * @param vfs The virtual filesystem file entry to mount
      * @param comp_path The path inside the computer to mount on
@@ -331,6 +334,16 @@ struct PluginFunctions {
      * tasks (such as creating computers) to not run!
      */
     void (*pumpTaskQueue)();
+
+    // The following fields are available in API version 10.10 and later.
+
+    /**
+     * Tells CraftOS-PC that a mounted virtual filesystem tree has changed.
+     * Mounts keep reading the old copy of the tree until this is called.
+     * Files that are already open keep their old contents.
+     * @param vfs The virtual filesystem file entry that changed
+     */
+    void (*invalidateVirtualMount)(const FileEntry& vfs);
 };
 
 /**
@@ -63,7 +63,7 @@ struct FileEntry {
      */
     FileEntry& path(std::filesystem::path path) noexcept(false) {
         FileEntry * retval = this;
-        for (const auto& item : path) if (item.string() != "." && !std::regex_match(item.native(), std::basic_regex<std::filesystem::path::value_type>(std::filesystem::path("\\d+:").native()))) retval = &(*retval)[item.string()];
+        for (const auto& item : path) if (item.native() != dot() && !isMountID(item.native())) retval = &(*retval)[item.string()];
         return *retval;
     }
     FileEntry& path(std::string path) noexcept(false) {
@@ -74,7 +74,7 @@ struct FileEntry {
     }
     const FileEntry& path(std::filesystem::path path) const noexcept(false) {
         const FileEntry * retval = this;
-        for (const auto& item : path) if (item.string() != "." && !std::regex_match(item.native(), std::basic_regex<std::filesystem::path::value_type>(std::filesystem::path("\\d+:").native()))) retval = &(*retval)[item.string()];
+        for (const auto& item : path) if (item.native() != dot() && !isMountID(item.native())) retval = &(*retval)[item.string()];
         return *retval;
     }
     const FileEntry& path(std::string path) const noexcept(false) {
@@ -83,6 +83,38 @@ struct FileEntry {
     const FileEntry& path(std::wstring path) const noexcept(false) {
         return this->path(std::filesystem::path(path));
     }
+
+    /**
+     * Returns whether a path string starts with a virtual mount ID: one or more
+     * ASCII digits followed by a colon (the same strings as the regex "^\d+:").
+     * @param str The path string to check
+     * @return Whether the string starts with a mount ID
+     */
+    template<class CharT>
+    static bool hasMountID(const std::basic_string<CharT>& str) noexcept {
+        return mountIDLength(str) > 0;
+    }
+
+    /**
+     * Returns whether a path string is only a virtual mount ID, like "0:" (the
+     * same strings as the regex "\d+:").
+     * @param str The path string to check
+     * @return Whether the string is a mount ID
+     */
+    template<class CharT>
+    static bool isMountID(const std::basic_string<CharT>& str) noexcept {
+        const size_t len = mountIDLength(str);
+        return len > 0 && len == str.size();
+    }
+private:
+    // Returns the length of the mount ID at the start of the string, including the colon, or 0 if there isn't one.
+    template<class CharT>
+    static size_t mountIDLength(const std::basic_string<CharT>& str) noexcept {
+        size_t i = 0;
+        while (i < str.size() && str[i] >= '0' && str[i] <= '9') i++;
+        return i > 0 && i < str.size() && str[i] == ':' ? i + 1 : 0;
+    }
+    static const std::filesystem::path::string_type& dot() {static const std::filesystem::path::string_type d(1, '.'); return d;}
 };
 
 #endif
\ No newline at end of file
@@ -95,6 +95,9 @@ struct configuration {
 
     // The following fields are available in API version 10.8 and later.
     bool useDFPWM;
+
+    // The following fields are available in API version 10.10 and later.
+    bool dedupStorage; // Whether computers' files are kept in the shared content store, so identical files are only stored once
 };
 
 // A smaller structure that holds the configuration for a single computer.
@@ -107,6 +110,9 @@ struct computer_configuration {
     // The following fields are available in API version 10.3 and later.
     int computerWidth;
     int computerHeight;
+
+    // The following fields are available in API version 10.10 and later.
+    bool syncOnClose; // Whether to fsync files when closing write handles, so closed files survive a system crash
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*
+ * async_check.cpp
+ * CraftOS-PC 2
+ *
+ * Measures how late a 50 ms timer ticks while a 256 MiB file is read with
+ * fs.open and with fs.readAsync, then checks that each asynchronous fs call
+ * gives the same results (and errors) as the call it stands in for, that a
+ * copy that fails partway still shows up in fs.list, and that shutting down
+ * with a copy still running exits cleanly.
+ *
+ * Usage: async_check <path to craftos>   (or `make async-check`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function await(id) while true do local ev = {os.pullEvent('task_complete')} if ev[2] == id then return table.unpack(ev, 3) end end end "
+    // the read waits for a tick first, and the timer gets one more tick afterwards to see how late it was
+    "local function timed(read) local maxGap, ticks, elapsed, size = 0, 0 "
+    "  parallel.waitForAny(function() sleep(0.1) local start = os.epoch('utc') size = read() elapsed = os.epoch('utc') - start sleep(0.2) end, function() "
+    "    local last = os.epoch('utc') "
+    "    while true do sleep(0.05) local now = os.epoch('utc') maxGap = math.max(maxGap, now - last) last = now ticks = ticks + 1 end "
+    "  end) "
+    "  return elapsed .. ' ' .. maxGap .. ' ' .. size "
+    "end "
+    "local function walk(path) local n = 0 for _, name in ipairs(fs.list(path)) do local p = fs.combine(path, name) "
+    "  if fs.isDir(p) then n = n + walk(p) else n = n + fs.getSize(p) end end return n end "
+    "local function readAll(path, mode) local f = fs.open(path, mode) local d = f.readAll() f.close() return d end "
+    "local r = {} "
+    "r[1] = timed(function() return #readAll('large.bin', 'rb') end) "
+    "r[2] = timed(function() local ok, d = await(fs.readAsync('large.bin', true)) return ok and #d or -1 end) "
+    "local ok, d = await(fs.readAsync('text.txt')) r[3] = tostring(ok and d == readAll('text.txt', 'r')) "
+    "ok, d = await(fs.readAsync('tree/d1/f1.lua', true)) r[4] = tostring(ok and d == readAll('tree/d1/f1.lua', 'rb')) "
+    "r[5] = select(2, await(fs.readAsync('missing.txt'))) "
+    "r[6] = select(2, await(fs.readAsync('tree'))) "
+    "ok = await(fs.writeAsync('out/written.txt', 'caf\\233\\n')) r[7] = tostring(ok and readAll('out/written.txt', 'rb') == 'caf\\195\\169\\n') "
+    "r[8] = select(2, await(fs.writeAsync('rom/x', 'x'))) "
+    "r[9] = select(2, await(fs.writeAsync('tree', 'x'))) "
+    "ok = await(fs.copyAsync('tree', 'copy')) r[10] = tostring(ok and walk('copy') == walk('tree')) "
+    "r[11] = select(2, await(fs.copyAsync('tree/d1/f1.lua', 'copy/d1/f1.lua'))) "
+    "r[12] = tostring(textutils.serialize(select(2, await(fs.listAsync('tree/d3')))) == textutils.serialize(fs.list('tree/d3'))) "
+    "r[13] = tostring(textutils.serialize(select(2, await(fs.listAsync('')))) == textutils.serialize(fs.list(''))) "
+    "r[14] = select(2, await(fs.listAsync('text.txt'))) "
+    "r[15] = 'true' for _, p in ipairs({'tree/*/*.lua', 'tree/d1*/f2*', '*/d5/*', 'rom/*', 'none/*'}) do "
+    "  if textutils.serialize(select(2, await(fs.findAsync(p)))) ~= textutils.serialize(fs.find(p)) then r[15] = p end end "
+    "r[16] = tostring(select(2, await(fs.getSizeAsync('tree'))) == walk('tree')) "
+    "r[17] = tostring(select(2, await(fs.getSizeAsync('text.txt'))) == fs.getSize('text.txt')) "
+    // the root is listed first so its listing is cached when the copy fails
+    "fs.list('') ok = await(fs.copyAsync('broken', 'partial')) r[18] = tostring(not ok) "
+    "for _, name in ipairs(fs.list('')) do if name == 'partial' then r[18] = r[18] .. ' listed' end end "
+    // the computer is freed while this copy is still going
+    "local f = fs.open('result.txt', 'w') for i = 1, #r do f.writeLine(r[i]) end f.close() fs.copyAsync('large.bin', 'late.bin') os.shutdown()";
+
+static const char * checks[] = {
+    "text read matches readAll",
+    "binary read matches readAll",
+    "missing file",
+    "reading a directory",
+    "text write is UTF-8",
+    "write to ROM",
+    "write to a directory",
+    "copied tree matches",
+    "copy onto a file",
+    "list matches fs.list",
+    "list of root matches fs.list",
+    "list of a file",
+    "find matches fs.find",
+    "size of tree",
+    "size of file",
+    "failed copy is listed",
+};
+
+static const char * expected[] = {
+    "true", "true", "/missing.txt: No such file", "/tree: No such file", "true", "/rom/x: Access denied",
+    "/tree: Cannot write to directory", "true", "/tree/d1/f1.lua: File exists", "true", "true", "/text.txt: Not a directory",
+    "true", "true", "true", "true listed",
+};
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-async-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir, root = dir + "/computer/0";
+    mkdir((dir + "/computer").c_str(), 0777);
+    mkdir(root.c_str(), 0777);
+    mkdir((root + "/tree").c_str(), 0777);
+    std::mt19937 rng(1);
+    {
+        std::ofstream out(root + "/large.bin", std::ios::binary);
+        std::string chunk(1048576, 0);
+        for (int i = 0; i < 256; i++) {
+            for (char& c : chunk) c = rng();
+            out.write(chunk.data(), chunk.size());
+        }
+    }
+    std::ofstream(root + "/text.txt", std::ios::binary) << "line one\r\nline two\r\r\n\xe9t\xc3\xa9\n\x01\x7f";
+    // the FIFO can't be copied, so the copy fails after making the directory
+    mkdir((root + "/broken").c_str(), 0777);
+    std::ofstream(root + "/broken/file.txt") << "data";
+    mkfifo((root + "/broken/fifo").c_str(), 0666);
+    for (int d = 0; d < 10; d++) {
+        const std::string sub = root + "/tree/d" + std::to_string(d);
+        mkdir(sub.c_str(), 0777);
+        for (int f = 0; f < 20; f++) {
+            std::string data(rng() % 4096, 0);
+            for (char& c : data) c = rng();
+            std::ofstream(sub + "/f" + std::to_string(f) + (f % 2 ? ".lua" : ".txt"), std::ios::binary) << data;
+        }
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    std::ifstream in(root + "/result.txt");
+    long elapsed[2] = {0, 0}, maxGap[2] = {0, 0}, size[2] = {0, 0};
+    for (int i = 0; i < 2; i++) in >> elapsed[i] >> maxGap[i] >> size[i];
+    in.ignore();
+    printf("256 MiB read with fs.open:      %5ld ms, timer up to %5ld ms late\n", elapsed[0], maxGap[0] - 50);
+    printf("256 MiB read with fs.readAsync: %5ld ms, timer up to %5ld ms late\n\n", elapsed[1], maxGap[1] - 50);
+    bool ok = size[0] == 268435456 && size[1] == 268435456 && maxGap[1] < 250 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        std::string line;
+        std::getline(in, line);
+        const bool pass = line == expected[i];
+        printf("%-28s %s\n", checks[i], pass ? "ok" : ("FAILED: " + line).c_str());
+        ok = ok && pass;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+/*
+ * cli_pty_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Runs CraftOS-PC's ncurses renderer inside a pseudo-terminal and reports how
+ * many bytes it writes to the tty, to measure the cost of screen updates.
+ *
+ * Usage: cli_pty_bench <path to craftos> [frames]   (or `make cli-pty-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos> [frames]\n", argv[0]);
+        return 2;
+    }
+    const int frames = argc > 2 ? atoi(argv[2]) : 200;
+    // one small change per frame, like a clock or a progress counter
+    const std::string script = "sleep(1) for i = 1, " + std::to_string(frames) + " do term.setCursorPos(i % 40 + 1, i % 15 + 1) term.setTextColor(2 ^ (i % 16)) term.write(i) sleep(0.05) end os.shutdown()";
+    char tmpdir[] = "/tmp/craftos-pty-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    struct winsize ws = {20, 51, 0, 0};
+    int fd;
+    const pid_t pid = forkpty(&fd, NULL, NULL, &ws);
+    if (pid < 0) {
+        perror("forkpty");
+        return 1;
+    } else if (pid == 0) {
+        setenv("TERM", "xterm-256color", 1);
+        execl(argv[1], argv[1], "--cli", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    size_t total = 0;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) total += n;
+    int status = 0;
+    waitpid(pid, &status, 0);
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu bytes written to the tty in %.1f s (%.1f bytes/frame over %d frames)\n", total, secs, (double)total / frames, frames);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
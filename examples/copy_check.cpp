@@ -0,0 +1,222 @@
+/*
+ * copy_check.cpp
+ * CraftOS-PC 2
+ *
+ * Checks the copier behind fs.copy against std::filesystem::copy on a few
+ * thousand random trees: the copied files, their modes and the error have to
+ * be the same. Then copies a large tree inside craftos while a timer ticks,
+ * to check that the computer keeps running during the copy, that the errors
+ * and standards-mode space count are unchanged, and that a terminate event
+ * cancels the copy. Also checks that a coroutine running alongside a waiting
+ * fs.copy gets each event exactly once, and that fs.copy works where it can't
+ * yield (inside a metamethod).
+ *
+ * Usage: copy_check <path to craftos>   (or `make copy-check`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/filecopy.hpp"
+
+namespace fs = std::filesystem;
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function walk(path) local n = 0 for _, name in ipairs(fs.list(path)) do local p = fs.combine(path, name) "
+    "  if fs.isDir(p) then n = n + walk(p) else n = n + fs.getSize(p) end end return n end "
+    "local capacity = fs.getCapacity('/') "
+    "local maxGap, ticks, ok, e = 0, 0 "
+    "local start = os.epoch('utc') "
+    "parallel.waitForAny(function() ok, e = pcall(fs.copy, 'src', 'dst') end, function() "
+    "  local last = os.epoch('utc') "
+    "  while true do sleep(0.05) local now = os.epoch('utc') maxGap = math.max(maxGap, now - last) last = now ticks = ticks + 1 end "
+    "end) "
+    "local elapsed = os.epoch('utc') - start "
+    "local _, exists = pcall(fs.copy, 'src/small/f1', 'dst/small/f1') "
+    "local _, outside = pcall(fs.copy, 'src', 'src/inner') "
+    "local _, terminated "
+    "parallel.waitForAny(function() _, terminated = pcall(fs.copy, 'src', 'canceled') end, function() os.queueEvent('terminate') sleep(60) end) "
+    "local seen = 0 "
+    "parallel.waitForAll(function() fs.copy('src/large.bin', 'once.bin') os.queueEvent('copied') end, function() "
+    "  for i = 1, 3 do os.queueEvent('mine', i) end "
+    "  while true do local ev = os.pullEvent() if ev == 'mine' then seen = seen + 1 elseif ev == 'copied' then break end end "
+    "end) "
+    "local once = seen == 3 "
+    "local meta = setmetatable({}, {__index = function() fs.copy('src/large.bin', 'meta.bin') return fs.getSize('meta.bin') end}) "
+    "local metaOk, metaSize = pcall(function() return meta.x end) "
+    "fs.delete('once.bin') fs.delete('meta.bin') "
+    "local used, real = capacity - fs.getFreeSpace('/'), walk('') "
+    "local f = fs.open('result.txt', 'w') "
+    "f.writeLine(tostring(ok) .. ' ' .. tostring(e)) f.writeLine(elapsed) f.writeLine(maxGap) f.writeLine(ticks) "
+    "f.writeLine(exists) f.writeLine(outside) f.writeLine(terminated) f.writeLine(used .. ' ' .. real) "
+    "f.writeLine(tostring(once)) f.writeLine(tostring(metaOk) .. ' ' .. tostring(metaSize)) f.close() os.shutdown()";
+
+static std::mt19937 rng(1);
+
+static void makeTree(const fs::path& p, int depth) {
+    fs::create_directory(p);
+    for (int i = rng() % 5; i > 0; i--) {
+        const fs::path c = p / std::string(1, 'a' + rng() % 4);
+        if (fs::exists(fs::symlink_status(c))) continue;
+        switch (rng() % 8) {
+            case 0: case 1: case 2:
+                std::ofstream(c) << std::string(rng() % 3000, 'a' + rng() % 26);
+                chmod(c.c_str(), rng() % 2 ? 0644 : 0755);
+                break;
+            case 3: case 4: if (depth < 3) makeTree(c, depth + 1); break;
+            case 5: fs::create_symlink(rng() % 2 ? "a" : "missing", c); break;
+            case 6: if (rng() % 4 == 0) mkfifo(c.c_str(), 0644); break;
+            case 7:
+                if (depth < 3) {
+                    makeTree(c, depth + 1);
+                    chmod(c.c_str(), rng() % 3 == 0 ? 0555 : 0755);
+                }
+                break;
+        }
+    }
+}
+
+// Lists every entry under a path with its mode and contents.
+static std::string describe(const fs::path& p) {
+    std::error_code e;
+    if (!fs::exists(fs::symlink_status(p, e))) return "none";
+    std::vector<fs::path> all = {p};
+    if (fs::is_directory(fs::symlink_status(p))) for (const auto& d : fs::recursive_directory_iterator(p, e)) all.push_back(d.path());
+    std::sort(all.begin(), all.end());
+    std::string out;
+    for (const fs::path& q : all) {
+        struct stat st;
+        lstat(q.c_str(), &st);
+        out += q.string().substr(p.parent_path().string().size()) + " " + std::to_string(st.st_mode) + " ";
+        if (S_ISREG(st.st_mode)) {
+            std::ifstream in(q);
+            out += std::string(std::istreambuf_iterator<char>(in), {});
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+static bool sameFile(const fs::path& a, const fs::path& b) {
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::string ba(1048576, 0), bb(1048576, 0);
+    while (fa && fb) {
+        fa.read(&ba[0], ba.size());
+        fb.read(&bb[0], bb.size());
+        if (fa.gcount() != fb.gcount() || ba.compare(0, fa.gcount(), bb, 0, fb.gcount()) != 0) return false;
+    }
+    return fa.eof() && fb.eof();
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-copy-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+
+    // each tree is made twice from the same seed, once for each copier
+    int mismatches = 0;
+    const std::atomic<bool> cancel {false};
+    for (int i = 0; i < 2000; i++) {
+        const fs::path work = dir + "/fuzz";
+        fs::remove_all(work);
+        for (int k = 0; k < 2; k++) {
+            const fs::path root = work / (k ? "b" : "a");
+            fs::create_directories(root);
+            rng.seed(i);
+            makeTree(root / "src", 0);
+            switch (i % 5) {
+                case 1: fs::create_directory(root / "dst"); break;
+                case 2: std::ofstream(root / "dst") << "x"; break;
+                case 3: makeTree(root / "dst", 1); break;
+                case 4: fs::create_symlink("src", root / "dst"); break;
+            }
+        }
+        // sometimes copy the first entry in the tree instead of all of it
+        fs::path from = "src";
+        if (i % 3 == 0)
+            for (const auto& d : fs::directory_iterator(work / "a/src")) {from /= d.path().filename(); break;}
+        std::error_code e1, e2;
+        fs::copy(work / "a" / from, work / "a/dst", fs::copy_options::recursive, e1);
+        copyTree(work / "b" / from, work / "b/dst", e2, cancel);
+        if ((e1 != e2 || describe(work / "a/dst") != describe(work / "b/dst")) && ++mismatches <= 10)
+            printf("mismatch on tree %d: '%s' vs '%s'\n", i, e1.message().c_str(), e2.message().c_str());
+    }
+    fs::remove_all(dir + "/fuzz");
+    printf("2000 trees copied, %d mismatches\n\n", mismatches);
+
+    const std::string root = dir + "/computer/0";
+    fs::create_directories(root + "/src/small");
+    fs::create_directories(dir + "/config");
+    std::ofstream(dir + "/config/global.json") << "{\"standardsMode\": true}";
+    {
+        std::ofstream out(root + "/src/large.bin", std::ios::binary);
+        std::string chunk(1048576, 0);
+        for (int i = 0; i < 512; i++) {
+            for (char& c : chunk) c = rng();
+            out.write(chunk.data(), chunk.size());
+        }
+    }
+    for (int i = 0; i < 2000; i++) std::ofstream(root + "/src/small/f" + std::to_string(i)) << std::string(rng() % 8192, 'a' + i % 26);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    std::ifstream in(root + "/result.txt");
+    std::string result, exists, outside, terminated, space, once, meta;
+    long elapsed = 0, maxGap = 0, ticks = 0;
+    std::getline(in, result);
+    in >> elapsed >> maxGap >> ticks;
+    in.ignore();
+    std::getline(in, exists);
+    std::getline(in, outside);
+    std::getline(in, terminated);
+    std::getline(in, space);
+    std::getline(in, once);
+    std::getline(in, meta);
+    bool ok = result == "true nil";
+    printf("copy of 512 MiB + 2000 files: %s, %ld ms, timer ticked %ld times, longest gap %ld ms\n", result.c_str(), elapsed, ticks, maxGap);
+    bool same = sameFile(root + "/src/large.bin", root + "/dst/large.bin");
+    for (int i = 0; i < 2000 && same; i++) same = sameFile(root + "/src/small/f" + std::to_string(i), root + "/dst/small/f" + std::to_string(i));
+    printf("copied files match: %s\n", same ? "yes" : "NO");
+    printf("copy onto a file: %s\n", exists.c_str());
+    printf("copy into itself: %s\n", outside.c_str());
+    printf("terminated copy: %s\n", terminated.c_str());
+    const size_t sp = space.find(' ');
+    const bool spaceOk = sp != std::string::npos && space.substr(0, sp) == space.substr(sp + 1);
+    printf("space used (counted, found): %s\n", space.c_str());
+    printf("events during the copy seen once by another coroutine: %s\n", once.c_str());
+    printf("copy inside a metamethod: %s\n", meta.c_str());
+    ok = ok && same && spaceOk && maxGap < 1000 && exists == "/src/small/f1: File exists" &&
+        outside == "/src: Can't copy a directory inside itself" && terminated == "Terminated" &&
+        once == "true" && meta == "true " + std::to_string(512 * 1048576);
+    return mismatches == 0 && ok ? 0 : 1;
+}
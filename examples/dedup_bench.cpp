@@ -0,0 +1,350 @@
+/*
+ * dedup_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures the content store on a fleet of 200 computers that each have the
+ * same 400-file operating system and a few files of their own: how much disk
+ * the fleet takes before and after its files are moved into the store, how
+ * fast moving them is, and whether reading and rewriting shared files gets
+ * slower. Then has 8 threads act as computers writing, appending, copying and
+ * deleting files in their own directories (all starting from the same files)
+ * while another collects the store, and checks that every computer ends up
+ * with exactly the files it wrote and the store is consistent, that hard
+ * links the store didn't make are left alone, and that directories on another
+ * filesystem are skipped. Last, runs craftos with deduplication turned on:
+ * two computers boot and share their files, then one changes some of them,
+ * and only that computer's copies change.
+ *
+ * Usage: dedup_bench <path to craftos>   (or `make dedup-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "../src/contentstore.hpp"
+#include "../src/filecopy.hpp"
+
+namespace fs = std::filesystem;
+
+static long since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns the bytes the files under a path take up on the disk, counting each file once however many links it has.
+static uintmax_t diskUsage(const fs::path& path) {
+    std::set<std::pair<dev_t, ino_t> > seen;
+    uintmax_t size = 0;
+    for (auto it = fs::recursive_directory_iterator(path); it != fs::recursive_directory_iterator(); ++it) {
+        struct stat st;
+        if (lstat(it->path().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (seen.insert(std::make_pair(st.st_dev, st.st_ino)).second) size += st.st_blocks * 512;
+    }
+    return size;
+}
+
+static std::string readFile(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+static void writeFile(const fs::path& path, const std::string& data, bool append = false) {
+    std::ofstream(path, append ? std::ios::binary | std::ios::app : std::ios::binary) << data;
+}
+
+// Reads every file under a path into a map from relative paths to contents.
+static std::map<std::string, std::string> readTree(const fs::path& root) {
+    std::map<std::string, std::string> files;
+    std::error_code e;
+    for (auto it = fs::recursive_directory_iterator(root, e); !e && it != fs::recursive_directory_iterator(); it.increment(e))
+        if (it->is_regular_file()) files[fs::relative(it->path(), root).generic_string()] = readFile(it->path());
+    return files;
+}
+
+// Runs craftos with some arguments and waits for it to exit, returning its status.
+static int run(const char * craftos, const std::vector<std::string>& args) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        std::vector<const char*> argv = {craftos};
+        for (const std::string& a : args) argv.push_back(a.c_str());
+        argv.push_back(NULL);
+        execv(craftos, (char* const*)argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Acts as one computer: makes random changes to the files in its directory the way the fs API
+// does, and keeps what the files should hold in a model. Moves its files into the store now and
+// then, as a computer does when it boots. Returns whether the directory matches the model.
+static bool churn(const ContentStore& store, const fs::path& root, std::map<std::string, std::string> model, unsigned seed) {
+    std::mt19937 rng(seed);
+    const std::atomic<bool> cancel {false};
+    std::error_code e;
+    for (int i = 0; i < 3000; i++) {
+        if (i % 500 == 499) store.add(root, e, cancel);
+        // a fifth of the changes go to files every computer has, so most of them are shared
+        const std::string name = rng() % 5 == 0 ? "programs0/p" + std::to_string(rng() % 20) + ".lua" : "own/f" + std::to_string(rng() % 40);
+        const fs::path path = root / name;
+        fs::create_directories(path.parent_path());
+        switch (rng() % 4) {
+        case 0: {  // fs.open(path, "w")
+            const std::string data = std::string(rng() % 4096, 'a' + rng() % 26);
+            store.unshare(path, false, e);
+            if (e) return false;
+            writeFile(path, data);
+            model[name] = data;
+            break;
+        } case 1: {  // fs.open(path, "a")
+            const std::string data = std::string(rng() % 512 + 1, 'a' + rng() % 26);
+            store.unshare(path, true, e);
+            if (e) return false;
+            writeFile(path, data, true);
+            model[name] += data;
+            break;
+        } case 2:  // fs.delete
+            fs::remove(path, e);
+            model.erase(name);
+            break;
+        case 3: {  // fs.copy onto a new name, which copies the link's contents
+            const auto it = model.begin();
+            if (it == model.end() || model.count(name)) break;
+            copyTree(root / it->first, path, e, cancel);
+            if (e) return false;
+            model[name] = it->second;
+            break;
+        }}
+    }
+    store.add(root, e, cancel);
+    return readTree(root) == model;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-dedup-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    const std::atomic<bool> cancel {false};
+    std::error_code e;
+    std::mt19937 rng(1);
+
+    // an operating system about the size of a small one: 400 files, 2 MiB, with one larger file
+    const fs::path os = dir + "/os";
+    for (int d = 0; d < 20; d++) {
+        const fs::path sub = os / ("programs" + std::to_string(d));
+        fs::create_directories(sub);
+        for (int f = 0; f < 20; f++) writeFile(sub / ("p" + std::to_string(f) + ".lua"), std::string(rng() % 10240 + 1, 'a' + f) + std::to_string(d));
+    }
+    writeFile(os / "data.bin", std::string(1048576, 'x'));
+    const std::map<std::string, std::string> osFiles = readTree(os);
+
+    // the fleet: every computer has the operating system and 10 files of its own
+    const fs::path fleet = dir + "/computer";
+    fs::create_directories(fleet);
+    for (int i = 0; i < 200; i++) {
+        const fs::path comp = fleet / std::to_string(i);
+        copyTree(os, comp, e, cancel);
+        fs::create_directories(comp / "home");
+        for (int f = 0; f < 10; f++) writeFile(comp / "home" / ("f" + std::to_string(f)), std::string(rng() % 8192 + 1, 'a' + f) + std::to_string(i));
+    }
+    const uintmax_t before = diskUsage(fleet);
+
+    const ContentStore store(fleet / "store");
+    auto start = std::chrono::steady_clock::now();
+    int64_t saved = 0;
+    for (int i = 0; i < 200; i++) saved += store.add(fleet / std::to_string(i), e, cancel);
+    const long addTime = since(start);
+    if (e) {
+        fprintf(stderr, "Could not add the fleet to the store: %s\n", e.message().c_str());
+        return 1;
+    }
+    const uintmax_t after = diskUsage(fleet);
+    const ContentStore::Stats st = store.stats();
+    printf("200 computers: %6llu KiB on disk before, %6llu KiB after (%.1fx smaller)\n",
+        (unsigned long long)before / 1024, (unsigned long long)after / 1024, (double)before / after);
+    printf("store: %lld objects (%lld KiB) behind %lld files (%lld KiB); %lld KiB reported saved\n",
+        (long long)st.objects, (long long)st.stored / 1024, (long long)st.links, (long long)st.linked / 1024, (long long)saved / 1024);
+    printf("moving the fleet into the store: %ld ms (%.0f files/s, %.0f MiB/s)\n", addTime,
+        st.links * 1000.0 / (addTime ? addTime : 1), st.linked * 1000.0 / 1048576 / (addTime ? addTime : 1));
+
+    // booting again only looks at files changed since the last add, like one written in the meantime
+    writeFile(fleet / "0" / "home" / "new", std::string(4096, 'n'));
+    writeFile(fleet / "1" / "home" / "new", std::string(4096, 'n'));
+    start = std::chrono::steady_clock::now();
+    int64_t resaved = 0;
+    for (int i = 0; i < 200; i++) resaved += store.add(fleet / std::to_string(i), e, cancel);
+    const long readdTime = since(start);
+    printf("adding the fleet again: %ld ms, %lld bytes saved (expected 4096)\n", readdTime, (long long)resaved);
+    if (e || resaved != 4096 || fs::hard_link_count(fleet / "0" / "home" / "new") != 3) {
+        fprintf(stderr, "Adding the fleet again didn't add only the new files\n");
+        return 1;
+    }
+
+    // reading goes through the same inodes either way, so it should be no slower
+    const fs::path plain = dir + "/plain";
+    copyTree(os, plain, e, cancel);
+    size_t bytes = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20; i++) for (const auto& f : osFiles) bytes += readFile(plain / f.first).size();
+    const long readPlain = since(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20; i++) for (const auto& f : osFiles) bytes += readFile(fleet / std::to_string(i) / f.first).size();
+    const long readShared = since(start);
+    printf("reading every file 20 times: %6ld ms from a plain directory, %6ld ms from shared files\n", readPlain, readShared);
+
+    // rewriting a shared file removes the link first; appending to one copies it first
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20; i++) for (const auto& f : osFiles) writeFile(plain / f.first, f.second);
+    const long writePlain = since(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 20; i < 40; i++) for (const auto& f : osFiles) {
+        store.unshare(fleet / std::to_string(i) / f.first, false, e);
+        writeFile(fleet / std::to_string(i) / f.first, f.second);
+    }
+    const long writeShared = since(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 40; i < 60; i++) for (const auto& f : osFiles) {
+        store.unshare(fleet / std::to_string(i) / f.first, true, e);
+        writeFile(fleet / std::to_string(i) / f.first, "\n", true);
+    }
+    const long appendShared = since(start);
+    printf("rewriting every file 20 times: %6ld ms in a plain directory, %6ld ms for shared files (%ld ms appending)\n\n", writePlain, writeShared, appendShared);
+
+    bool shared = true;
+    for (int i = 0; i < 20 && shared; i++) {
+        std::map<std::string, std::string> files = readTree(fleet / std::to_string(i));
+        for (const auto& f : osFiles) shared = shared && files[f.first] == f.second;
+    }
+    for (int i = 40; i < 60 && shared; i++) {
+        std::map<std::string, std::string> files = readTree(fleet / std::to_string(i));
+        for (const auto& f : osFiles) shared = shared && files[f.first] == f.second + "\n";
+    }
+    printf("%-40s %s\n", "changes only touch their own computer", shared ? "ok" : "FAILED");
+
+    // 8 computers change their files at once while the store is collected
+    const fs::path busy = dir + "/busy";
+    const ContentStore busyStore(busy / "store");
+    fs::create_directories(busy);
+    for (int i = 0; i < 8; i++) {
+        copyTree(os, busy / std::to_string(i), e, cancel);
+        busyStore.add(busy / std::to_string(i), e, cancel);
+    }
+    std::atomic<bool> done {false};
+    std::atomic<int64_t> freed {0};
+    std::thread collector([&]() {
+        std::error_code e;
+        while (!done) freed += busyStore.collect(e);
+    });
+    bool results[8];
+    std::vector<std::thread> computers;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 8; i++) computers.emplace_back([&, i]() {results[i] = churn(busyStore, busy / std::to_string(i), osFiles, i + 1);});
+    for (std::thread& t : computers) t.join();
+    const long churnTime = since(start);
+    done = true;
+    collector.join();
+    bool matches = true;
+    for (int i = 0; i < 8; i++) matches = matches && results[i];
+    printf("%-40s %s\n", "concurrent writes keep every computer's files", matches ? "ok" : "FAILED");
+
+    freed += busyStore.collect(e);
+    bool consistent = !e, noOrphans = true;
+    for (auto it = fs::recursive_directory_iterator(busy / "store"); it != fs::recursive_directory_iterator(); ++it) {
+        if (!it->is_regular_file() || it->path().parent_path().filename() == "tmp" || it->path().parent_path().filename() == "added") continue;
+        std::error_code e2;
+        const std::string name = it->path().parent_path().filename().string() + it->path().filename().string();
+        consistent = consistent && ContentStore::hash(it->path(), e2) == name;
+        noOrphans = noOrphans && it->hard_link_count() > 1;
+    }
+    printf("%-40s %s\n", "every object matches its hash", consistent ? "ok" : "FAILED");
+    printf("%-40s %s\n", "collecting leaves no unused objects", noOrphans ? "ok" : "FAILED");
+    printf("24000 changes by 8 computers: %ld ms, %lld KiB collected on the way\n\n", churnTime, (long long)freed / 1024);
+    bool ok = shared && matches && consistent && noOrphans;
+
+    // a hard link the user made (e.g. in a mounted directory) isn't the store's to break
+    const fs::path userDir = dir + "/user";
+    fs::create_directories(userDir);
+    writeFile(userDir / "a.txt", "user data");
+    fs::create_hard_link(userDir / "a.txt", userDir / "b.txt");
+    store.unshare(userDir / "a.txt", true, e);
+    const bool userLinks = !e && fs::hard_link_count(userDir / "a.txt") == 2;
+    printf("%-40s %s\n", "user hard links are left alone", userLinks ? "ok" : "FAILED");
+    ok = ok && userLinks;
+
+    // a directory the store can't link to is skipped without hashing it
+    char otherdir[] = "/dev/shm/craftos-dedup-XXXXXX";
+    struct stat tmpStat, otherStat;
+    if (stat("/dev/shm", &otherStat) == 0 && stat(tmpdir, &tmpStat) == 0 && otherStat.st_dev != tmpStat.st_dev && mkdtemp(otherdir) != NULL) {
+        copyTree(os, fs::path(otherdir) / "0", e, cancel);
+        start = std::chrono::steady_clock::now();
+        const int64_t otherSaved = store.add(fs::path(otherdir) / "0", e, cancel);
+        const long otherTime = since(start);
+        const bool skipped = !e && otherSaved == 0 && fs::hard_link_count(fs::path(otherdir) / "0" / "data.bin") == 1;
+        printf("%-40s %s (%ld ms)\n", "other filesystems are skipped", skipped ? "ok" : "FAILED", otherTime);
+        fs::remove_all(otherdir);
+        ok = ok && skipped;
+    } else printf("%-40s %s\n", "other filesystems are skipped", "not checked: /dev/shm is on the same filesystem");
+    printf("\n");
+
+    // craftos moves computers into the store when they boot, so once both have booted they share their files;
+    // then a computer changing a shared file gets a copy of its own, and a mounted directory's own links are kept
+    const fs::path base = dir + "/craftos";
+    fs::create_directories(base / "config");
+    fs::create_directories(base / "computer");
+    writeFile(base / "config" / "global.json", "{\"dedupStorage\": true}");
+    for (int i = 0; i < 2; i++) copyTree(os, base / "computer" / std::to_string(i), e, cancel);
+    for (int i = 0; i < 2; i++) run(argv[1], {"--raw", "-d", base.string(), "-i", std::to_string(i), "--exec", "os.shutdown()"});
+    const fs::path file0 = base / "computer" / "0" / "programs0", file1 = base / "computer" / "1" / "programs0";
+    bool linked = true;
+    for (const char * name : {"p0.lua", "p1.lua", "p2.lua"}) linked = linked && fs::equivalent(file0 / name, file1 / name, e) && !e;
+    const std::string object = (base / "computer" / "store").string() + "/" + ContentStore::hash(file1 / "p0.lua", e).insert(2, "/");
+    run(argv[1], {"--raw", "-d", base.string(), "-i", "0", "--mount-rw", "user=" + userDir.string(), "--exec",
+        "local f = fs.open('programs0/p0.lua', 'a') f.write('!') f.close() "
+        "f = fs.open('programs0/p1.lua', 'w') f.write('new') f.close() "
+        "local id = fs.writeAsync('programs0/p2.lua', 'async') repeat local _, t = os.pullEvent('task_complete') until t == id "
+        "f = fs.open('user/a.txt', 'a') f.write('!') f.close() os.shutdown()"});
+    std::map<std::string, std::string> expected = osFiles;
+    expected["programs0/p0.lua"] += "!";
+    expected["programs0/p1.lua"] = "new";
+    expected["programs0/p2.lua"] = "async";
+    const bool isolated = readTree(base / "computer" / "0") == expected && readTree(base / "computer" / "1") == osFiles &&
+        readFile(object) == osFiles.at("programs0/p0.lua");
+    const bool userKept = readFile(userDir / "b.txt") == "user data!";
+    printf("%-40s %s\n", "craftos shares files between computers", linked ? "ok" : "FAILED");
+    printf("%-40s %s\n", "craftos writes only change one computer", isolated ? "ok" : "FAILED");
+    printf("%-40s %s\n", "craftos keeps a mount's own hard links", userKept ? "ok" : "FAILED");
+    ok = ok && linked && isolated && userKept;
+
+    fs::remove_all(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,272 @@
+/*
+ * gif_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Compares the two ways recordings can be written to GIFs: quantizing every
+ * frame against the palette (GifMakePaletteFromColors + GifThresholdImage),
+ * and looking up palette colors directly while writing only the changed
+ * rectangle (GifWritePaletteFrame). It renders a synthetic 60 second terminal
+ * session at 10 FPS, encodes it both ways, and decodes the results to check
+ * that every frame still matches.
+ *
+ * Usage: make gif-bench
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../src/gif.hpp"
+
+static const int termWidth = 51, termHeight = 19, cellWidth = 12, cellHeight = 18, border = 4;
+static const int imageWidth = termWidth * cellWidth + border * 2, imageHeight = termHeight * cellHeight + border * 2;
+static const int fps = 10, frames = 60 * fps;
+
+static uint32_t palette[256];
+
+struct Session {
+    unsigned char screen[termHeight][termWidth];
+    unsigned char colors[termHeight][termWidth];
+    int cursorX = 0, cursorY = 0;
+    unsigned rng = 12345;
+    unsigned random() {rng = rng * 1103515245 + 12345; return (rng >> 16) & 0x7FFF;}
+
+    Session() {
+        memset(screen, ' ', sizeof(screen));
+        memset(colors, 0xF0, sizeof(colors));
+    }
+
+    void newline() {
+        cursorX = 0;
+        if (++cursorY == termHeight) {
+            memmove(screen[0], screen[1], sizeof(screen[0]) * (termHeight - 1));
+            memmove(colors[0], colors[1], sizeof(colors[0]) * (termHeight - 1));
+            memset(screen[termHeight-1], ' ', termWidth);
+            memset(colors[termHeight-1], 0xF0, termWidth);
+            cursorY--;
+        }
+    }
+
+    // a shell-like workload: mostly typing, sometimes a burst of program output
+    void step(int frame) {
+        if (frame % 50 == 49) {
+            for (int l = 0; l < 8; l++) {
+                const unsigned char color = 0xF0 | (random() % 15);
+                for (int i = 0; i < termWidth - 4; i++) {
+                    screen[cursorY][i] = 'a' + random() % 26;
+                    colors[cursorY][i] = color;
+                }
+                newline();
+            }
+        } else {
+            for (int i = random() % 3; i > 0; i--) {
+                screen[cursorY][cursorX] = 'a' + random() % 26;
+                colors[cursorY][cursorX] = 0xF0 | (cursorX < 2 ? 4 : 0);
+                if (++cursorX == termWidth || random() % 40 == 0) newline();
+            }
+        }
+    }
+
+    void render(uint8_t * image, bool blink) const {
+        for (int y = 0; y < imageHeight; y++) {
+            for (int x = 0; x < imageWidth; x++) {
+                uint32_t color = palette[15];
+                const int cx = (x - border) / cellWidth, cy = (y - border) / cellHeight;
+                if (x >= border && y >= border && cx < termWidth && cy < termHeight) {
+                    const int px = (x - border) % cellWidth / 2, py = (y - border) % cellHeight / 2;
+                    const unsigned char c = screen[cy][cx];
+                    bool set = c != ' ' && px < 5 && py > 1 && py < 8 && ((c * 2654435761u) >> ((px + py * 5) % 29)) & 1;
+                    if (blink && cx == cursorX && cy == cursorY && py == 7) set = true;
+                    color = palette[set ? colors[cy][cx] & 0x0F : colors[cy][cx] >> 4];
+                }
+                uint8_t * p = image + (y * imageWidth + x) * 4;
+                p[0] = color & 0xFF;
+                p[1] = (color >> 8) & 0xFF;
+                p[2] = (color >> 16) & 0xFF;
+                p[3] = 0xFF;
+            }
+        }
+    }
+};
+
+// Encodes a frame the way recordings were encoded before GifWritePaletteFrame.
+static void writeQuantizedFrame(GifWriter * writer, const uint8_t * image) {
+    GifPalette pal;
+    GifMakePaletteFromColors(palette, 5, &pal);
+    GifThresholdImage(writer->firstFrame ? NULL : writer->oldImage, image, writer->oldImage, imageWidth, imageHeight, &pal);
+    writer->firstFrame = false;
+    GifWriteLzwImage(writer->f, writer->oldImage, 0, 0, imageWidth, imageHeight, 100 / fps, &pal);
+}
+
+// Just enough of a GIF decoder to read back what gif.cpp writes.
+class GifReader {
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    std::vector<uint8_t> canvas;
+public:
+    int width = 0, height = 0;
+    bool open(const std::string& path) {
+        FILE * fp = fopen(path.c_str(), "rb");
+        if (fp == NULL) return false;
+        uint8_t buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + n);
+        fclose(fp);
+        if (data.size() < 13 || memcmp(data.data(), "GIF89a", 6) != 0) return false;
+        width = data[6] | (data[7] << 8);
+        height = data[8] | (data[9] << 8);
+        pos = 13;
+        if (data[10] & 0x80) pos += 3 << ((data[10] & 7) + 1);
+        canvas.resize(width * height * 3);
+        return true;
+    }
+    // Composites the next frame onto the canvas; returns NULL at the end of the file.
+    const uint8_t * next() {
+        int transIndex = -1;
+        while (pos < data.size()) {
+            const uint8_t type = data[pos++];
+            if (type == 0x3B) return NULL;
+            else if (type == 0x21) {
+                const uint8_t label = data[pos++];
+                if (label == 0xF9 && (data[pos+1] & 1)) transIndex = data[pos+4];
+                while (data[pos]) pos += data[pos] + 1;
+                pos++;
+            } else if (type == 0x2C) {
+                const int left = data[pos] | (data[pos+1] << 8), top = data[pos+2] | (data[pos+3] << 8);
+                const int w = data[pos+4] | (data[pos+5] << 8), h = data[pos+6] | (data[pos+7] << 8);
+                const uint8_t flags = data[pos+8];
+                pos += 9;
+                const uint8_t * table = &data[pos];
+                if (flags & 0x80) pos += 3 << ((flags & 7) + 1);
+                std::vector<uint8_t> indices = decode(w * h);
+                for (int y = 0; y < h; y++) {
+                    for (int x = 0; x < w; x++) {
+                        const uint8_t index = indices[y * w + x];
+                        if (index == transIndex) continue;
+                        uint8_t * p = &canvas[((top + y) * width + left + x) * 3];
+                        memcpy(p, table + index * 3, 3);
+                    }
+                }
+                return canvas.data();
+            } else return NULL;
+        }
+        return NULL;
+    }
+private:
+    std::vector<uint8_t> decode(size_t count) {
+        const int minCodeSize = data[pos++];
+        std::vector<uint8_t> bytes;
+        while (data[pos]) {
+            bytes.insert(bytes.end(), &data[pos+1], &data[pos+1] + data[pos]);
+            pos += data[pos] + 1;
+        }
+        pos++;
+        const int clearCode = 1 << minCodeSize;
+        std::vector<std::vector<uint8_t>> dict;
+        std::vector<uint8_t> out, prev;
+        int codeSize = minCodeSize + 1;
+        size_t bit = 0;
+        while (out.size() < count && bit + codeSize <= bytes.size() * 8) {
+            int code = 0;
+            for (int i = 0; i < codeSize; i++, bit++) code |= ((bytes[bit / 8] >> (bit % 8)) & 1) << i;
+            if (code == clearCode) {
+                dict.clear();
+                for (int i = 0; i < clearCode + 2; i++) dict.push_back(std::vector<uint8_t>(1, (uint8_t)i));
+                codeSize = minCodeSize + 1;
+                prev.clear();
+                continue;
+            } else if (code == clearCode + 1) break;
+            std::vector<uint8_t> entry;
+            if (code < (int)dict.size()) entry = dict[code];
+            else {
+                entry = prev;
+                entry.push_back(prev[0]);
+            }
+            out.insert(out.end(), entry.begin(), entry.end());
+            if (!prev.empty()) {
+                prev.push_back(entry[0]);
+                dict.push_back(prev);
+            }
+            prev = entry;
+            if ((int)dict.size() == (1 << codeSize) && codeSize < 12) codeSize++;
+        }
+        out.resize(count);
+        return out;
+    }
+};
+
+static bool verify(const std::string& path, const std::vector<std::vector<uint8_t>>& images) {
+    GifReader reader;
+    if (!reader.open(path) || reader.width != imageWidth || reader.height != imageHeight) return false;
+    for (size_t f = 0; f < images.size(); f++) {
+        const uint8_t * canvas = reader.next();
+        if (canvas == NULL) {
+            fprintf(stderr, "%s: missing frame %zu\n", path.c_str(), f);
+            return false;
+        }
+        for (int i = 0; i < imageWidth * imageHeight; i++) {
+            if (memcmp(canvas + i * 3, images[f].data() + i * 4, 3) != 0) {
+                fprintf(stderr, "%s: frame %zu differs at %d, %d\n", path.c_str(), f, i % imageWidth, i / imageWidth);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static long fileSize(const std::string& path) {
+    FILE * fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) return 0;
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+int main() {
+    // the default 16 colors; GIFs are written at 5 bits per pixel like mode 0 recordings
+    static const uint32_t defaultColors[16] = {
+        0xf0f0f0, 0x33b2f2, 0xd87fe5, 0xf2b299, 0x6cdede, 0x19cc7f, 0xccb2f2, 0x4c4c4c,
+        0x999999, 0xb2994c, 0xe5667f, 0xcc6633, 0x4f667f, 0x4ea657, 0x4c4ccc, 0x111111
+    };
+    for (int i = 0; i < 256; i++) {
+        const uint32_t c = i < 16 ? defaultColors[i] : (i * 0x010101u);
+        palette[i] = ((c >> 16) & 0xFF) | (c & 0xFF00) | ((c & 0xFF) << 16);
+    }
+
+    std::vector<std::vector<uint8_t>> images(frames, std::vector<uint8_t>(imageWidth * imageHeight * 4));
+    Session session;
+    for (int f = 0; f < frames; f++) {
+        session.step(f);
+        session.render(images[f].data(), (f / 4) % 2);
+    }
+
+    const std::string paths[2] = {"gif_bench_quantized.gif", "gif_bench_palette.gif"};
+    const char * names[2] = {"quantized", "palette"};
+    double times[2];
+    for (int mode = 0; mode < 2; mode++) {
+        GifWriter writer;
+        if (!GifBegin(&writer, paths[mode].c_str(), imageWidth, imageHeight, 100 / fps)) {
+            fprintf(stderr, "Could not open %s\n", paths[mode].c_str());
+            return 1;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) {
+            if (mode == 0) writeQuantizedFrame(&writer, images[f].data());
+            else GifWritePaletteFrame(&writer, images[f].data(), imageWidth, imageHeight, 100 / fps, 5, palette);
+        }
+        GifEnd(&writer);
+        times[mode] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        const bool ok = verify(paths[mode], images);
+        printf("%-9s %8.1f ms (%.2f ms/frame), %8.1f kB, frames %s\n", names[mode], times[mode], times[mode] / frames,
+               fileSize(paths[mode]) / 1024.0, ok ? "match" : "DIFFER");
+        if (!ok) return 1;
+    }
+    printf("Palette path is %.1fx faster\n", times[0] / times[1]);
+    return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * image_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Compares keeping a computer's files in a directory and in a disk image:
+ * how many host files each takes, how long cloning 100 computers takes, and
+ * how long walking and reading the whole tree takes. Then packs the same tree
+ * into an image with --pack-image, checks that --unpack-image gives it back,
+ * and runs craftos on a directory computer and an image computer, timing boot
+ * and fs.find and checking that the fs API gives the same results on both.
+ *
+ * Usage: image_bench <path to craftos>   (or `make image-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/dircache.hpp"
+#include "../src/diskimage.hpp"
+#include "../src/filecopy.hpp"
+
+namespace fs = std::filesystem;
+
+// the last line is the time fs.find took, which isn't compared
+static const std::string script =
+    "local function readAll(path, mode) local f = fs.open(path, mode or 'r') if not f then return 'nil' end local d = f.readAll() f.close() return d end "
+    "local function write(path, data, mode) local f = fs.open(path, mode or 'w') f.write(data) f.close() end "
+    "local r = {} "
+    "local start, found = os.epoch('utc') "
+    "for i = 1, 50 do found = fs.find('programs*/*.lua') end "
+    "local findTime = os.epoch('utc') - start "
+    "sleep(0) "
+    "r[#r+1] = #found .. ' ' .. found[1] .. ' ' .. found[#found] "
+    "r[#r+1] = #fs.list('programs3') .. ' ' .. fs.getSize('programs3/p7.lua') .. ' ' .. #readAll('programs3/p7.lua') "
+    "write('new/a.txt', 'hello') r[#r+1] = table.concat(fs.list('new'), ',') .. ' ' .. fs.getSize('new/a.txt') "
+    "fs.move('new/a.txt', 'new/b.txt') r[#r+1] = tostring(fs.exists('new/a.txt')) .. ' ' .. readAll('new/b.txt') "
+    "write('new/b.txt', ' world', 'a') r[#r+1] = readAll('new/b.txt') "
+    "local f = fs.open('new/b.txt', 'rb') f.seek('set', 6) r[#r+1] = f.read(5) f.close() "
+    "fs.copy('programs0', 'copy0') r[#r+1] = #fs.list('copy0') .. ' ' .. tostring(readAll('copy0/p1.lua') == readAll('programs0/p1.lua')) "
+    "fs.delete('copy0') r[#r+1] = tostring(fs.exists('copy0')) "
+    "r[#r+1] = select(2, pcall(fs.makeDir, 'new/b.txt')) "
+    "r[#r+1] = select(2, fs.open('programs0', 'w')) "
+    "r[#r+1] = select(2, pcall(fs.move, 'new/b.txt', 'programs0/p1.lua')) "
+    "local a = fs.attributes('new/b.txt') r[#r+1] = a.size .. ' ' .. tostring(a.isDir) .. ' ' .. tostring(a.isReadOnly) "
+    "r[#r+1] = findTime "
+    "local out = fs.open('result.txt', 'w') for i = 1, #r do out.writeLine(r[i]) end out.close() os.shutdown()";
+
+static const char * checks[] = {
+    "find",
+    "list and read",
+    "write a new file",
+    "move",
+    "append",
+    "seek",
+    "copy a directory",
+    "delete",
+    "makeDir on a file",
+    "open a directory to write",
+    "move onto a file",
+    "attributes",
+};
+
+static std::mt19937 rng(1);
+
+// Lists every entry under a path with its contents, the same way for a real directory and an image.
+static std::string describeTree(const fs::path& root, const fs::path& rel = "") {
+    const DirectoryCache::Listing names = DirectoryCache::read(root / rel);
+    if (names == NULL) {
+        std::ifstream in(root / rel, std::ios::binary);
+        return rel.generic_string() + " " + std::string(std::istreambuf_iterator<char>(in), {}) + "\n";
+    }
+    std::string out = rel.generic_string() + "/\n";
+    for (const std::string& name : *names) out += describeTree(root, rel / name);
+    return out;
+}
+
+static std::string describeImage(const DiskImage& image, const std::string& rel = "") {
+    const DiskImage::Listing names = image.list(rel);
+    std::error_code e;
+    if (names == NULL) {
+        const std::shared_ptr<const DiskImage::Contents> contents = image.read(rel, e);
+        return rel + " " + (contents != NULL ? std::string(contents->data, contents->size) : "") + "\n";
+    }
+    std::string out = rel + "/\n";
+    for (const std::string& name : *names) out += describeImage(image, rel.empty() ? name : rel + "/" + name);
+    return out;
+}
+
+// Walks a tree and reads every file in it, returning the number of bytes read.
+static size_t readTree(const fs::path& path) {
+    const DirectoryCache::Listing names = DirectoryCache::read(path);
+    if (names == NULL) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), {}).size();
+    }
+    size_t size = 0;
+    for (const std::string& name : *names) size += readTree(path / name);
+    return size;
+}
+
+static size_t readImage(const DiskImage& image, const std::string& rel = "") {
+    const DiskImage::Listing names = image.list(rel);
+    std::error_code e;
+    if (names == NULL) {
+        const std::shared_ptr<const DiskImage::Contents> contents = image.read(rel, e);
+        return contents != NULL ? contents->size : 0;
+    }
+    size_t size = 0;
+    for (const std::string& name : *names) size += readImage(image, rel.empty() ? name : rel + "/" + name);
+    return size;
+}
+
+static long since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs craftos with some arguments and waits for it to exit, returning its status.
+static int run(const char * craftos, const std::vector<std::string>& args) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        std::vector<const char*> argv = {craftos};
+        for (const std::string& a : args) argv.push_back(a.c_str());
+        argv.push_back(NULL);
+        execv(craftos, (char* const*)argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static std::vector<std::string> lines(std::istream& in) {
+    std::vector<std::string> retval;
+    std::string line;
+    while (std::getline(in, line)) retval.push_back(line);
+    return retval;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-image-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    const std::atomic<bool> cancel {false};
+    std::error_code e;
+
+    // a computer about the size of a small operating system: 400 files, 2 MiB, with one larger file
+    const fs::path tree = dir + "/tree";
+    for (int d = 0; d < 20; d++) {
+        const fs::path sub = tree / ("programs" + std::to_string(d));
+        fs::create_directories(sub);
+        for (int f = 0; f < 20; f++) std::ofstream(sub / ("p" + std::to_string(f) + ".lua")) << std::string(rng() % 10240, 'a' + f);
+    }
+    std::ofstream(tree / "data.bin") << std::string(1048576, 'x');
+    size_t hostFiles = 0;
+    for (auto it = fs::recursive_directory_iterator(tree); it != fs::recursive_directory_iterator(); ++it) hostFiles++;
+
+    auto start = std::chrono::steady_clock::now();
+    DiskImage::pack(tree, dir + "/tree.img", e);
+    const long packTime = since(start);
+    if (e) {
+        fprintf(stderr, "Could not pack the tree: %s\n", e.message().c_str());
+        return 1;
+    }
+    printf("one computer: %zu host files as a directory, 1 as a %lld KiB image (packed in %ld ms)\n", hostFiles, (long long)fs::file_size(dir + "/tree.img") / 1024, packTime);
+
+    fs::create_directories(dir + "/clones");
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++) copyTree(tree, dir + "/clones/" + std::to_string(i), e, cancel);
+    const long cloneTree = since(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++) fs::copy_file(dir + "/tree.img", dir + "/clones/" + std::to_string(i) + ".img", e);
+    const long cloneImage = since(start);
+    printf("cloning 100 computers: %6ld ms as directories, %6ld ms as images\n", cloneTree, cloneImage);
+    fs::remove_all(dir + "/clones");
+
+    bool packed;
+    {
+        const std::shared_ptr<DiskImage> image = DiskImage::open(dir + "/tree.img", false, e);
+        size_t treeBytes = 0, imageBytes = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 20; i++) treeBytes += readTree(tree);
+        const long walkTree = since(start);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 20; i++) imageBytes += readImage(*image);
+        const long walkImage = since(start);
+        printf("walking and reading every file 20 times: %6ld ms from the directory, %6ld ms from the image\n\n", walkTree, walkImage);
+        packed = treeBytes == imageBytes && describeImage(*image) == describeTree(tree);
+    }
+    printf("%-30s %s\n", "packed image matches", packed ? "ok" : "FAILED");
+
+    // the CLI packs a computer into an image, and unpacks it again as it was
+    const std::string craftos = argv[1];
+    const fs::path computers = dir + "/computer";
+    fs::create_directories(computers);
+    copyTree(tree, computers / "0", e, cancel);
+    bool ok = run(argv[1], {"--pack-image", tree.string(), (computers / "1.img").string()}) == 0;
+    ok = run(argv[1], {"--unpack-image", (computers / "1.img").string(), dir + "/unpacked"}) == 0 && ok;
+    const bool roundTrip = ok && describeTree(dir + "/unpacked") == describeTree(tree);
+    printf("%-30s %s\n", "pack and unpack", roundTrip ? "ok" : "FAILED");
+    fs::create_directories(dir + "/config");
+
+    // boot is timed with a computer that shuts down straight away
+    long boot[2];
+    for (int id = 0; id < 2; id++) {
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 5; i++) run(argv[1], {"--raw", "-d", dir, "-i", std::to_string(id), "--exec", "os.shutdown()"});
+        boot[id] = since(start) / 5;
+    }
+    std::vector<std::string> results[2];
+    for (int id = 0; id < 2; id++) run(argv[1], {"--raw", "-d", dir, "-i", std::to_string(id), "--exec", script});
+    {
+        std::ifstream in(computers / "0" / "result.txt");
+        results[0] = lines(in);
+    }
+    {
+        const std::shared_ptr<DiskImage> image = DiskImage::open(computers / "1.img", false, e);
+        const std::shared_ptr<const DiskImage::Contents> contents = image != NULL ? image->read("result.txt", e) : NULL;
+        std::istringstream in(contents != NULL ? std::string(contents->data, contents->size) : "");
+        results[1] = lines(in);
+    }
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        const std::string a = i < results[0].size() ? results[0][i] : "", b = i < results[1].size() ? results[1][i] : "";
+        const bool pass = !a.empty() && a == b;
+        printf("%-30s %s\n", checks[i], pass ? "ok" : ("FAILED: " + a + " / " + b).c_str());
+        ok = ok && pass;
+    }
+    const size_t n = sizeof(checks) / sizeof(checks[0]);
+    printf("\nboot:                    %6ld ms from a directory, %6ld ms from an image\n", boot[0], boot[1]);
+    printf("50 x fs.find (400 files): %5s ms from a directory, %6s ms from an image\n",
+        n < results[0].size() ? results[0][n].c_str() : "?", n < results[1].size() ? results[1][n].c_str() : "?");
+    fs::remove_all(dir);
+    return ok && packed && roundTrip ? 0 : 1;
+}
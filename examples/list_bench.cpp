@@ -0,0 +1,151 @@
+/*
+ * list_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Fuzzes the fs.find pattern matcher against the std::regex translation it
+ * replaced, then measures fs.list and fs.find calls per second on a tree of
+ * 100 directories with 100 files each. Halfway through, files are added
+ * behind the computer's back to check that the listings it sees change too.
+ * Before that, checks that more caches than a user has inotify instances (128
+ * by default) all still see outside changes, including caches sharing a
+ * directory when one of them stops watching it.
+ *
+ * Usage: list_bench <path to craftos>   (or `make list-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "../src/dircache.hpp"
+
+static const char * phases[] = {"fs.list", "fs.find(\"tree/*/*.lua\")", "fs.find(\"tree/**/*.lua\")", "fs.find(\"tree/d5*/f1*\")"};
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function phase(n, fn) local t = os.clock() for i = 1, n do fn(i) end t = os.clock() - t os.queueEvent('bench') os.pullEvent('bench') return n / t end "
+    "local r = {} "
+    "r[1] = phase(20000, function(i) fs.list('tree/d' .. i % 100) end) "
+    "r[2] = phase(50, function() fs.find('tree/*/*.lua') end) "
+    "r[3] = phase(50, function() fs.find('tree/**/*.lua') end) "
+    "r[4] = phase(500, function() fs.find('tree/d5*/f1*') end) "
+    // wait for the harness to add a file, which must show up without any fs call on our side
+    "local before = #fs.find('tree/*/*.lua') "
+    "local f = fs.open('waiting.txt', 'w') f.close() "
+    "while not fs.exists('added.txt') do sleep(0.05) end "
+    "r[5] = #fs.find('tree/*/*.lua') - before "
+    "r[6] = #fs.list('tree/d0') "
+    "local f = fs.open('bench.txt', 'w') f.write(table.concat(r, ' ')) f.close() os.shutdown()";
+
+static std::string replace_str(std::string data, const std::string& toSearch, const std::string& replaceStr) {
+    size_t pos = data.find(toSearch);
+    while (pos != std::string::npos) {
+        data.replace(pos, toSearch.size(), replaceStr);
+        pos = data.find(toSearch, pos + replaceStr.size());
+    }
+    return data;
+}
+
+// the old matcher
+static bool referenceMatch(const std::string& pattern, const std::string& name) {
+    static const std::string regex_escape[] = {"\\", ".", "[", "]", "{", "}", "^", "$", "(", ")", "+", "?", "|"};
+    std::string pathc_regex = pattern;
+    for (const std::string& r : regex_escape) pathc_regex = replace_str(pathc_regex, r, "\\" + r);
+    pathc_regex = replace_str(pathc_regex, "*", ".*");
+    return std::regex_match(name, std::regex(pathc_regex));
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    std::mt19937 rng(1);
+    static const char alphabet[] = "ab.*?\\[(|\n";
+    long mismatches = 0;
+    for (int i = 0; i < 500000; i++) {
+        std::string pattern, name;
+        for (int j = rng() % 8; j > 0; j--) pattern += alphabet[rng() % (sizeof(alphabet) - 1)];
+        for (int j = rng() % 10; j > 0; j--) name += alphabet[rng() % (sizeof(alphabet) - 1)];
+        if (GlobPattern(pattern).match(name) != referenceMatch(pattern, name) && ++mismatches <= 10)
+            printf("mismatch: pattern '%s', name '%s'\n", pattern.c_str(), name.c_str());
+    }
+    printf("500000 patterns checked, %ld mismatches\n\n", mismatches);
+
+    char tmpdir[] = "/tmp/craftos-list-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir, root = dir + "/computer/0";
+
+    // one cache per computer, for more computers than there are inotify instances
+    const std::string shared = dir + "/shared";
+    mkdir(shared.c_str(), 0777);
+    std::vector<std::unique_ptr<DirectoryCache> > caches;
+    std::vector<std::string> own;
+    for (int i = 0; i < 200; i++) {
+        caches.emplace_back(new DirectoryCache());
+        own.push_back(dir + "/own" + std::to_string(i));
+        mkdir(own.back().c_str(), 0777);
+        caches[i]->list(own[i]);
+        caches[i]->list(shared);
+    }
+    // the first cache stops watching the shared directory, which mustn't stop the others seeing it change
+    caches[0]->invalidate(shared);
+    std::ofstream(shared + "/new");
+    int stale = 0, uncached = 0;
+    for (int i = 0; i < 200; i++) {
+        std::ofstream(own[i] + "/new");
+        if (caches[i]->list(own[i])->size() != 1 || caches[i]->list(shared)->size() != 1) stale++;
+        // a cache that couldn't watch anything would list the directory again every time
+        if (caches[i]->list(own[i]) != caches[i]->list(own[i])) uncached++;
+    }
+    caches.clear();
+    printf("200 caches seeing outside changes: %s (%d not caching)\n\n", stale == 0 && uncached == 0 ? "ok" : "FAILED", uncached);
+    mkdir((dir + "/computer").c_str(), 0777);
+    mkdir(root.c_str(), 0777);
+    mkdir((root + "/tree").c_str(), 0777);
+    for (int d = 0; d < 100; d++) {
+        const std::string sub = root + "/tree/d" + std::to_string(d);
+        mkdir(sub.c_str(), 0777);
+        for (int f = 0; f < 100; f++) std::ofstream(sub + "/f" + std::to_string(f) + (f % 2 ? ".lua" : ".txt"));
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    struct stat st;
+    for (int i = 0; i < 1200 && stat((root + "/waiting.txt").c_str(), &st) != 0; i++) usleep(50000);
+    std::ofstream(root + "/tree/d0/new.lua");
+    std::ofstream(root + "/added.txt");
+    int status = 0;
+    waitpid(pid, &status, 0);
+    double results[6] = {0, 0, 0, 0, 0, 0};
+    std::ifstream in(root + "/bench.txt");
+    for (int i = 0; i < 6; i++) in >> results[i];
+    for (int i = 0; i < 4; i++) printf("%-26s %10.0f calls/s\n", phases[i], results[i]);
+    const bool seen = results[4] == 1 && results[5] == 101;
+    printf("\nfile added outside the emulator: %s\n", seen ? "seen" : "NOT SEEN");
+    return mismatches == 0 && stale == 0 && uncached == 0 && seen && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+/*
+ * mount_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures how many fs.exists calls a computer can make per second with 1, 16
+ * and 128 directories mounted (--mount-ro), checking paths inside the root,
+ * the ROM, and the most recently added mount.
+ *
+ * Usage: mount_bench <path to craftos>   (or `make mount-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static const int mountCounts[] = {1, 16, 128};
+static const char * phases[] = {"root", "rom", "mount", "missing"};
+
+// each phase runs for a second, yielding every so often so the computer isn't killed for running too long
+static std::string script(int mounts) {
+    return "local function phase(path) local n, start = 0, os.epoch('utc') "
+           "while os.epoch('utc') - start < 1000 do for i = 1, 1000 do fs.exists(path) end n = n + 1000 os.queueEvent('bench') os.pullEvent('bench') end "
+           "return n * 1000 / (os.epoch('utc') - start) end "
+           "local r = {} "
+           "r[1] = phase('startup.lua') "
+           "r[2] = phase('rom/programs/shell.lua') "
+           "r[3] = phase('mnt/m" + std::to_string(mounts - 1) + "/file.txt') "
+           "r[4] = phase('mnt/m0/nothing/here') "
+           "local f = fs.open('bench.txt', 'w') f.write(table.concat(r, ' ')) f.close() os.shutdown()";
+}
+
+static bool run(const std::vector<std::string>& args) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        std::vector<char*> argv;
+        for (const std::string& a : args) argv.push_back((char*)a.c_str());
+        argv.push_back(NULL);
+        execv(argv[0], argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-mount-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    mkdir((dir + "/mounts").c_str(), 0777);
+    for (int i = 0; i < mountCounts[2]; i++) {
+        const std::string path = dir + "/mounts/" + std::to_string(i);
+        mkdir(path.c_str(), 0777);
+        std::ofstream(path + "/file.txt") << "hello\n";
+    }
+    printf("%-7s", "mounts");
+    for (const char * p : phases) printf(" %12s", p);
+    printf("   (fs.exists calls/s)\n");
+    for (int mounts : mountCounts) {
+        std::vector<std::string> args = {argv[1], "--raw", "-d", dir, "--exec", script(mounts)};
+        for (int i = 0; i < mounts; i++) {
+            args.push_back("--mount-ro");
+            args.push_back("mnt/m" + std::to_string(i) + "=" + dir + "/mounts/" + std::to_string(i));
+        }
+        if (!run(args)) {
+            fprintf(stderr, "Could not run the benchmark script with %d mounts\n", mounts);
+            return 1;
+        }
+        double rates[4];
+        std::ifstream in(dir + "/computer/0/bench.txt");
+        for (int i = 0; i < 4; i++) if (!(in >> rates[i])) rates[i] = 0;
+        printf("%-7d", mounts);
+        for (double r : rates) printf(" %12.0f", r);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * overlay_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Times provisioning 500 computers from one golden image, by copying the
+ * image into each computer's directory and by giving each an empty overlay
+ * directory over it, and counts the disk space each way uses. Then checks the
+ * overlay against a plain copy on a few thousand random sequences of writes,
+ * appends, deletes, moves and new directories, and runs craftos with the image
+ * mounted as an overlay on the root to check the fs API and space count.
+ *
+ * Usage: overlay_bench <path to craftos>   (or `make overlay-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/diskusage.hpp"
+#include "../src/filecopy.hpp"
+#include "../src/overlay.hpp"
+
+namespace fs = std::filesystem;
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function readAll(path) local f = fs.open(path, 'rb') if not f then return 'nil' end local d = f.readAll() f.close() return d end "
+    "local function write(path, data, mode) local f = fs.open(path, mode or 'wb') f.write(data) f.close() end "
+    "local function list(path) return table.concat(fs.list(path), ',') end "
+    "local r = {} "
+    "r[#r+1] = readAll('docs/a.txt') "
+    "write('new.txt', 'new file') r[#r+1] = list('') "
+    "fs.delete('docs/a.txt') r[#r+1] = tostring(fs.exists('docs/a.txt')) .. ' ' .. list('docs') "
+    "fs.move('docs/b.txt', 'moved.txt') r[#r+1] = tostring(fs.exists('docs/b.txt')) .. ' ' .. readAll('moved.txt') "
+    "write('log.txt', ' and more', 'ab') r[#r+1] = readAll('log.txt') "
+    "r[#r+1] = tostring(fs.isReadOnly('log.txt')) .. ' ' .. tostring(fs.attributes('docs/c.txt').isReadOnly) "
+    "write('docs/a.txt', 'back again') r[#r+1] = readAll('docs/a.txt') .. ' ' .. list('docs') "
+    "r[#r+1] = table.concat(fs.find('docs/*.txt'), ',') "
+    "fs.copy('docs', 'docs2') r[#r+1] = list('docs2') .. ' ' .. readAll('docs2/c.txt') "
+    "fs.delete('sub') fs.makeDir('sub') r[#r+1] = '[' .. list('sub') .. ']' "
+    "r[#r+1] = select(2, pcall(fs.makeDir, 'log.txt')) "
+    "r[#r+1] = select(2, pcall(fs.move, 'moved.txt', 'docs/c.txt')) "
+    "sleep(0) "
+    "r[#r+1] = fs.getCapacity('/') - fs.getFreeSpace('/') "
+    "local f = fs.open('result.txt', 'w') for i = 1, #r do f.writeLine(r[i]) end f.close() os.shutdown()";
+
+static const char * checks[] = {
+    "read from the image",
+    "list merges new files",
+    "delete hides a file",
+    "move out of the image",
+    "append copies up",
+    "image files are writable",
+    "recreate a deleted file",
+    "find",
+    "copy a merged directory",
+    "recreated directory is empty",
+    "makeDir on an image file",
+    "move onto an image file",
+};
+
+static const char * expected[] = {
+    "alpha",
+    "docs,log.txt,new.txt,rom,startup.lua,sub",
+    "false b.txt,c.txt",
+    "false bravo",
+    "log and more",
+    "false false",
+    "back again a.txt,c.txt",
+    "docs/a.txt,docs/c.txt",
+    "a.txt,c.txt charlie",
+    "[]",
+    "/log.txt: File exists",
+    "File exists",
+};
+
+static std::mt19937 rng(1);
+
+// Lists every entry under a path with its type and contents, the same way for a real directory and an overlay.
+static std::string describe(const std::function<DirectoryCache::Listing(const fs::path&)>& list, const std::function<fs::path(const fs::path&)>& resolve, const fs::path& rel) {
+    std::string out;
+    const DirectoryCache::Listing names = list(rel);
+    if (names == NULL) {
+        std::ifstream in(resolve(rel), std::ios::binary);
+        return rel.string() + " " + std::string(std::istreambuf_iterator<char>(in), {}) + "\n";
+    }
+    out += rel.string() + "/\n";
+    for (const std::string& name : *names) out += describe(list, resolve, rel / name);
+    return out;
+}
+
+static std::string describeTree(const fs::path& root) {
+    return describe([&root](const fs::path& rel) {return DirectoryCache::read(root / rel);}, [&root](const fs::path& rel) {return root / rel;}, "");
+}
+
+static std::string describeOverlay(const Overlay& o) {
+    return describe([&o](const fs::path& rel) {return o.list(rel, DirectoryCache::read);}, [&o](const fs::path& rel) {return o.resolve(rel);}, "");
+}
+
+static void makeTree(const fs::path& p, int depth) {
+    fs::create_directory(p);
+    for (int i = rng() % 5 + 1; i > 0; i--) {
+        const fs::path c = p / std::string(1, 'a' + rng() % 4);
+        if (fs::exists(c)) continue;
+        if (depth < 2 && rng() % 3 == 0) makeTree(c, depth + 1);
+        else std::ofstream(c) << std::string(rng() % 100, 'a' + rng() % 26);
+    }
+}
+
+// Picks a random path that may or may not exist.
+static fs::path randomPath() {
+    fs::path p;
+    for (int i = rng() % 3 + 1; i > 0; i--) p /= std::string(1, 'a' + rng() % 5);
+    return p;
+}
+
+// Runs one random change on a plain directory and the same change on an
+// overlay, in the way the fs API makes it. Both are checked by the plain
+// directory's rules first, so only changes fs would allow are made.
+static void randomChange(const fs::path& plain, const Overlay& o) {
+    std::error_code e;
+    const fs::path rel = randomPath(), to = randomPath();
+    const bool exists = fs::exists(plain / rel), parentIsDir = fs::is_directory(plain / rel.parent_path());
+    const std::string data(rng() % 50, 'A' + rng() % 26);
+    switch (rng() % 5) {
+        case 0: // fs.open(rel, "w")
+            if (!parentIsDir || fs::is_directory(plain / rel)) return;
+            std::ofstream(plain / rel) << data;
+            fs::create_directories((o.upper / rel).parent_path());
+            std::ofstream(o.upper / rel) << data;
+            break;
+        case 1: // fs.open(rel, "a")
+            if (!parentIsDir || fs::is_directory(plain / rel)) return;
+            std::ofstream(plain / rel, std::ios::app) << data;
+            fs::create_directories((o.upper / rel).parent_path());
+            o.copyUp(rel, e);
+            std::ofstream(o.upper / rel, std::ios::app) << data;
+            break;
+        case 2: // fs.delete(rel)
+            if (!exists) return;
+            fs::remove_all(plain / rel);
+            o.remove(rel, e);
+            break;
+        case 3: // fs.makeDir(rel)
+            if (fs::is_regular_file(plain / rel)) return;
+            for (fs::path p = rel.parent_path(); !p.empty(); p = p.parent_path()) if (fs::is_regular_file(plain / p)) return;
+            fs::create_directories(plain / rel);
+            fs::create_directories(o.upper / rel);
+            break;
+        case 4: { // fs.move(rel, to)
+            if (!exists || fs::exists(plain / to) || !fs::is_directory(plain / to.parent_path())) return;
+            if (std::mismatch(rel.begin(), rel.end(), to.begin(), to.end()).first == rel.end()) return;
+            fs::rename(plain / rel, plain / to);
+            const bool hideLower = o.showsLower(rel) && fs::exists(o.lower / rel);
+            if (hideLower) o.copyUp(rel, e);
+            fs::create_directories((o.upper / to).parent_path());
+            fs::rename(o.upper / rel, o.upper / to);
+            if (hideLower) o.remove(rel, e);
+            break;
+        }
+    }
+}
+
+// Returns the space a tree takes on disk.
+static int64_t allocated(const fs::path& root) {
+    int64_t size = 0;
+    struct stat st;
+    for (const auto& d : fs::recursive_directory_iterator(root))
+        if (lstat(d.path().c_str(), &st) == 0) size += (int64_t)st.st_blocks * 512;
+    return size;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-overlay-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+
+    // a golden image about the size of a small operating system: 400 files, 2 MiB
+    const fs::path image = dir + "/image";
+    for (int d = 0; d < 20; d++) {
+        const fs::path sub = image / ("programs" + std::to_string(d));
+        fs::create_directories(sub);
+        for (int f = 0; f < 20; f++) std::ofstream(sub / ("p" + std::to_string(f) + ".lua")) << std::string(rng() % 10240, 'a' + f);
+    }
+    const std::atomic<bool> cancel {false};
+    std::error_code e;
+    fs::create_directories(dir + "/full");
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 500; i++) copyTree(image, dir + "/full/" + std::to_string(i), e, cancel);
+    const long copyTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 500; i++) fs::create_directories(dir + "/overlay/" + std::to_string(i));
+    const long overlayTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    const int64_t imageSize = allocated(image), copySize = allocated(dir + "/full"), overlaySize = allocated(dir + "/overlay");
+    printf("provisioning 500 computers from a %lld KiB image:\n", (long long)imageSize / 1024);
+    printf("  full copies:     %6ld ms, %8lld KiB on disk\n", copyTime, (long long)copySize / 1024);
+    printf("  overlays:        %6ld ms, %8lld KiB on disk (+ %lld KiB for the shared image)\n", overlayTime, (long long)overlaySize / 1024, (long long)imageSize / 1024);
+    // on file systems with reflinks, the full copies share their blocks too; the per-computer count is the same either way
+    int64_t copyBytes = 0;
+    for (int i = 0; i < 500; i++) copyBytes += DiskUsage::measure(dir + "/full/" + std::to_string(i));
+    printf("  standards-mode space used per computer: %lld bytes copied, 0 bytes with an overlay\n\n", (long long)(copyBytes / 500));
+    fs::remove_all(dir + "/full");
+    fs::remove_all(dir + "/overlay");
+    fs::remove_all(image);
+
+    // each sequence starts from a fresh image, made twice from the same seed
+    int mismatches = 0;
+    for (int i = 0; i < 2000; i++) {
+        const fs::path work = dir + "/fuzz";
+        fs::remove_all(work);
+        fs::create_directories(work / "upper");
+        rng.seed(i);
+        makeTree(work / "lower", 0);
+        copyTree(work / "lower", work / "plain", e, cancel);
+        const std::string lowerBefore = describeTree(work / "lower");
+        const Overlay o(work / "upper", work / "lower");
+        for (int k = rng() % 20 + 1; k > 0; k--) randomChange(work / "plain", o);
+        const std::string want = describeTree(work / "plain"), got = describeOverlay(o);
+        if ((want != got || describeTree(work / "lower") != lowerBefore) && ++mismatches <= 10)
+            printf("mismatch on sequence %d:\n%s--- vs ---\n%s\n", i, want.c_str(), got.c_str());
+    }
+    fs::remove_all(dir + "/fuzz");
+    printf("2000 sequences of changes, %d mismatches\n\n", mismatches);
+
+    // the image is read-only, as a shared image would be
+    fs::create_directories(image / "docs");
+    fs::create_directories(image / "sub");
+    std::ofstream(image / "docs/a.txt") << "alpha";
+    std::ofstream(image / "docs/b.txt") << "bravo";
+    std::ofstream(image / "docs/c.txt") << "charlie";
+    std::ofstream(image / "sub/d.txt") << "delta";
+    std::ofstream(image / "log.txt") << "log";
+    std::ofstream(image / "startup.lua") << "-- nothing";
+    for (const auto& d : fs::recursive_directory_iterator(image)) if (d.is_regular_file()) chmod(d.path().c_str(), 0444);
+    const std::string imageBefore = describeTree(image);
+    fs::create_directories(dir + "/config");
+    std::ofstream(dir + "/config/global.json") << "{\"standardsMode\": true}";
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--mount-overlay", ("/=" + image.string()).c_str(), "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    const fs::path upper = dir + "/computer/0";
+    std::ifstream in(upper / "result.txt");
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        std::string line;
+        std::getline(in, line);
+        const bool pass = line == expected[i];
+        printf("%-30s %s\n", checks[i], pass ? "ok" : ("FAILED: " + line).c_str());
+        ok = ok && pass;
+    }
+    // only the changes count towards the space limit
+    long long used = -1;
+    in >> used;
+    const long long changed = DiskUsage::measure(upper) - DiskUsage::measure(upper / "result.txt");
+    printf("%-30s %s (%lld counted, %lld in the upper directory)\n", "space used", used == changed ? "ok" : "FAILED", used, changed);
+    const bool unchanged = describeTree(image) == imageBefore;
+    printf("%-30s %s\n", "image unchanged", unchanged ? "ok" : "FAILED");
+    return mismatches == 0 && ok && used == changed && unchanged ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/*
+ * path_check.cpp
+ * CraftOS-PC 2
+ *
+ * Checks that the hand-written virtual mount ID checks in FileEntry.hpp
+ * accept exactly the same strings as the regexes the fs API used to build on
+ * every call ("^\d+:" and "\d+:"), and that FileEntry::path still resolves
+ * paths the same way. Then it times both versions.
+ *
+ * Usage: make path-check
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <regex>
+#include <string>
+#include <vector>
+#include <FileEntry.hpp>
+
+typedef std::filesystem::path path_t;
+
+// How the fs API checked paths before FileEntry::hasMountID/isMountID.
+static std::basic_regex<path_t::value_type> pathregex(const std::string& str) {return std::basic_regex<path_t::value_type>(path_t(str).native());}
+
+// How FileEntry::path traversed paths before.
+static const FileEntry * oldPath(const FileEntry& root, const path_t& path) {
+    const FileEntry * retval = &root;
+    for (const auto& item : path) if (item.string() != "." && !std::regex_match(item.native(), std::basic_regex<path_t::value_type>(path_t("\\d+:").native()))) retval = &(*retval)[item.string()];
+    return retval;
+}
+
+static const FileEntry * tryPath(const std::function<const FileEntry*()>& fn, int& error) {
+    error = 0;
+    try {return fn();}
+    catch (std::out_of_range&) {error = 1;}
+    catch (std::runtime_error&) {error = 2;}
+    return NULL;
+}
+
+template<class CharT>
+static long checkStrings(const std::vector<CharT>& alphabet, size_t maxLength, long& mismatches) {
+    const std::basic_regex<CharT> prefix(std::basic_string<CharT>({'^', '\\', 'd', '+', ':'}));
+    const std::basic_regex<CharT> whole(std::basic_string<CharT>({'\\', 'd', '+', ':'}));
+    long count = 0;
+    std::vector<size_t> digits;
+    for (size_t len = 0; len <= maxLength; len++) {
+        digits.assign(len, 0);
+        while (true) {
+            std::basic_string<CharT> str;
+            for (size_t d : digits) str += alphabet[d];
+            count++;
+            if (FileEntry::hasMountID(str) != std::regex_search(str, prefix) || FileEntry::isMountID(str) != std::regex_match(str, whole)) {
+                if (mismatches++ < 10) {
+                    fprintf(stderr, "Mismatch on \"");
+                    for (CharT c : str) fprintf(stderr, c < 128 ? "%c" : "\\u%04x", (unsigned)c);
+                    fprintf(stderr, "\"\n");
+                }
+            }
+            size_t i = 0;
+            while (i < len && ++digits[i] == alphabet.size()) digits[i++] = 0;
+            if (i == len) break;
+        }
+    }
+    return count;
+}
+
+template<class Fn>
+static double timeNs(long iterations, Fn fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) fn(i);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main() {
+    long mismatches = 0;
+    // every string up to 6 characters long over digits, colons, separators and a few lookalikes
+    long count = checkStrings<char>({'0', '9', ':', '/', '.', 'a', ' ', '\xd9'}, 6, mismatches);
+    count += checkStrings<wchar_t>({L'0', L'5', L':', L'/', L'x', 0x0663 /* ARABIC-INDIC DIGIT THREE */, 0xFF11 /* FULLWIDTH DIGIT ONE */}, 6, mismatches);
+
+    const FileEntry root = {
+        {"rom", {
+            {"programs", {
+                {"shell.lua", "print('hi')"}
+            }},
+            {"startup.lua", "shell.run('x')"}
+        }},
+        {"12:", "not a mount"},
+        {"file", "data"}
+    };
+    const char * paths[] = {"0:/rom/programs/shell.lua", "rom/startup.lua", "./rom/./programs", "12:/file", "3:a/rom", "rom/missing",
+        "file/inner", "12:", "1a:/rom", ":/rom", "", ".", "0:", "00:/12:/file", "rom/programs/shell.lua/x"};
+    for (const char * p : paths) {
+        int oldError, newError;
+        const FileEntry * a = tryPath([&]() {return oldPath(root, p);}, oldError);
+        const FileEntry * b = tryPath([&]() {return &root.path(path_t(p));}, newError);
+        count++;
+        if (a != b || oldError != newError) {
+            mismatches++;
+            fprintf(stderr, "FileEntry::path mismatch on \"%s\"\n", p);
+        }
+    }
+    printf("%ld cases, %ld mismatches\n", count, mismatches);
+    if (mismatches) return 1;
+
+    // timings, on the strings the fs API actually checks: the first component of a resolved path
+    const path_t::string_type components[] = {path_t("/home/user/.local/share/craftos-pc/computer/0").begin()->native(), path_t("0:").native(), path_t("rom").native()};
+    volatile bool sink = false;
+    const double oldCheck = timeNs(200000, [&](long i) {sink = std::regex_search(components[i % 3], pathregex("^\\d+:"));});
+    const double newCheck = timeNs(20000000, [&](long i) {sink = FileEntry::hasMountID(components[i % 3]);});
+    printf("mount ID check:  %8.1f ns with std::regex, %6.1f ns by hand (%.0fx)\n", oldCheck, newCheck, oldCheck / newCheck);
+    const path_t lookup("0:/rom/programs/shell.lua");
+    const double oldLookup = timeNs(200000, [&](long) {sink = oldPath(root, lookup)->isDir;});
+    const double newLookup = timeNs(2000000, [&](long) {sink = root.path(lookup).isDir;});
+    printf("FileEntry::path: %8.1f ns with std::regex, %6.1f ns by hand (%.0fx)\n", oldLookup, newLookup, oldLookup / newLookup);
+    return 0;
+}
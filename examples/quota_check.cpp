@@ -0,0 +1,89 @@
+/*
+ * quota_check.cpp
+ * CraftOS-PC 2
+ *
+ * Checks that the space used in standards mode (fs.getCapacity minus
+ * fs.getFreeSpace) stays equal to the total size of the computer's files
+ * through a few thousand random writes, appends, deletes, moves and copies,
+ * some with handles left open.
+ *
+ * Usage: quota_check <path to craftos>   (or `make quota-check`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const std::string script =
+    "math.randomseed(1) "
+    "local function walk(path) local n = 0 for _, name in ipairs(fs.list(path)) do local p = fs.combine(path, name) "
+    "  if fs.getDrive(p) == 'hdd' then if fs.isDir(p) then n = n + walk(p) else n = n + fs.getSize(p) end end end return n end "
+    "local function name() return (math.random(3) == 1 and 'dir/' or '') .. string.char(96 + math.random(6)) end "
+    "local capacity, handles, result = fs.getCapacity('/'), {}, 'ok' "
+    "for i = 1, 3000 do "
+    "  local op, a, b = math.random(8), name(), name() "
+    "  if op <= 2 and not fs.isDir(a) then "
+    "    local f = fs.open(a, ({'w', 'a', 'wb', 'ab'})[math.random(4)]) "
+    "    if f then "
+    "      for j = 1, math.random(4) do f.write(string.rep('x', math.random(0, 3000))) if math.random(2) == 1 then f.flush() end end "
+    "      if #handles < 8 and math.random(3) == 1 then handles[#handles+1] = f else f.close() end "
+    "    end "
+    "  elseif op == 3 and #handles > 0 then table.remove(handles, math.random(#handles)).close() "
+    "  elseif op == 4 then pcall(fs.delete, a) "
+    "  elseif op == 5 then pcall(fs.move, a, b) "
+    "  elseif op == 6 then pcall(fs.copy, a, b) "
+    "  elseif op == 7 then pcall(fs.copy, 'rom/apis/keys.lua', b) "
+    "  elseif op == 8 then pcall(fs.makeDir, a) end "
+    "  local used, real = capacity - fs.getFreeSpace('/'), walk('') "
+    "  if used ~= real then result = 'operation ' .. i .. ': counted ' .. used .. ' bytes, found ' .. real break end "
+    "  if i % 100 == 0 then os.queueEvent('check') os.pullEvent('check') end "
+    "end "
+    "for _, f in ipairs(handles) do f.close() end "
+    "if result == 'ok' and capacity - fs.getFreeSpace('/') ~= walk('') then result = 'mismatch after closing handles' end "
+    "local f = fs.open('result.txt', 'w') f.write(result) f.close() os.shutdown()";
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-quota-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    mkdir((dir + "/computer").c_str(), 0777);
+    mkdir((dir + "/computer/0").c_str(), 0777);
+    mkdir((dir + "/config").c_str(), 0777);
+    std::ofstream(dir + "/config/global.json") << "{\"standardsMode\": true}";
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    std::ifstream in(dir + "/computer/0/result.txt");
+    std::string result;
+    std::getline(in, result);
+    if (result.empty()) result = "no result";
+    printf("%s\n", result.c_str());
+    return result == "ok" ? 0 : 1;
+}
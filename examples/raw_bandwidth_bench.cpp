@@ -0,0 +1,328 @@
+/*
+ * raw_bandwidth_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures how many bytes raw mode sends for three scripted sessions: a shell
+ * (typing commands and scrolling output), an editor (editing a line with a
+ * clock in the status bar) and a graphics demo (a sprite moving over a
+ * background in 16-color mode). Each session is encoded with full frames and
+ * with delta frames, using the same encoders RawTerminal uses, and every delta
+ * is applied to a copy of the screen to check that it ends up the same.
+ * Every packet is also run through the adaptive compression, with the CPU time
+ * spent compressing and decompressing it, and decompressed to check it.
+ *
+ * It then pushes the full frames through a pipe to a reader thread that parses
+ * them with RawPacketParser, once with the Base64 framing and once with the
+ * binary framing, and prints frames/sec and MB/s for each.
+ *
+ * Usage: raw_bandwidth_bench   (or `make raw-bandwidth-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "../src/terminal/RawFrames.hpp"
+#include "../src/terminal/RawPacketParser.hpp"
+
+// Frames per second the sessions are assumed to render at, for turning bytes per frame into bytes per second.
+static const int frameRate = 20;
+static const int frameCount = 600;
+// How many times the recorded frames are sent through the pipe.
+static const int pipeRounds = 20;
+
+class BenchTerminal: public Terminal {
+public:
+    BenchTerminal(): Terminal(51, 19) {}
+    void render() override {}
+    void showMessage(uint32_t flags, const char * title, const char * message) override {}
+    void setLabel(std::string label) override {}
+    bool resize(unsigned w, unsigned h) override {return false;}
+    void onActivate() override {}
+};
+
+// Returns how big a packet's frame is in the Base64 text framing.
+static size_t textFrameSize(size_t size) {
+    const size_t encoded = (size + 2) / 3 * 4;
+    return encoded > 65535 ? 4 + 12 + encoded + 8 + 1 : 4 + 4 + encoded + 8 + 1;
+}
+
+static void writeText(Terminal& term, unsigned x, unsigned y, const std::string& text, unsigned char color = 0xF0) {
+    for (size_t i = 0; i < text.size() && x + i < term.width; i++) {
+        term.screen[y][x+i] = text[i];
+        term.colors[y][x+i] = color;
+    }
+}
+
+static void scrollText(Terminal& term) {
+    memmove(term.screen.data(), term.screen.data() + term.width, (size_t)term.width * (term.height - 1));
+    memmove(term.colors.data(), term.colors.data() + term.width, (size_t)term.width * (term.height - 1));
+    memset(term.screen.data() + (size_t)term.width * (term.height - 1), ' ', term.width);
+    memset(term.colors.data() + (size_t)term.width * (term.height - 1), 0xF0, term.width);
+}
+
+// A shell: each frame types one character of a command, and each finished command prints a few lines.
+static void shellFrame(Terminal& term, int frame) {
+    static const std::string command = "ls rom/programs/fun/advanced";
+    const int step = frame % (int)(command.size() + 1);
+    if (step == 0) {
+        for (int i = 0; i < 4; i++) {
+            if (term.blinkY >= (int)term.height - 1) scrollText(term);
+            else term.blinkY++;
+            writeText(term, 0, term.blinkY, i < 3 ? "gps.lua  levelup.lua  paint.lua  pngview.lua  x.lua" : "> ", i < 3 ? 0xF0 : 0x40);
+        }
+        term.blinkX = 2;
+    } else {
+        writeText(term, term.blinkX, term.blinkY, command.substr(step - 1, 1));
+        term.blinkX++;
+    }
+}
+
+// An editor: each frame changes one character of the line being edited and updates the clock in the
+// status bar, and every 30 frames the file scrolls a line.
+static void editorFrame(Terminal& term, int frame) {
+    if (frame == 0) {
+        for (unsigned y = 0; y < term.height - 1; y++) writeText(term, 0, y, "local x" + std::to_string(y) + " = function(a, b) return a + b end", y % 3 ? 0x90 : 0x40);
+    }
+    if (frame % 30 == 29) {
+        memmove(term.screen.data(), term.screen.data() + term.width, (size_t)term.width * (term.height - 2));
+        memmove(term.colors.data(), term.colors.data() + term.width, (size_t)term.width * (term.height - 2));
+        writeText(term, 0, term.height - 2, "-- line " + std::to_string(frame) + std::string(40, ' '), 0xD0);
+    }
+    term.blinkY = 8;
+    term.blinkX = frame % 40;
+    writeText(term, term.blinkX, 8, std::string(1, 'a' + frame % 26), 0x90);
+    char status[64];
+    snprintf(status, sizeof(status), "Ln 9, Col %-3d   Press Ctrl to access menu  %02d:%02d", term.blinkX + 1, frame / 1200 % 100, frame / 20 % 60);
+    writeText(term, 0, term.height - 1, status, 0x4F);
+}
+
+// A graphics demo: a 20x20 sprite bounces over a background of diagonal stripes, and every 60 frames a palette entry changes.
+static void graphicsFrame(Terminal& term, int frame) {
+    const unsigned w = term.width * Terminal::fontWidth, h = term.height * Terminal::fontHeight;
+    const auto background = [&term, w](unsigned x, unsigned y, unsigned n) {
+        for (unsigned i = 0; i < n; i++) term.pixels.data()[y * w + x + i] = (x + i + y) / 8 % 16;
+    };
+    if (frame == 0) {
+        term.mode = 1;
+        for (unsigned y = 0; y < h; y++) background(0, y, w);
+    }
+    const auto spriteAt = [w, h](int f, unsigned& x, unsigned& y) {
+        x = (unsigned)(f * 3) % (2 * (w - 20)); if (x >= w - 20) x = 2 * (w - 20) - x;
+        y = (unsigned)(f * 2) % (2 * (h - 20)); if (y >= h - 20) y = 2 * (h - 20) - y;
+    };
+    unsigned x, y;
+    if (frame > 0) {
+        spriteAt(frame - 1, x, y);
+        for (unsigned dy = 0; dy < 20; dy++) background(x, y + dy, 20);
+    }
+    spriteAt(frame, x, y);
+    for (unsigned dy = 0; dy < 20; dy++) memset(term.pixels.data() + (y + dy) * w + x, dy < 2 || dy > 17 ? 15 : 14, 20);
+    if (frame % 60 == 59) term.palette[frame / 60 % 16].r += 16;
+}
+
+// Applies a frame to a copy of the screen, as the raw client in main.cpp does.
+static bool applyFrame(const std::string& packet, bool delta, Terminal& copy) {
+    std::istringstream in(packet);
+    copy.mode = in.get();
+    copy.canBlink = in.get();
+    uint16_t width = 0, height = 0, blinkX = 0, blinkY = 0, nranges = 0;
+    in.read((char*)&width, 2);
+    in.read((char*)&height, 2);
+    in.read((char*)&blinkX, 2);
+    in.read((char*)&blinkY, 2);
+    in.get();
+    const int flags = delta ? in.get() : 1;
+    if (delta) in.read((char*)&nranges, 2);
+    else in.ignore(3);
+    copy.blinkX = blinkX;
+    copy.blinkY = blinkY;
+    const size_t rowSize = copy.mode == 0 ? width : width * Terminal::fontWidth;
+    if (!delta) {
+        if (copy.mode == 0 && !(readRLE(in, copy.screen.data(), rowSize * height) && readRLE(in, copy.colors.data(), rowSize * height))) return false;
+        if (copy.mode != 0 && !readRLE(in, copy.pixels.data(), rowSize * height * Terminal::fontHeight)) return false;
+    }
+    for (int i = 0; i < nranges; i++) {
+        uint16_t start = 0, count = 0;
+        in.read((char*)&start, 2);
+        in.read((char*)&count, 2);
+        if (copy.mode == 0 && !(readRLE(in, copy.screen.data() + start * rowSize, count * rowSize) && readRLE(in, copy.colors.data() + start * rowSize, count * rowSize))) return false;
+        if (copy.mode != 0 && !readRLE(in, copy.pixels.data() + start * rowSize, count * rowSize)) return false;
+    }
+    if (flags & 1) in.read((char*)copy.palette, 16 * 3);
+    return (bool)in;
+}
+
+static bool sameScreen(Terminal& a, Terminal& b) {
+    const size_t text = (size_t)a.width * a.height, pixels = text * Terminal::fontWidth * Terminal::fontHeight;
+    if (a.mode != b.mode || a.blinkX != b.blinkX || a.blinkY != b.blinkY || memcmp(a.palette, b.palette, 16 * sizeof(Color))) return false;
+    if (a.mode == 0) return !memcmp(a.screen.data(), b.screen.data(), text) && !memcmp(a.colors.data(), b.colors.data(), text);
+    return !memcmp(a.pixels.data(), b.pixels.data(), pixels);
+}
+
+struct SessionResult {
+    size_t payload[2] = {0, 0}; // full, delta
+    size_t framed[2] = {0, 0};
+    size_t compressed[2] = {0, 0}; // framed sizes with compression
+    std::clock_t compressTime[2] = {0, 0}, decompressTime[2] = {0, 0};
+    bool matches = true;
+};
+
+// Full frame packets from every session, with their type and window ID header, for the pipe test.
+static std::vector<std::string> recorded;
+
+static SessionResult runSession(const std::function<void(Terminal&, int)>& step) {
+    SessionResult result;
+    for (int delta = 0; delta < 2; delta++) {
+        BenchTerminal term, copy;
+        RawFrameState last;
+        RawCompressor compressor;
+        for (int frame = 0; frame < frameCount; frame++) {
+            step(term, frame);
+            std::ostringstream out;
+            const bool useDelta = delta && last.matches(term);
+            if (useDelta) writeTerminalDelta(out, term, last);
+            else writeTerminalFrame(out, term);
+            last.save(term);
+            const std::string packet = out.str();
+            // the 2-byte type and window ID header is part of every packet
+            result.payload[delta] += packet.size() + 2;
+            result.framed[delta] += textFrameSize(packet.size() + 2);
+            result.matches = applyFrame(packet, useDelta, copy) && sameScreen(term, copy) && result.matches;
+            const std::string header = std::string(1, (char)(useDelta ? 10 : 0)) + '\0';
+            if (!delta) recorded.push_back(header + packet);
+            std::string data = header + packet;
+            std::clock_t t = std::clock();
+            const bool isCompressed = compressor.compress(data);
+            result.compressTime[delta] += std::clock() - t;
+            result.compressed[delta] += textFrameSize(data.size());
+            if (isCompressed) {
+                t = std::clock();
+                const std::string decompressed = rawDecompress(data);
+                result.decompressTime[delta] += std::clock() - t;
+                result.matches = decompressed == header + packet && result.matches;
+            }
+        }
+    }
+    return result;
+}
+
+// Returns whether a packet that inflates to more than its header says is rejected, both when the header
+// asks for more than a frame can hold and when it understates the real size.
+static bool rejectsBombs() {
+    std::string bomb = rawCompress(std::string("\0\0", 2) + std::string(1 << 24, 'x'));
+    const uint32_t sizes[] = {100, 0xFFFFFFFF};
+    for (uint32_t size : sizes) {
+        memcpy(&bomb[2], &size, 4);
+        try {
+            rawDecompress(bomb);
+            return false;
+        } catch (std::runtime_error&) {}
+    }
+    return true;
+}
+
+struct PipeResult {
+    double seconds = 0;
+    size_t frames = 0, payload = 0, wire = 0;
+    bool ok = true;
+};
+
+// Frames every recorded packet, writes it to a pipe, and parses it on the other end.
+static PipeResult runPipe(bool binary) {
+    PipeResult result;
+    int fds[2];
+    if (pipe(fds)) {
+        perror("pipe");
+        result.ok = false;
+        return result;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::thread reader([&result, binary, fd = fds[0]]() {
+        RawPacketParser parser;
+        parser.binaryChecksum = binary;
+        parser.largePackets = true;
+        char buf[65536];
+        size_t i = 0;
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            parser.feed(buf, n);
+            for (const std::string * packet; (packet = parser.next()) != NULL; i++) {
+                result.ok = result.ok && *packet == recorded[i % recorded.size()];
+                result.frames++;
+                result.payload += packet->size();
+            }
+        }
+        result.ok = result.ok && parser.errors == 0;
+    });
+    for (int round = 0; round < pipeRounds; round++) {
+        for (const std::string& packet : recorded) {
+            const std::string frame = frameRawPacket(packet, binary, binary, true);
+            result.wire += frame.size();
+            for (size_t off = 0; off < frame.size();) {
+                const ssize_t n = write(fds[1], frame.data() + off, frame.size() - off);
+                if (n <= 0) break;
+                off += n;
+            }
+        }
+    }
+    close(fds[1]);
+    reader.join();
+    close(fds[0]);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.ok = result.ok && result.frames == recorded.size() * pipeRounds;
+    return result;
+}
+
+int main() {
+    const struct {const char * name; std::function<void(Terminal&, int)> step;} sessions[] = {
+        {"shell", shellFrame},
+        {"editor", editorFrame},
+        {"graphics demo", graphicsFrame},
+    };
+    bool ok = true;
+    std::vector<SessionResult> compression;
+    printf("%d frames per session, at %d frames/s; sizes on the wire use Base64 framing\n\n", frameCount, frameRate);
+    printf("%-14s %16s %16s %16s %16s %8s\n", "", "full B/frame", "delta B/frame", "full kB/s", "delta kB/s", "saved");
+    for (const auto& s : sessions) {
+        const SessionResult r = runSession(s.step);
+        printf("%-14s %16.0f %16.0f %16.1f %16.1f %7.1f%%%s\n", s.name,
+            (double)r.framed[0] / frameCount, (double)r.framed[1] / frameCount,
+            (double)r.framed[0] / frameCount * frameRate / 1024, (double)r.framed[1] / frameCount * frameRate / 1024,
+            100.0 - r.framed[1] * 100.0 / r.framed[0], r.matches ? "" : "  (DELTAS DON'T MATCH)");
+        ok = ok && r.matches;
+        compression.push_back(r);
+    }
+    printf("\nWith compression\n\n");
+    printf("%-14s %16s %16s %16s %16s\n", "", "frames", "kB/s", "compress us/f", "inflate us/f");
+    for (size_t i = 0; i < compression.size(); i++) {
+        for (int delta = 0; delta < 2; delta++) {
+            const SessionResult& r = compression[i];
+            printf("%-14s %16s %16.1f %16.1f %16.1f\n", delta ? "" : sessions[i].name, delta ? "delta" : "full",
+                (double)r.compressed[delta] / frameCount * frameRate / 1024,
+                r.compressTime[delta] * 1e6 / CLOCKS_PER_SEC / frameCount, r.decompressTime[delta] * 1e6 / CLOCKS_PER_SEC / frameCount);
+        }
+    }
+    const bool bombs = rejectsBombs();
+    printf("\nOversized compressed packets %s\n", bombs ? "are rejected" : "WERE ACCEPTED");
+    ok = ok && bombs;
+    printf("\n%zu full frames x %d rounds through a pipe\n\n", recorded.size(), pipeRounds);
+    printf("%-14s %16s %16s %16s %16s\n", "", "frames/s", "payload MB/s", "wire MB/s", "wire/payload");
+    for (int binary = 0; binary < 2; binary++) {
+        const PipeResult r = runPipe(binary);
+        printf("%-14s %16.0f %16.1f %16.1f %16.2f%s\n", binary ? "binary" : "Base64",
+            r.frames / r.seconds, r.payload / r.seconds / 1048576, r.wire / r.seconds / 1048576,
+            (double)r.wire / r.payload, r.ok ? "" : "  (PACKETS DON'T MATCH)");
+        ok = ok && r.ok;
+    }
+    return ok ? 0 : 1;
+}
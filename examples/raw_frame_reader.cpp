@@ -1,9 +1,13 @@
+#include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <map>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <cstdint>
 #include <cstring>
+#include <zlib.h>
 #include "../src/terminal/RawTerminal.hpp"
 
 /*
@@ -184,6 +188,58 @@ void parseIBTTag(std::istream& in, int level = 0) {
 
 bool noterm = false;
 
+// The last known contents of each window, which delta frames are applied on top of
+struct WindowState {
+	uint16_t width = 0;
+	uint16_t height = 0;
+	uint8_t mode = 0;
+	std::vector<unsigned char> screen;
+	std::vector<unsigned char> colors;
+	std::vector<unsigned char> pixels;
+};
+
+std::map<uint8_t, WindowState> windows;
+size_t terminalBytes = 0;
+std::chrono::steady_clock::time_point terminalStart;
+
+void decodeRLE(std::istream& in, unsigned char * data, size_t len) {
+	for (size_t i = 0; i < len;) {
+		unsigned char c = in.get();
+		unsigned char n = in.get();
+		if (n == 0 || !in.good()) break;
+		memset(data + i, c, (size_t)n < len - i ? (size_t)n : len - i);
+		i += n;
+	}
+}
+
+void printWindow(const WindowState& win) {
+	if (noterm || win.mode != 0) return;
+	std::cout << "> Terminal contents:\n";
+	for (int y = 0; y < win.height; y++) {
+		std::cout.write((const char*)win.screen.data() + y * win.width, win.width);
+		std::cout << "\n";
+	}
+}
+
+void printPalette(std::istream& in, uint8_t mode) {
+	std::cout << "> Palette contents: ";
+	uint8_t r, g, b;
+	for (int i = 0; i < (mode == 2 ? 256 : 16); i++) {
+		r = in.get();
+		g = in.get();
+		b = in.get();
+		printf("%s#%02x%02x%02x", (i == 0 ? "" : ", "), r, g, b);
+	}
+	std::cout << "\n";
+}
+
+void countTerminalBytes(long size) {
+	if (terminalBytes == 0) terminalStart = std::chrono::steady_clock::now();
+	terminalBytes += size;
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - terminalStart).count();
+	if (secs > 0) std::cout << "> Terminal data: " << terminalBytes << " bytes total, " << (size_t)(terminalBytes / secs) << " bytes/sec\n";
+}
+
 static const char * fileoptypes[] = {
 	"exists",
 	"isDir",
@@ -211,33 +267,82 @@ static const char * fileoptypes[] = {
 	"open('ab')"
 };
 
+void countFrame(size_t wireSize) {
+	static size_t frames = 0, bytes = 0;
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	frames++;
+	bytes += wireSize;
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (secs > 0) printf("> Throughput: %zu frames, %.1f frames/sec, %.3f MB/s\n", frames, frames / secs, bytes / secs / 1048576.0);
+}
+
+bool inflatePacket(std::string& ddata) {
+	static size_t compressedBytes = 0, uncompressedBytes = 0;
+	if (ddata.size() < 6) return false;
+	uint32_t size = 0;
+	memcpy(&size, ddata.c_str() + 2, 4);
+	std::string data(size + 2, 0);
+	data[0] = ddata[0] & ~CCPC_RAW_COMPRESSED_PACKET;
+	data[1] = ddata[1];
+	uLongf destLen = size;
+	if (uncompress((Bytef*)&data[2], &destLen, (const Bytef*)ddata.c_str() + 6, ddata.size() - 6) != Z_OK || destLen != size) return false;
+	compressedBytes += ddata.size();
+	uncompressedBytes += data.size();
+	printf("> Compressed packet: %zu -> %zu bytes (total %.1f%% of uncompressed size)\n", ddata.size(), data.size(), compressedBytes * 100.0 / uncompressedBytes);
+	ddata = data;
+	return true;
+}
+
 int main(int argc, const char * argv[]) {
 	if (argc > 1 && std::string(argv[1]) == "--noterm") noterm = true;
 	std::cout << "Listening for data...\n";
 	bool useBinaryChecksum = false;
 	while (true) {
 		unsigned char c = std::cin.get();
+		if (!std::cin.good()) break;
 		if (c == '!' && std::cin.get() == 'C' && std::cin.get() == 'P') {
 			char mode = std::cin.get();
-			char size[13];
-			if (mode == 'C') std::cin.read(size, 4);
-			else if (mode == 'D') std::cin.read(size, 12);
-			else {std::cout << "Unknown frame type '" << mode << "'!\n"; continue;}
-			long sizen = strtol(size, NULL, 16);
-			std::cout << "Got frame of size " << sizen << "\n";
-			char * tmp = new char[sizen + 1];
-			tmp[sizen] = 0;
-			std::cin.read(tmp, sizen);
-			std::string ddata = base64_decode(tmp);
-			uint32_t sum = useBinaryChecksum ? rc_crc32(0, ddata.c_str(), ddata.size()) : rc_crc32(0, tmp, sizen);
-			delete[] tmp;
-			uint32_t getsum = 0;
-			scanf("%08x", &getsum);
-			if (sum == getsum) printf("> Checksums match (%08X)\n", getsum);
-			else printf("\n> Checksums don't match! (%08X vs. expected %08X)\n", sum, getsum);
+			std::string ddata;
+			long sizen;
+			if (mode == 'B') {
+				uint32_t size = 0, getsum = 0;
+				std::cin.read((char*)&size, 4);
+				sizen = size;
+				std::cout << "Got binary frame of size " << sizen << "\n";
+				ddata.resize(size);
+				std::cin.read(&ddata[0], size);
+				std::cin.read((char*)&getsum, 4);
+				uint32_t sum = rc_crc32(0, ddata.c_str(), ddata.size());
+				if (sum == getsum) printf("> Checksums match (%08X)\n", getsum);
+				else printf("\n> Checksums don't match! (%08X vs. expected %08X)\n", sum, getsum);
+				countFrame(sizen + 12);
+			} else {
+				char size[13] = {0};
+				if (mode == 'C') std::cin.read(size, 4);
+				else if (mode == 'D') std::cin.read(size, 12);
+				else {std::cout << "Unknown frame type '" << mode << "'!\n"; continue;}
+				sizen = strtol(size, NULL, 16);
+				std::cout << "Got frame of size " << sizen << "\n";
+				char * tmp = new char[sizen + 1];
+				tmp[sizen] = 0;
+				std::cin.read(tmp, sizen);
+				ddata = base64_decode(tmp);
+				uint32_t sum = useBinaryChecksum ? rc_crc32(0, ddata.c_str(), ddata.size()) : rc_crc32(0, tmp, sizen);
+				delete[] tmp;
+				uint32_t getsum = 0;
+				scanf("%08x", &getsum);
+				if (sum == getsum) printf("> Checksums match (%08X)\n", getsum);
+				else printf("\n> Checksums don't match! (%08X vs. expected %08X)\n", sum, getsum);
+				countFrame(sizen + (mode == 'C' ? 17 : 25));
+			}
+			if (ddata.size() >= 2 && ((uint8_t)ddata[0] & CCPC_RAW_COMPRESSED_PACKET) && !inflatePacket(ddata)) {
+				std::cout << "> Could not decompress packet!\n";
+				continue;
+			}
 			std::stringstream in(ddata);
 			uint8_t type = in.get();
-			std::cout << "> Frame is of type " << (int)type << " for window ID " << (int)in.get() << "\n";
+			uint8_t id = in.get();
+			std::cout << "> Frame is of type " << (int)type << " for window ID " << (int)id << "\n";
 			switch (type) {
 			case CCPC_RAW_TERMINAL_DATA: {
 				uint16_t width = 0, height = 0, cursorX = 0, cursorY = 0;
@@ -251,43 +356,59 @@ int main(int argc, const char * argv[]) {
 				std::cout << "> Cursor X: " << cursorX << ", Y: " << cursorY << "\n";
 				std::cout << "> Grayscale? " << (in.get() ? "Yes\n" : "No\n");
 				in.seekg((long)in.tellg() + 3);
-				int i = 0;
+				WindowState& win = windows[id];
+				win.width = width;
+				win.height = height;
+				win.mode = mode;
+				win.screen.assign((size_t)width * height, ' ');
+				win.colors.assign((size_t)width * height, 0xF0);
+				win.pixels.assign((size_t)width * height * 54, 0x0F);
 				if (mode == 0) {
-					if (!noterm) std::cout << "> Terminal contents:\n";
-					while (i < width * height) {
-						char c = in.get();
-						int len = in.get();
-						if (!noterm) {
-							for (int j = 0; j < len; j++) {
-								if (i + j > 0 && (i + j) % width == 0) std::cout << "\n";
-								std::cout << c;
-							}
-						}
-						i += len;
-					}
-					i = 0;
-					while (i < width * height) {
-						in.get();
-						int len = in.get();
-						i += len;
-					}
-					if (!noterm) std::cout << "\n";
-				} else {
-					while (i < width * height * 56) {
-						in.get();
-						int len = in.get();
-						i += len;
-					}
+					decodeRLE(in, win.screen.data(), win.screen.size());
+					decodeRLE(in, win.colors.data(), win.colors.size());
+				} else decodeRLE(in, win.pixels.data(), win.pixels.size());
+				printWindow(win);
+				printPalette(in, mode);
+				countTerminalBytes(sizen);
+				break;
+			} case CCPC_RAW_TERMINAL_DELTA: {
+				uint16_t width = 0, height = 0, cursorX = 0, cursorY = 0, nranges = 0;
+				uint8_t mode = in.get();
+				std::cout << "> Graphics mode: " << (int)mode << "\n> Cursor showing/blinking? " << (in.get() ? "Yes\n" : "No\n");
+				in.read((char*)&width, 2);
+				in.read((char*)&height, 2);
+				in.read((char*)&cursorX, 2);
+				in.read((char*)&cursorY, 2);
+				std::cout << "> Cursor X: " << cursorX << ", Y: " << cursorY << "\n";
+				std::cout << "> Grayscale? " << (in.get() ? "Yes\n" : "No\n");
+				uint8_t flags = in.get();
+				in.read((char*)&nranges, 2);
+				std::cout << "> Changed row ranges: " << nranges << (flags & 1 ? ", palette changed\n" : "\n");
+				auto it = windows.find(id);
+				if (it == windows.end() || it->second.width != width || it->second.height != height || it->second.mode != mode) {
+					std::cout << "> Delta frame does not match the last full frame for this window!\n";
+					break;
 				}
-				std::cout << "> Palette contents: ";
-				uint8_t r, g, b;
-				for (int i = 0; i < (mode == 2 ? 256 : 16); i++) {
-					r = in.get();
-					g = in.get();
-					b = in.get();
-					printf("%s#%02x%02x%02x", (i == 0 ? "" : ", "), r, g, b);
+				WindowState& win = it->second;
+				size_t rowSize = mode == 0 ? width : width * 6;
+				unsigned rows = mode == 0 ? height : height * 9;
+				for (int i = 0; i < nranges; i++) {
+					uint16_t start = 0, count = 0;
+					in.read((char*)&start, 2);
+					in.read((char*)&count, 2);
+					std::cout << ">   Rows " << start << "-" << (start + count - 1) << "\n";
+					if (start + count > rows) {
+						std::cout << "> Row range is out of bounds!\n";
+						break;
+					}
+					if (mode == 0) {
+						decodeRLE(in, win.screen.data() + start * rowSize, count * rowSize);
+						decodeRLE(in, win.colors.data() + start * rowSize, count * rowSize);
+					} else decodeRLE(in, win.pixels.data() + start * rowSize, count * rowSize);
 				}
-				std::cout << "\n";
+				printWindow(win);
+				if (flags & 1) printPalette(in, mode);
+				countTerminalBytes(sizen);
 				break;
 			} case CCPC_RAW_KEY_DATA: {
 				std::cout << "> Key ID or character: " << (int)in.get();
@@ -346,6 +467,9 @@ int main(int argc, const char * argv[]) {
 				if (flags & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM) {std::cout << "  * Binary checksums\n"; useBinaryChecksum = true;}
 				if (flags & CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT) std::cout << "  * Filesystem extension\n";
 				if (flags & CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS) std::cout << "  * Send all windows\n";
+				if (flags & CCPC_RAW_FEATURE_FLAG_DELTA_FRAMES) std::cout << "  * Delta frames\n";
+				if (flags & CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING) std::cout << "  * Binary framing\n";
+				if (flags & CCPC_RAW_FEATURE_FLAG_COMPRESSION) std::cout << "  * Compression\n";
 				if (flags & CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES) {
 					std::cout << "  * Extended flags:\n";
 					// if (eflags && CCPC_RAW_FEATURE_FLAG_EXTENDED_) std::cout << "    * \n";
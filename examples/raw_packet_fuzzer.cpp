@@ -0,0 +1,117 @@
+/*
+ * raw_packet_fuzzer.cpp
+ * CraftOS-PC 2
+ *
+ * Fuzz target and benchmark for the raw mode input parser.
+ *
+ * Fuzzing (requires clang):  make raw-packet-fuzzer && ./raw_packet_fuzzer
+ * Benchmark:                 make raw-packet-benchmark && ./raw_packet_benchmark
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <Poco/Checksum.h>
+#include "../src/terminal/RawPacketParser.hpp"
+
+static std::vector<std::string> parseAll(const uint8_t * data, size_t size, size_t chunk, bool binaryChecksum, bool largePackets) {
+    std::vector<std::string> packets;
+    RawPacketParser parser;
+    parser.binaryChecksum = binaryChecksum;
+    parser.largePackets = largePackets;
+    for (size_t i = 0; i < size; i += chunk) {
+        parser.feed((const char*)data + i, std::min(chunk, size - i));
+        const std::string * packet;
+        while ((packet = parser.next()) != NULL) packets.push_back(*packet);
+    }
+    return packets;
+}
+
+// The first byte selects the parser options and chunk size; the rest is input.
+// Any chunking must produce the same packets as feeding everything at once.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+    if (size < 1) return 0;
+    const bool binaryChecksum = data[0] & 1, largePackets = data[0] & 2;
+    const size_t chunk = (data[0] >> 2) + 1;
+    const std::vector<std::string> whole = parseAll(data + 1, size - 1, size, binaryChecksum, largePackets);
+    const std::vector<std::string> chunked = parseAll(data + 1, size - 1, chunk, binaryChecksum, largePackets);
+    if (whole != chunked) abort();
+    return 0;
+}
+
+#ifndef RAW_PACKET_FUZZER
+
+static const char * b64chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string b64encode(const std::string& in) {
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < in.size(); i += 3) {
+        const uint32_t n = ((uint8_t)in[i] << 16) | ((uint8_t)in[i+1] << 8) | (uint8_t)in[i+2];
+        out += b64chars[n >> 18]; out += b64chars[(n >> 12) & 63]; out += b64chars[(n >> 6) & 63]; out += b64chars[n & 63];
+    }
+    if (i + 1 == in.size()) {
+        const uint32_t n = (uint8_t)in[i] << 16;
+        out += b64chars[n >> 18]; out += b64chars[(n >> 12) & 63]; out += "==";
+    } else if (i + 2 == in.size()) {
+        const uint32_t n = ((uint8_t)in[i] << 16) | ((uint8_t)in[i+1] << 8);
+        out += b64chars[n >> 18]; out += b64chars[(n >> 12) & 63]; out += b64chars[(n >> 6) & 63]; out += '=';
+    }
+    return out;
+}
+
+// Builds a stream of mouse drag packets (type 2), like what a client sends while dragging.
+static std::string makeStream(size_t count, bool binary) {
+    std::string stream;
+    for (size_t i = 0; i < count; i++) {
+        std::string packet = {2, 0, 3, 1};
+        const uint32_t x = i % 51, y = i % 19;
+        packet.append((const char*)&x, 4);
+        packet.append((const char*)&y, 4);
+        Poco::Checksum chk;
+        if (binary) {
+            chk.update(packet);
+            const uint32_t size = packet.size(), sum = chk.checksum();
+            stream.append("!CPB", 4);
+            stream.append((const char*)&size, 4);
+            stream.append(packet);
+            stream.append((const char*)&sum, 4);
+        } else {
+            const std::string str = b64encode(packet);
+            chk.update(str);
+            char tmp[13];
+            snprintf(tmp, 13, "%04X%08x", (unsigned)str.size(), chk.checksum());
+            stream += "!CPC" + std::string(tmp, 4) + str + std::string(tmp + 4, 8) + "\n";
+        }
+    }
+    return stream;
+}
+
+static void benchmark(const char * name, const std::string& stream, size_t count) {
+    const auto start = std::chrono::steady_clock::now();
+    RawPacketParser parser;
+    size_t packets = 0;
+    for (size_t i = 0; i < stream.size(); i += 65536) {
+        parser.feed(stream.c_str() + i, std::min((size_t)65536, stream.size() - i));
+        while (parser.next() != NULL) packets++;
+    }
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (packets != count || parser.errors) printf("%s: parsed %zu of %zu packets (%zu errors)!\n", name, packets, count, parser.errors);
+    printf("%s: %.0f packets/sec, %.1f MB/s\n", name, packets / secs, stream.size() / secs / 1048576.0);
+}
+
+int main(int argc, const char * argv[]) {
+    const size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    benchmark("Base64 frames", makeStream(count, false), count);
+    benchmark("Binary frames", makeStream(count, true), count);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * raw_server_test.cpp
+ * CraftOS-PC 2
+ *
+ * Loopback test for the raw socket server (--raw-server). It connects several
+ * viewers plus one that never reads, and checks that the reading viewers get
+ * a window announcement followed by valid frames until the server shuts down.
+ * The computer has one window, and each viewer must be told about it exactly
+ * once: viewers that connect later must not make the others hear it again.
+ *
+ * Usage: raw_server_test <host:port> [viewers]   (or `make raw-server-test`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/Net/SocketAddress.h>
+#include "../src/terminal/RawPacketParser.hpp"
+
+struct ViewerResult {
+    size_t announcements = 0;
+    size_t frames = 0;
+    size_t framesBeforeAnnouncement = 0;
+    size_t errors = 0;
+    size_t bytes = 0;
+};
+
+static Poco::Net::StreamSocket connect(const Poco::Net::SocketAddress& address) {
+    for (int i = 0; ; i++) {
+        try {
+            return Poco::Net::StreamSocket(address);
+        } catch (Poco::Exception &e) {
+            if (i == 100) throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+static void runViewer(Poco::Net::StreamSocket sock, ViewerResult * result) {
+    RawPacketParser parser;
+    parser.largePackets = true;
+    char buf[65536];
+    int n;
+    try {
+        while ((n = sock.receiveBytes(buf, sizeof(buf))) > 0) {
+            result->bytes += n;
+            parser.feed(buf, n);
+            const std::string * packet;
+            while ((packet = parser.next()) != NULL) {
+                if ((*packet)[0] == 4 && packet->size() > 2 && (*packet)[2] == 0) result->announcements++;
+                else if ((*packet)[0] == 0) {
+                    result->frames++;
+                    if (result->announcements == 0) result->framesBeforeAnnouncement++;
+                }
+            }
+        }
+    } catch (Poco::Exception &e) {}
+    result->errors = parser.errors;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <host:port> [viewers]\n", argv[0]);
+        return 2;
+    }
+    const Poco::Net::SocketAddress address(argv[1]);
+    const int count = argc > 2 ? atoi(argv[2]) : 4;
+    std::vector<ViewerResult> results(count);
+    std::vector<std::thread> threads;
+    // this viewer never reads, so the server has to drop its frames instead of stalling
+    Poco::Net::StreamSocket stuck = connect(address);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) threads.emplace_back(runViewer, connect(address), &results[i]);
+    for (std::thread& t : threads) t.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        const ViewerResult& r = results[i];
+        printf("Viewer %d: %zu frames (%.1f/s), %.1f kB/s, %zu announcements, %zu errors\n", i, r.frames, r.frames / secs, r.bytes / secs / 1024.0, r.announcements, r.errors);
+        if (r.frames == 0 || r.announcements != 1 || r.framesBeforeAnnouncement || r.errors) ok = false;
+    }
+    printf(ok ? "Passed\n" : "Failed\n");
+    return ok ? 0 : 1;
+}
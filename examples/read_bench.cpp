@@ -0,0 +1,80 @@
+/*
+ * read_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures how fast a computer can read an 8 MiB text file through fs.open
+ * handles with readAll, a readLine loop, and read(n) in text and binary mode.
+ *
+ * Usage: read_bench <path to craftos>   (or `make read-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char * phases[] = {"readAll", "readLine loop", "readLine loop (rb)", "read(16)", "read(4096) (rb)"};
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local size = fs.getSize('data.txt') "
+    "local function phase(mode, fn) local f = fs.open('data.txt', mode) local t = os.clock() fn(f) t = os.clock() - t f.close() os.queueEvent('bench') os.pullEvent('bench') return size / 1048576 / t end "
+    "local r = {} "
+    "r[1] = phase('r', function(f) f.readAll() end) "
+    "r[2] = phase('r', function(f) while f.readLine() do end end) "
+    "r[3] = phase('rb', function(f) while f.readLine() do end end) "
+    "r[4] = phase('r', function(f) while f.read(16) do end end) "
+    "r[5] = phase('rb', function(f) while f.read(4096) do end end) "
+    "local f = fs.open('bench.txt', 'w') f.write(table.concat(r, ' ')) f.close() os.shutdown()";
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-read-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    mkdir((dir + "/computer").c_str(), 0777);
+    mkdir((dir + "/computer/0").c_str(), 0777);
+    {
+        // log-like lines of 20-100 characters
+        std::ofstream out(dir + "/computer/0/data.txt", std::ios::binary);
+        size_t size = 0;
+        for (unsigned i = 0; size < 8 << 20; i++) {
+            const std::string line = "[" + std::to_string(i) + "] " + std::string(20 + (i * 7919) % 80, 'a' + i % 26) + "\n";
+            out << line;
+            size += line.size();
+        }
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    double rates[5] = {0, 0, 0, 0, 0};
+    std::ifstream results(dir + "/computer/0/bench.txt");
+    for (int i = 0; i < 5; i++) results >> rates[i];
+    for (int i = 0; i < 5; i++) printf("%-19s %8.1f MB/s\n", phases[i], rates[i]);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+/*
+ * term_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures the shared drawing kernel through both of its entry points: runs
+ * write, blit, scroll, clear, drawPixels and getPixels on term.native() and on
+ * a monitor the same size, and prints calls per second for each. Since both go
+ * through the same code in termsupport, the two columns should be within
+ * noise of each other.
+ *
+ * Usage: term_bench <path to craftos>   (or `make term-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char * phases[] = {"write", "blit", "scroll", "clear", "drawPixels (fill)", "drawPixels (table)", "getPixels"};
+static const int phaseCount = sizeof(phases) / sizeof(phases[0]);
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function phase(n, fn) local t = os.clock() for i = 1, n do fn(i) end t = os.clock() - t os.queueEvent('bench') os.pullEvent('bench') return n / t end "
+    "local function run(t) "
+    "  local w, h = t.getSize() local r = {} "
+    "  local line, fg, bg = ('x'):rep(w), ('0'):rep(w), ('f'):rep(w) "
+    "  local rows = {} for y = 1, 60 do rows[y] = ('\\1\\2\\3\\4'):rep(75) end "
+    "  r[1] = phase(100000, function(i) t.setCursorPos(1, i % h + 1) t.write(line) end) "
+    "  r[2] = phase(100000, function(i) t.setCursorPos(1, i % h + 1) t.blit(line, fg, bg) end) "
+    "  r[3] = phase(100000, function(i) t.scroll(i % 2 == 0 and 1 or -1) end) "
+    "  r[4] = phase(50000, function() t.clear() end) "
+    "  t.setGraphicsMode(1) "
+    "  r[5] = phase(20000, function(i) t.drawPixels(0, 0, i % 16, w * 6, h * 9) end) "
+    "  r[6] = phase(5000, function() t.drawPixels(0, 0, rows) end) "
+    "  r[7] = phase(5000, function() t.getPixels(0, 0, 300, 60, true) end) "
+    "  t.setGraphicsMode(0) t.clear() "
+    "  return table.concat(r, ' ') "
+    "end "
+    "local w, h = term.getSize() "
+    "periphemu.create('bench', 'monitor', w, h) "
+    "local results = run(term.native()) .. ' ' .. run(peripheral.wrap('bench')) "
+    "local f = fs.open('bench.txt', 'w') f.write(results) f.close() os.shutdown()";
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-term-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir, root = dir + "/computer/0";
+    mkdir((dir + "/computer").c_str(), 0777);
+    mkdir(root.c_str(), 0777);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(argv[1], argv[1], "--raw", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    double results[phaseCount * 2] = {};
+    std::ifstream in(root + "/bench.txt");
+    bool ok = true;
+    for (int i = 0; i < phaseCount * 2; i++) ok = (bool)(in >> results[i]) && ok;
+    printf("%-20s %16s %16s %8s\n", "", "term calls/s", "monitor calls/s", "ratio");
+    for (int i = 0; i < phaseCount; i++) {
+        const double ratio = results[i] > 0 ? results[phaseCount + i] / results[i] : 0;
+        printf("%-20s %16.0f %16.0f %8.2f\n", phases[i], results[i], results[phaseCount + i], ratio);
+        // the same kernel is behind both, so anything beyond scheduling noise means one side has drifted
+        if (ratio < 0.5 || ratio > 2) ok = false;
+    }
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+/*
+ * trace_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures the cost of recording a terminal trace (--trace). It runs the same
+ * drawing workload with and without tracing, then renders the trace to images
+ * with --replay-images to see how much faster than real time that is.
+ *
+ * Usage: trace_bench <path to craftos>   (or `make trace-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static const char * phases[] = {"write", "blit", "scroll", "setPixel"};
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function phase(n, fn) local t = os.epoch('utc') for i = 1, n do fn(i) end t = os.epoch('utc') - t os.queueEvent('bench') os.pullEvent('bench') return t end "
+    "local w, h = term.getSize() local r = {} "
+    "r[1] = phase(100000, function(i) term.setCursorPos(i % w + 1, i % h + 1) term.setTextColor(2 ^ (i % 16)) term.write('x') end) "
+    "r[2] = phase(100000, function(i) term.setCursorPos(1, i % h + 1) term.blit('hello', '01234', 'fedcb') end) "
+    "r[3] = phase(100000, function(i) term.scroll(1) end) "
+    "term.setGraphicsMode(2) r[4] = phase(100000, function(i) term.setPixel(i % (w * 6), i % (h * 9), i % 256) end) term.setGraphicsMode(0) "
+    "local f = fs.open('bench.txt', 'w') f.write(table.concat(r, ' ')) f.close() os.shutdown()";
+
+static bool run(const std::vector<std::string>& args) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    } else if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        std::vector<char*> argv;
+        for (const std::string& a : args) argv.push_back((char*)a.c_str());
+        argv.push_back(NULL);
+        execv(argv[0], argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool runWorkload(const std::string& craftos, const std::string& dir, const std::string& trace, double times[4]) {
+    std::vector<std::string> args = {craftos, "--raw", "-d", dir, "--exec", script};
+    if (!trace.empty()) {
+        args.push_back("--trace");
+        args.push_back(trace);
+    }
+    if (!run(args)) return false;
+    std::ifstream in(dir + "/computer/0/bench.txt");
+    for (int i = 0; i < 4; i++) if (!(in >> times[i])) return false;
+    return true;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-trace-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir, trace = dir + "/session.cctrace";
+    double base[4], traced[4];
+    if (!runWorkload(argv[1], dir, "", base) || !runWorkload(argv[1], dir, trace, traced)) {
+        fprintf(stderr, "Could not run the benchmark script\n");
+        return 1;
+    }
+    for (int i = 0; i < 4; i++)
+        printf("%-9s %6.0f ms untraced, %6.0f ms traced (%+.1f%%)\n", phases[i], base[i], traced[i], (traced[i] - base[i]) * 100.0 / base[i]);
+    struct stat st;
+    if (stat(trace.c_str(), &st) == 0) printf("Trace size: %.1f MB (%.1f bytes per operation)\n", st.st_size / 1048576.0, st.st_size / 400000.0);
+    const auto start = std::chrono::steady_clock::now();
+    if (!run({argv[1], "--replay", trace, "--replay-images", dir + "/frames"})) {
+        fprintf(stderr, "Could not replay the trace\n");
+        return 1;
+    }
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double total = 0;
+    for (int i = 0; i < 4; i++) total += traced[i];
+    printf("Rendered the trace to images in %.2f s (%.1fx real time)\n", secs, total / 1000.0 / secs);
+    return 0;
+}
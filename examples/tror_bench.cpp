@@ -0,0 +1,93 @@
+/*
+ * tror_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Runs CraftOS-PC in TRoR mode (--tror) with its output going into a pipe, and
+ * reports how many packets and bytes a drawing-heavy workload produces and how
+ * fast the computer could run it.
+ *
+ * Usage: tror_bench <path to craftos>   (or `make tror-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char * phases[] = {"write", "blit", "cursor+color"};
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string script =
+    "local function phase(n, fn) local t = os.epoch('utc') for i = 1, n do fn(i) end t = os.epoch('utc') - t os.queueEvent('bench') os.pullEvent('bench') return t end "
+    "local w, h = term.getSize() local r = {} "
+    "r[1] = phase(100000, function(i) term.write('x') end) "
+    "r[2] = phase(20000, function(i) term.setCursorPos(1, i % h + 1) term.blit('hello world', '00000000000', 'fffffffffff') end) "
+    "r[3] = phase(100000, function(i) term.setCursorPos(i % w + 1, i % h + 1) term.setCursorPos(1, 1) term.setTextColor(colors.white) term.setBackgroundColor(colors.black) term.write('y') end) "
+    "local f = fs.open('bench.txt', 'w') f.write(table.concat(r, ' ')) f.close() os.shutdown()";
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-tror-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    } else if (pid == 0) {
+        // stdin stays open so the input thread just waits for packets
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[1]);
+        close(out[0]);
+        execl(argv[1], argv[1], "--tror", "-d", tmpdir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    const auto start = std::chrono::steady_clock::now();
+    std::map<std::string, size_t> packets;
+    size_t total = 0, lines = 0;
+    std::string line;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(out[0], buf, sizeof(buf))) > 0) {
+        total += n;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                if (line.size() >= 2) packets[line.substr(0, 2)]++;
+                lines++;
+                line.clear();
+            } else if (line.size() < 2) line += buf[i];
+        }
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    close(in[1]);
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double times[3] = {0, 0, 0};
+    std::ifstream results(std::string(tmpdir) + "/computer/0/bench.txt");
+    for (int i = 0; i < 3; i++) results >> times[i];
+    for (int i = 0; i < 3; i++) printf("%-13s %6.0f ms\n", phases[i], times[i]);
+    printf("%zu packets, %zu bytes in %.2f s (%.0f packets/s, %.1f MB/s)\n", lines, total, secs, lines / secs, total / secs / 1048576.0);
+    for (const auto& p : packets) printf("  %s: %zu\n", p.first.c_str(), p.second);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
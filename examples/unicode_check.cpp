@@ -0,0 +1,131 @@
+/*
+ * unicode_check.cpp
+ * CraftOS-PC 2
+ *
+ * Fuzzes makeASCIISafe and latin1ToUTF8 against the std::wstring_convert
+ * versions they replaced, then compares their speed on ASCII, Latin-1 and
+ * mixed text.
+ *
+ * Usage: unicode_check [iterations]   (or `make unicode-check`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <codecvt>
+#include <cstdio>
+#include <cstdlib>
+#include <locale>
+#include <random>
+#include <string>
+#include "../src/unicode.hpp"
+
+// the old implementation, minus its error message
+static std::string referenceASCIISafe(const char * retval, size_t len) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    std::wstring wstr;
+    try {wstr = converter.from_bytes(retval, retval + len);}
+    catch (std::exception &e) {
+        std::string out;
+        for (size_t i = 0; i < len; i++) {if ((unsigned char)retval[i] < 128) out += retval[i]; else out += '?';}
+        return out;
+    }
+    std::string out;
+    for (wchar_t c : wstr) {if (c < 256) out += (char)c; else out += '?';}
+    return out;
+}
+
+// the old write handle conversion
+static std::string referenceUTF8(const char * str, size_t len) {
+    std::wstring wstr;
+    for (size_t i = 0; i < len; i++) wstr += (wchar_t)(unsigned char)str[i];
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.to_bytes(wstr);
+}
+
+static std::string encode(uint32_t c) {
+    std::string s;
+    if (c < 0x80) s += (char)c;
+    else if (c < 0x800) {s += (char)(0xC0 | (c >> 6)); s += (char)(0x80 | (c & 0x3F));}
+    else if (c < 0x10000) {s += (char)(0xE0 | (c >> 12)); s += (char)(0x80 | ((c >> 6) & 0x3F)); s += (char)(0x80 | (c & 0x3F));}
+    else {s += (char)(0xF0 | (c >> 18)); s += (char)(0x80 | ((c >> 12) & 0x3F)); s += (char)(0x80 | ((c >> 6) & 0x3F)); s += (char)(0x80 | (c & 0x3F));}
+    return s;
+}
+
+static size_t mismatches = 0, checked = 0;
+
+static void check(const std::string& str) {
+    checked++;
+    if ((makeASCIISafe(str.data(), str.size()) != referenceASCIISafe(str.data(), str.size()) ||
+         latin1ToUTF8(str.data(), str.size()) != referenceUTF8(str.data(), str.size())) && ++mismatches <= 10) {
+        printf("mismatch on:");
+        for (unsigned char c : str) printf(" %02X", c);
+        printf("\n");
+    }
+}
+
+static void bench(const char * name, const std::string& str) {
+    const int rounds = 20;
+    double times[2];
+    size_t sink = 0;
+    for (int which = 0; which < 2; which++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) sink += (which ? makeASCIISafe : referenceASCIISafe)(str.data(), str.size()).size();
+        times[which] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / rounds;
+    }
+    printf("%-8s %10.1f MB/s %10.1f MB/s %8.1fx\n", name, str.size() / times[0] / 1048576.0, str.size() / times[1] / 1048576.0, times[0] / times[1]);
+    if (sink == 0) printf("\n");
+}
+
+int main(int argc, const char * argv[]) {
+    const long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    std::mt19937 rng(1);
+    // every one- and two-byte string, with ASCII around it to reach the vector paths
+    for (int a = 0; a < 256; a++) {
+        check(std::string(1, (char)a));
+        for (int b = 0; b < 256; b++) {
+            const std::string s = {(char)a, (char)b};
+            check(s);
+            check(std::string(17, 'x') + s + std::string(9, 'y'));
+        }
+    }
+    // every three-byte string starting with a lead byte
+    for (int a = 0xC0; a < 0x100; a++)
+        for (int b = 0; b < 256; b++)
+            for (int c = 0; c < 256; c++) check({(char)a, (char)b, (char)c});
+    // every code point, and each one cut short
+    for (uint32_t c = 0; c < 0x110000; c++) {
+        const std::string s = encode(c);
+        check(s);
+        if (s.size() > 1) check(s.substr(0, s.size() - 1));
+    }
+    // random mixes of valid text, stray bytes and boundary code points
+    static const uint32_t edges[] = {0x7F, 0x80, 0xFF, 0x100, 0x7FF, 0x800, 0xD7FF, 0xE000, 0xFEFF, 0xFFFD, 0xFFFF, 0x10000, 0x10FFFF};
+    for (long i = 0; i < iterations; i++) {
+        std::string s;
+        const int parts = rng() % 40;
+        for (int j = 0; j < parts; j++) {
+            switch (rng() % 6) {
+                case 0: s += std::string(rng() % 40, 'a' + rng() % 26); break;
+                case 1: s += encode(rng() % 0x100); break;
+                case 2: s += encode(rng() % 0x110000); break;
+                case 3: s += encode(edges[rng() % (sizeof(edges) / sizeof(edges[0]))]); break;
+                case 4: if (rng() % 20 == 0) s += (char)rng(); else s += encode(rng() % 0x800); break;
+                case 5: {const std::string e = encode(0x80 + rng() % 0x10FF80); s += e.substr(0, 1 + rng() % e.size()); break;}
+            }
+        }
+        check(s);
+    }
+    printf("%zu strings checked, %zu mismatches\n\n", checked, mismatches);
+
+    std::string ascii, latin1, mixed;
+    while (ascii.size() < (1 << 20)) ascii += "local x = fs.open(\"file.txt\", \"r\") -- read the file\n";
+    while (latin1.size() < (1 << 20)) latin1 += encode(0x20 + rng() % 0xE0);
+    while (mixed.size() < (1 << 20)) mixed += rng() % 8 ? std::string("some text ") : encode(rng() % 0x3000);
+    printf("%-8s %15s %15s\n", "", "wstring_convert", "makeASCIISafe");
+    bench("ASCII", ascii);
+    bench("Latin-1", latin1);
+    bench("mixed", mixed);
+    return mismatches != 0;
+}
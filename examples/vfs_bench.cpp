@@ -0,0 +1,153 @@
+/*
+ * vfs_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Compares reading a 10,000-file virtual mount through FileEntry::path and a
+ * copied std::stringstream (how fs.list/fs.open used to work) against the flat
+ * VirtualFS index and zero-copy VFSFileStream, after checking that both agree
+ * on every path.
+ *
+ * Usage: vfs_bench   (or `make vfs-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/vfs.hpp"
+
+static constexpr int dirCount = 100, filesPerDir = 100, fileSize = 4096;
+
+// reads like fs_handle_readAll
+static size_t readAll(std::iostream& fp) {
+    fp.seekg(0, std::ios::end);
+    const size_t size = fp.tellg();
+    fp.seekg(0);
+    std::string str(size, 0);
+    fp.read(&str[0], size);
+    return fp.gcount();
+}
+
+template<typename F>
+static double timeLoop(int rounds, F fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) fn();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+int main() {
+    FileEntry root(std::map<std::string, FileEntry>{});
+    std::vector<std::filesystem::path> dirs, files;
+    for (int d = 0; d < dirCount; d++) {
+        const std::string dname = "dir" + std::to_string(d);
+        FileEntry& dir = root.dir.emplace(dname, FileEntry(std::map<std::string, FileEntry>{})).first->second;
+        dirs.push_back(std::filesystem::path("0:") / dname);
+        for (int f = 0; f < filesPerDir; f++) {
+            const std::string fname = "file" + std::to_string(f) + ".lua";
+            dir.dir.emplace(fname, FileEntry(std::string(fileSize, 'a' + (d + f) % 26)));
+            files.push_back(std::filesystem::path("0:") / dname / fname);
+        }
+    }
+    const std::shared_ptr<const VirtualFS> vfs = VirtualFS::get(root);
+
+    // correctness: every lookup and read must match FileEntry
+    size_t mismatches = 0;
+    std::vector<std::filesystem::path> probes = files;
+    probes.insert(probes.end(), dirs.begin(), dirs.end());
+    for (const char * extra : {"0:", "0:/dir1/.", "0:/dir1/nope", "0:/dir1/file1.lua/x", "0:/nope/file1.lua", "0:/dir1//file1.lua"}) probes.push_back(extra);
+    for (const std::filesystem::path& path : probes) {
+        const FileEntry * d = NULL;
+        try {d = &root.path(path);} catch (...) {}
+        const VirtualFS::Node * node = vfs->find(path);
+        if ((d == NULL) != (node == NULL)) {mismatches++; continue;}
+        if (d == NULL) continue;
+        if (d->isDir != node->isDir) mismatches++;
+        else if (d->isDir) {
+            std::vector<std::string> names;
+            for (const auto& p : d->dir) names.push_back(p.first);
+            if (names != node->children) mismatches++;
+        } else {
+            VFSFileStream fp(vfs, node);
+            std::string data((std::istreambuf_iterator<char>(fp)), std::istreambuf_iterator<char>());
+            if (data != d->data) mismatches++;
+            fp.clear();
+            fp.seekg(-2, std::ios::end);
+            if (fp.tellg() != (std::streamoff)d->data.size() - 2 || fp.get() != d->data[d->data.size()-2]) mismatches++;
+        }
+    }
+    printf("%zu paths checked, %zu mismatches\n", probes.size(), mismatches);
+
+    // lifetime: an open file must outlive its tree, and an invalidated tree must be indexed again
+    {
+        FileEntry * tree = new FileEntry(std::map<std::string, FileEntry>{{"a", FileEntry(std::string("old"))}});
+        std::shared_ptr<const VirtualFS> index = VirtualFS::get(*tree);
+        VFSFileStream fp(index, index->find(std::string("a")));
+        tree->dir.at("a").data = "new";
+        VirtualFS::invalidate(*tree);
+        const std::shared_ptr<const VirtualFS> rebuilt = VirtualFS::get(*tree);
+        const VirtualFS::Node * node = rebuilt->find(std::string("a"));
+        const bool seen = rebuilt != index && std::string(node->data, node->size) == "new";
+        delete tree;
+        index.reset();
+        std::string data((std::istreambuf_iterator<char>(fp)), std::istreambuf_iterator<char>());
+        printf("lifetime: %s\n", seen && data == "old" ? "ok" : "FAILED");
+        if (!seen || data != "old") mismatches++;
+    }
+
+    size_t sink = 0;
+    const double oldList = timeLoop(20, [&]() {
+        for (const auto& path : dirs) {
+            std::set<std::string> entries;
+            const FileEntry& d = root.path(path.lexically_relative(*path.begin()));
+            for (const auto& p : d.dir) entries.insert(p.first);
+            sink += entries.size();
+        }
+    }) / dirs.size();
+    const double newList = timeLoop(20, [&]() {
+        for (const auto& path : dirs) {
+            std::set<std::string> entries;
+            const VirtualFS::Node * node = vfs->find(path);
+            entries.insert(node->children.begin(), node->children.end());
+            sink += entries.size();
+        }
+    }) / dirs.size();
+    const double oldOpen = timeLoop(5, [&]() {
+        for (const auto& path : files) {
+            std::iostream * fp = new std::stringstream(root.path(path.lexically_relative(*path.begin())).data);
+            sink += fp->good();
+            delete fp;
+        }
+    }) / files.size();
+    const double newOpen = timeLoop(5, [&]() {
+        for (const auto& path : files) {
+            std::iostream * fp = new VFSFileStream(vfs, vfs->find(path));
+            sink += fp->good();
+            delete fp;
+        }
+    }) / files.size();
+    const double oldRead = timeLoop(5, [&]() {
+        for (const auto& path : files) {
+            std::iostream * fp = new std::stringstream(root.path(path.lexically_relative(*path.begin())).data);
+            sink += readAll(*fp);
+            delete fp;
+        }
+    }) / files.size();
+    const double newRead = timeLoop(5, [&]() {
+        for (const auto& path : files) {
+            std::iostream * fp = new VFSFileStream(vfs, vfs->find(path));
+            sink += readAll(*fp);
+            delete fp;
+        }
+    }) / files.size();
+    printf("%d files of %d bytes in %d directories (per call)\n", dirCount * filesPerDir, fileSize, dirCount);
+    printf("%-14s %10s %10s\n", "", "FileEntry", "VirtualFS");
+    printf("%-14s %8.2f us %8.2f us\n", "list", oldList, newList);
+    printf("%-14s %8.2f us %8.2f us\n", "open+close", oldOpen, newOpen);
+    printf("%-14s %8.2f us %8.2f us\n", "open+readAll", oldRead, newRead);
+    return mismatches == 0 && sink > 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/*
+ * write_bench.cpp
+ * CraftOS-PC 2
+ *
+ * Measures how many short lines per second a computer can write through
+ * fs.open handles, with and without a flush after every line. Then checks
+ * the crash-safety guarantees of write handles: everything written before a
+ * flush must be in the file after craftos is killed with SIGKILL. The harness
+ * watches the file itself to know when the flushes are done, rather than
+ * waiting for a signal from the script that could write the data out as a
+ * side effect. Last, two handles append to the
+ * same file in turn, and neither may overwrite the other's data.
+ *
+ * Usage: write_bench <path to craftos>   (or `make write-bench`)
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char * phases[] = {"writeLine", "writeLine + flush", "write (a)", "write (wb)", "write (wb) + flush"};
+static const int lines = 200000;
+static const int flushedLines = 5000;
+
+// each phase yields afterwards so the computer isn't killed for running too long
+static const std::string benchScript =
+    "local n = " + std::to_string(lines) + " "
+    "local function phase(mode, fn) local f = fs.open('data.txt', mode) local t = os.clock() fn(f) f.close() t = os.clock() - t os.queueEvent('bench') os.pullEvent('bench') return n / t end "
+    "local r = {} "
+    "r[1] = phase('w', function(f) for i = 1, n do f.writeLine('[' .. i .. '] some log message') end end) "
+    "r[2] = phase('w', function(f) for i = 1, n do f.writeLine('[' .. i .. '] some log message') f.flush() end end) "
+    "r[3] = phase('a', function(f) for i = 1, n do f.write('x') end end) "
+    "r[4] = phase('wb', function(f) for i = 1, n do f.write(65) end end) "
+    "r[5] = phase('wb', function(f) for i = 1, n do f.write('some bytes\\n') f.flush() end end) "
+    "local f = fs.open('bench.txt', 'w') f.write(table.concat(r, ' ')) f.close() os.shutdown()";
+
+// writes lines with a flush after each, then some that are never flushed, and
+// waits to be killed; it touches no other file, so only the flushes (and the
+// write-out of flushes left pending, which waiting for an event does) can have
+// put the data in the file
+static const std::string crashScript =
+    "local f = fs.open('data.txt', 'w') "
+    "for i = 1, " + std::to_string(flushedLines) + " do f.writeLine('line ' .. i) f.flush() end "
+    "for i = 1, 10 do f.writeLine('unflushed ' .. i) end "
+    "while true do os.pullEvent() end";
+
+// two handles append to the same file in turn, flushing after each write
+static const std::string appendScript =
+    "local a, b = fs.open('append.txt', 'a'), fs.open('append.txt', 'a') "
+    "for i = 1, 100 do a.writeLine('a' .. i) a.flush() b.writeLine('b' .. i) b.flush() if i % 10 == 0 then os.queueEvent('x') os.pullEvent('x') end end "
+    "a.close() b.close() os.shutdown()";
+
+static pid_t run(const char * craftos, const char * dir, const std::string& script) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        // the raw renderer writes every frame to stdout
+        const int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execl(craftos, craftos, "--raw", "-d", dir, "--exec", script.c_str(), (char*)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <path to craftos>\n", argv[0]);
+        return 2;
+    }
+    char tmpdir[] = "/tmp/craftos-write-XXXXXX";
+    if (mkdtemp(tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    mkdir((dir + "/computer").c_str(), 0777);
+    mkdir((dir + "/computer/0").c_str(), 0777);
+    mkdir((dir + "/config").c_str(), 0777);
+
+    pid_t pid = run(argv[1], tmpdir, benchScript);
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "craftos exited abnormally\n");
+        return 1;
+    }
+    double rates[5] = {0, 0, 0, 0, 0};
+    std::ifstream results(dir + "/computer/0/bench.txt");
+    for (int i = 0; i < 5; i++) results >> rates[i];
+    for (int i = 0; i < 5; i++) printf("%-19s %12.0f lines/s\n", phases[i], rates[i]);
+
+    // the crash test also exercises fsync on close
+    std::ofstream(dir + "/config/0.json") << "{\"syncOnClose\": true}";
+    remove((dir + "/computer/0/data.txt").c_str());
+    pid = run(argv[1], tmpdir, crashScript);
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    size_t flushedSize = 0;
+    for (int i = 1; i <= flushedLines; i++) flushedSize += ("line " + std::to_string(i) + "\n").size();
+    const std::string dataPath = dir + "/computer/0/data.txt";
+    struct stat st;
+    for (int i = 0; i < 200 && (stat(dataPath.c_str(), &st) != 0 || (size_t)st.st_size < flushedSize); i++) usleep(50000);
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    std::ifstream in(dir + "/computer/0/data.txt");
+    std::string line;
+    int found = 0;
+    bool ok = true;
+    while (std::getline(in, line) && found < flushedLines) {
+        if (line != "line " + std::to_string(found + 1)) {
+            ok = false;
+            break;
+        }
+        found++;
+    }
+    ok = ok && found == flushedLines;
+    printf("\ncrash test: %d/%d flushed lines survived SIGKILL: %s\n", found, flushedLines, ok ? "ok" : "FAILED");
+
+    pid = run(argv[1], tmpdir, appendScript);
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    waitpid(pid, &status, 0);
+    std::ifstream appended(dir + "/computer/0/append.txt");
+    int as = 0, bs = 0;
+    while (std::getline(appended, line)) {
+        if (line == "a" + std::to_string(as + 1)) as++;
+        else if (line == "b" + std::to_string(bs + 1)) bs++;
+    }
+    const bool appendOk = as == 100 && bs == 100;
+    printf("append test: %d/100 and %d/100 lines from each handle: %s\n", as, bs, appendOk ? "ok" : "FAILED");
+    return ok && appendOk ? 0 : 1;
+}
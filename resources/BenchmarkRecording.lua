@@ -0,0 +1,49 @@
+-- Measures how much recording (F3) slows down rendering. Frames are encoded on
+-- background threads, so the render time while recording should stay close to
+-- the render time without it; frames are dropped from the recording instead.
+local benchmark = debug.getregistry().benchmark
+if benchmark == nil then error("This program requires debug_enable to be set.") end
+if shell == nil then error("This program must be run from the shell.") end
+
+local function measure(seconds)
+    local w, h = term.getSize()
+    local count = 0
+    benchmark()
+    local start = os.epoch "utc"
+    while os.epoch "utc" - start < seconds * 1000 do
+        for _ = 1, 200 do
+            term.setCursorPos(math.random(1, w), math.random(1, h))
+            term.setBackgroundColor(2^math.random(0, 15))
+            term.setTextColor(2^math.random(0, 15))
+            term.write(string.char(math.random(32, 126)))
+            count = count + 1
+        end
+        os.queueEvent("nosleep")
+        os.pullEvent("nosleep")
+    end
+    local frames, frameTime = benchmark()
+    local time = os.epoch "utc" - start
+    term.setBackgroundColor(colors.black)
+    term.setTextColor(colors.white)
+    term.clear()
+    term.setCursorPos(1, 1)
+    return frames / (time / 1000), frameTime or 0, count / (time / 1000)
+end
+
+term.redirect(term.native())
+term.setTextColor(colors.yellow)
+term.clear()
+term.setCursorPos(1, 1)
+print("This program measures rendering speed with and without recording. Make sure you are not recording, then press enter to continue.")
+read()
+local fps, frameTime, cps = measure(10)
+term.setTextColor(colors.yellow)
+print("Now press F3 to start recording, then press enter to continue.")
+read()
+local recfps, recFrameTime, reccps = measure(10)
+term.setTextColor(colors.yellow)
+print("Press F3 to stop recording.")
+term.setTextColor(colors.white)
+print(("Not recording: %.1f fps, %.2f ms per frame, %d cps"):format(fps, frameTime, cps))
+print(("Recording:     %.1f fps, %.2f ms per frame, %d cps"):format(recfps, recFrameTime, reccps))
+if frameTime > 0 then print(("Recording changed the frame time by %+.1f%%"):format((recFrameTime - frameTime) * 100 / frameTime)) end
@@ -263,6 +263,9 @@ testStart "fs"
 	local file = call("open", "test_file.txt", "w")
 	callLocal("file.writeLine", file.writeLine, "This is a test")
 	callLocal("file.flush", file.flush)
+	local file2 = call("open", "test_file.txt", "r")
+	testLocal("file.readAll", callLocal("file.readAll", file2.readAll), "This is a test\n")
+	callLocal("file.close", file2.close)
 	callLocal("file.write", file.write, "Line 2")
 	callLocal("file.close", file.close)
 	test("exists", true, "test_file.txt")
@@ -286,6 +289,16 @@ testStart "fs"
 	file = call("open", "test_file.txt", "r")
 	testLocal("file.readAll", callLocal("file.readAll", file.readAll), "This is a test\nLine 2\nHi")
 	callLocal("file.close", file.close)
+	file = call("open", "test_file.txt", "a")
+	file2 = call("open", "test_file.txt", "a")
+	callLocal("file.write", file.write, "1")
+	callLocal("file.flush", file.flush)
+	callLocal("file.write", file2.write, "2")
+	callLocal("file.close", file2.close)
+	callLocal("file.close", file.close)
+	file = call("open", "test_file.txt", "r")
+	testLocal("file.readAll", callLocal("file.readAll", file.readAll), "This is a test\nLine 2\nHi12")
+	callLocal("file.close", file.close)
 	file = call("open", "test_file.txt", "rb")
 	testLocal("file.read", callLocal("file.read", file.read), string.byte("T"))
 	testLocal("file.read", callLocal("file.read", file.read), string.byte("h"))
@@ -640,6 +653,56 @@ if not _HEADLESS then testStart "term"
 	testValue("restore", nil)
 testEnd() end
 
+if not _HEADLESS and periphemu and term.setGraphicsMode then testStart "periphemu"
+	-- Runs each drawing operation against a terminal and records the results, so the term API and monitors can be compared
+	local function drawingOps(t)
+		local w, h = t.getSize()
+		local res = {}
+		t.setTextColor(colors.white)
+		t.setBackgroundColor(colors.black)
+		t.clear()
+		for _, pos in ipairs {{-3, 1}, {w - 2, 2}, {w + 1, 3}, {1, 0}, {1, h + 1}} do
+			t.setCursorPos(pos[1], pos[2])
+			t.write("overflowing text")
+			res[#res+1] = {t.getCursorPos()}
+		end
+		for _, pos in ipairs {{1, 4}, {-1, 5}, {w - 1, 6}} do
+			t.setCursorPos(pos[1], pos[2])
+			t.blit("abcd", "e1f0", "f0e4")
+			res[#res+1] = {t.getCursorPos()}
+			res[#res+1] = {t.getTextColor(), t.getBackgroundColor()}
+		end
+		t.scroll(2)
+		t.scroll(-1)
+		t.scroll(h + 5)
+		t.clearLine()
+		res[#res+1] = {t.getCursorPos()}
+		t.setGraphicsMode(1)
+		t.clear()
+		t.drawPixels(-2, -2, colors.red, 10, 10)
+		t.drawPixels(w * 6 - 3, 5, {"\1\2\3\4\5", {1, 2, 4, 8}})
+		t.drawPixels(-1, 20, {{colors.blue, -1, colors.green}}, 2)
+		t.drawPixels(4, 30, {"\9\9\9\9", "\10\10\10\10"}, 2, 1)
+		res[#res+1] = t.getPixels(-1, -1, 24, 34, true)
+		res[#res+1] = t.getPixels(w * 6 - 4, 3, 8, 4)
+		t.clear()
+		t.setGraphicsMode(0)
+		return res
+	end
+	local w, h = term.getSize()
+	if call("create", "conformance_monitor", "monitor", w, h) then
+		local mon = peripheral.wrap("conformance_monitor")
+		local ok, monres = pcall(drawingOps, mon)
+		local ok2, termres = pcall(drawingOps, term.native())
+		testLocal("monitor drawing ops", ok and monres or false, ok2 and termres or true)
+		call("remove", "conformance_monitor")
+	end
+	term.setTextColor(colors.white)
+	term.setBackgroundColor(colors.black)
+	term.setCursorPos(1, 1)
+	term.clear()
+testEnd() end
+
 testStart "textutils"
 	call("slowWrite", "This should write slowly: ")
 	call("slowPrint", "And even slower this time...", 10)
@@ -18,9 +18,14 @@ extern "C" {
 #include <peripheral.hpp>
 #include <sys/stat.h>
 #include "apis.hpp"
+#include "contentstore.hpp"
+#include "diskimage.hpp"
+#include "diskusage.hpp"
+#include "iopool.hpp"
 #include "main.hpp"
 #include "peripheral/computer.hpp"
 #include "platform.hpp"
+#include "romarchive.hpp"
 #include "runtime.hpp"
 #include "terminal/RawTerminal.hpp"
 #include "termsupport.hpp"
@@ -99,35 +104,82 @@ Computer::Computer(int i, bool debug): isDebugger(debug) {
     addVirtualMount(this, standaloneROM, "rom");
     if (debug) addVirtualMount(this, standaloneDebug, "debug");
 #else
-    if (!addMount(this, getROMPath() / "rom", "rom", ::config.romReadOnly)) { if (::config.standardsMode && term) { displayFailure(term, "Cannot mount ROM"); orphanedTerminals.insert(term); } else if (term) term->factory->deleteTerminal(term); throw std::runtime_error("Could not mount ROM"); }
-    if (debug) if (!addMount(this, getROMPath() / "debug", "debug", true)) { if (::config.standardsMode && term) { displayFailure(term, "Cannot mount ROM"); orphanedTerminals.insert(term); } else if (term) term->factory->deleteTerminal(term); throw std::runtime_error("Could not mount debugger ROM"); }
+    if (romArchive != NULL) {
+        // the archive is shared by every computer, so it's always read-only
+        addVirtualMount(this, (*romArchive)["rom"], "rom");
+        if (debug) {
+            const auto it = romArchive->dir.find("debug");
+            if (it == romArchive->dir.end() || !it->second.isDir) { if (::config.standardsMode && term) { displayFailure(term, "Cannot mount ROM"); orphanedTerminals.insert(term); } else if (term) term->factory->deleteTerminal(term); throw std::runtime_error("Could not mount debugger ROM"); }
+            addVirtualMount(this, it->second, "debug");
+        }
+    } else {
+        if (!addMount(this, getROMPath() / "rom", "rom", ::config.romReadOnly)) { if (::config.standardsMode && term) { displayFailure(term, "Cannot mount ROM"); orphanedTerminals.insert(term); } else if (term) term->factory->deleteTerminal(term); throw std::runtime_error("Could not mount ROM"); }
+        if (debug) if (!addMount(this, getROMPath() / "debug", "debug", true)) { if (::config.standardsMode && term) { displayFailure(term, "Cannot mount ROM"); orphanedTerminals.insert(term); } else if (term) term->factory->deleteTerminal(term); throw std::runtime_error("Could not mount debugger ROM"); }
+    }
 #endif // STANDALONE_ROM
+    // Get the computer's data directory
+    std::error_code e;
+    if (customDataDirs.find(id) != customDataDirs.end()) dataDir = customDataDirs[id];
+    else {
+        dataDir = computerDir / std::to_string(id);
+        // a computer with no directory can keep its files in a disk image instead
+        if (!fs::exists(dataDir, e) && fs::is_regular_file(computerDir / (std::to_string(id) + ".img"), e)) dataDir = computerDir / (std::to_string(id) + ".img");
+    }
+    if (fs::is_regular_file(dataDir, e) && DiskImage::isImage(dataDir)) {
+        // Open the disk image
+        const std::shared_ptr<DiskImage> image = DiskImage::open(dataDir, false, e);
+        if (e) {
+            if (term) term->factory->deleteTerminal(term);
+            throw std::runtime_error("Could not open computer disk image: " + e.message());
+        }
+        addDiskImage(this, dataDir, image);
+    } else {
+        // Create the root directory
+        fs::create_directories(dataDir, e);
+        if (e) {
+            if (term) term->factory->deleteTerminal(term);
+            throw std::runtime_error("Could not create computer data directory: " + e.message());
+        }
+    }
     // Mount custom directories from the command line
     for (auto m : customMounts) {
         bool ok = false;
         switch (std::get<2>(m)) {
             case -1: if (::config.mount_mode != MOUNT_MODE_NONE) ok = addMount(this, std::get<1>(m), std::get<0>(m).c_str(), ::config.mount_mode != MOUNT_MODE_RW); break; // use default mode
             case 0: ok = addMount(this, std::get<1>(m), std::get<0>(m).c_str(), true); break; // force RO
+            case 2: ok = addOverlayMount(this, std::get<1>(m), std::get<0>(m)); break; // overlay on a shared directory
             default: ok = addMount(this, std::get<1>(m), std::get<0>(m).c_str(), false); break; // force RW
         }
         if (!ok) fprintf(stderr, "Could not mount custom mount path at %s\n", std::get<1>(m).c_str());
     }
     mounter_initializing = false;
-    // Get the computer's data directory
-    if (customDataDirs.find(id) != customDataDirs.end()) dataDir = customDataDirs[id];
-    else dataDir = computerDir / std::to_string(id);
-    // Create the root directory
-    std::error_code e;
-    fs::create_directories(dataDir, e);
-    if (e) {
-        if (term) term->factory->deleteTerminal(term);
-        throw std::runtime_error("Could not create computer data directory: " + e.message());
+    // in standards mode, count the computer's files in the background now, so fs.getFreeSpace doesn't have to; a disk image keeps its own count
+    if (::config.standardsMode && findDiskImage(this, dataDir) == NULL) {
+        std::shared_ptr<DiskUsage> usage = std::make_shared<DiskUsage>(dataDir);
+        usage->rescan();
+        diskUsage = usage;
     }
     config = new computer_configuration(_config);
+    // with deduplicated storage, files written since the computer last ran are moved into the store in the
+    // background (this is last, so the constructor can't throw after the job has this); fs calls that change
+    // files wait for it first, as a file mustn't change while it's being moved
+    if (::config.dedupStorage && findDiskImage(this, dataDir) == NULL) {
+        std::shared_ptr<std::promise<void> > done = std::make_shared<std::promise<void> >();
+        storeMigration = done->get_future().share();
+        queueIOJob([this, done]() {
+            std::error_code e;
+            const std::shared_ptr<ContentStore> store = getContentStore();
+            if (store != NULL) store->add(dataDir, e, cancelIO);
+            done->set_value();
+        }, this);
+    }
 }
 
 // Destructor
 Computer::~Computer() {
+    // Stop any asynchronous fs calls, which queue their results to this computer
+    cancelIO = true;
+    ioPoolCancel(this);
     // Deinitialize any plugins that registered a destructor
     for (const auto& d : userdata_destructors) d.second(this, d.first, userdata[d.first]);
     // Destroy terminal
@@ -619,13 +671,24 @@ void runComputer(Computer * self, const path_t& bios_name, const std::string& bi
         path_t bios_path_expanded("standalone ROM");
 #else
         path_t bios_path_expanded = getROMPath() / bios_name;
-        std::ifstream bios_file(bios_path_expanded);
-        if (bios_file.is_open()) {
-            status = lua_load(self->coro, file_reader, &bios_file, "@bios.lua");
-            bios_file.close();
+        if (romArchive != NULL) {
+            bios_path_expanded = path_t("ROM archive") / bios_name;
+            const std::shared_ptr<const VirtualFS> archive = VirtualFS::get(*romArchive);
+            const VirtualFS::Node * bios_entry = archive->find(bios_name);
+            if (bios_entry != NULL && !bios_entry->isDir) status = luaL_loadbuffer(self->coro, bios_entry->data, bios_entry->size, "@bios.lua");
+            else {
+                status = LUA_ERRFILE;
+                lua_pushstring(L, "No such file");
+            }
         } else {
-            status = LUA_ERRFILE;
-            lua_pushstring(L, strerror(errno));
+            std::ifstream bios_file(bios_path_expanded);
+            if (bios_file.is_open()) {
+                status = lua_load(self->coro, file_reader, &bios_file, "@bios.lua");
+                bios_file.close();
+            } else {
+                status = LUA_ERRFILE;
+                lua_pushstring(L, strerror(errno));
+            }
         }
 #endif
         if (status || !lua_isfunction(self->coro, -1)) {
@@ -662,8 +725,11 @@ void runComputer(Computer * self, const path_t& bios_name, const std::string& bi
         while (status == LUA_YIELD && self->running == 1) {
             status = lua_resume(self->coro, narg);
             if (status == LUA_YIELD) {
-                if (lua_gettop(self->coro) && lua_isstring(self->coro, -1)) narg = getNextEvent(self->coro, std::string(lua_tostring(self->coro, -1), lua_strlen(self->coro, -1)));
-                else narg = getNextEvent(self->coro, "");
+                const std::string filter = lua_gettop(self->coro) && lua_isstring(self->coro, -1) ? std::string(lua_tostring(self->coro, -1), lua_strlen(self->coro, -1)) : "";
+                // the yielded values are taken off, as coroutine.resume does, so a C function resumed
+                // after lua_vyield finds the event right above the values it kept
+                lua_settop(self->coro, 0);
+                narg = getNextEvent(self->coro, filter);
             } else if (status != 0 && self->running == 1) {
                 // Catch runtime error
                 self->running = 0;
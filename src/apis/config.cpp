@@ -53,6 +53,8 @@ static int config_get(lua_State *L) {
         lua_pushinteger(L, computer->config->computerWidth);
     else if (strcmp(name, "computerHeight") == 0)
         lua_pushinteger(L, computer->config->computerHeight);
+    else if (strcmp(name, "syncOnClose") == 0)
+        lua_pushboolean(L, computer->config->syncOnClose);
     getConfigSetting(checkUpdates, boolean);
     getConfigSetting(configReadOnly, boolean);
     getConfigSetting(vanilla, boolean);
@@ -84,6 +86,7 @@ static int config_get(lua_State *L) {
     getConfigSetting(useWebP, boolean);
     getConfigSetting(dropFilePath, boolean);
     getConfigSetting(useDFPWM, boolean);
+    getConfigSetting(dedupStorage, boolean);
     else if (strcmp(name, "useHDFont") == 0) {
         if (config.customFontPath.empty()) lua_pushboolean(L, false);
         else if (config.customFontPath == "hdfont") lua_pushboolean(L, true);
@@ -187,6 +190,9 @@ static int config_set(lua_State *L) {
     } else if (strcmp(name, "computerHeight") == 0) {
         computer->config->computerHeight = luaL_checkinteger(L, 2);
         setComputerConfig(computer->id, *computer->config);
+    } else if (strcmp(name, "syncOnClose") == 0) {
+        computer->config->syncOnClose = lua_toboolean(L, 2);
+        setComputerConfig(computer->id, *computer->config);
     }
     setConfigSetting(checkUpdates, boolean);
     setConfigSetting(vanilla, boolean);
@@ -217,6 +223,7 @@ static int config_set(lua_State *L) {
     setConfigSetting(useWebP, boolean);
     setConfigSetting(dropFilePath, boolean);
     setConfigSetting(useDFPWM, boolean);
+    setConfigSetting(dedupStorage, boolean);
     else if (strcmp(name, "useHDFont") == 0)
         config.customFontPath = lua_toboolean(L, 2) ? "hdfont" : "";
     else if (strcmp(name, "http_whitelist") == 0) {
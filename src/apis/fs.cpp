@@ -8,14 +8,17 @@
  * Copyright (c) 2019-2023 JackMacWindows.
  */
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <codecvt>
 #include <filesystem>
 #include <fstream>
 #include <iterator>
-#include <regex>
+#include <mutex>
 #include <sstream>
 #include <Computer.hpp>
 #include <configuration.hpp>
@@ -23,6 +26,14 @@
 #include <FileEntry.hpp>
 #include <sys/stat.h>
 #include "handles/fs_handle.hpp"
+#include "../contentstore.hpp"
+#include "../dircache.hpp"
+#include "../diskimage.hpp"
+#include "../diskusage.hpp"
+#include "../filecopy.hpp"
+#include "../filestream.hpp"
+#include "../iopool.hpp"
+#include "../overlay.hpp"
 #include "../platform.hpp"
 #include "../runtime.hpp"
 #ifdef WIN32
@@ -38,8 +49,6 @@
 #define W_OK 2
 #endif
 
-static std::basic_regex<path_t::value_type> pathregex(const std::string& str) {return std::basic_regex<path_t::value_type>(path_t(str).native());};
-
 #define err(L, idx, err) luaL_error(L, "/%s: %s", fixpath(get_comp(L), lua_tostring(L, idx), false, false).string().c_str(), err)
 
 #ifdef STANDALONE_ROM
@@ -55,16 +64,8 @@ static path_t ignored_files[4] = {
     "desktop.ini"
 };
 
-static bool _nothrow(std::function<void()> f) { try { f(); return true; } catch (...) { return false; } }
-#define nothrow(expr) _nothrow([&](){ expr ;})
-
-inline bool isVFSPath(path_t path) {
-    if (!std::isdigit(path.native()[0])) return false;
-    for (const path_t::value_type& c : path.native()) {
-        if (c == ':') return true;
-        else if (!std::isdigit(c)) return false;
-    }
-    return false;
+inline bool isVFSPath(const path_t& path) {
+    return FileEntry::hasMountID(path.native());
 }
 
 static std::vector<path_t> fixpath_multiple(Computer *comp, const std::string& path) {
@@ -88,27 +89,27 @@ static std::vector<path_t> fixpath_multiple(Computer *comp, const std::string& p
 #else
         return {getROMPath()/"bios.lua"};
 #endif
-    std::pair<size_t, std::vector<_path_t> > max_path = std::make_pair(0, std::vector<_path_t>(1, comp->dataDir));
-    std::list<std::string> * mount_list = NULL;
-    for (auto& m : comp->mounts) {
-        std::list<std::string> &pathlist = std::get<0>(m);
-        if (pathc.size() >= pathlist.size() && std::equal(pathlist.begin(), pathlist.end(), pathc.begin())) {
-            if (pathlist.size() > max_path.first) {
-                max_path = std::make_pair(pathlist.size(), std::vector<_path_t>(1, std::get<1>(m)));
-                mount_list = &pathlist;
-            } else if (pathlist.size() == max_path.first) {
-                max_path.second.push_back(std::get<1>(m));
-            }
-        }
-    }
-    for (size_t i = 0; i < max_path.first; i++) pathc.pop_front();
-    for (const _path_t& p : max_path.second) {
+    std::vector<_path_t> realPaths;
+    for (size_t i = findMount(comp, pathc, realPaths); i > 0; i--) pathc.pop_front();
+    for (const _path_t& p : realPaths) {
         path_t sstmp = p;
         std::error_code e;
+        const std::shared_ptr<const Overlay> overlay = findOverlay(comp, p);
+        if (overlay != NULL && overlay->upper == p) {
+            // the directory is listed through the overlay, so either of its copies will do
+            path_t rel;
+            for (const std::string& s : pathc) rel /= s;
+            sstmp = overlay->resolve(rel);
+            if (!sstmp.empty()) retval.push_back(sstmp);
+            continue;
+        }
         for (const std::string& s : pathc) sstmp /= s;
+        std::string rel;
+        const std::shared_ptr<DiskImage> image = findDiskImage(comp, sstmp, &rel);
         if (
-            (isVFSPath(p) && nothrow(comp->virtualMounts[(unsigned)std::stoul(p.substr(0, p.size()-1))]->path(sstmp.string()))) ||
-            (fs::exists(sstmp, e))) {
+            (image != NULL && image->exists(rel)) ||
+            (isVFSPath(p) && findVirtualPath(comp, sstmp) != NULL) ||
+            (image == NULL && fs::exists(sstmp, e))) {
             if (path_t::preferred_separator != (path_t::value_type)'/' && isVFSPath(sstmp)) {
                 path_t::string_type str = sstmp.native();
                 std::replace(str.begin(), str.end(), path_t::preferred_separator, (path_t::value_type)'/');
@@ -123,7 +124,8 @@ static std::vector<path_t> fixpath_multiple(Computer *comp, const std::string& p
 static std::string normalizePath(const path_t& basePath) {
     path_t cleanPath;
     for (const auto& p : basePath) {
-        if (std::regex_match(p.native(), pathregex("^\\.\\.\\.+$"))) cleanPath /= ".";
+        // CraftOS treats three or more dots as the current directory
+        if (p.native().size() >= 3 && std::all_of(p.native().begin(), p.native().end(), [](path_t::value_type c)->bool{return c == '.';})) cleanPath /= ".";
         else cleanPath /= p;
     }
     cleanPath = cleanPath.lexically_normal();
@@ -150,6 +152,64 @@ static fs::space_info getSpace(const path_t& path) {
     return retval;
 }
 
+static DirectoryCache * getListingCache(Computer * comp) {
+    if (!comp->listingCache) comp->listingCache = std::make_shared<DirectoryCache>();
+    return (DirectoryCache*)comp->listingCache.get();
+}
+
+// Drops any cached listings a change to a path affects.
+static void invalidateListing(Computer * comp, const path_t& path) {
+    if (comp->listingCache) ((DirectoryCache*)comp->listingCache.get())->invalidate(path);
+}
+
+// Waits for the computer's files to finish moving into the content store,
+// which happens in the background at startup; until then, changing a file
+// could race with it being replaced by a link to its object.
+static void waitForStore(Computer * comp) {
+    if (comp->storeMigration.valid()) comp->storeMigration.wait();
+}
+
+// Lists a real directory through the cache, merging it with the rest of its
+// overlay if it's in one. A directory in a disk image is listed from its index.
+static DirectoryCache::Listing listDirectory(Computer * comp, const path_t& path) {
+    std::string imageRel;
+    const std::shared_ptr<DiskImage> image = findDiskImage(comp, path, &imageRel);
+    if (image != NULL) return image->list(imageRel);
+    path_t rel;
+    DirectoryCache * cache = getListingCache(comp);
+    const std::shared_ptr<const Overlay> overlay = findOverlay(comp, path, &rel);
+    if (overlay == NULL) return cache->list(path);
+    return overlay->list(rel, [cache](const path_t& p)->DirectoryCache::Listing {return cache->list(p);});
+}
+
+// Returns a function that lists a real directory like listDirectory, but
+// without the cache, so it can be called off the computer thread.
+static std::function<DirectoryCache::Listing()> directoryReader(Computer * comp, const path_t& path) {
+    std::string imageRel;
+    const std::shared_ptr<DiskImage> image = findDiskImage(comp, path, &imageRel);
+    if (image != NULL) return [image, imageRel]()->DirectoryCache::Listing {return image->list(imageRel);};
+    path_t rel;
+    const std::shared_ptr<const Overlay> overlay = findOverlay(comp, path, &rel);
+    if (overlay == NULL) return [path]()->DirectoryCache::Listing {return DirectoryCache::read(path);};
+    return [overlay, rel]()->DirectoryCache::Listing {return overlay->list(rel, DirectoryCache::read);};
+}
+
+// Returns the path changes to a real path are written to: in an overlay, the same path in its upper directory.
+static path_t upperPath(Computer * comp, const path_t& path) {
+    path_t rel;
+    const std::shared_ptr<const Overlay> overlay = findOverlay(comp, path, &rel);
+    return overlay == NULL ? path : overlay->upper / rel;
+}
+
+// Returns what shows at a path fixpath gave for writing, which in an overlay may be in its lower directory.
+static path_t visiblePath(Computer * comp, const path_t& path) {
+    path_t rel;
+    const std::shared_ptr<const Overlay> overlay = findOverlay(comp, path, &rel);
+    if (overlay == NULL) return path;
+    const path_t p = overlay->resolve(rel);
+    return p.empty() ? path : p;
+}
+
 static int fs_list(lua_State *L) {
     lastCFunction = __func__;
     std::string str = checkstring(L, 1);
@@ -157,27 +217,34 @@ static int fs_list(lua_State *L) {
     if (possible_paths.empty()) err(L, 1, "Not a directory");
     bool gotdir = false;
     std::set<std::string> entries;
+    DirectoryCache::Listing listing;
     for (const path_t& path : possible_paths) {
-        if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) {
-            try {
-                const FileEntry &d = get_comp(L)->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin()));
+        if (FileEntry::hasMountID((*path.begin()).native())) {
+            const VirtualFS::Node * node = findVirtualPath(get_comp(L), path);
+            if (node != NULL && node->isDir) {
                 gotdir = true;
-                if (d.isDir) for (const auto& p : d.dir) entries.insert(p.first);
-                else gotdir = false;
-            } catch (...) {continue;}
+                entries.insert(node->children.begin(), node->children.end());
+            }
         } else {
-            std::error_code e;
-            if (fs::is_directory(path, e)) {
+            const DirectoryCache::Listing names = listDirectory(get_comp(L), path);
+            if (names != NULL) {
                 gotdir = true;
-                for (const auto& dir : fs::directory_iterator(path, e)) {
-                    if (dir.path().filename() == ".DS_Store" || dir.path().filename() == "desktop.ini") continue;
-                    entries.insert(dir.path().filename().string());
-                }
+                // one directory's listing is already sorted, so unless something's mounted in it, it can skip the set
+                if (possible_paths.size() == 1) listing = names;
+                else entries.insert(names->begin(), names->end());
             }
         }
     }
     if (!gotdir) err(L, 1, "Not a directory");
     std::set<std::string> mounts = getMounts(get_comp(L), str);
+    if (listing != NULL && mounts.empty()) {
+        lua_createtable(L, listing->size(), 0);
+        for (size_t i = 0; i < listing->size(); i++) {
+            lua_pushlstring(L, (*listing)[i].c_str(), (*listing)[i].size());
+            lua_rawseti(L, -2, (int)i + 1);
+        }
+        return 1;
+    } else if (listing != NULL) entries.insert(listing->begin(), listing->end());
     std::set<std::string> all;
     std::set_union(entries.begin(), entries.end(), mounts.begin(), mounts.end(), std::inserter(all, all.begin()));
     int i = 1;
@@ -193,10 +260,8 @@ static int fs_list(lua_State *L) {
 static int fs_exists(lua_State *L) {
     lastCFunction = __func__;
     const path_t path = fixpath(get_comp(L), checkstring(L, 1), true);
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) {
-        bool found = true;
-        try {get_comp(L)->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin()));} catch (...) {found = false;}
-        lua_pushboolean(L, found);
+    if (FileEntry::hasMountID((*path.begin()).native())) {
+        lua_pushboolean(L, findVirtualPath(get_comp(L), path) != NULL);
 #ifdef STANDALONE_ROM
     } else if (path == ":bios.lua") {
         lua_pushboolean(L, true);
@@ -209,17 +274,18 @@ static int fs_exists(lua_State *L) {
 
 static int fs_isDir(lua_State *L) {
     lastCFunction = __func__;
-    const path_t path = fixpath(get_comp(L), checkstring(L, 1), true);
+    MountKind kind;
+    const path_t path = fixpath(get_comp(L), checkstring(L, 1), true, true, NULL, NULL, &kind);
     if (path.empty()) {
         lua_pushboolean(L, false);
         return 1;
     }
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) {
-        try {lua_pushboolean(L, get_comp(L)->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin())).isDir);} 
-        catch (...) {lua_pushboolean(L, false);}
+    if (FileEntry::hasMountID((*path.begin()).native())) {
+        const VirtualFS::Node * node = findVirtualPath(get_comp(L), path);
+        lua_pushboolean(L, node != NULL && node->isDir);
     } else {
         std::error_code e;
-        lua_pushboolean(L, fs::is_directory(path, e));
+        lua_pushboolean(L, kind.image != NULL ? kind.image->isDir(kind.imageRel) : fs::is_directory(path, e));
     }
     return 1;
 }
@@ -234,7 +300,10 @@ static int fs_isReadOnly(lua_State *L) {
     const path_t path = fixpath_mkdir(get_comp(L), str, false);
     std::error_code e;
     if (path.empty()) err(L, 1, "Invalid path"); // This should never happen
-    if (!fs::exists(path, e)) lua_pushboolean(L, false);
+    std::string rel;
+    const std::shared_ptr<DiskImage> image = findDiskImage(get_comp(L), path, &rel);
+    if (image != NULL) lua_pushboolean(L, image->exists(rel) && !image->writable());
+    else if (!fs::exists(path, e)) lua_pushboolean(L, false);
 #ifdef WIN32
     else if (e.clear(), fs::is_directory(path, e)) {
         e.clear();
@@ -268,20 +337,25 @@ static int fs_getDrive(lua_State *L) {
 
 static int fs_getSize(lua_State *L) {
     lastCFunction = __func__;
+    flushPendingWrites(get_comp(L));
     std::string str = checkstring(L, 1);
-    const path_t path = fixpath(get_comp(L), str, true);
+    MountKind kind;
+    const path_t path = fixpath(get_comp(L), str, true, true, NULL, NULL, &kind);
     std::error_code e;
     if (path.empty()) err(L, 1, "No such file");
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) {
-        try {
-            const FileEntry &d = get_comp(L)->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin()));
-            if (d.isDir) err(L, 1, "Is a directory");
-            lua_pushinteger(L, d.data.size());
-        } catch (...) {err(L, 1, "No such file");}
+    if (FileEntry::hasMountID((*path.begin()).native())) {
+        const VirtualFS::Node * node = findVirtualPath(get_comp(L), path);
+        if (node == NULL) err(L, 1, "No such file");
+        if (node->isDir) err(L, 1, "Is a directory");
+        lua_pushinteger(L, node->size);
 #ifdef STANDALONE_ROM
     } else if (path == ":bios.lua") {
         lua_pushinteger(L, standaloneBIOS.size());
 #endif
+    } else if (kind.image != NULL) {
+        DiskImage::Stat st;
+        if (!kind.image->stat(kind.imageRel, st)) err(L, 1, "No such file");
+        lua_pushinteger(L, st.isDir ? 0 : st.size);
     } else if (fs::is_directory(path, e)) {
         lua_pushinteger(L, 0);
     } else {
@@ -290,25 +364,49 @@ static int fs_getSize(lua_State *L) {
     return 1;
 }
 
-static int calculateDirectorySize(const path_t& path) {
-    int size = 0;
-    std::error_code e;
-    for (const auto& dir : fs::directory_iterator(path, e)) {
-        if (dir.is_directory()) size += calculateDirectorySize(dir.path());
-        else size += dir.file_size();
-    }
-    return size;
+// Returns the computer's disk usage counter if it's counting the path, or NULL.
+static std::shared_ptr<DiskUsage> trackedUsage(Computer * comp, const path_t& path) {
+    std::shared_ptr<DiskUsage> usage = std::static_pointer_cast<DiskUsage>(comp->diskUsage);
+    if (usage && usage->contains(path)) return usage;
+    return NULL;
+}
+
+// Copies what shows of an overlay's lower directory at a real path into the
+// upper directory, so it can be changed in place, and returns the upper path.
+// Paths outside overlays are returned as they are.
+static path_t copyUp(Computer * comp, const path_t& path, std::error_code& e) {
+    path_t rel;
+    e.clear();
+    const std::shared_ptr<const Overlay> overlay = findOverlay(comp, path, &rel);
+    if (overlay == NULL) return path;
+    const path_t up = overlay->upper / rel;
+    const int64_t size = overlay->copyUp(rel, e);
+    invalidateListing(comp, up);
+    const std::shared_ptr<DiskUsage> usage = trackedUsage(comp, up);
+    if (usage) usage->add(size);
+    return up;
 }
 
 static int fs_getFreeSpace(lua_State *L) {
     lastCFunction = __func__;
+    flushPendingWrites(get_comp(L));
     std::string mountPath;
     std::string str = checkstring(L, 1);
     const path_t path = fixpath(get_comp(L), str, false, true, &mountPath);
     if (path.empty()) err(L, 1, "No such path");
+    const std::shared_ptr<DiskImage> image = findDiskImage(get_comp(L), path);
     if (fixpath_ro(get_comp(L), str)) lua_pushinteger(L, 0);
-    else if (!config.standardsMode || mountPath != "hdd") lua_pushinteger(L, getSpace(path).free);
-    else lua_pushinteger(L, config.computerSpaceLimit - calculateDirectorySize(fixpath(get_comp(L), "", true)));
+    else if (image != NULL) {
+        // an image grows into the space on the disk it's on, and counts its own files
+        if (config.standardsMode && mountPath == "hdd") lua_pushinteger(L, config.computerSpaceLimit - image->used());
+        else lua_pushinteger(L, getSpace(image->file()).free);
+    } else if (!config.standardsMode || mountPath != "hdd") lua_pushinteger(L, getSpace(path).free);
+    else {
+        Computer * computer = get_comp(L);
+        // the first call counts the computer's files; after that, fs calls keep the count up to date
+        if (!computer->diskUsage) computer->diskUsage = std::make_shared<DiskUsage>(computer->dataDir);
+        lua_pushinteger(L, config.computerSpaceLimit - ((DiskUsage*)computer->diskUsage.get())->used());
+    }
     return 1;
 }
 
@@ -318,9 +416,21 @@ static int fs_makeDir(lua_State *L) {
     if (fixpath_ro(get_comp(L), str)) err(L, 1, "Access denied");
     const path_t path = fixpath_mkdir(get_comp(L), str);
     if (path.empty()) err(L, 1, "Could not create directory");
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) err(L, 1, "Permission denied");
+    if (FileEntry::hasMountID((*path.begin()).native())) err(L, 1, "Permission denied");
     std::error_code e;
+    std::string rel;
+    const std::shared_ptr<DiskImage> image = findDiskImage(get_comp(L), path, &rel);
+    if (image != NULL) {
+        if (image->exists(rel) && !image->isDir(rel)) err(L, 1, "File exists");
+        image->makeDir(rel, e);
+        if (e) err(L, 1, e.message().c_str());
+        return 0;
+    }
+    // a file in an overlay's lower directory isn't in the way of the upper directory, but it's still there
+    if (fs::is_regular_file(visiblePath(get_comp(L), path), e)) err(L, 1, "File exists");
+    e.clear();
     fs::create_directories(path, e);
+    invalidateListing(get_comp(L), path);
     if (e) {
         if (e.value() == ENOTDIR) e.assign(EEXIST, std::generic_category());
         err(L, 1, e.message().c_str());
@@ -328,95 +438,371 @@ static int fs_makeDir(lua_State *L) {
     return 0;
 }
 
+// Copies what shows at a path in an overlay into a disk image, the same way Overlay::copy copies it to a real path.
+static void copyOverlayToImage(const Overlay& overlay, const path_t& rel, DiskImage& image, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel) {
+    e.clear();
+    const path_t from = overlay.resolve(rel);
+    if (from.empty()) {
+        e = std::make_error_code(std::errc::no_such_file_or_directory);
+        return;
+    }
+    if (from != overlay.upper / rel || !fs::is_directory(from, e)) {
+        e.clear();
+        image.importTree(from, to, e, cancel);
+        return;
+    }
+    DiskImage::Stat st;
+    if (!image.stat(to, st)) image.makeDir(to, e);
+    else if (!st.isDir) e = std::make_error_code(std::errc::is_a_directory);
+    if (e) return;
+    const DirectoryCache::Listing names = overlay.list(rel, DirectoryCache::read);
+    if (names == NULL) return;
+    for (const std::string& name : *names) {
+        if (cancel) {
+            e = std::make_error_code(std::errc::operation_canceled);
+            return;
+        }
+        copyOverlayToImage(overlay, rel / name, image, to.empty() ? name : to + "/" + name, e, cancel);
+        if (e) return;
+    }
+}
+
+typedef std::function<void(std::error_code&, const std::atomic<bool>&)> copy_func;
+
+// Returns a function that copies a real path for fs.copy to wherever it's
+// going; a path in an overlay is copied as it shows, and either side can be in
+// a disk image. The mounts have to be looked up on the computer thread, but
+// the copy can be run anywhere.
+static copy_func copyFunction(Computer * comp, const path_t& fromPath, const path_t& toPath) {
+    path_t fromRel;
+    std::string fromImageRel, toImageRel;
+    const std::shared_ptr<const Overlay> overlay = findOverlay(comp, fromPath, &fromRel);
+    const std::shared_ptr<DiskImage> fromImage = findDiskImage(comp, fromPath, &fromImageRel), toImage = findDiskImage(comp, toPath, &toImageRel);
+    if (fromImage != NULL && toImage != NULL) return [fromImage, fromImageRel, toImage, toImageRel](std::error_code& e, const std::atomic<bool>& cancel) {fromImage->copyTree(fromImageRel, *toImage, toImageRel, e, cancel);};
+    if (fromImage != NULL) return [fromImage, fromImageRel, toPath](std::error_code& e, const std::atomic<bool>& cancel) {fromImage->exportTree(fromImageRel, toPath, e, cancel);};
+    if (toImage != NULL && overlay != NULL) return [overlay, fromRel, toImage, toImageRel](std::error_code& e, const std::atomic<bool>& cancel) {copyOverlayToImage(*overlay, fromRel, *toImage, toImageRel, e, cancel);};
+    if (toImage != NULL) return [fromPath, toImage, toImageRel](std::error_code& e, const std::atomic<bool>& cancel) {toImage->importTree(fromPath, toImageRel, e, cancel);};
+    if (overlay != NULL) return [overlay, fromRel, toPath](std::error_code& e, const std::atomic<bool>& cancel) {overlay->copy(fromRel, toPath, e, cancel);};
+    return [fromPath, toPath](std::error_code& e, const std::atomic<bool>& cancel) {copyTree(fromPath, toPath, e, cancel);};
+}
+
 static int fs_move(lua_State *L) {
     lastCFunction = __func__;
+    flushPendingWrites(get_comp(L));
     std::string str1 = checkstring(L, 1);
     std::string str2 = checkstring(L, 2);
     if (fixpath_ro(get_comp(L), str1)) luaL_error(L, "Access denied");
     if (fixpath_ro(get_comp(L), str2)) luaL_error(L, "Access denied");
+    waitForStore(get_comp(L));
     bool isRoot = false;
     const path_t fromPath = fixpath(get_comp(L), str1, true, true, NULL, &isRoot);
     const path_t toPath = fixpath_mkdir(get_comp(L), str2);
     if (fromPath.empty()) luaL_error(L, "No such file");
     if (toPath.empty()) err(L, 2, "Invalid path");
-    if (std::regex_search((*fromPath.begin()).native(), pathregex("^\\d+:"))) err(L, 1, "Permission denied");
-    if (std::regex_search((*toPath.begin()).native(), pathregex("^\\d+:"))) err(L, 2, "Permission denied");
-    if (std::mismatch(toPath.begin(), toPath.end(), fromPath.begin(), fromPath.end()).second == fromPath.end()) 
+    if (FileEntry::hasMountID((*fromPath.begin()).native())) err(L, 1, "Permission denied");
+    if (FileEntry::hasMountID((*toPath.begin()).native())) err(L, 2, "Permission denied");
+    const path_t fromUpper = upperPath(get_comp(L), fromPath);
+    if (std::mismatch(toPath.begin(), toPath.end(), fromUpper.begin(), fromUpper.end()).second == fromUpper.end()) 
         luaL_error(L, "Can't move a directory inside itself");
     if (isRoot) luaL_error(L, "Cannot move mount");
     std::error_code e;
-    if (fs::exists(toPath, e)) luaL_error(L, "File exists");
+    std::string fromImageRel, toImageRel;
+    const std::shared_ptr<DiskImage> fromImage = findDiskImage(get_comp(L), fromPath, &fromImageRel), toImage = findDiskImage(get_comp(L), toPath, &toImageRel);
+    if (fromImage != NULL || toImage != NULL) {
+        if (toImage != NULL ? toImage->exists(toImageRel) : fs::exists(visiblePath(get_comp(L), toPath), e)) luaL_error(L, "File exists");
+        e.clear();
+        if (fromImage == toImage) fromImage->rename(fromImageRel, toImageRel, e);
+        else {
+            // a move into or out of an image is a copy, then a delete
+            if (toImage == NULL) {
+                fs::create_directories(toPath.parent_path(), e);
+                if (e) err(L, 2, e.message().c_str());
+            }
+            const std::shared_ptr<DiskUsage> fromUsage = fromImage == NULL ? trackedUsage(get_comp(L), fromUpper) : NULL, toUsage = toImage == NULL ? trackedUsage(get_comp(L), toPath) : NULL;
+            const int64_t fromSize = fromUsage ? DiskUsage::measure(fromUpper) : 0;
+            static const std::atomic<bool> cancel {false};
+            copyFunction(get_comp(L), fromPath, toPath)(e, cancel);
+            if (!e) {
+                path_t fromRel;
+                const std::shared_ptr<const Overlay> overlay = findOverlay(get_comp(L), fromPath, &fromRel);
+                if (fromImage != NULL) fromImage->remove(fromImageRel, e);
+                else if (overlay != NULL) overlay->remove(fromRel, e);
+                else fs::remove_all(fromPath, e);
+            }
+            if (fromUsage) fromUsage->add(DiskUsage::measure(fromUpper) - fromSize);
+            if (toUsage) toUsage->add(DiskUsage::measure(toPath));
+        }
+        invalidateListing(get_comp(L), fromUpper);
+        invalidateListing(get_comp(L), toPath);
+        if (e) err(L, 1, e.message().c_str());
+        return 0;
+    }
+    if (fs::exists(visiblePath(get_comp(L), toPath), e)) luaL_error(L, "File exists");
     e.clear();
     fs::create_directories(toPath.parent_path(), e);
     if (e) err(L, 2, e.message().c_str());
-    fs::rename(fromPath, toPath, e);
+    // the lower copy in an overlay can't be moved, so it's copied up to be moved, and hidden once it has been
+    path_t fromRel;
+    const std::shared_ptr<const Overlay> overlay = findOverlay(get_comp(L), fromPath, &fromRel);
+    const bool hideLower = overlay != NULL && overlay->showsLower(fromRel) && fs::exists(overlay->lower / fromRel, e);
+    e.clear();
+    const path_t source = hideLower ? copyUp(get_comp(L), fromPath, e) : fromPath;
+    if (e) err(L, 1, e.message().c_str());
+    // only moves into or out of the computer's directory change its size
+    const std::shared_ptr<DiskUsage> fromUsage = trackedUsage(get_comp(L), source), toUsage = trackedUsage(get_comp(L), toPath);
+    const int64_t size = fromUsage != toUsage ? DiskUsage::measure(source) : 0;
+    fs::rename(source, toPath, e);
+    if (!e && hideLower) overlay->remove(fromRel, e);
+    invalidateListing(get_comp(L), source);
+    invalidateListing(get_comp(L), toPath);
     if (e) err(L, 1, e.message().c_str());
+    if (fromUsage) fromUsage->add(-size);
+    if (toUsage) toUsage->add(size);
     return 0;
 }
 
-static int fs_copy(lua_State *L) {
-    lastCFunction = __func__;
+// How long fs.copy waits for a copy to finish before yielding until it does; most copies are done by then.
+static constexpr std::chrono::milliseconds copyWaitTime {50};
+static std::atomic<int> nextTaskID {1};
+
+// A copy running on an I/O thread. The coroutine that started it keeps it on
+// its stack in a userdata, so it's canceled if the coroutine is collected.
+struct copy_job {
+    std::mutex lock;
+    std::condition_variable notify;
+    std::atomic<bool> cancel {false};
+    bool done = false;
+    bool waiting = false; // whether the caller yielded, and needs an event to wake it up
+    bool finished = false; // whether the changes the copy made have been accounted for
+    std::error_code error;
+    Computer * comp;
+    int id;
+    path_t toPath;
+    std::string errorPath; // the target path as shown in error messages
+    std::shared_ptr<DiskUsage> usage;
+    int64_t oldSize;
+};
+
+// Waits for the copy to finish and records the changes it made.
+static void copy_job_finish(copy_job * job) {
+    if (job->finished) return;
+    job->finished = true;
+    {
+        std::unique_lock<std::mutex> lock(job->lock);
+        job->notify.wait(lock, [job]()->bool{return job->done;});
+    }
+    invalidateListing(job->comp, job->toPath);
+    // a failed (or canceled) copy may still have copied some files
+    if (job->usage) job->usage->add(DiskUsage::measure(job->toPath) - job->oldSize);
+}
+
+static int copy_job_gc(lua_State *L) {
+    copy_job * job = *(copy_job**)lua_touserdata(L, 1);
+    job->cancel = true;
+    copy_job_finish(job);
+    delete job;
+    return 0;
+}
+
+// Whether the running C function may yield: lua_yield refuses on the main
+// thread and across a metamethod or C call, which it tells by nCcalls.
+static bool canYield(lua_State *L) {
+    const bool mainThread = lua_pushthread(L);
+    lua_pop(L, 1);
+    return !mainThread && L->nCcalls <= L->baseCcalls;
+}
+
+// Waits for the copy in the userdata at index 1 to finish. If it takes longer
+// than copyWaitTime, this yields with a task_complete filter, as sleep does
+// with timer, and is called again with each task_complete or terminate event
+// until the one the copy queues when it's done; terminate cancels the copy.
+// Other events go to whatever else is running, and aren't seen here. Where
+// the caller can't yield, this just waits for the copy.
+static int fs_copy_wait(lua_State *L) {
+    copy_job * job = *(copy_job**)lua_touserdata(L, 1);
+    bool terminated = false;
+    if (lua_vcontext(L) != NULL) {
+        // resumed with an event, which starts at index 2
+        const char * name = lua_isstring(L, 2) ? lua_tostring(L, 2) : "";
+        if (strcmp(name, "terminate") == 0) terminated = true;
+        else if (strcmp(name, "task_complete") != 0 || lua_tointeger(L, 3) != job->id) {
+            lua_settop(L, 1);
+            lua_pushliteral(L, "task_complete");
+            return lua_vyield(L, 1, job);
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(job->lock);
+        if (canYield(L)) job->notify.wait_for(lock, copyWaitTime, [job]()->bool{return job->done;});
+        else job->notify.wait(lock, [job]()->bool{return job->done;});
+        job->waiting = !job->done;
+        if (job->waiting) {
+            lock.unlock();
+            lua_settop(L, 1);
+            lua_pushliteral(L, "task_complete");
+            return lua_vyield(L, 1, job);
+        }
+    }
+    if (terminated) {
+        std::lock_guard<std::mutex> lock(job->lock);
+        // the copy won't be waited for any more, so it shouldn't send its event
+        job->waiting = false;
+        job->cancel = true;
+    }
+    copy_job_finish(job);
+    if (terminated) return luaL_error(L, "Terminated");
+    if (job->error) return luaL_error(L, "/%s: %s", job->errorPath.c_str(), job->error.message().c_str());
+    return 0;
+}
+
+// Resolves and checks the paths for fs.copy, raising the same errors. A file
+// from a virtual mount is copied on the spot, which returns true; otherwise the
+// target's parent directory is made, and the copy is left to the caller.
+static bool prepareCopy(lua_State *L, path_t& fromPath, path_t& toPath) {
+    flushPendingWrites(get_comp(L));
     std::string str1 = checkstring(L, 1);
     std::string str2 = checkstring(L, 2);
     if (fixpath_ro(get_comp(L), str2)) luaL_error(L, "/%s: Access denied", fixpath(get_comp(L), str2, false, false).c_str());
-    const path_t fromPath = fixpath(get_comp(L), str1, true);
-    const path_t toPath = fixpath_mkdir(get_comp(L), str2);
+    waitForStore(get_comp(L));
+    fromPath = fixpath(get_comp(L), str1, true);
+    toPath = fixpath_mkdir(get_comp(L), str2);
     if (fromPath.empty()) err(L, 1, "No such file");
     if (toPath.empty()) err(L, 2, "Invalid path");
-    if (std::regex_search((*toPath.begin()).native(), pathregex("^\\d+:"))) err(L, 2, "Permission denied");
-    if (std::regex_search((*fromPath.begin()).native(), pathregex("^\\d+:"))) {
-        try {
-            const FileEntry &d = get_comp(L)->virtualMounts[(unsigned)std::stoul((*fromPath.begin()).c_str())]->path(fromPath.lexically_relative(*fromPath.begin()));
-            if (d.isDir) err(L, 1, "Is a directory");
-            std::ofstream tofp(toPath);
-            if (!tofp.is_open()) return err(L, 2, "Cannot write file");
-            tofp.write(d.data.c_str(), d.data.size());
-            tofp.close();
-        } catch (...) {err(L, 1, "No such file");}
-    } else {
-        /*if (isFSCaseSensitive == -1) {
-            struct_stat st;
-            char* name = tmpnam(NULL);
-            fclose(platform_fopen(name, "w"));
-            std::transform(name, name + strlen(name), name, [](char c)->char{return isupper(c) ? tolower(c) : toupper(c);});
-            isFSCaseSensitive = stat(name, &st);
-            remove(name);
-        }*/
-        std::vector<std::string> fromElems = split(str1, "/\\"), toElems = split(str2, "/\\");
-        while (!fromElems.empty() && fromElems.front().empty()) fromElems.erase(fromElems.begin());
-        while (!toElems.empty() && toElems.front().empty()) toElems.erase(toElems.begin());
-        while (!fromElems.empty() && fromElems.back().empty()) fromElems.pop_back();
-        while (!toElems.empty() && toElems.back().empty()) toElems.pop_back();
-        bool equal = true;
-        for (unsigned i = 0; i < toElems.size() && equal; i++) {
-            if (i >= fromElems.size()) err(L, 1, "Can't copy a directory inside itself");
-            std::string lstrfrom = fromElems[i], lstrto = toElems[i];
-            std::transform(lstrfrom.begin(), lstrfrom.end(), lstrfrom.begin(), [](unsigned char c) {return std::tolower(c);});
-            std::transform(lstrto.begin(), lstrto.end(), lstrto.begin(), [](unsigned char c) {return std::tolower(c);});
-            if (lstrfrom != lstrto) equal = false;
-            else if ((i == fromElems.size() - 1 && i == toElems.size() - 1)) err(L, 1, "Can't copy a directory inside itself");
-        }
-        if (equal) err(L, 1, "Can't copy a directory inside itself");
-        std::error_code e;
-        fs::create_directories(toPath.parent_path(), e);
+    if (FileEntry::hasMountID((*toPath.begin()).native())) err(L, 2, "Permission denied");
+    if (FileEntry::hasMountID((*fromPath.begin()).native())) {
+        std::shared_ptr<const VirtualFS> vfs;
+        const VirtualFS::Node * node = findVirtualPath(get_comp(L), fromPath, &vfs);
+        if (node == NULL) err(L, 1, "No such file");
+        if (node->isDir) err(L, 1, "Is a directory");
+        std::string toRel;
+        const std::shared_ptr<DiskImage> image = findDiskImage(get_comp(L), toPath, &toRel);
+        if (image != NULL) {
+            std::error_code e;
+            image->write(toRel, node->data, node->size, e);
+            if (e) err(L, 2, "Cannot write file");
+            return true;
+        }
+        const std::shared_ptr<DiskUsage> usage = trackedUsage(get_comp(L), toPath);
+        const int64_t oldSize = usage ? DiskUsage::measure(toPath) : 0;
+        // a target in the content store is unlinked first, as writing through it would change it for every computer
+        const std::shared_ptr<ContentStore> store = getContentStore();
+        std::error_code se;
+        if (store != NULL) store->unshare(toPath, false, se);
+        if (se) err(L, 2, "Cannot write file");
+        std::ofstream tofp(toPath);
+        if (!tofp.is_open()) err(L, 2, "Cannot write file");
+        tofp.write(node->data, node->size);
+        tofp.close();
+        invalidateListing(get_comp(L), toPath);
+        if (usage) usage->add(DiskUsage::measure(toPath) - oldSize);
+        return true;
+    }
+    /*if (isFSCaseSensitive == -1) {
+        struct_stat st;
+        char* name = tmpnam(NULL);
+        fclose(platform_fopen(name, "w"));
+        std::transform(name, name + strlen(name), name, [](char c)->char{return isupper(c) ? tolower(c) : toupper(c);});
+        isFSCaseSensitive = stat(name, &st);
+        remove(name);
+    }*/
+    std::vector<std::string> fromElems = split(str1, "/\\"), toElems = split(str2, "/\\");
+    while (!fromElems.empty() && fromElems.front().empty()) fromElems.erase(fromElems.begin());
+    while (!toElems.empty() && toElems.front().empty()) toElems.erase(toElems.begin());
+    while (!fromElems.empty() && fromElems.back().empty()) fromElems.pop_back();
+    while (!toElems.empty() && toElems.back().empty()) toElems.pop_back();
+    bool equal = true;
+    for (unsigned i = 0; i < toElems.size() && equal; i++) {
+        if (i >= fromElems.size()) err(L, 1, "Can't copy a directory inside itself");
+        std::string lstrfrom = fromElems[i], lstrto = toElems[i];
+        std::transform(lstrfrom.begin(), lstrfrom.end(), lstrfrom.begin(), [](unsigned char c) {return std::tolower(c);});
+        std::transform(lstrto.begin(), lstrto.end(), lstrto.begin(), [](unsigned char c) {return std::tolower(c);});
+        if (lstrfrom != lstrto) equal = false;
+        else if ((i == fromElems.size() - 1 && i == toElems.size() - 1)) err(L, 1, "Can't copy a directory inside itself");
+    }
+    if (equal) err(L, 1, "Can't copy a directory inside itself");
+    // fixpath_mkdir already made the parent directory in a disk image
+    if (findDiskImage(get_comp(L), toPath) != NULL) return false;
+    std::error_code e;
+    fs::create_directories(toPath.parent_path(), e);
+    if (e) err(L, 2, e.message().c_str());
+    // a target that's only in an overlay's lower directory is treated as if it were in the upper directory
+    const path_t visible = visiblePath(get_comp(L), toPath);
+    if (visible != toPath) {
+        if (!fs::is_directory(visible, e)) err(L, 1, fs::is_directory(fromPath, e) ? "Is a directory" : "File exists");
+        fs::create_directory(toPath, e);
         if (e) err(L, 2, e.message().c_str());
-        fs::copy(fromPath, toPath, fs::copy_options::recursive, e);
-        if (e) err(L, 1, e.message().c_str());
+        invalidateListing(get_comp(L), toPath);
     }
-    return 0;
+    return false;
+}
+
+static int fs_copy(lua_State *L) {
+    lastCFunction = __func__;
+    if (lua_vcontext(L)) return fs_copy_wait(L);
+    path_t fromPath, toPath;
+    if (prepareCopy(L, fromPath, toPath)) return 0;
+    copy_job * job = new copy_job;
+    job->comp = get_comp(L);
+    job->id = nextTaskID++;
+    job->toPath = toPath;
+    job->errorPath = fixpath(get_comp(L), checkstring(L, 1), false, false).string();
+    job->usage = trackedUsage(get_comp(L), toPath);
+    job->oldSize = job->usage ? DiskUsage::measure(toPath) : 0;
+    const copy_func copy = copyFunction(get_comp(L), fromPath, toPath);
+    lua_settop(L, 0);
+    copy_job ** ud = (copy_job**)lua_newuserdata(L, sizeof(copy_job*));
+    *ud = job;
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, copy_job_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    queueIOJob([job, copy]() {
+        std::error_code e;
+        copy(e, job->cancel);
+        std::lock_guard<std::mutex> lock(job->lock);
+        job->error = e;
+        job->done = true;
+        if (job->waiting) {
+            const int id = job->id;
+            const bool ok = !e;
+            queueEvent(job->comp, [id, ok](lua_State *L, void*)->std::string {
+                lua_pushinteger(L, id);
+                lua_pushboolean(L, ok);
+                return "task_complete";
+            }, NULL);
+        }
+        job->notify.notify_all();
+    }, job->comp);
+    return fs_copy_wait(L);
 }
 
 static int fs_delete(lua_State *L) {
     lastCFunction = __func__;
     std::string str = checkstring(L, 1);
     if (fixpath_ro(get_comp(L), str)) err(L, 1, "Access denied");
+    waitForStore(get_comp(L));
     bool isRoot = false;
-    const path_t path = fixpath(get_comp(L), str, true, true, NULL, &isRoot);
+    MountKind kind;
+    const path_t path = fixpath(get_comp(L), str, true, true, NULL, &isRoot, &kind);
     if (isRoot) luaL_error(L, "Cannot delete mount, use mounter.unmount instead");
     if (path.empty()) return 0;
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) err(L, 1, "Permission denied");
+    if (FileEntry::hasMountID((*path.begin()).native())) err(L, 1, "Permission denied");
     std::error_code e;
-    fs::remove_all(path, e);
+    if (kind.image != NULL) {
+        kind.image->remove(kind.imageRel, e);
+        if (e) err(L, 1, e.message().c_str());
+        return 0;
+    }
+    // in an overlay, only the upper copy is removed, and the lower copy is hidden
+    const std::shared_ptr<const Overlay> overlay = kind.overlay;
+    const path_t& rel = kind.overlayRel;
+    const path_t target = overlay != NULL ? overlay->upper / rel : path;
+    const std::shared_ptr<DiskUsage> usage = trackedUsage(get_comp(L), target);
+    const int64_t oldSize = usage ? DiskUsage::measure(target) : 0;
+    if (overlay != NULL) overlay->remove(rel, e);
+    else fs::remove_all(path, e);
+    invalidateListing(get_comp(L), target);
+    // a failed delete may still have removed some files
+    if (usage) usage->add(DiskUsage::measure(target) - oldSize);
     if (e) err(L, 1, e.message().c_str());
     return 0;
 }
@@ -436,6 +822,8 @@ static int fs_combine(lua_State *L) {
 static int fs_open(lua_State *L) {
     lastCFunction = __func__;
     Computer * computer = get_comp(L);
+    // flushed data must be visible to the new handle
+    flushPendingWrites(computer);
     const char * mode = luaL_checkstring(L, 2);
     if ((mode[0] != 'r' && mode[0] != 'w' && mode[0] != 'a') || (!(mode[1] == 'b' && mode[2] == '\0') && mode[1] != '\0')) luaL_error(L, "%s: Unsupported mode", mode);
     std::string str = checkstring(L, 1);
@@ -452,37 +840,74 @@ static int fs_open(lua_State *L) {
         }
     }
     int fpid;
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:")) || path == ":bios.lua") {
+    if (FileEntry::hasMountID((*path.begin()).native()) || path == ":bios.lua") {
         if (computer->files_open >= config.maximumFilesOpen) err(L, 1, "Too many files already open");
-        std::stringstream ** fp = (std::stringstream**)lua_newuserdata(L, sizeof(std::stringstream**));
+        std::iostream ** fp = (std::iostream**)lua_newuserdata(L, sizeof(std::iostream*));
         fpid = lua_gettop(L);
 #ifdef STANDALONE_ROM
         if (path == ":bios.lua") {
             *fp = new std::stringstream(standaloneBIOS);
         } else {
 #endif
-            try {
-                const FileEntry &d = computer->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin()));
-                if (d.isDir) {
-                    lua_remove(L, fpid);
-                    lua_pushnil(L);
-                    if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
-                    else lua_pushfstring(L, "/%s: Cannot write to directory", fixpath(computer, str, false, false).string().c_str());
-                    return 2; 
-                }
-                *fp = new std::stringstream(d.data);
-            } catch (...) {
+            std::shared_ptr<const VirtualFS> vfs;
+            const VirtualFS::Node * node = findVirtualPath(computer, path, &vfs);
+            if (node == NULL) {
                 lua_remove(L, fpid);
                 lua_pushnil(L);
                 lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
                 return 2;
+            } else if (node->isDir) {
+                lua_remove(L, fpid);
+                lua_pushnil(L);
+                if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
+                else lua_pushfstring(L, "/%s: Cannot write to directory", fixpath(computer, str, false, false).string().c_str());
+                return 2; 
             }
+            // reads use the mount's data in place; anything else gets a scratch copy, as writes to virtual files are thrown away
+            if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) *fp = new VFSFileStream(vfs, node);
+            else *fp = new std::stringstream(std::string(node->data, node->size));
 #ifdef STANDALONE_ROM
         }
 #endif
+    } else if (std::string rel; const std::shared_ptr<DiskImage> image = findDiskImage(computer, path, &rel)) {
+        if (image->isDir(rel)) {
+            lua_pushnil(L);
+            if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
+            else lua_pushfstring(L, "/%s: Cannot write to directory", fixpath(computer, str, false, false).string().c_str());
+            return 2;
+        }
+        if (mode[0] != 'r' && fixpath_ro(computer, str)) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "/%s: Access denied", fixpath(computer, str, false, false).string().c_str());
+            return 2;
+        }
+        if (computer->files_open >= config.maximumFilesOpen) err(L, 1, "Too many files already open");
+        std::error_code e;
+        std::iostream * stream;
+        if (mode[0] == 'r') {
+            // reads use the file's contents in place, which stay as they were when it was opened
+            const std::shared_ptr<const DiskImage::Contents> contents = image->read(rel, e);
+            stream = contents != NULL ? new ImageReadStream(contents) : NULL;
+        } else {
+            // writes are collected, and written to the image when the file is flushed or closed
+            ImageWriteStream * out = new ImageWriteStream(image, rel, mode[0] == 'a');
+            if (out->is_open()) stream = out;
+            else {
+                delete out;
+                stream = NULL;
+            }
+        }
+        if (stream == NULL) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
+            return 2;
+        }
+        std::iostream ** fp = (std::iostream**)lua_newuserdata(L, sizeof(std::iostream*));
+        fpid = lua_gettop(L);
+        *fp = stream;
     } else {
         std::error_code e;
-        if (fs::is_directory(path, e)) { 
+        if (fs::is_directory(mode[0] == 'r' ? path : visiblePath(computer, path), e)) { 
             lua_pushnil(L);
             if (strcmp(mode, "r") == 0 || strcmp(mode, "rb") == 0) lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
             else lua_pushfstring(L, "/%s: Cannot write to directory", fixpath(computer, str, false, false).string().c_str());
@@ -494,6 +919,7 @@ static int fs_open(lua_State *L) {
                 lua_pushfstring(L, "/%s: Access denied", fixpath(computer, str, false, false).string().c_str());
                 return 2; 
             }
+            waitForStore(computer);
             e.clear();
             fs::create_directories(path.parent_path(), e);
             if (e) {
@@ -501,30 +927,51 @@ static int fs_open(lua_State *L) {
                 lua_pushfstring(L, "/%s: Cannot create directory", fixpath(computer, str, false, false).string().c_str());
                 return 2; 
             }
+            // appending to a file in an overlay's lower directory adds to a copy of it
+            if (mode[0] == 'a') {
+                copyUp(computer, path, e);
+                if (e) {
+                    lua_pushnil(L);
+                    lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).string().c_str());
+                    return 2;
+                }
+            }
         }
-        std::fstream ** fp = (std::fstream**)lua_newuserdata(L, sizeof(std::fstream*));
+        std::iostream ** fp = (std::iostream**)lua_newuserdata(L, sizeof(std::iostream*));
         fpid = lua_gettop(L);
-        std::ios::openmode flags = std::ios::binary;
-        if (strchr(mode, 'r')) flags |= std::ios::in;
-        else if (strchr(mode, 'w')) flags |= std::ios::out | std::ios::trunc;
-        else if (strchr(mode, 'a')) flags |= std::ios::in | std::ios::out | std::ios::ate;
-        *fp = new std::fstream(path, flags);
-        if (!(*fp)->is_open()) {
-            bool ok = false;
-            if (strchr(mode, 'a')) {
-                (*fp)->open(path, std::ios::out | std::ios::trunc);
-                ok = (*fp)->is_open();
-            }
-            if (!ok) {
-                delete *fp;
-                lua_remove(L, fpid);
-                lua_pushnil(L);
-                lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).native().c_str());
-                return 2;
+        bool ok;
+        if (strchr(mode, 'r')) {
+            // reads go through our own block buffer
+            FileReadStream * in = new FileReadStream(path);
+            *fp = in;
+            ok = in->is_open();
+        } else {
+            // so do writes, which keep small writes and flushes from each turning into a system call
+            const std::shared_ptr<DiskUsage> usage = trackedUsage(computer, path);
+            const int64_t oldSize = usage && strchr(mode, 'w') ? DiskUsage::measure(path) : 0;
+            // a file in the content store is shared with other computers, so it gets a copy of its own before it's changed
+            const std::shared_ptr<ContentStore> store = getContentStore();
+            std::error_code se;
+            if (store != NULL) store->unshare(path, strchr(mode, 'a') != NULL, se);
+            FileWriteStream * out = se ? NULL : new FileWriteStream(path, strchr(mode, 'a') != NULL);
+            *fp = out;
+            ok = out != NULL && out->is_open();
+            if (out != NULL) out->buffer()->syncOnClose = computer->config->syncOnClose;
+            invalidateListing(computer, path);
+            if (ok && usage) {
+                // the file was truncated, and grows as data is written out
+                usage->add(-oldSize);
+                out->buffer()->onGrow = [usage](std::streamoff n) {usage->add(n);};
             }
         }
+        if (!ok) {
+            delete *fp;
+            lua_remove(L, fpid);
+            lua_pushnil(L);
+            lua_pushfstring(L, "/%s: No such file", fixpath(computer, str, false, false).native().c_str());
+            return 2;
+        }
         if (computer->files_open >= config.maximumFilesOpen) {
-            (*fp)->close();
             delete *fp;
             err(L, 1, "Too many files already open");
         }
@@ -612,40 +1059,20 @@ static int fs_open(lua_State *L) {
     return 1;
 }
 
-static std::string replace_str(std::string data, const std::string& toSearch, const std::string& replaceStr) {
-    size_t pos = data.find(toSearch);
-    while (pos != std::string::npos) {
-        data.replace(pos, toSearch.size(), replaceStr);
-        pos = data.find(toSearch, pos + replaceStr.size());
-    }
-    return data;
-}
-
-static std::string regex_escape[] = {"\\", ".", "[", "]", "{", "}", "^", "$", "(", ")", "+", "?", "|"};
-
 static std::list<std::string> matchWildcard(Computer * comp, const std::list<std::string>& options, std::list<std::string>::iterator pathc, const std::list<std::string>::iterator end) {
     if (pathc == end) return {};
-    std::string pathc_regex = *pathc;
-    for (const std::string& r : regex_escape) pathc_regex = replace_str(pathc_regex, r, "\\" + r);
-    pathc_regex = replace_str(pathc_regex, "*", ".*");
+    const GlobPattern pattern(*pathc);
     std::list<std::string> nextOptions;
     for (const std::string& opt : options) {
         std::vector<path_t> possible_paths = fixpath_multiple(comp, opt.c_str());
         if (possible_paths.empty()) continue;
         for (const path_t& path : possible_paths) {
-            if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) {
-                try {
-                    const FileEntry &d = comp->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin()));
-                    if (d.isDir) for (auto p : d.dir) if (std::regex_match(p.first, std::regex(pathc_regex))) nextOptions.push_back(opt + (opt == "" ? "" : "/") + p.first);
-                } catch (...) {continue;}
+            if (FileEntry::hasMountID((*path.begin()).native())) {
+                const VirtualFS::Node * node = findVirtualPath(comp, path);
+                if (node != NULL && node->isDir) for (const std::string& name : node->children) if (pattern.match(name)) nextOptions.push_back(opt + (opt == "" ? "" : "/") + name);
             } else {
-                std::error_code e;
-                if (fs::is_directory(path, e)) {
-                    for (const auto& dir : fs::directory_iterator(path, e)) {
-                        if (dir.path().filename() == ".DS_Store" || dir.path().filename() == "desktop.ini") continue;
-                        if (std::regex_match(dir.path().filename().string(), std::regex(pathc_regex))) nextOptions.push_back(opt + (opt.empty() ? "" : "/") + dir.path().filename().string());
-                    }
-                }
+                const DirectoryCache::Listing names = listDirectory(comp, path);
+                if (names != NULL) for (const std::string& name : *names) if (pattern.match(name)) nextOptions.push_back(opt + (opt.empty() ? "" : "/") + name);
             }
         }
         for (const std::string& value : getMounts(comp, opt.c_str())) 
@@ -711,29 +1138,50 @@ static int fs_getDir(lua_State *L) {
 
 static int fs_attributes(lua_State *L) {
     lastCFunction = __func__;
+    flushPendingWrites(get_comp(L));
     std::string str = checkstring(L, 1);
-    const path_t path = fixpath(get_comp(L), str, true);
+    MountKind kind;
+    const path_t path = fixpath(get_comp(L), str, true, true, NULL, NULL, &kind);
     if (path.empty()) err(L, 1, "No such file");
-    if (std::regex_search((*path.begin()).native(), pathregex("^\\d+:"))) {
-        try {
-            const FileEntry &d = get_comp(L)->virtualMounts[(unsigned)std::stoul((*path.begin()).native())]->path(path.lexically_relative(*path.begin()));
-            lua_createtable(L, 0, 6);
-            lua_pushinteger(L, 0);
-            lua_setfield(L, -2, "modification");
-            lua_pushinteger(L, 0);
-            lua_setfield(L, -2, "modified");
-            lua_pushinteger(L, 0);
-            lua_setfield(L, -2, "created");
-            lua_pushinteger(L, d.isDir ? 0 : d.data.length());
-            lua_setfield(L, -2, "size");
-            lua_pushboolean(L, d.isDir);
-            lua_setfield(L, -2, "isDir");
-            lua_pushboolean(L, true);
-            lua_setfield(L, -2, "isReadOnly");
-        } catch (...) {
+    if (FileEntry::hasMountID((*path.begin()).native())) {
+        const VirtualFS::Node * node = findVirtualPath(get_comp(L), path);
+        if (node == NULL) {
             lua_pushnil(L);
             return 1;
         }
+        lua_createtable(L, 0, 6);
+        lua_pushinteger(L, 0);
+        lua_setfield(L, -2, "modification");
+        lua_pushinteger(L, 0);
+        lua_setfield(L, -2, "modified");
+        lua_pushinteger(L, 0);
+        lua_setfield(L, -2, "created");
+        lua_pushinteger(L, node->isDir ? 0 : node->size);
+        lua_setfield(L, -2, "size");
+        lua_pushboolean(L, node->isDir);
+        lua_setfield(L, -2, "isDir");
+        lua_pushboolean(L, true);
+        lua_setfield(L, -2, "isReadOnly");
+    } else if (const std::shared_ptr<DiskImage>& image = kind.image) {
+        // images only keep one time for each file
+        DiskImage::Stat st;
+        if (!image->stat(kind.imageRel, st)) {
+            lua_pushnil(L);
+            return 1;
+        }
+        lua_createtable(L, 0, 6);
+        lua_pushinteger(L, st.modified);
+        lua_setfield(L, -2, "modification");
+        lua_pushinteger(L, st.modified);
+        lua_setfield(L, -2, "modified");
+        lua_pushinteger(L, st.modified);
+        lua_setfield(L, -2, "created");
+        lua_pushinteger(L, st.isDir ? 0 : st.size);
+        lua_setfield(L, -2, "size");
+        lua_pushboolean(L, st.isDir);
+        lua_setfield(L, -2, "isDir");
+        lua_pushboolean(L, fixpath_ro(get_comp(L), str) || !image->writable());
+        lua_setfield(L, -2, "isReadOnly");
     } else {
 #ifdef _WIN32
         struct _stat st;
@@ -761,11 +1209,13 @@ static int fs_attributes(lua_State *L) {
         lua_setfield(L, -2, "isDir");
         if (fixpath_ro(get_comp(L), str)) lua_pushboolean(L, true);
         else {
+            // a file in an overlay's lower directory can be written, as it's copied up first
+            const path_t writable = upperPath(get_comp(L), path);
             std::error_code e;
-            if (!fs::exists(path, e)) lua_pushboolean(L, false);
+            if (!fs::exists(writable, e)) lua_pushboolean(L, false);
 #ifdef WIN32
-            else if (e.clear(), fs::is_directory(path, e)) {
-                const path_t file = path / "a";
+            else if (e.clear(), fs::is_directory(writable, e)) {
+                const path_t file = writable / "a";
                 const bool didexist = fs::exists(file, e);
                 std::fstream fp(file, didexist ? std::ios::in : std::ios::out);
                 lua_pushboolean(L, !fp.is_open());
@@ -774,7 +1224,7 @@ static int fs_attributes(lua_State *L) {
                 if (!didexist && fs::exists(file, e)) fs::remove(file, e);
             }
 #endif
-            else lua_pushboolean(L, access(path.c_str(), W_OK) != 0);
+            else lua_pushboolean(L, access(writable.c_str(), W_OK) != 0);
         }
         lua_setfield(L, -2, "isReadOnly");
     }
@@ -794,7 +1244,8 @@ static int fs_getCapacity(lua_State *L) {
         return 1;
     }
     if (path.empty()) luaL_error(L, "%s: Invalid path", str.c_str());
-    lua_pushinteger(L, getSpace(path).capacity);
+    const std::shared_ptr<DiskImage> image = findDiskImage(get_comp(L), path);
+    lua_pushinteger(L, getSpace(image != NULL ? image->file() : path).capacity);
     return 1;
 }
 
@@ -807,6 +1258,345 @@ static int fs_isDriveRoot(lua_State *L) {
     return 1;
 }
 
+// Queues the task_complete event that ends an asynchronous call: the task ID,
+// then true and whatever results pushes, or false and the error message.
+static void finishTask(Computer * comp, int id, const std::string& error, const std::function<void(lua_State*)>& results = nullptr) {
+    queueEvent(comp, [id, error, results](lua_State *L, void*)->std::string {
+        lua_checkstack(L, 8);
+        lua_pushinteger(L, id);
+        lua_pushboolean(L, error.empty());
+        if (!error.empty()) lua_pushlstring(L, error.c_str(), error.size());
+        else if (results) results(L);
+        return "task_complete";
+    }, NULL);
+}
+
+// Finishes an asynchronous call that changes a path. The cached listings are
+// dropped even if it failed, as it may have got partway first.
+static void finishChange(Computer * comp, int id, const std::string& error, const path_t& path) {
+    queueEvent(comp, [comp, path](lua_State *, void*)->std::string {
+        invalidateListing(comp, path);
+        return "";
+    }, NULL);
+    finishTask(comp, id, error);
+}
+
+// Pushes a list of names as a Lua array.
+static void pushNames(lua_State *L, const std::vector<std::string>& names) {
+    lua_createtable(L, names.size(), 0);
+    for (size_t i = 0; i < names.size(); i++) {
+        lua_pushlstring(L, names[i].c_str(), names[i].size());
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+}
+
+// Finishes a readAsync call with a file's contents, converting them like a text handle's readAll unless binary is set.
+// The contents are shared rather than copied, as the event is copied on its way to the computer.
+static void finishRead(Computer * comp, int id, std::string data, bool binary) {
+    if (!binary) {
+        data.resize(convertCRLF(&data[0], data.size()));
+        data = makeASCIISafe(data.c_str(), data.size());
+    }
+    const std::shared_ptr<const std::string> contents = std::make_shared<const std::string>(std::move(data));
+    finishTask(comp, id, "", [contents](lua_State *L) {lua_pushlstring(L, contents->c_str(), contents->size());});
+}
+
+static int fs_readAsync(lua_State *L) {
+    lastCFunction = __func__;
+    Computer * computer = get_comp(L);
+    // flushed data must be visible to the read
+    flushPendingWrites(computer);
+    std::string str = checkstring(L, 1);
+    const bool binary = lua_toboolean(L, 2);
+    MountKind kind;
+    const path_t path = fixpath(computer, str, true, true, NULL, NULL, &kind);
+    const std::string errorPath = "/" + fixpath(computer, str, false, false).string() + ": ";
+    const std::string missing = errorPath + "No such file";
+    const int id = nextTaskID++;
+    if (path.empty()) finishTask(computer, id, missing);
+#ifdef STANDALONE_ROM
+    else if (path == ":bios.lua") finishRead(computer, id, standaloneBIOS, binary);
+#endif
+    else if (FileEntry::hasMountID((*path.begin()).native())) {
+        // virtual files are already in memory
+        const VirtualFS::Node * node = findVirtualPath(computer, path);
+        if (node == NULL || node->isDir) finishTask(computer, id, missing);
+        else finishRead(computer, id, std::string(node->data, node->size), binary);
+    } else if (kind.image != NULL) {
+        queueIOJob([computer, id, image = kind.image, rel = kind.imageRel, binary, missing]() {
+            std::error_code e;
+            const std::shared_ptr<const DiskImage::Contents> contents = image->read(rel, e);
+            if (contents == NULL) return finishTask(computer, id, missing);
+            finishRead(computer, id, std::string(contents->data, contents->size), binary);
+        }, computer);
+    } else {
+        queueIOJob([computer, id, path, binary, errorPath, missing]() {
+            std::error_code e;
+            if (fs::is_directory(path, e)) return finishTask(computer, id, missing);
+            std::ifstream in(path, std::ios::binary);
+            if (!in.is_open()) return finishTask(computer, id, missing);
+            std::string data;
+            e.clear();
+            const uintmax_t size = fs::file_size(path, e);
+            if (!e) data.resize(size);
+            in.read(&data[0], data.size());
+            data.resize(in.gcount());
+            // the file may have grown since its size was read
+            char buf[4096];
+            while (in.read(buf, sizeof(buf)) || in.gcount() > 0) data.append(buf, in.gcount());
+            if (in.bad()) return finishTask(computer, id, errorPath + "Could not read file");
+            finishRead(computer, id, std::move(data), binary);
+        }, computer);
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int fs_writeAsync(lua_State *L) {
+    lastCFunction = __func__;
+    Computer * computer = get_comp(L);
+    std::string str = checkstring(L, 1);
+    size_t len = 0;
+    const char * data = luaL_checklstring(L, 2, &len);
+    const bool binary = lua_toboolean(L, 3);
+    const path_t path = fixpath_mkdir(computer, str);
+    const std::string errorPath = "/" + fixpath(computer, str, false, false).string() + ": ";
+    const int id = nextTaskID++;
+    if (fixpath_ro(computer, str)) finishTask(computer, id, errorPath + "Access denied");
+    else if (path.empty()) finishTask(computer, id, errorPath + "No such file");
+    else if (FileEntry::hasMountID((*path.begin()).native())) finishTask(computer, id, errorPath + "Permission denied");
+    else {
+        waitForStore(computer);
+        // text is written as UTF-8, as it is by text handles
+        const std::shared_ptr<const std::string> contents = std::make_shared<const std::string>(binary || isASCII(data, len) ? std::string(data, len) : latin1ToUTF8(data, len));
+        std::string rel;
+        const std::shared_ptr<DiskImage> image = findDiskImage(computer, path, &rel);
+        if (image != NULL) {
+            queueIOJob([computer, id, image, rel, contents, errorPath]() {
+                if (image->isDir(rel)) return finishTask(computer, id, errorPath + "Cannot write to directory");
+                std::error_code e;
+                image->write(rel, contents->c_str(), contents->size(), e);
+                finishTask(computer, id, e ? errorPath + "Could not write file" : "");
+            }, computer);
+            lua_pushinteger(L, id);
+            return 1;
+        }
+        const std::shared_ptr<DiskUsage> usage = trackedUsage(computer, path);
+        const bool syncOnClose = computer->config->syncOnClose;
+        const path_t visible = visiblePath(computer, path);
+        const std::shared_ptr<ContentStore> store = getContentStore();
+        queueIOJob([computer, id, path, visible, contents, usage, store, syncOnClose, errorPath]() {
+            std::error_code e;
+            if (fs::is_directory(visible, e)) return finishTask(computer, id, errorPath + "Cannot write to directory");
+            e.clear();
+            fs::create_directories(path.parent_path(), e);
+            if (e) return finishChange(computer, id, errorPath + "Cannot create directory", path);
+            const int64_t oldSize = usage ? DiskUsage::measure(path) : 0;
+            if (store != NULL) {
+                store->unshare(path, false, e);
+                if (e) return finishChange(computer, id, errorPath + "Could not write file", path);
+            }
+            bool ok;
+            {
+                FileWriteStream out(path, false);
+                if (!out.is_open()) return finishChange(computer, id, errorPath + "No such file", path);
+                out.buffer()->syncOnClose = syncOnClose;
+                if (usage) {
+                    usage->add(-oldSize);
+                    out.buffer()->onGrow = [usage](std::streamoff n) {usage->add(n);};
+                }
+                out.write(contents->c_str(), contents->size());
+                out.flush();
+                ok = !out.fail();
+            }
+            finishChange(computer, id, ok ? "" : errorPath + "Could not write file", path);
+        }, computer);
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int fs_copyAsync(lua_State *L) {
+    lastCFunction = __func__;
+    Computer * computer = get_comp(L);
+    path_t fromPath, toPath;
+    const int id = nextTaskID++;
+    // argument errors are raised here, like fs.copy does; only the copy itself is left for the event
+    if (prepareCopy(L, fromPath, toPath)) finishTask(computer, id, "");
+    else {
+        const std::string errorPath = "/" + fixpath(computer, checkstring(L, 1), false, false).string() + ": ";
+        const std::shared_ptr<DiskUsage> usage = trackedUsage(computer, toPath);
+        const copy_func copy = copyFunction(computer, fromPath, toPath);
+        queueIOJob([computer, id, copy, toPath, errorPath, usage]() {
+            const int64_t oldSize = usage ? DiskUsage::measure(toPath) : 0;
+            std::error_code e;
+            // stops early if the computer is freed in the meantime
+            copy(e, computer->cancelIO);
+            // a failed copy may still have copied some files
+            if (usage) usage->add(DiskUsage::measure(toPath) - oldSize);
+            finishChange(computer, id, e ? errorPath + e.message() : "", toPath);
+        }, computer);
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int fs_listAsync(lua_State *L) {
+    lastCFunction = __func__;
+    Computer * computer = get_comp(L);
+    std::string str = checkstring(L, 1);
+    const std::string error = "/" + fixpath(computer, str, false, false).string() + ": Not a directory";
+    const int id = nextTaskID++;
+    lua_pushinteger(L, id);
+    const std::vector<path_t> possible_paths = fixpath_multiple(computer, str);
+    if (possible_paths.empty()) {
+        finishTask(computer, id, error);
+        return 1;
+    }
+    // mounts and virtual directories are resolved here, and only real directories are read on the I/O thread
+    bool gotdir = false;
+    std::set<std::string> entries = getMounts(computer, str);
+    std::vector<std::function<DirectoryCache::Listing()>> dirs;
+    for (const path_t& path : possible_paths) {
+        if (FileEntry::hasMountID((*path.begin()).native())) {
+            const VirtualFS::Node * node = findVirtualPath(computer, path);
+            if (node != NULL && node->isDir) {
+                gotdir = true;
+                entries.insert(node->children.begin(), node->children.end());
+            }
+        } else dirs.push_back(directoryReader(computer, path));
+    }
+    queueIOJob([computer, id, error, gotdir, entries, dirs]() mutable {
+        for (const auto& read : dirs) {
+            const DirectoryCache::Listing names = read();
+            if (names != NULL) {
+                gotdir = true;
+                entries.insert(names->begin(), names->end());
+            }
+        }
+        if (!gotdir) return finishTask(computer, id, error);
+        const std::shared_ptr<const std::vector<std::string>> all = std::make_shared<const std::vector<std::string>>(entries.begin(), entries.end());
+        finishTask(computer, id, "", [all](lua_State *L) {pushNames(L, *all);});
+    }, computer);
+    return 1;
+}
+
+// A findAsync call, which matches one path component at a time.
+struct find_task {
+    Computer * comp;
+    int id;
+    std::vector<std::string> pathc;
+    size_t level = 0; // The component being matched
+    std::list<std::string> options; // The paths matched so far
+};
+
+// Matches the next path component of a findAsync call. Mounts and virtual
+// directories are resolved here, on the computer thread; the real directories
+// are read on an I/O thread, which then queues an event that's never seen by
+// the computer to run the next step (or queues the results).
+static void findAsyncStep(const std::shared_ptr<find_task>& task) {
+    const std::string& component = task->pathc[task->level];
+    const GlobPattern pattern(component);
+    std::list<std::string> nextOptions;
+    std::vector<std::pair<std::string, std::function<DirectoryCache::Listing()>>> dirs;
+    for (const std::string& opt : task->options) {
+        for (const path_t& path : fixpath_multiple(task->comp, opt)) {
+            if (FileEntry::hasMountID((*path.begin()).native())) {
+                const VirtualFS::Node * node = findVirtualPath(task->comp, path);
+                if (node != NULL && node->isDir) for (const std::string& name : node->children) if (pattern.match(name)) nextOptions.push_back(opt + (opt.empty() ? "" : "/") + name);
+            } else dirs.emplace_back(opt, directoryReader(task->comp, path));
+        }
+        for (const std::string& value : getMounts(task->comp, opt))
+            if (component == "*" || value == component) nextOptions.push_back(opt + (opt.empty() ? "" : "/") + value);
+    }
+    queueIOJob([task, dirs, nextOptions]() mutable {
+        const GlobPattern pattern(task->pathc[task->level]);
+        for (const auto& dir : dirs) {
+            const DirectoryCache::Listing names = dir.second();
+            if (names != NULL) for (const std::string& name : *names) if (pattern.match(name)) nextOptions.push_back(dir.first + (dir.first.empty() ? "" : "/") + name);
+        }
+        task->options = std::move(nextOptions);
+        if (++task->level < task->pathc.size() && !task->options.empty()) {
+            queueEvent(task->comp, [task](lua_State *, void*)->std::string {
+                findAsyncStep(task);
+                return "";
+            }, NULL);
+            return;
+        }
+        task->options.sort();
+        task->options.erase(std::unique(task->options.begin(), task->options.end()), task->options.end());
+        const std::shared_ptr<const std::vector<std::string>> matches = std::make_shared<const std::vector<std::string>>(task->options.begin(), task->options.end());
+        finishTask(task->comp, task->id, "", [matches](lua_State *L) {pushNames(L, *matches);});
+    }, task->comp);
+}
+
+static int fs_findAsync(lua_State *L) {
+    lastCFunction = __func__;
+    std::string str = checkstring(L, 1);
+    std::vector<std::string> elems = split(str, "/\\");
+    std::shared_ptr<find_task> task = std::make_shared<find_task>();
+    for (const std::string& s : elems) {
+        if (s == "..") {
+            if (task->pathc.empty()) luaL_error(L, "Not a directory");
+            else task->pathc.pop_back();
+        }
+        else if (!s.empty() && !std::all_of(s.begin(), s.end(), [](const char c)->bool{return c == '.';})) task->pathc.push_back(s);
+    }
+    task->comp = get_comp(L);
+    task->id = nextTaskID++;
+    task->options.push_back("");
+    if (task->pathc.empty()) finishTask(task->comp, task->id, "", [](lua_State *L) {pushNames(L, {""});});
+    else findAsyncStep(task);
+    lua_pushinteger(L, task->id);
+    return 1;
+}
+
+// Returns the total size of the files in a virtual directory.
+static int64_t virtualSize(Computer * comp, const path_t& path, const VirtualFS::Node * node) {
+    if (!node->isDir) return node->size;
+    int64_t size = 0;
+    for (const std::string& name : node->children) {
+        const VirtualFS::Node * child = findVirtualPath(comp, path / name);
+        if (child != NULL) size += virtualSize(comp, path / name, child);
+    }
+    return size;
+}
+
+static int fs_getSizeAsync(lua_State *L) {
+    lastCFunction = __func__;
+    Computer * computer = get_comp(L);
+    flushPendingWrites(computer);
+    std::string str = checkstring(L, 1);
+    MountKind kind;
+    const path_t path = fixpath(computer, str, true, true, NULL, NULL, &kind);
+    const int id = nextTaskID++;
+    if (path.empty()) finishTask(computer, id, "/" + fixpath(computer, str, false, false).string() + ": No such file");
+#ifdef STANDALONE_ROM
+    else if (path == ":bios.lua") {
+        const lua_Integer size = standaloneBIOS.size();
+        finishTask(computer, id, "", [size](lua_State *L) {lua_pushinteger(L, size);});
+    }
+#endif
+    else if (FileEntry::hasMountID((*path.begin()).native())) {
+        const VirtualFS::Node * node = findVirtualPath(computer, path);
+        const lua_Integer size = node != NULL ? virtualSize(computer, path, node) : 0;
+        finishTask(computer, id, "", [size](lua_State *L) {lua_pushinteger(L, size);});
+    } else if (kind.image != NULL) {
+        queueIOJob([computer, id, image = kind.image, imageRel = kind.imageRel]() {
+            const lua_Integer size = image->measure(imageRel);
+            finishTask(computer, id, "", [size](lua_State *L) {lua_pushinteger(L, size);});
+        }, computer);
+    } else {
+        queueIOJob([computer, id, path, overlay = kind.overlay, rel = kind.overlayRel]() {
+            // unlike fs.getSize, directories count all the files inside them
+            const lua_Integer size = overlay != NULL ? overlay->measure(rel) : DiskUsage::measure(path);
+            finishTask(computer, id, "", [size](lua_State *L) {lua_pushinteger(L, size);});
+        }, computer);
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
 static luaL_Reg fs_reg[] = {
     {"list", fs_list},
     {"exists", fs_exists},
@@ -827,6 +1617,12 @@ static luaL_Reg fs_reg[] = {
     {"attributes", fs_attributes},
     {"getCapacity", fs_getCapacity},
     {"isDriveRoot", fs_isDriveRoot},
+    {"readAsync", fs_readAsync},
+    {"writeAsync", fs_writeAsync},
+    {"copyAsync", fs_copyAsync},
+    {"listAsync", fs_listAsync},
+    {"findAsync", fs_findAsync},
+    {"getSizeAsync", fs_getSizeAsync},
     {NULL, NULL}
 };
 
@@ -8,16 +8,16 @@
  * Copyright (c) 2019-2023 JackMacWindows.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <codecvt>
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <locale>
 #include <string>
 #include "fs_handle.hpp"
+#include "../../filestream.hpp"
 #include "../../util.hpp"
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
@@ -35,11 +35,30 @@ EM_JS(void, syncfs, (), {
 })
 #endif
 
+// Converts CRLF line endings to LF in place, returning the new length.
+size_t convertCRLF(char * str, size_t len) {
+    char * const end = str + len;
+    char * in = (char*)memchr(str, '\r', len);
+    if (in == NULL) return len;
+    char * out = in;
+    while (in < end) {
+        // in is always at a CR here
+        if (in + 1 < end && in[1] == '\n') in++;
+        char * next = (char*)memchr(in + 1, '\r', end - in - 1);
+        if (next == NULL) next = end;
+        memmove(out, in, next - in);
+        out += next - in;
+        in = next;
+    }
+    return out - str;
+}
+
 int fs_handle_close(lua_State *L) {
     lastCFunction = __func__;
     std::iostream ** fp = (std::iostream**)lua_touserdata(L, lua_upvalueindex(1));
     if (*fp == NULL)
         return luaL_error(L, "attempt to use a closed file");
+    get_comp(L)->pendingWrites.erase((*fp)->rdbuf());
     if (dynamic_cast<std::fstream*>(*fp) != NULL) delete (std::fstream*)*fp;
     else if (dynamic_cast<std::stringstream*>(*fp) != NULL) delete (std::stringstream*)*fp;
     else delete *fp;
@@ -56,6 +75,7 @@ int fs_handle_gc(lua_State *L) {
     std::iostream ** fp = (std::iostream**)lua_touserdata(L, lua_upvalueindex(1));
     if (*fp == NULL)
         return 0;
+    get_comp(L)->pendingWrites.erase((*fp)->rdbuf());
     if (dynamic_cast<std::fstream*>(*fp) != NULL) delete (std::fstream*)*fp;
     else if (dynamic_cast<std::stringstream*>(*fp) != NULL) delete (std::stringstream*)*fp;
     else delete *fp;
@@ -73,22 +93,18 @@ int fs_handle_readAll(lua_State *L) {
     if (fp == NULL) return luaL_error(L, "attempt to use a closed file");
     if (fp->eof()) return 0;
     if (!fp->good()) luaL_error(L, "Could not read file");
-    const long pos = (long)fp->tellg();
+    const std::streamoff pos = fp->tellg();
     fp->seekg(0, std::ios::end);
-    if (!fp->good()) luaL_error(L, "Could not read file");
-    long size = (long)fp->tellg() - pos;
-    char * retval = new char[size + 1];
-    memset(retval, 0, size + 1);
+    const std::streamoff end = fp->tellg();
+    if (!fp->good() || pos < 0 || end < 0) luaL_error(L, "Could not read file");
+    // the file may have been truncated since the handle's position was set
+    std::string retval((size_t)std::max(end - pos, (std::streamoff)0), '\0');
     fp->seekg(pos);
-    int i;
-    for (i = 0; !fp->eof() && i < size; i++) {
-        int c = fp->get();
-        if (c == EOF && fp->eof()) { size = i; break; }
-        if (c == '\n' && (i > 0 && retval[i-1] == '\r')) retval[--i] = '\n';
-        else retval[i] = (char)c;
-    }
-    const std::string out = makeASCIISafe(retval, i - (i == size ? 0 : 1));
-    delete[] retval;
+    fp->read(&retval[0], retval.size());
+    const size_t len = convertCRLF(&retval[0], fp->gcount());
+    // handles have always reached EOF here if any line endings were converted
+    if (len < retval.size()) fp->setstate(std::ios::eofbit | std::ios::failbit);
+    const std::string out = makeASCIISafe(retval.c_str(), len);
     lua_pushlstring(L, out.c_str(), out.length());
     return 1;
 }
@@ -99,13 +115,53 @@ int fs_handle_readLine(lua_State *L) {
     if (fp == NULL) return luaL_error(L, "attempt to use a closed file");
     if (fp->eof()) return 0;
     if (!fp->good()) luaL_error(L, "Could not read file");
+    const bool binary = lua_toboolean(L, lua_upvalueindex(2));
     std::string retval;
-    std::getline(*fp, retval);
-    if (retval.empty() && fp->eof()) return 0;
-    if (*retval.rbegin() == '\r' && !lua_toboolean(L, lua_upvalueindex(2))) retval = retval.substr(0, retval.size()-1);
-    if (lua_toboolean(L, 1) && fp->good()) retval += '\n';
-    const std::string out = lua_toboolean(L, lua_upvalueindex(2)) ? retval : makeASCIISafe(retval.c_str(), retval.size());
-    lua_pushlstring(L, out.c_str(), out.length());
+    const char * line = NULL; // Either in the handle's buffer or in retval
+    size_t len = 0;
+    HandleBuffer * buf = dynamic_cast<HandleBuffer*>(fp->rdbuf());
+    if (buf != NULL) {
+        // same as getline, but a whole buffer at a time
+        bool found = false;
+        while (buf->fill()) {
+            const char * start = buf->data();
+            const char * nl = (const char*)memchr(start, '\n', buf->available());
+            const size_t n = nl != NULL ? nl - start : buf->available();
+            // a line that's all in the buffer is used from there without copying
+            if (nl != NULL && retval.empty()) {
+                line = start;
+                len = n;
+            } else retval.append(start, n);
+            buf->consume(nl != NULL ? n + 1 : n);
+            if (nl != NULL) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) fp->setstate(retval.empty() ? std::ios::eofbit | std::ios::failbit : std::ios::eofbit);
+    } else std::getline(*fp, retval);
+    if (line == NULL) {
+        line = retval.data();
+        len = retval.size();
+    }
+    if (len == 0 && fp->eof()) return 0;
+    if (len > 0 && line[len-1] == '\r' && !binary) len--;
+    if (lua_toboolean(L, 1) && fp->good()) {
+        // the newline is still right after an unchanged line in the buffer
+        if (line != retval.data() && line[len] == '\n') len++;
+        else {
+            if (line != retval.data()) retval.assign(line, len);
+            else retval.resize(len);
+            retval += '\n';
+            line = retval.data();
+            len = retval.size();
+        }
+    }
+    if (binary) lua_pushlstring(L, line, len);
+    else {
+        const std::string out = makeASCIISafe(line, len);
+        lua_pushlstring(L, out.c_str(), out.length());
+    }
     return 1;
 }
 
@@ -116,23 +172,45 @@ int fs_handle_readChar(lua_State *L) {
     if (fp->eof()) return 0;
     if (!fp->good()) luaL_error(L, "Could not read file");
     std::string retval;
-    for (int i = 0; i < luaL_optinteger(L, 1, 1) && !fp->eof(); i++) {
+    const lua_Integer count = luaL_optinteger(L, 1, 1);
+    std::streambuf * sb = fp->rdbuf();
+    HandleBuffer * buf = dynamic_cast<HandleBuffer*>(sb);
+    // reads straight from the buffer so each byte doesn't need a stream sentry; the stream state is kept the same as with get()
+    const auto get = [fp, sb]()->int {
+        const int c = sb->sbumpc();
+        if (c == EOF) fp->setstate(std::ios::eofbit | std::ios::failbit);
+        return c;
+    };
+    for (lua_Integer i = 0; i < count && !fp->eof(); i++) {
+        if (buf != NULL && buf->available() > 0) {
+            // copy any run of plain ASCII at once
+            const char * start = buf->data();
+            const size_t avail = std::min(buf->available(), (size_t)(count - i));
+            size_t n = 0;
+            while (n < avail && (unsigned char)start[n] < 0x80 && start[n] != '\r') n++;
+            if (n > 0) {
+                retval.append(start, n);
+                buf->consume(n);
+                i += n - 1;
+                continue;
+            }
+        }
         uint32_t codepoint;
-        const int c = fp->get();
+        const int c = get();
         if (c == EOF) break;
         else if (c > 0x7F) {
             if (c & 64) {
-                const int c2 = fp->get();
+                const int c2 = get();
                 if (c2 == EOF) {retval += '?'; break;}
                 else if (c2 < 0x80 || c2 & 64) codepoint = 1U<<31;
                 else if (c & 32) {
-                    const int c3 = fp->get();
+                    const int c3 = get();
                     if (c3 == EOF) {retval += '?'; break;}
                     else if (c3 < 0x80 || c3 & 64) codepoint = 1U<<31;
                     else if (c & 16) {
                         if (c & 8) codepoint = 1U<<31;
                         else {
-                            const int c4 = fp->get();
+                            const int c4 = get();
                             if (c4 == EOF) {retval += '?'; break;}
                             else if (c4 < 0x80 || c4 & 64) codepoint = 1U<<31;
                             else codepoint = ((c & 0x7) << 18) | ((c2 & 0x3F) << 12) | ((c3 & 0x3F) << 6) | (c4 & 0x3F);
@@ -144,9 +222,9 @@ int fs_handle_readChar(lua_State *L) {
         if (codepoint > 255) retval += '?';
         else {
             if (codepoint == '\r') {
-                const int nextc = fp->get();
-                if (nextc == '\n') codepoint = nextc;
-                else fp->putback((char)nextc);
+                const int nextc = sb->sgetc();
+                if (nextc == '\n') codepoint = sb->sbumpc();
+                else if (nextc == EOF) fp->setstate(std::ios::eofbit | std::ios::failbit);
             }
             retval += (char)codepoint;
         }
@@ -175,8 +253,11 @@ int fs_handle_readByte(lua_State *L) {
         lua_pushlstring(L, retval, actual);
         delete[] retval;
     } else {
-        const int retval = fp->get();
-        if (retval == EOF || fp->eof()) return 0;
+        const int retval = fp->rdbuf()->sbumpc();
+        if (retval == EOF) {
+            fp->setstate(std::ios::eofbit | std::ios::failbit);
+            return 0;
+        }
         lua_pushinteger(L, (unsigned char)retval);
     }
     return 1;
@@ -188,16 +269,14 @@ int fs_handle_readAllByte(lua_State *L) {
     if (fp == NULL) return luaL_error(L, "attempt to use a closed file");
     if (fp->eof()) return 0;
     if (!fp->good()) luaL_error(L, "Could not read file");
-    std::streampos pos = fp->tellg();
+    const std::streamoff pos = fp->tellg();
     fp->seekg(0, std::ios_base::end);
-    size_t size = fp->tellg() - pos;
+    const std::streamoff end = fp->tellg();
+    if (!fp->good() || pos < 0 || end < 0) luaL_error(L, "Could not read file");
+    std::string str((size_t)std::max(end - pos, (std::streamoff)0), '\0');
     fp->seekg(pos, std::ios_base::beg);
-    char * str = (char*)malloc(size);
-    if (str == NULL) return luaL_error(L, "failed to allocate memory");
-    fp->read(str, size);
-    size = fp->gcount();
-    lua_pushlstring(L, str, size);
-    free(str);
+    fp->read(&str[0], str.size());
+    lua_pushlstring(L, str.c_str(), (size_t)fp->gcount());
     return 1;
 }
 
@@ -208,12 +287,13 @@ int fs_handle_writeString(lua_State *L) {
     if (lua_isnoneornil(L, 1)) return 0;
     else if (!lua_isstring(L, 1) && !lua_isnumber(L, 1)) luaL_typerror(L, 1, "string");
     if (fp->fail()) luaL_error(L, "Could not write file");
-    std::string str(lua_tostring(L, 1), lua_strlen(L, 1));
-    std::wstring wstr;
-    for (unsigned char c : str) wstr += (wchar_t)c;
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t> > converter;
-    const std::string newstr = converter.to_bytes(wstr);
-    fp->write(newstr.c_str(), newstr.size());
+    size_t len = 0;
+    const char * str = lua_tolstring(L, 1, &len);
+    if (isASCII(str, len)) fp->write(str, len);
+    else {
+        const std::string newstr = latin1ToUTF8(str, len);
+        fp->write(newstr.c_str(), newstr.size());
+    }
     return 0;
 }
 
@@ -224,12 +304,13 @@ int fs_handle_writeLine(lua_State *L) {
     if (lua_isnoneornil(L, 1)) return 0;
     else if (!lua_isstring(L, 1) && !lua_isnumber(L, 1)) luaL_typerror(L, 1, "string");
     if (fp->fail()) luaL_error(L, "Could not write file");
-    std::string str(lua_tostring(L, 1), lua_strlen(L, 1));
-    std::wstring wstr;
-    for (unsigned char c : str) wstr += (wchar_t)c;
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t> > converter;
-    const std::string newstr = converter.to_bytes(wstr);
-    fp->write(newstr.c_str(), newstr.size());
+    size_t len = 0;
+    const char * str = lua_tolstring(L, 1, &len);
+    if (isASCII(str, len)) fp->write(str, len);
+    else {
+        const std::string newstr = latin1ToUTF8(str, len);
+        fp->write(newstr.c_str(), newstr.size());
+    }
     fp->put('\n');
     return 0;
 }
@@ -255,13 +336,24 @@ int fs_handle_flush(lua_State *L) {
     lastCFunction = __func__;
     std::iostream * fp = *(std::iostream**)lua_touserdata(L, lua_upvalueindex(1));
     if (fp == NULL) luaL_error(L, "attempt to use a closed file");
-    fp->flush();
 #ifdef __EMSCRIPTEN__
+    fp->flush();
     queueTask([](void*)->void*{syncfs(); return NULL;}, NULL, true);
+#else
+    // flushes in quick succession are batched up, and written out when the computer next waits for an event
+    FileWriteBuffer * buf = dynamic_cast<FileWriteBuffer*>(fp->rdbuf());
+    if (buf == NULL) fp->flush();
+    else if (!buf->requestFlush()) get_comp(L)->pendingWrites.insert(buf);
 #endif
     return 0;
 }
 
+void flushPendingWrites(Computer * comp) {
+    if (comp->pendingWrites.empty()) return;
+    for (std::streambuf * buf : comp->pendingWrites) buf->pubsync();
+    comp->pendingWrites.clear();
+}
+
 int fs_handle_seek(lua_State *L) {
     lastCFunction = __func__;
     std::iostream * fp = *(std::iostream**)lua_touserdata(L, lua_upvalueindex(1));
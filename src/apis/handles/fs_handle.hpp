@@ -10,9 +10,11 @@
 
 #ifndef FS_HANDLE_HPP
 #define FS_HANDLE_HPP
+#include <cstddef>
 extern "C" {
 #include <lua.h>
 }
+struct Computer;
 extern int fs_handle_close(lua_State *L);
 extern int fs_handle_gc(lua_State *L);
 extern int fs_handle_readAll(lua_State *L);
@@ -25,4 +27,8 @@ extern int fs_handle_writeLine(lua_State *L);
 extern int fs_handle_writeByte(lua_State *L);
 extern int fs_handle_flush(lua_State *L);
 extern int fs_handle_seek(lua_State *L);
+// Converts CRLF line endings to LF in place, as text reads do, returning the new length.
+extern size_t convertCRLF(char * str, size_t len);
+// Writes out the data of any flushes that were put off.
+extern void flushPendingWrites(Computer * comp);
 #endif
\ No newline at end of file
@@ -57,11 +57,14 @@ static int mounter_unmount(lua_State *L) {
     bool found = false;
     for (auto it = computer->mounts.begin(); it != computer->mounts.end(); ++it) {
         if (pathc.size() == std::get<0>(*it).size() && std::equal(std::get<0>(*it).begin(), std::get<0>(*it).end(), pathc.begin())) {
+            const path_t real_path = std::get<1>(*it);
             it = computer->mounts.erase(it);
+            removeDiskImage(computer, real_path);
             found = true;
             if (it == computer->mounts.end()) break;
         }
     }
+    if (found) invalidateMountCache(computer);
     lua_pushboolean(L, found);
     return 1;
 }
@@ -80,7 +83,7 @@ static int mounter_list(lua_State *L) {
             lua_createtable(L, 1, 0); // table, entries
         }
         lua_pushinteger(L, lua_objlen(L, -1) + 1); // table, entries, index
-        if (std::regex_match(std::get<1>(m), std::basic_regex<path_t::value_type>(path_t("\\d+:").native()))) lua_pushfstring(L, "(virtual mount:%s)", std::get<1>(m).substr(0, std::get<1>(m).size()-1).c_str());
+        if (FileEntry::isMountID(std::get<1>(m))) lua_pushfstring(L, "(virtual mount:%s)", std::get<1>(m).substr(0, std::get<1>(m).size()-1).c_str());
         else lua_pushstring(L, path_t(std::get<1>(m)).string().c_str()); // table, entries, index, value
         lua_settable(L, -3); // table, entries
         lua_pushstring(L, ss.str().c_str()); // table, entries, key
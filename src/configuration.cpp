@@ -35,7 +35,7 @@ static void showMessage(const std::string& message) {
 }
 
 struct computer_configuration getComputerConfig(int id) {
-    struct computer_configuration cfg = {"", true, false, false, 0, 0};
+    struct computer_configuration cfg = {"", true, false, false, 0, 0, false};
     std::ifstream in(getBasePath() / "config" / (std::to_string(id) + ".json"));
     if (!in.is_open()) return cfg;
     if (in.peek() == std::ifstream::traits_type::eof()) { in.close(); return cfg; } // treat an empty file as if it didn't exist in the first place
@@ -73,6 +73,7 @@ struct computer_configuration getComputerConfig(int id) {
 #endif
     if (root.isMember("computerWidth")) cfg.computerWidth = root["computerWidth"].asInt();
     if (root.isMember("computerHeight")) cfg.computerHeight = root["computerHeight"].asInt();
+    if (root.isMember("syncOnClose")) cfg.syncOnClose = root["syncOnClose"].asBool();
     return cfg;
 }
 
@@ -85,6 +86,7 @@ void setComputerConfig(int id, const computer_configuration& cfg) {
     root["startFullscreen"] = cfg.startFullscreen;
     root["computerWidth"] = cfg.computerWidth;
     root["computerHeight"] = cfg.computerHeight;
+    root["syncOnClose"] = cfg.syncOnClose;
     std::ofstream out(getBasePath() / "config" / (std::to_string(id) + ".json"));
     out << root;
     out.close();
@@ -145,10 +147,12 @@ std::unordered_map<std::string, std::pair<int, int> > configSettings = {
     {"snooperEnabled", {2, 0}},
     {"computerWidth", {2, 1}},
     {"computerHeight", {2, 1}},
+    {"syncOnClose", {0, 0}},
     {"keepOpenOnShutdown", {0, 0}},
     {"useWebP", {0, 0}},
     {"dropFilePath", {0, 0}},
     {"useDFPWM", {0, 0}},
+    {"dedupStorage", {2, 0}},
 };
 
 const std::string hiddenOptions[] = {"customFontPath", "customFontScale", "customCharScale", "skipUpdate", "lastVersion", "pluginData", "http_proxy_server", "http_proxy_port", "cliControlKeyMode", "serverMode", "romReadOnly"};
@@ -229,6 +233,7 @@ void config_init() {
 #else
         false,
 #endif
+        false,
         false,
         false,
         false
@@ -347,6 +352,7 @@ void config_init() {
         readConfigSetting(useWebP, Bool);
         readConfigSetting(dropFilePath, Bool);
         readConfigSetting(useDFPWM, Bool);
+        readConfigSetting(dedupStorage, Bool);
         // for JIT: substr until the position of the first '-' in CRAFTOSPC_VERSION (todo: find a static way to determine this)
         if (onboardingMode == 0 && (!root.isMember("lastVersion") || root["lastVersion"].asString().substr(0, sizeof(CRAFTOSPC_VERSION) - 1) != CRAFTOSPC_VERSION)) { onboardingMode = 2; config_save(); }
 #ifndef __EMSCRIPTEN__
@@ -432,6 +438,7 @@ void config_save() {
     root["useWebP"] = config.useWebP;
     root["dropFilePath"] = config.dropFilePath;
     root["useDFPWM"] = config.useDFPWM;
+    root["dedupStorage"] = config.dedupStorage;
     root["lastVersion"] = CRAFTOSPC_VERSION;
     Value pluginRoot;
     for (const auto& e : config.pluginData) pluginRoot[e.first] = e.second;
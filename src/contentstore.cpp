@@ -0,0 +1,247 @@
+/*
+ * contentstore.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the content store, which keeps one copy of each file
+ * that many computers have.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+/*
+ * Store layout
+ *
+ *   <root>/<first 2 hex digits>/<other 62 hex digits>
+ *                an object: the contents whose SHA-256 hash is the two
+ *                joined together, with one more link for each file using it
+ *   <root>/tmp/  links and copies being made, which are renamed into place
+ *                once they're done; names start with a random number for
+ *                each process, so processes sharing the store never clash
+ *   <root>/added/<SHA-256 hash of a path>
+ *                an empty file whose modification time is when add() last
+ *                finished with that path; files that haven't changed since
+ *                then were already added (or couldn't be), so they're skipped
+ *
+ * Objects are never changed once they're made. An object is added by linking
+ * the file with its contents into the store; a file that matches an object
+ * the store already has is replaced by linking the object to a temporary name,
+ * then renaming that over the file. If the object is collected in between,
+ * the link fails, and the file is added as a new object instead.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <Poco/SHA2Engine.h>
+#include "contentstore.hpp"
+#include "filecopy.hpp"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Leftover temporary files are only removed once they haven't been touched for this long.
+static constexpr std::chrono::hours tempLifetime {1};
+
+static const std::string tempPrefix = std::to_string(std::random_device()());
+static std::atomic<unsigned> nextTemp {0};
+
+fs::path ContentStore::objectPath(const std::string& name) const {
+    return root / name.substr(0, 2) / name.substr(2);
+}
+
+fs::path ContentStore::addedPath(const fs::path& path) const {
+    std::error_code e;
+    Poco::SHA2Engine engine(Poco::SHA2Engine::SHA_256);
+    engine.update(fs::absolute(path, e).lexically_normal().string());
+    return root / "added" / Poco::DigestEngine::digestToHex(engine.digest());
+}
+
+fs::path ContentStore::tempPath() const {
+    return root / "tmp" / (tempPrefix + "-" + std::to_string(nextTemp++));
+}
+
+// Hard links can't cross filesystems, so files anywhere else can never be linked to an object.
+bool ContentStore::onStoreDevice(const fs::path& path) const {
+#ifdef _WIN32
+    std::error_code e;
+    return fs::absolute(path, e).root_name() == fs::absolute(root, e).root_name();
+#else
+    struct stat pathStat, rootStat;
+    return stat(path.c_str(), &pathStat) == 0 && stat(root.c_str(), &rootStat) == 0 && pathStat.st_dev == rootStat.st_dev;
+#endif
+}
+
+// Whether a file is linked to the object for its contents, rather than only to other files.
+bool ContentStore::isObject(const fs::path& path) const {
+    if (!onStoreDevice(path)) return false;
+    std::error_code e;
+    const std::string name = hash(path, e);
+    if (e) return false;
+    const bool retval = fs::equivalent(path, objectPath(name), e);
+    return retval && !e;
+}
+
+std::string ContentStore::hash(const fs::path& path, std::error_code& e) {
+    e.clear();
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        e = std::make_error_code(std::errc::no_such_file_or_directory);
+        return "";
+    }
+    Poco::SHA2Engine engine(Poco::SHA2Engine::SHA_256);
+    char buf[65536];
+    while (in.read(buf, sizeof(buf)) || in.gcount() > 0) engine.update(buf, (unsigned)in.gcount());
+    if (in.bad()) {
+        e = std::make_error_code(std::errc::io_error);
+        return "";
+    }
+    return Poco::DigestEngine::digestToHex(engine.digest());
+}
+
+int64_t ContentStore::addFile(const fs::path& path, int64_t size, std::error_code& e) const {
+    const std::string name = hash(path, e);
+    if (e) return 0;
+    const fs::path object = objectPath(name);
+    fs::create_directories(object.parent_path(), e);
+    if (e) return 0;
+    // the object may be collected between finding it and linking it, which is tried again; a third try means something else is wrong
+    for (int tries = 0; tries < 3; tries++) {
+        // contents the store doesn't have yet are added by making the file itself the object
+        fs::create_hard_link(path, object, e);
+        if (e != std::errc::file_exists) return 0;
+        e.clear();
+        const fs::path temp = tempPath();
+        fs::create_hard_link(object, temp, e);
+        if (e == std::errc::no_such_file_or_directory) continue;
+        // filesystems limit how many links a file can have, so once an object has that many, the rest of the copies keep their own contents
+        if (e == std::errc::too_many_links) {
+            e.clear();
+            return 0;
+        }
+        if (e) return 0;
+        fs::rename(temp, path, e);
+        if (e) {
+            std::error_code e2;
+            fs::remove(temp, e2);
+            return 0;
+        }
+        return size;
+    }
+    e = std::make_error_code(std::errc::resource_unavailable_try_again);
+    return 0;
+}
+
+int64_t ContentStore::add(const fs::path& path, std::error_code& e, const std::atomic<bool>& cancel) const {
+    e.clear();
+    fs::create_directories(root / "tmp", e);
+    if (e) return 0;
+    // otherwise every file would be hashed only for the link to fail, every time
+    if (!onStoreDevice(path)) return 0;
+    int64_t saved = 0;
+    if (fs::is_regular_file(path, e)) {
+        const uintmax_t size = fs::file_size(path, e);
+        if (!e && size > 0 && fs::hard_link_count(path, e) == 1) saved = addFile(path, size, e);
+        return saved;
+    }
+    // only files changed since the last time this tree was added need hashing
+    const fs::path added = addedPath(path);
+    std::error_code e2;
+    const fs::file_time_type start = fs::file_time_type::clock::now();
+    const fs::file_time_type since = fs::exists(added, e2) ? fs::last_write_time(added, e2) : fs::file_time_type::min();
+    if (e2) e2.clear();
+    for (fs::recursive_directory_iterator it(path, e), end; !e && it != end; it.increment(e)) {
+        if (cancel) {
+            e = std::make_error_code(std::errc::operation_canceled);
+            break;
+        }
+        if (!it->is_regular_file(e2) || it->is_symlink(e2)) continue;
+        const uintmax_t size = it->file_size(e2);
+        if (e2 || size == 0) continue;
+        if (it->hard_link_count(e2) != 1 || e2) continue;
+        if (it->last_write_time(e2) < since || e2) continue;
+        // a file that can't be added keeps its own contents, and the rest are still added
+        saved += addFile(it->path(), size, e2);
+    }
+    if (!e) {
+        // the time is from before the walk, so files changed during it are looked at again next time
+        fs::create_directories(added.parent_path(), e2);
+        if (!e2) std::ofstream(added, std::ios::binary);
+        fs::last_write_time(added, start, e2);
+    }
+    return saved;
+}
+
+void ContentStore::unshare(const fs::path& path, bool keep, std::error_code& e) const {
+    e.clear();
+    if (!fs::is_regular_file(path, e) || fs::hard_link_count(path, e) <= 1 || !isObject(path)) {
+        e.clear();
+        return;
+    }
+    if (!keep) {
+        fs::remove(path, e);
+        return;
+    }
+    // the copy is made on the side and renamed over the file, so the file always has all of its contents
+    static const std::atomic<bool> cancel {false};
+    const fs::path temp = tempPath();
+    fs::create_directories(temp.parent_path(), e);
+    if (e) return;
+    copyTree(path, temp, e, cancel);
+    if (!e) fs::rename(temp, path, e);
+    if (e) {
+        std::error_code e2;
+        fs::remove(temp, e2);
+    }
+}
+
+int64_t ContentStore::collect(std::error_code& e) const {
+    e.clear();
+    int64_t freed = 0;
+    for (fs::directory_iterator dir(root, e), end; !e && dir != end; dir.increment(e)) {
+        std::error_code e2;
+        if (dir->path().filename() == "tmp" || dir->path().filename() == "added" || !dir->is_directory(e2)) continue;
+        for (fs::directory_iterator it(dir->path(), e2); !e2 && it != end; it.increment(e2)) {
+            std::error_code e3;
+            if (it->hard_link_count(e3) != 1 || e3) continue;
+            const uintmax_t size = it->file_size(e3);
+            // a file being added may link it again after this, which fails, and adds the file as the object again
+            if (fs::remove(it->path(), e3)) freed += size;
+        }
+    }
+#ifndef _WIN32
+    // temporary files are left behind if a process stops part way through a change; linking or
+    // renaming a file updates its status change time, so it shows how long since one was last used
+    const auto now = std::chrono::system_clock::now();
+    std::error_code e2;
+    for (fs::directory_iterator it(root / "tmp", e2), end; !e2 && it != end; it.increment(e2)) {
+        struct stat st;
+        if (stat(it->path().c_str(), &st) != 0) continue;
+        if (now - std::chrono::system_clock::from_time_t(st.st_ctime) < tempLifetime) continue;
+        std::error_code e3;
+        fs::remove(it->path(), e3);
+    }
+#endif
+    return freed;
+}
+
+ContentStore::Stats ContentStore::stats() const {
+    Stats st;
+    std::error_code e;
+    for (fs::directory_iterator dir(root, e), end; !e && dir != end; dir.increment(e)) {
+        std::error_code e2;
+        if (dir->path().filename() == "tmp" || dir->path().filename() == "added" || !dir->is_directory(e2)) continue;
+        for (fs::directory_iterator it(dir->path(), e2); !e2 && it != end; it.increment(e2)) {
+            std::error_code e3;
+            const uintmax_t links = it->hard_link_count(e3), size = it->file_size(e3);
+            if (e3) continue;
+            st.objects++;
+            st.links += links - 1;
+            st.stored += size;
+            st.linked += size * (links - 1);
+        }
+    }
+    return st;
+}
@@ -0,0 +1,76 @@
+/*
+ * contentstore.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the content store, which keeps one copy of each file that
+ * many computers have.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef CONTENTSTORE_HPP
+#define CONTENTSTORE_HPP
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+/*
+ * Keeps the contents of each distinct file once, for every computer that has
+ * a copy of it. Each object in the store is named by the SHA-256 hash of its
+ * contents, and computers' directories hold hard links to the objects instead
+ * of copies of their own, so a computer's directory is its index from paths to
+ * contents, and an object's link count is how many files use it. Objects that
+ * only the store links to aren't used any more, and are removed by collect().
+ *
+ * A file that's linked to an object mustn't be changed in place, as that would
+ * change it for every computer, so unshare() gives it its own copy first.
+ * Files with other hard links, like ones the user made in a mounted directory,
+ * are left alone. The store has to be on the same filesystem as the
+ * directories that use it; add() skips any that aren't.
+ *
+ * Every change is made with a single link or rename, so any number of threads
+ * and processes can use the same store at once, and a crash at any point
+ * leaves every file with its contents. The one thing that isn't safe is
+ * writing to a directory while add() is moving it into the store.
+ */
+class ContentStore {
+public:
+    struct Stats {
+        int64_t objects = 0; // The number of objects in the store
+        int64_t links = 0;   // The number of files linked to them
+        int64_t stored = 0;  // The bytes the objects take up
+        int64_t linked = 0;  // The bytes the linked files would take up without the store
+    };
+
+    const std::filesystem::path root;
+
+    explicit ContentStore(const std::filesystem::path& root): root(root) {}
+    // Links every file under a path to the object with its contents, adding
+    // the object if the store doesn't have one yet. Files that are already
+    // shared, empty files, and files that haven't changed since the last add
+    // of the same directory are left as they are, as is everything if the
+    // path is on a different filesystem from the store. Returns the number of
+    // bytes that no longer need a copy of their own.
+    int64_t add(const std::filesystem::path& path, std::error_code& e, const std::atomic<bool>& cancel) const;
+    // Gives a file that's linked to an object its own copy of its contents, so
+    // it can be changed in place. If keep is false, the file is removed
+    // instead, as it's about to be replaced anyway.
+    void unshare(const std::filesystem::path& path, bool keep, std::error_code& e) const;
+    // Removes the objects no file links to any more. Returns the number of bytes freed.
+    int64_t collect(std::error_code& e) const;
+    Stats stats() const;
+    // Returns the hash of a file's contents as hex, which names its object.
+    static std::string hash(const std::filesystem::path& path, std::error_code& e);
+private:
+    std::filesystem::path objectPath(const std::string& name) const;
+    std::filesystem::path tempPath() const;
+    std::filesystem::path addedPath(const std::filesystem::path& path) const;
+    bool onStoreDevice(const std::filesystem::path& path) const;
+    bool isObject(const std::filesystem::path& path) const;
+    int64_t addFile(const std::filesystem::path& path, int64_t size, std::error_code& e) const;
+};
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * dircache.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the cache of directory listings used by fs.list and
+ * fs.find, and the wildcard patterns fs.find matches against them.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include "dircache.hpp"
+#ifdef __linux__
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+/*
+ * Every cache shares one inotify instance, as there are only 128 of them per
+ * user by default, and a process can run more computers than that. Adding a
+ * watch on a directory that's already watched gives back the same descriptor,
+ * so each descriptor keeps the set of caches using it, and is only removed
+ * once none are. Whichever cache reads the events hands each one to the
+ * caches watching its descriptor, which act on them the next time they poll.
+ */
+struct WatchHub {
+    std::mutex lock;
+    int fd = -1;
+    std::unordered_map<int, std::unordered_set<DirectoryCache*> > watchers;
+    std::unordered_map<DirectoryCache*, std::vector<std::pair<int, uint32_t> > > pending; // Events each cache hasn't seen yet (wd, mask)
+};
+
+// Never freed, so caches freed during exit can still use it.
+static WatchHub * hub = new WatchHub;
+#endif
+
+DirectoryCache::DirectoryCache() {
+#ifdef __linux__
+    std::lock_guard<std::mutex> lock(hub->lock);
+    if (hub->fd < 0) {
+        static bool warned = false;
+        hub->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (hub->fd < 0 && !warned) {
+            fprintf(stderr, "Warning: Could not start watching directories (%s); directory listings won't be cached\n", strerror(errno));
+            warned = true;
+        }
+    }
+    fd = hub->fd;
+    if (fd >= 0) hub->pending[this];
+#endif
+}
+
+DirectoryCache::~DirectoryCache() {
+#ifdef __linux__
+    if (fd < 0) return;
+    std::lock_guard<std::mutex> lock(hub->lock);
+    for (const auto& w : watches) unwatch(w.first);
+    hub->pending.erase(this);
+#endif
+}
+
+DirectoryCache::Listing DirectoryCache::read(const std::filesystem::path& path) {
+    std::error_code e;
+    if (!std::filesystem::is_directory(path, e)) return NULL;
+    std::shared_ptr<std::vector<std::string> > names = std::make_shared<std::vector<std::string> >();
+    for (const auto& dir : std::filesystem::directory_iterator(path, e)) {
+        std::string name = dir.path().filename().string();
+        if (name == ".DS_Store" || name == "desktop.ini") continue;
+        names->push_back(std::move(name));
+    }
+    std::sort(names->begin(), names->end());
+    return names;
+}
+
+DirectoryCache::Listing DirectoryCache::list(const std::filesystem::path& path) {
+#ifdef __linux__
+    if (fd < 0) return read(path);
+    poll();
+    const std::string& key = path.native();
+    struct stat st;
+    const auto it = entries.find(key);
+    if (stat(key.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        if (it != entries.end()) drop(key);
+        return NULL;
+    }
+    if (it != entries.end()) {
+        if (it->second.dev == st.st_dev && it->second.ino == st.st_ino) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return it->second.names;
+        }
+        // something else was put in its place
+        drop(key);
+    }
+    // watch before reading, so changes made in between aren't missed
+    int wd;
+    {
+        std::lock_guard<std::mutex> lock(hub->lock);
+        wd = inotify_add_watch(fd, key.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (wd >= 0) hub->watchers[wd].insert(this);
+    }
+    Listing names = read(path);
+    if (wd < 0) return names; // out of watches, so this one can't be cached
+    if (names == NULL) {
+        if (watches.find(wd) == watches.end()) {
+            std::lock_guard<std::mutex> lock(hub->lock);
+            unwatch(wd);
+        }
+        return NULL;
+    }
+    lru.push_front(key);
+    entries[key] = {names, wd, (unsigned long long)st.st_dev, (unsigned long long)st.st_ino, lru.begin()};
+    watches[wd].insert(key);
+    if (entries.size() > maxEntries) drop(lru.back());
+    return names;
+#else
+    return read(path);
+#endif
+}
+
+void DirectoryCache::invalidate(const std::filesystem::path& path) {
+#ifdef __linux__
+    if (entries.empty()) return;
+    for (std::filesystem::path p = path; !p.empty();) {
+        drop(p.native());
+        std::filesystem::path parent = p.parent_path();
+        if (parent == p) break;
+        p = std::move(parent);
+    }
+    const std::string prefix = path.native() + (char)std::filesystem::path::preferred_separator;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+            const std::string key = (it++)->first;
+            drop(key);
+        } else ++it;
+    }
+#endif
+}
+
+void DirectoryCache::poll() {
+#ifdef __linux__
+    std::vector<std::pair<int, uint32_t> > events;
+    {
+        std::lock_guard<std::mutex> lock(hub->lock);
+        alignas(struct inotify_event) char buf[4096];
+        ssize_t n;
+        while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+            for (const char * p = buf; p < buf + n;) {
+                const struct inotify_event * ev = (const struct inotify_event *)p;
+                p += sizeof(struct inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    // events were lost, so no cache can trust anything
+                    for (auto& c : hub->pending) c.second.emplace_back(-1, IN_Q_OVERFLOW);
+                    continue;
+                }
+                const auto w = hub->watchers.find(ev->wd);
+                if (w == hub->watchers.end()) continue;
+                for (DirectoryCache * c : w->second) hub->pending[c].emplace_back(ev->wd, ev->mask);
+                // the kernel already removed the watch (e.g. the directory was deleted)
+                if (ev->mask & IN_IGNORED) hub->watchers.erase(w);
+            }
+        }
+        events.swap(hub->pending[this]);
+    }
+    for (const auto& ev : events) {
+        if (ev.second & IN_Q_OVERFLOW) {
+            std::lock_guard<std::mutex> lock(hub->lock);
+            for (const auto& w : watches) unwatch(w.first);
+            watches.clear();
+            entries.clear();
+            lru.clear();
+            continue;
+        }
+        const auto w = watches.find(ev.first);
+        if (w == watches.end()) continue;
+        if (ev.second & IN_IGNORED) {
+            for (const std::string& key : w->second) {
+                const auto it = entries.find(key);
+                lru.erase(it->second.lru);
+                entries.erase(it);
+            }
+            watches.erase(w);
+        } else {
+            const std::unordered_set<std::string> keys = w->second;
+            for (const std::string& key : keys) drop(key);
+        }
+    }
+#endif
+}
+
+void DirectoryCache::drop(const std::string& key) {
+#ifdef __linux__
+    const auto it = entries.find(key);
+    if (it == entries.end()) return;
+    lru.erase(it->second.lru);
+    const auto w = watches.find(it->second.wd);
+    if (w != watches.end()) {
+        w->second.erase(key);
+        if (w->second.empty()) {
+            std::lock_guard<std::mutex> lock(hub->lock);
+            unwatch(it->second.wd);
+            watches.erase(w);
+        }
+    }
+    entries.erase(it);
+#endif
+}
+
+#ifdef __linux__
+// Stops this cache using a watch, removing it once no cache is. Must be called with the hub locked.
+void DirectoryCache::unwatch(int wd) {
+    const auto w = hub->watchers.find(wd);
+    if (w == hub->watchers.end()) return;
+    w->second.erase(this);
+    if (w->second.empty()) {
+        inotify_rm_watch(fd, wd);
+        hub->watchers.erase(w);
+    }
+}
+#endif
+
+GlobPattern::GlobPattern(const std::string& pattern): pattern(pattern) {
+    const size_t first = pattern.find('*');
+    hasStar = first != std::string::npos;
+    if (hasStar) {
+        prefix = first;
+        suffix = pattern.size() - pattern.rfind('*') - 1;
+    }
+}
+
+bool GlobPattern::match(const std::string& name) const {
+    if (!hasStar) return name == pattern;
+    // most patterns are like *.lua, which the literal ends decide on their own
+    if (name.size() < prefix + suffix ||
+        name.compare(0, prefix, pattern, 0, prefix) != 0 ||
+        name.compare(name.size() - suffix, suffix, pattern, pattern.size() - suffix, suffix) != 0) return false;
+    // match the rest, backtracking to the last * when the text after it doesn't fit
+    const char * s = name.data(), * p = pattern.data();
+    const size_t n = name.size(), m = pattern.size();
+    size_t i = 0, j = 0, star = std::string::npos, mark = 0;
+    while (i < n) {
+        if (j < m && p[j] == '*') {
+            star = j++;
+            mark = i;
+        } else if (j < m && p[j] == s[i]) {
+            i++;
+            j++;
+        } else if (star != std::string::npos && s[mark] != '\n' && s[mark] != '\r') {
+            i = ++mark;
+            j = star + 1;
+        } else return false;
+    }
+    while (j < m && p[j] == '*') j++;
+    return j == m;
+}
@@ -0,0 +1,76 @@
+/*
+ * dircache.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the cache of directory listings used by fs.list and
+ * fs.find, and the wildcard patterns fs.find matches against them.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef DIRCACHE_HPP
+#define DIRCACHE_HPP
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Keeps the sorted entry names of recently listed directories. On Linux, each
+ * cached directory is watched with inotify (one instance shared by every
+ * cache), and the events are read before every lookup, so changes from
+ * anywhere (other programs included) drop the stale listing. A directory that's been replaced by another at the same path
+ * is caught by comparing inode numbers. The fs API also drops the listings it
+ * changes itself. Other platforms have no cheap way to learn about outside
+ * changes, so they don't cache anything and list the directory every time.
+ */
+class DirectoryCache {
+public:
+    typedef std::shared_ptr<const std::vector<std::string> > Listing;
+    static constexpr size_t maxEntries = 1024;
+    DirectoryCache();
+    ~DirectoryCache();
+    // Returns the names in a directory, skipping .DS_Store and desktop.ini; NULL if it isn't a directory.
+    Listing list(const std::filesystem::path& path);
+    // Drops the listings of a path, everything under it, and (as making it may have made them too) everything above it.
+    void invalidate(const std::filesystem::path& path);
+    // Reads a directory without the cache.
+    static Listing read(const std::filesystem::path& path);
+private:
+    struct Entry {
+        Listing names;
+        int wd;
+        unsigned long long dev, ino; // The directory that was listed
+        std::list<std::string>::iterator lru;
+    };
+    int fd = -1; // The shared inotify descriptor, or -1 if listings aren't cached
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<int, std::unordered_set<std::string> > watches; // Two paths can lead to the same directory, and share a watch
+    std::list<std::string> lru; // Most recently used first
+    void poll();
+    void drop(const std::string& key);
+    void unwatch(int wd);
+};
+
+/*
+ * A compiled fs.find pattern for one path component: * matches any run of
+ * characters except line breaks (as the regex it replaced did), and everything
+ * else matches itself.
+ */
+class GlobPattern {
+public:
+    explicit GlobPattern(const std::string& pattern);
+    bool match(const std::string& name) const;
+    bool isLiteral() const {return !hasStar;}
+    const std::string& str() const {return pattern;}
+private:
+    std::string pattern;
+    bool hasStar;
+    size_t prefix = 0, suffix = 0; // Lengths of the literal text before the first * and after the last
+};
+
+#endif
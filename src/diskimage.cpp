@@ -0,0 +1,861 @@
+/*
+ * diskimage.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements disk images, which hold a whole computer or disk in one
+ * file on the host.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+/*
+ * Image format
+ *
+ * All integers are little-endian. The image is split into 512-byte blocks.
+ *
+ *   block 0      two 64-byte header slots, at offsets 0 and 64; an index is
+ *                written to the slot for its generation modulo 2, and the
+ *                valid slot with the highest generation is used
+ *   header slot  "CCDSKIM" + version byte (1), u64 generation, u64 first
+ *                block of the index, u64 index size in bytes, u32 block size
+ *                (512), u32 checksum of the index, 20 reserved bytes, u32
+ *                checksum of the first 60 bytes of the slot
+ *   index        u32 entry count, then per entry: u16 path length, path
+ *                (relative to the root, with "/" between components), u8
+ *                flags (1 = directory), u64 size, u64 first block of the
+ *                contents (0 if empty), i64 modification time in ms
+ *   contents     each file's contents start at the start of a block, and fill
+ *                as many blocks after it as they need
+ *
+ * Entries are sorted by path, so a directory's entry always comes before the
+ * entries inside it. Checksums are 32-bit FNV-1a. Blocks that no entry (or the
+ * index) uses are free, and are handed out again first-fit.
+ *
+ * A new index and the contents it points to are flushed to the disk before
+ * the slot pointing to it is written, and the blocks an index used are only
+ * handed out again once the slot that replaced it has been flushed too. The
+ * contents have no checksum, so this ordering is what keeps a power cut from
+ * leaving a slot that points to blocks that were never written.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "diskimage.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __EMSCRIPTEN__
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+static const char imageMagic[8] = {'C', 'C', 'D', 'S', 'K', 'I', 'M', 1};
+static constexpr size_t slotSize = 64, indexEntrySize = 27;
+
+static std::mutex openImagesLock;
+static std::map<fs::path, std::weak_ptr<DiskImage> > openImages;
+
+static uint16_t read16(const uint8_t * p) {return p[0] | (p[1] << 8);}
+static uint32_t read32(const uint8_t * p) {return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);}
+static uint64_t read64(const uint8_t * p) {return read32(p) | ((uint64_t)read32(p + 4) << 32);}
+
+static void write16(std::string& out, uint16_t n) {out += (char)n; out += (char)(n >> 8);}
+static void write32(std::string& out, uint32_t n) {write16(out, n & 0xFFFF); write16(out, n >> 16);}
+static void write64(std::string& out, uint64_t n) {write32(out, n & 0xFFFFFFFF); write32(out, n >> 32);}
+
+static uint32_t checksum(const char * data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    return hash;
+}
+
+static uint64_t blocksFor(uint64_t size) {return (size + DiskImage::blockSize - 1) / DiskImage::blockSize;}
+
+static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::string join(const std::string& dir, const std::string& name) {return dir.empty() ? name : dir + "/" + name;}
+
+static std::string parentName(const std::string& path) {
+    const size_t pos = path.rfind('/');
+    return pos == std::string::npos ? std::string() : path.substr(0, pos);
+}
+
+static std::string baseName(const std::string& path) {
+    const size_t pos = path.rfind('/');
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+namespace {
+struct HeapContents: public DiskImage::Contents {
+    std::string buffer;
+};
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+struct MappedContents: public DiskImage::Contents {
+    void * mapping = NULL;
+    size_t length = 0;
+    std::shared_ptr<int> pin;
+    ~MappedContents() {munmap(mapping, length);}
+};
+#endif
+}
+
+DiskImage::~DiskImage() {
+    std::error_code e;
+    if (dirty) commit(e);
+#ifdef _WIN32
+    if (handle != NULL) {
+        if (canWrite) FlushFileBuffers(handle);
+        CloseHandle(handle);
+    }
+#else
+    if (fd >= 0) {
+        if (canWrite) fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+bool DiskImage::readAt(uint64_t offset, char * data, size_t size) const {
+#ifdef _WIN32
+    while (size > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD n = 0;
+        if (!ReadFile(handle, data, (DWORD)std::min<size_t>(size, 0x40000000), &n, &ov) || n == 0) return false;
+        data += n; size -= n; offset += n;
+    }
+#else
+    while (size > 0) {
+        const ssize_t n = pread(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n; size -= n; offset += n;
+    }
+#endif
+    return true;
+}
+
+bool DiskImage::flush() {
+#ifdef _WIN32
+    return FlushFileBuffers(handle);
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+bool DiskImage::writeAt(uint64_t offset, const char * data, size_t size) {
+#ifdef _WIN32
+    while (size > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD n = 0;
+        if (!WriteFile(handle, data, (DWORD)std::min<size_t>(size, 0x40000000), &n, &ov) || n == 0) return false;
+        data += n; size -= n; offset += n;
+    }
+#else
+    while (size > 0) {
+        const ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n; size -= n; offset += n;
+    }
+#endif
+    return true;
+}
+
+std::shared_ptr<DiskImage> DiskImage::open(const fs::path& path, bool create, std::error_code& e) {
+    e.clear();
+    const bool exists = fs::exists(path, e);
+    if (e) return NULL;
+    if (!exists && !create) {
+        e = std::make_error_code(std::errc::no_such_file_or_directory);
+        return NULL;
+    }
+    const fs::path key = fs::weakly_canonical(path, e);
+    if (e) return NULL;
+    std::lock_guard<std::mutex> lock(openImagesLock);
+    const auto it = openImages.find(key);
+    if (it != openImages.end()) {
+        std::shared_ptr<DiskImage> image = it->second.lock();
+        if (image) return image;
+    }
+    std::shared_ptr<DiskImage> image(new DiskImage());
+    image->imagePath = path;
+#ifdef _WIN32
+    image->handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (image->handle == INVALID_HANDLE_VALUE && exists) {
+        image->canWrite = false;
+        image->handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if (image->handle == INVALID_HANDLE_VALUE) {
+        image->handle = NULL;
+        e = std::error_code(GetLastError(), std::system_category());
+        return NULL;
+    }
+#else
+    image->fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (image->fd < 0 && exists && (errno == EACCES || errno == EROFS)) {
+        image->canWrite = false;
+        image->fd = ::open(path.c_str(), O_RDONLY);
+    }
+    if (image->fd < 0) {
+        e = std::error_code(errno, std::generic_category());
+        return NULL;
+    }
+#endif
+    if (!exists || fs::file_size(path, e) == 0) {
+        // a new image is an empty header and an empty root
+        const std::string header(blockSize, 0);
+        image->entries[""].isDir = true;
+        if (!image->canWrite || !image->writeAt(0, header.data(), header.size())) e = std::make_error_code(std::errc::io_error);
+        else image->commit(e);
+    } else if (!image->load()) e = std::make_error_code(std::errc::invalid_argument);
+    if (e) return NULL;
+    openImages[key] = image;
+    return image;
+}
+
+bool DiskImage::isImage(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(imageMagic)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, imageMagic, sizeof(magic)) == 0;
+}
+
+void DiskImage::pack(const fs::path& dir, const fs::path& path, std::error_code& e) {
+    static const std::atomic<bool> cancel {false};
+    e.clear();
+    if (!fs::is_directory(dir, e)) {
+        if (!e) e = std::make_error_code(std::errc::not_a_directory);
+        return;
+    }
+    if (fs::exists(path, e) || e) {
+        if (!e) e = std::make_error_code(std::errc::file_exists);
+        return;
+    }
+    const std::shared_ptr<DiskImage> image = open(path, true, e);
+    if (e) return;
+    image->importTree(dir, "", e, cancel);
+    if (!e) image->sync(e);
+}
+
+void DiskImage::unpack(const fs::path& path, const fs::path& dir, std::error_code& e) {
+    static const std::atomic<bool> cancel {false};
+    e.clear();
+    if (fs::exists(dir, e) || e) {
+        if (!e) e = std::make_error_code(std::errc::file_exists);
+        return;
+    }
+    const std::shared_ptr<DiskImage> image = open(path, false, e);
+    if (e) return;
+    image->exportTree("", dir, e, cancel);
+}
+
+bool DiskImage::load() {
+    uint8_t header[slotSize * 2];
+    if (!readAt(0, (char*)header, sizeof(header))) return false;
+    // try the newest index first, and fall back to the one before it if it didn't get written out whole
+    std::vector<const uint8_t*> slots;
+    for (const uint8_t * slot : {header, header + slotSize})
+        if (memcmp(slot, imageMagic, sizeof(imageMagic)) == 0 && read32(slot + slotSize - 4) == checksum((const char*)slot, slotSize - 4) && read32(slot + 32) == blockSize)
+            slots.push_back(slot);
+    std::sort(slots.begin(), slots.end(), [](const uint8_t * a, const uint8_t * b)->bool {return read64(a + 8) > read64(b + 8);});
+    std::error_code e;
+    const uint64_t fileBlocks = std::max<uint64_t>(blocksFor(fs::file_size(imagePath, e)), 1);
+    if (e) return false;
+    for (const uint8_t * slot : slots) {
+        const uint64_t gen = read64(slot + 8), block = read64(slot + 16), size = read64(slot + 24);
+        if (block == 0 || block >= fileBlocks || blocksFor(size) > fileBlocks - block || size < 4) continue;
+        std::string index(size, 0);
+        if (!readAt(block * blockSize, &index[0], size) || checksum(index.data(), size) != read32(slot + 36)) continue;
+        const uint8_t * p = (const uint8_t*)index.data(), * end = p + size;
+        const uint32_t count = read32(p);
+        p += 4;
+        std::unordered_map<std::string, Entry> found;
+        found[""].isDir = true;
+        // each run of blocks in use, to find the free ones between them
+        std::vector<std::pair<uint64_t, uint64_t> > runs = {{block, blocksFor(size)}};
+        uint64_t bytes = 0;
+        bool ok = true;
+        for (uint32_t i = 0; i < count && ok; i++) {
+            if ((size_t)(end - p) < 2 || (size_t)(end - p) < 2 + (size_t)read16(p) + indexEntrySize - 2) {ok = false; break;}
+            const uint16_t length = read16(p);
+            const std::string name((const char*)p + 2, length);
+            p += 2 + length;
+            Entry entry;
+            entry.isDir = *p & 1;
+            entry.size = read64(p + 1);
+            entry.block = read64(p + 9);
+            entry.modified = (int64_t)read64(p + 17);
+            p += indexEntrySize - 2;
+            const auto parent = found.find(parentName(name));
+            if (name.empty() || baseName(name).empty() || found.find(name) != found.end() || parent == found.end() || !parent->second.isDir) ok = false;
+            else if (!entry.isDir && entry.size > 0) {
+                if (entry.block == 0 || entry.block >= fileBlocks || blocksFor(entry.size) > fileBlocks - entry.block) ok = false;
+                runs.push_back(std::make_pair(entry.block, blocksFor(entry.size)));
+                bytes += entry.size;
+            }
+            if (!ok) break;
+            parent->second.children.insert(baseName(name));
+            found.emplace(name, std::move(entry));
+        }
+        if (!ok || p != end) continue;
+        std::sort(runs.begin(), runs.end());
+        std::map<uint64_t, uint64_t> gaps;
+        uint64_t next = 1;
+        for (const auto& run : runs) {
+            if (run.first < next) {ok = false; break;} // two entries share blocks
+            if (run.first > next) gaps[next] = run.first - next;
+            next = run.first + run.second;
+        }
+        if (!ok) continue;
+        if (next < fileBlocks) gaps[next] = fileBlocks - next;
+        entries = std::move(found);
+        freeRuns = std::move(gaps);
+        blockCount = fileBlocks;
+        generation = gen;
+        indexBlock = block;
+        indexSize = size;
+        usedBytes = bytes;
+        return true;
+    }
+    return false;
+}
+
+void DiskImage::commit(std::error_code& e) {
+    dirty = false;
+    std::vector<std::unordered_map<std::string, Entry>::const_iterator> sorted;
+    sorted.reserve(entries.size());
+    for (auto it = entries.begin(); it != entries.end(); ++it) if (!it->first.empty()) sorted.push_back(it);
+    std::sort(sorted.begin(), sorted.end(), [](const std::unordered_map<std::string, Entry>::const_iterator& a, const std::unordered_map<std::string, Entry>::const_iterator& b)->bool {return a->first < b->first;});
+    std::string index;
+    write32(index, sorted.size());
+    for (const auto& it : sorted) {
+        write16(index, it->first.size());
+        index += it->first;
+        index += (char)(it->second.isDir ? 1 : 0);
+        write64(index, it->second.size);
+        write64(index, it->second.block);
+        write64(index, (uint64_t)it->second.modified);
+    }
+    const uint64_t blocks = blocksFor(index.size()), block = allocate(blocks);
+    std::string slot(imageMagic, sizeof(imageMagic));
+    write64(slot, generation + 1);
+    write64(slot, block);
+    write64(slot, index.size());
+    write32(slot, blockSize);
+    write32(slot, checksum(index.data(), index.size()));
+    slot.resize(slotSize - 4, 0);
+    write32(slot, checksum(slot.data(), slot.size()));
+    // the slot can only be written once everything it points to is on the disk
+    if (!writeAt(block * blockSize, index.data(), index.size()) || !flush() || !writeAt(((generation + 1) % 2) * slotSize, slot.data(), slot.size())) {
+        addFreeRun(block, blocks);
+        dirty = true;
+        e = std::make_error_code(std::errc::io_error);
+        return;
+    }
+    slotSynced = false;
+    release(indexBlock, indexSize);
+    generation++;
+    indexBlock = block;
+    indexSize = index.size();
+    // free blocks at the end of the image are given back to the host
+    reclaim();
+    const uint64_t oldCount = blockCount;
+    while (!freeRuns.empty() && std::prev(freeRuns.end())->first + std::prev(freeRuns.end())->second == blockCount) {
+        blockCount = std::prev(freeRuns.end())->first;
+        freeRuns.erase(std::prev(freeRuns.end()));
+    }
+    if (blockCount < oldCount) {
+#ifdef _WIN32
+        LARGE_INTEGER size;
+        size.QuadPart = blockCount * blockSize;
+        if (SetFilePointerEx(handle, size, NULL, FILE_BEGIN)) SetEndOfFile(handle);
+#else
+        if (ftruncate(fd, blockCount * blockSize) != 0) {} // the blocks are still free if this fails
+#endif
+    }
+}
+
+void DiskImage::addFreeRun(uint64_t block, uint64_t count) {
+    auto next = freeRuns.lower_bound(block);
+    if (next != freeRuns.begin()) {
+        const auto prev = std::prev(next);
+        if (prev->first + prev->second == block) {
+            block = prev->first;
+            count += prev->second;
+            freeRuns.erase(prev);
+        }
+    }
+    if (next != freeRuns.end() && block + count == next->first) {
+        count += next->second;
+        freeRuns.erase(next);
+    }
+    freeRuns[block] = count;
+}
+
+void DiskImage::release(uint64_t block, uint64_t size) {
+    if (size > 0) released.push_back(std::make_pair(std::make_pair(block, blocksFor(size)), generation));
+}
+
+void DiskImage::reclaim() {
+    // the header only falls back to the index before the newest one, so runs that one used can't be overwritten until it's been replaced
+    if (released.empty() || mappings.use_count() > 1) return;
+    // until the newest slot is on the disk, a power cut could still fall back to the index before it
+    if (!slotSynced && std::any_of(released.begin(), released.end(), [this](const std::pair<std::pair<uint64_t, uint64_t>, uint64_t>& r)->bool {return r.second < generation;})) {
+        if (!flush()) return;
+        slotSynced = true;
+    }
+    auto keep = released.begin();
+    for (auto it = released.begin(); it != released.end(); ++it) {
+        if (it->second < generation) addFreeRun(it->first.first, it->first.second);
+        else *keep++ = *it;
+    }
+    released.erase(keep, released.end());
+}
+
+uint64_t DiskImage::allocate(uint64_t blocks) {
+    reclaim();
+    for (auto it = freeRuns.begin(); it != freeRuns.end(); ++it) {
+        if (it->second < blocks) continue;
+        const uint64_t block = it->first, rest = it->second - blocks;
+        freeRuns.erase(it);
+        if (rest > 0) freeRuns[block + blocks] = rest;
+        return block;
+    }
+    const uint64_t block = blockCount;
+    blockCount += blocks;
+    return block;
+}
+
+bool DiskImage::checkWritable(std::error_code& e) const {
+    e.clear();
+    if (!canWrite) e = std::make_error_code(std::errc::read_only_file_system);
+    return canWrite;
+}
+
+DiskImage::Entry * DiskImage::parentOf(const std::string& path, std::error_code& e) {
+    const auto it = entries.find(parentName(path));
+    if (it == entries.end()) e = std::make_error_code(std::errc::no_such_file_or_directory);
+    else if (!it->second.isDir) e = std::make_error_code(std::errc::not_a_directory);
+    else return &it->second;
+    return NULL;
+}
+
+bool DiskImage::stat(const std::string& path, Stat& st) const {
+    std::lock_guard<std::mutex> lk(lock);
+    const auto it = entries.find(path);
+    if (it == entries.end()) return false;
+    st.isDir = it->second.isDir;
+    st.size = it->second.size;
+    st.modified = it->second.modified;
+    return true;
+}
+
+DiskImage::Listing DiskImage::list(const std::string& path) const {
+    std::lock_guard<std::mutex> lk(lock);
+    const auto it = entries.find(path);
+    if (it == entries.end() || !it->second.isDir) return NULL;
+    return std::make_shared<std::vector<std::string> >(it->second.children.begin(), it->second.children.end());
+}
+
+bool DiskImage::readLocked(const Entry& entry, std::string& data) const {
+    data.resize(entry.size);
+    return entry.size == 0 || readAt(entry.block * blockSize, &data[0], entry.size);
+}
+
+std::shared_ptr<const DiskImage::Contents> DiskImage::read(const std::string& path, std::error_code& e) const {
+    e.clear();
+    std::lock_guard<std::mutex> lk(lock);
+    const auto it = entries.find(path);
+    if (it == entries.end()) e = std::make_error_code(std::errc::no_such_file_or_directory);
+    else if (it->second.isDir) e = std::make_error_code(std::errc::is_a_directory);
+    if (e) return NULL;
+    const Entry& entry = it->second;
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    // big files are mapped instead; Windows can't unmap part of a view, and the web build has no mmap, so they read them in like everything else
+    if (entry.size >= mapThreshold) {
+        static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        const uint64_t offset = entry.block * blockSize, start = offset - offset % pageSize;
+        void * ptr = mmap(NULL, entry.size + (offset - start), PROT_READ, MAP_SHARED, fd, start);
+        if (ptr != MAP_FAILED) {
+            std::shared_ptr<MappedContents> contents = std::make_shared<MappedContents>();
+            contents->mapping = ptr;
+            contents->length = entry.size + (offset - start);
+            contents->data = (const char*)ptr + (offset - start);
+            contents->size = entry.size;
+            contents->pin = mappings;
+            return contents;
+        }
+    }
+#endif
+    std::shared_ptr<HeapContents> contents = std::make_shared<HeapContents>();
+    if (!readLocked(entry, contents->buffer)) {
+        e = std::make_error_code(std::errc::io_error);
+        return NULL;
+    }
+    contents->data = contents->buffer.data();
+    contents->size = contents->buffer.size();
+    return contents;
+}
+
+uint64_t DiskImage::measure(const std::string& path) const {
+    std::lock_guard<std::mutex> lk(lock);
+    const auto it = entries.find(path);
+    if (it == entries.end()) return 0;
+    if (path.empty()) return usedBytes;
+    uint64_t size = it->second.size;
+    // everything under a directory follows it in path order, but the entries aren't kept in order, so walk down instead
+    std::vector<std::string> queue;
+    if (it->second.isDir) queue.push_back(path);
+    while (!queue.empty()) {
+        const std::string dir = queue.back();
+        queue.pop_back();
+        for (const std::string& name : entries.at(dir).children) {
+            const std::string child = join(dir, name);
+            const Entry& entry = entries.at(child);
+            if (entry.isDir) queue.push_back(child);
+            else size += entry.size;
+        }
+    }
+    return size;
+}
+
+uint64_t DiskImage::used() const {
+    std::lock_guard<std::mutex> lk(lock);
+    return usedBytes;
+}
+
+void DiskImage::writeLocked(const std::string& path, const char * data, size_t size, std::error_code& e) {
+    Entry * parent = parentOf(path, e);
+    if (parent == NULL) return;
+    const auto it = entries.find(path);
+    if (path.empty() || (it != entries.end() && it->second.isDir)) {
+        e = std::make_error_code(std::errc::is_a_directory);
+        return;
+    }
+    uint64_t block = 0;
+    if (size > 0) {
+        block = allocate(blocksFor(size));
+        if (!writeAt(block * blockSize, data, size)) {
+            addFreeRun(block, blocksFor(size));
+            e = std::make_error_code(std::errc::io_error);
+            return;
+        }
+    }
+    Entry& entry = entries[path];
+    release(entry.block, entry.size);
+    usedBytes += size - entry.size;
+    entry.size = size;
+    entry.block = block;
+    entry.modified = now();
+    parent->children.insert(baseName(path));
+    dirty = true;
+}
+
+void DiskImage::makeDirLocked(const std::string& path, std::error_code& e) {
+    if (path.empty()) return;
+    const auto it = entries.find(path);
+    if (it != entries.end()) {
+        if (!it->second.isDir) e = std::make_error_code(std::errc::file_exists);
+        return;
+    }
+    makeDirLocked(parentName(path), e);
+    if (e) return;
+    Entry * parent = parentOf(path, e);
+    if (parent == NULL) return;
+    Entry& entry = entries[path];
+    entry.isDir = true;
+    entry.modified = now();
+    parent->children.insert(baseName(path));
+    dirty = true;
+}
+
+void DiskImage::removeLocked(const std::string& path) {
+    const auto it = entries.find(path);
+    if (it == entries.end()) return;
+    if (it->second.isDir) {
+        const std::set<std::string> children = it->second.children;
+        for (const std::string& name : children) removeLocked(join(path, name));
+    }
+    if (path.empty()) return; // the root stays, empty
+    release(it->second.block, it->second.size);
+    usedBytes -= it->second.size;
+    entries.erase(path);
+    entries.at(parentName(path)).children.erase(baseName(path));
+    dirty = true;
+}
+
+void DiskImage::renameLocked(const std::string& from, const std::string& to) {
+    const auto it = entries.find(from);
+    Entry entry = std::move(it->second);
+    entries.erase(it);
+    for (const std::string& name : entry.children) renameLocked(join(from, name), join(to, name));
+    entries.emplace(to, std::move(entry));
+}
+
+void DiskImage::write(const std::string& path, const char * data, size_t size, std::error_code& e) {
+    if (!checkWritable(e)) return;
+    std::lock_guard<std::mutex> lk(lock);
+    writeLocked(path, data, size, e);
+    if (dirty) commit(e);
+}
+
+void DiskImage::makeDir(const std::string& path, std::error_code& e) {
+    if (!checkWritable(e)) return;
+    std::lock_guard<std::mutex> lk(lock);
+    makeDirLocked(path, e);
+    if (dirty) commit(e);
+}
+
+void DiskImage::remove(const std::string& path, std::error_code& e) {
+    if (!checkWritable(e)) return;
+    std::lock_guard<std::mutex> lk(lock);
+    removeLocked(path);
+    if (dirty) commit(e);
+}
+
+void DiskImage::rename(const std::string& from, const std::string& to, std::error_code& e) {
+    if (!checkWritable(e)) return;
+    std::lock_guard<std::mutex> lk(lock);
+    Entry * parent = parentOf(to, e);
+    if (e) return;
+    if (from.empty() || entries.find(from) == entries.end()) e = std::make_error_code(std::errc::no_such_file_or_directory);
+    else if (to.empty() || entries.find(to) != entries.end()) e = std::make_error_code(std::errc::file_exists);
+    else if (to.compare(0, from.size() + 1, from + "/") == 0) e = std::make_error_code(std::errc::invalid_argument);
+    if (e) return;
+    entries.at(parentName(from)).children.erase(baseName(from));
+    renameLocked(from, to);
+    parent->children.insert(baseName(to));
+    entries.at(to).modified = now();
+    dirty = true;
+    commit(e);
+}
+
+void DiskImage::sync(std::error_code& e) {
+    e.clear();
+    std::lock_guard<std::mutex> lk(lock);
+    if (dirty) commit(e);
+    if (e || !canWrite) return;
+#ifdef _WIN32
+    if (!FlushFileBuffers(handle)) e = std::error_code(GetLastError(), std::system_category());
+#else
+    if (fsync(fd) != 0) e = std::error_code(errno, std::generic_category());
+#endif
+    else slotSynced = true;
+}
+
+void DiskImage::importLocked(const fs::path& from, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel) {
+    const fs::file_status st = fs::status(from, e);
+    if (e) return;
+    const auto target = entries.find(to);
+    if (fs::is_directory(st)) {
+        if (target != entries.end() && !target->second.isDir) {
+            e = std::make_error_code(std::errc::is_a_directory);
+            return;
+        } else if (target == entries.end()) {
+            Entry * parent = parentOf(to, e);
+            if (parent == NULL) return;
+            entries[to].isDir = true;
+            entries[to].modified = now();
+            parent->children.insert(baseName(to));
+            dirty = true;
+        }
+        for (const auto& child : fs::directory_iterator(from, e)) {
+            const std::string name = child.path().filename().string();
+            if (name == ".DS_Store" || name == "desktop.ini") continue;
+            if (cancel) e = std::make_error_code(std::errc::operation_canceled);
+            else importLocked(child.path(), join(to, name), e, cancel);
+            if (e) return;
+        }
+    } else if (fs::is_regular_file(st)) {
+        const std::string path = target != entries.end() && target->second.isDir ? join(to, from.filename().string()) : to;
+        if (entries.find(path) != entries.end()) {
+            e = std::make_error_code(std::errc::file_exists);
+            return;
+        }
+        std::ifstream in(from, std::ios::binary);
+        if (!in.is_open()) {
+            e = std::make_error_code(std::errc::permission_denied);
+            return;
+        }
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        writeLocked(path, data.data(), data.size(), e);
+    }
+}
+
+void DiskImage::exportLocked(const std::string& from, const fs::path& to, std::error_code& e, const std::atomic<bool>& cancel) const {
+    const auto it = entries.find(from);
+    if (it == entries.end()) {
+        e = std::make_error_code(std::errc::no_such_file_or_directory);
+        return;
+    }
+    const fs::file_status st = fs::status(to, e);
+    e.clear();
+    if (it->second.isDir) {
+        if (fs::exists(st) && !fs::is_directory(st)) {
+            e = std::make_error_code(std::errc::is_a_directory);
+            return;
+        } else if (!fs::exists(st)) {
+            fs::create_directory(to, e);
+            if (e) return;
+        }
+        for (const std::string& name : it->second.children) {
+            if (cancel) e = std::make_error_code(std::errc::operation_canceled);
+            else exportLocked(join(from, name), to / name, e, cancel);
+            if (e) return;
+        }
+    } else {
+        const fs::path path = fs::is_directory(st) ? to / baseName(from) : to;
+        if (fs::exists(path, e) || e) {
+            if (!e) e = std::make_error_code(std::errc::file_exists);
+            return;
+        }
+        std::string data;
+        if (!readLocked(it->second, data)) {
+            e = std::make_error_code(std::errc::io_error);
+            return;
+        }
+        std::ofstream out(path, std::ios::binary);
+        if (!out.is_open()) e = std::make_error_code(std::errc::permission_denied);
+        else if (!out.write(data.data(), data.size())) e = std::make_error_code(std::errc::io_error);
+    }
+}
+
+FileEntry DiskImage::getLocked(const std::string& path, std::error_code& e, const std::atomic<bool>& cancel) const {
+    const auto it = entries.find(path);
+    if (it == entries.end()) {
+        e = std::make_error_code(std::errc::no_such_file_or_directory);
+        return FileEntry("");
+    }
+    if (!it->second.isDir) {
+        std::string data;
+        if (!readLocked(it->second, data)) e = std::make_error_code(std::errc::io_error);
+        return FileEntry(data);
+    }
+    FileEntry dir = FileEntry(std::map<std::string, FileEntry>());
+    for (const std::string& name : it->second.children) {
+        if (cancel) e = std::make_error_code(std::errc::operation_canceled);
+        else dir.dir.emplace(name, getLocked(join(path, name), e, cancel));
+        if (e) break;
+    }
+    return dir;
+}
+
+void DiskImage::putLocked(const std::string& to, const std::string& name, const FileEntry& entry, std::error_code& e, const std::atomic<bool>& cancel) {
+    const auto target = entries.find(to);
+    if (entry.isDir) {
+        if (target != entries.end() && !target->second.isDir) {
+            e = std::make_error_code(std::errc::is_a_directory);
+            return;
+        } else if (target == entries.end()) {
+            Entry * parent = parentOf(to, e);
+            if (parent == NULL) return;
+            entries[to].isDir = true;
+            entries[to].modified = now();
+            parent->children.insert(baseName(to));
+            dirty = true;
+        }
+        for (const auto& child : entry.dir) {
+            if (cancel) e = std::make_error_code(std::errc::operation_canceled);
+            else putLocked(join(to, child.first), child.first, child.second, e, cancel);
+            if (e) return;
+        }
+    } else {
+        const std::string path = target != entries.end() && target->second.isDir ? join(to, name) : to;
+        if (entries.find(path) != entries.end()) e = std::make_error_code(std::errc::file_exists);
+        else writeLocked(path, entry.data.data(), entry.data.size(), e);
+    }
+}
+
+void DiskImage::importTree(const fs::path& from, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel) {
+    if (!checkWritable(e)) return;
+    std::lock_guard<std::mutex> lk(lock);
+    importLocked(from, to, e, cancel);
+    // a copy that failed part way keeps what it copied, like copyTree does
+    std::error_code ec;
+    if (dirty) commit(ec);
+    if (!e) e = ec;
+}
+
+void DiskImage::exportTree(const std::string& from, const fs::path& to, std::error_code& e, const std::atomic<bool>& cancel) const {
+    e.clear();
+    std::lock_guard<std::mutex> lk(lock);
+    exportLocked(from, to, e, cancel);
+}
+
+void DiskImage::copyTree(const std::string& from, DiskImage& image, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel) const {
+    if (!image.checkWritable(e)) return;
+    FileEntry entry("");
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        entry = getLocked(from, e, cancel);
+    }
+    if (e) return;
+    std::lock_guard<std::mutex> lk(image.lock);
+    image.putLocked(to, baseName(from), entry, e, cancel);
+    std::error_code ec;
+    if (image.dirty) image.commit(ec);
+    if (!e) e = ec;
+}
+
+ImageReadStream::ImageReadStream(const std::shared_ptr<const DiskImage::Contents>& contents): std::iostream(NULL), contents(contents), buf(contents->data, contents->size) {
+    rdbuf(&buf);
+}
+
+ImageWriteBuffer::ImageWriteBuffer(const std::shared_ptr<DiskImage>& image, const std::string& path, bool append): std::stringbuf(std::ios::in | std::ios::out), image(image), path(path) {
+    std::error_code e;
+    if (append && image->exists(path)) {
+        const std::shared_ptr<const DiskImage::Contents> contents = image->read(path, e);
+        if (e) return;
+        str(std::string(contents->data, contents->size));
+        pubseekoff(0, std::ios::end, std::ios::out);
+    } else {
+        // the file is made (or emptied) straight away, as it would be on a real disk
+        image->write(path, NULL, 0, e);
+        if (e) return;
+    }
+    open = true;
+}
+
+ImageWriteBuffer::~ImageWriteBuffer() {
+    sync();
+}
+
+ImageWriteBuffer::int_type ImageWriteBuffer::overflow(int_type c) {
+    changed = true;
+    return std::stringbuf::overflow(c);
+}
+
+std::streamsize ImageWriteBuffer::xsputn(const char * s, std::streamsize n) {
+    changed = true;
+    return std::stringbuf::xsputn(s, n);
+}
+
+int ImageWriteBuffer::sync() {
+    if (!open || !changed) return 0;
+    std::error_code e;
+    const std::string data = str();
+    image->write(path, data.data(), data.size(), e);
+    if (e) return -1;
+    changed = false;
+    return 0;
+}
+
+ImageWriteStream::ImageWriteStream(const std::shared_ptr<DiskImage>& image, const std::string& path, bool append): std::iostream(NULL), buf(image, path, append) {
+    rdbuf(&buf);
+}
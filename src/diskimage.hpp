@@ -0,0 +1,202 @@
+/*
+ * diskimage.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines disk images, which hold a whole computer or disk in one
+ * file on the host.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef DISKIMAGE_HPP
+#define DISKIMAGE_HPP
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <FileEntry.hpp>
+#include "filestream.hpp"
+
+/*
+ * A file system kept in a single image file: an index of every path, and the
+ * file contents in 512-byte blocks handed out by an allocator. Each file's
+ * contents are one run of contiguous blocks, so any file can be read with one
+ * read, and big ones are mapped into memory instead. Changing a file writes
+ * the new contents to blocks that aren't in use, then writes a new index and
+ * switches the header over to it, so if the program stops part way through a
+ * change, the image opens as it was before it. Blocks that are freed aren't
+ * reused until the index that used them has been replaced, or while anything
+ * read from a mapping is still held.
+ *
+ * Paths are relative to the root of the image, with "/" between components,
+ * as fixpath cleans them up; "" is the root. An image file is only opened
+ * once, and shared by every computer that mounts it, so all of these can be
+ * called from any thread.
+ */
+class DiskImage {
+public:
+    typedef std::shared_ptr<const std::vector<std::string> > Listing;
+    struct Stat {
+        bool isDir = false;
+        uint64_t size = 0;
+        int64_t modified = 0; // Milliseconds since the epoch
+    };
+    // A file's contents, which stay the same for as long as they're held, even if the file changes.
+    struct Contents {
+        const char * data = NULL;
+        size_t size = 0;
+        virtual ~Contents() = default;
+    };
+
+    static constexpr uint32_t blockSize = 512;
+    // Files at least this big are mapped into memory when they're read, instead of being copied out.
+    static constexpr size_t mapThreshold = 65536;
+
+    ~DiskImage();
+    // Opens an image, or returns the copy that's already open. If create is set, a missing image is made empty.
+    static std::shared_ptr<DiskImage> open(const std::filesystem::path& path, bool create, std::error_code& e);
+    // Returns whether a file is a disk image.
+    static bool isImage(const std::filesystem::path& path);
+    // Packs a real directory into a new image.
+    static void pack(const std::filesystem::path& dir, const std::filesystem::path& path, std::error_code& e);
+    // Unpacks an image into a new real directory.
+    static void unpack(const std::filesystem::path& path, const std::filesystem::path& dir, std::error_code& e);
+
+    const std::filesystem::path& file() const {return imagePath;}
+    // Whether the image file could be opened for writing; if not, every change fails with read_only_file_system.
+    bool writable() const {return canWrite;}
+    bool stat(const std::string& path, Stat& st) const;
+    bool exists(const std::string& path) const {Stat st; return stat(path, st);}
+    bool isDir(const std::string& path) const {Stat st; return stat(path, st) && st.isDir;}
+    // Returns the sorted names in a directory; NULL if it isn't one.
+    Listing list(const std::string& path) const;
+    // Returns a file's contents; NULL (with an error) if it isn't a file.
+    std::shared_ptr<const Contents> read(const std::string& path, std::error_code& e) const;
+    // Returns the total size of the files at or under a path.
+    uint64_t measure(const std::string& path) const;
+    // Returns the total size of every file in the image.
+    uint64_t used() const;
+
+    // Replaces a file's contents, making the file if it doesn't exist. Its parent directory must exist.
+    void write(const std::string& path, const char * data, size_t size, std::error_code& e);
+    // Makes a directory and any parents it needs.
+    void makeDir(const std::string& path, std::error_code& e);
+    // Deletes a file or directory and everything in it; something that doesn't exist is left alone.
+    void remove(const std::string& path, std::error_code& e);
+    // Moves a file or directory. The target must not exist, but its parent must.
+    void rename(const std::string& from, const std::string& to, std::error_code& e);
+    // Forces everything written so far out to the disk.
+    void sync(std::error_code& e);
+
+    // The copies below follow copyTree's rules: a file copied onto a
+    // directory goes inside it under its own name, a directory copied onto a
+    // directory is merged into it, and files are never replaced. Setting
+    // cancel stops between two files with operation_canceled.
+
+    // Copies a file or directory from a real path into the image.
+    void importTree(const std::filesystem::path& from, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel);
+    // Copies a file or directory from the image to a real path.
+    void exportTree(const std::string& from, const std::filesystem::path& to, std::error_code& e, const std::atomic<bool>& cancel) const;
+    // Copies a file or directory from this image to a path in another image (or this one).
+    void copyTree(const std::string& from, DiskImage& image, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel) const;
+private:
+    struct Entry {
+        bool isDir = false;
+        uint64_t size = 0;
+        uint64_t block = 0; // The first block of the file's contents (0 if it's empty)
+        int64_t modified = 0;
+        std::set<std::string> children;
+    };
+
+    std::filesystem::path imagePath;
+#ifdef _WIN32
+    void * handle = NULL;
+#else
+    int fd = -1;
+#endif
+    bool canWrite = true;
+    mutable std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+    std::map<uint64_t, uint64_t> freeRuns; // Runs of blocks that can be reused: first block -> block count
+    std::vector<std::pair<std::pair<uint64_t, uint64_t>, uint64_t> > released; // Runs that were freed, with the generation of the index that last used them
+    uint64_t blockCount = 1;     // The length of the image in blocks (block 0 is the header)
+    uint64_t generation = 0;     // The generation of the index the header points to
+    uint64_t indexBlock = 0, indexSize = 0;
+    uint64_t usedBytes = 0;
+    bool dirty = false;          // Whether the index has changed since it was written
+    bool slotSynced = true;      // Whether the header slot written last is known to be on the disk
+    std::shared_ptr<int> mappings = std::make_shared<int>(0); // Copied into each mapped Contents, so the count shows whether any are held
+
+    DiskImage() = default;
+    bool readAt(uint64_t offset, char * data, size_t size) const;
+    bool writeAt(uint64_t offset, const char * data, size_t size);
+    bool flush();
+    bool load();
+    void commit(std::error_code& e);
+    uint64_t allocate(uint64_t blocks);
+    void release(uint64_t block, uint64_t size);
+    void addFreeRun(uint64_t block, uint64_t count);
+    void reclaim();
+    bool checkWritable(std::error_code& e) const;
+    Entry * parentOf(const std::string& path, std::error_code& e);
+    void writeLocked(const std::string& path, const char * data, size_t size, std::error_code& e);
+    void makeDirLocked(const std::string& path, std::error_code& e);
+    void removeLocked(const std::string& path);
+    void renameLocked(const std::string& from, const std::string& to);
+    bool readLocked(const Entry& entry, std::string& data) const;
+    FileEntry getLocked(const std::string& path, std::error_code& e, const std::atomic<bool>& cancel) const;
+    void putLocked(const std::string& to, const std::string& name, const FileEntry& entry, std::error_code& e, const std::atomic<bool>& cancel);
+    void importLocked(const std::filesystem::path& from, const std::string& to, std::error_code& e, const std::atomic<bool>& cancel);
+    void exportLocked(const std::string& from, const std::filesystem::path& to, std::error_code& e, const std::atomic<bool>& cancel) const;
+};
+
+/*
+ * A read-only stream over a file in a disk image. It reads the contents in
+ * place, and keeps them alive until it's closed.
+ */
+class ImageReadStream : public std::iostream {
+    std::shared_ptr<const DiskImage::Contents> contents;
+    MemoryBuffer buf;
+public:
+    explicit ImageReadStream(const std::shared_ptr<const DiskImage::Contents>& contents);
+};
+
+/*
+ * Collects what's written to a file in a disk image in memory, and writes the
+ * whole file to the image when it's flushed or closed (as each version of a
+ * file gets blocks of its own, there's nothing to gain by writing less).
+ */
+class ImageWriteBuffer : public std::stringbuf {
+public:
+    ImageWriteBuffer(const std::shared_ptr<DiskImage>& image, const std::string& path, bool append);
+    ~ImageWriteBuffer();
+    bool is_open() const {return open;}
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char * s, std::streamsize n) override;
+    int sync() override;
+private:
+    std::shared_ptr<DiskImage> image;
+    std::string path;
+    bool open = false;
+    bool changed = false; // Whether anything was written since the file was last written out
+};
+
+// A write-only file stream for write handles on a disk image.
+class ImageWriteStream : public std::iostream {
+    ImageWriteBuffer buf;
+public:
+    ImageWriteStream(const std::shared_ptr<DiskImage>& image, const std::string& path, bool append);
+    bool is_open() const {return buf.is_open();}
+};
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * diskusage.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the class that keeps track of how much space a
+ * computer's data directory uses, for the space limit in standards mode.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <thread>
+#include "diskusage.hpp"
+
+static std::filesystem::path normalize(const std::filesystem::path& path) {
+    std::filesystem::path retval = path.lexically_normal();
+    // drop the empty component a trailing separator leaves
+    if (!retval.has_filename() && retval.has_relative_path()) retval = retval.parent_path();
+    return retval;
+}
+
+DiskUsage::DiskUsage(const std::filesystem::path& root): root(normalize(root)) {}
+
+bool DiskUsage::contains(const std::filesystem::path& path) const {
+    const std::filesystem::path p = normalize(path);
+    return std::mismatch(root.begin(), root.end(), p.begin(), p.end()).first == root.end();
+}
+
+int64_t DiskUsage::used() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!seeded) {
+        startScan();
+        scanned.wait(lock, [this]()->bool{return seeded;});
+    } else if (std::chrono::steady_clock::now() - lastScan >= rescanInterval) startScan();
+    return bytes;
+}
+
+void DiskUsage::add(int64_t n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes += n;
+    if (scanning) scanDelta += n;
+}
+
+void DiskUsage::rescan() {
+    std::lock_guard<std::mutex> lock(mutex);
+    startScan();
+}
+
+void DiskUsage::startScan() {
+    if (scanning) return;
+    scanning = true;
+    scanDelta = 0;
+    std::thread([](std::shared_ptr<DiskUsage> self) {
+        const int64_t total = measure(self->root);
+        std::lock_guard<std::mutex> lock(self->mutex);
+        // a change made during the scan may or may not have been seen by it; count it as unseen, the next scan corrects it either way
+        self->bytes = total + self->scanDelta;
+        self->seeded = true;
+        self->scanning = false;
+        self->lastScan = std::chrono::steady_clock::now();
+        self->scanned.notify_all();
+    }, shared_from_this()).detach();
+}
+
+int64_t DiskUsage::measure(const std::filesystem::path& path) {
+    std::error_code e;
+    if (!std::filesystem::is_directory(path, e)) {
+        const uintmax_t size = std::filesystem::file_size(path, e);
+        return e ? 0 : (int64_t)size;
+    }
+    int64_t size = 0;
+    // this runs on a detached thread, so nothing here may throw; and links aren't followed into
+    // directories, so a symlink loop in a mount can't recurse forever
+    std::filesystem::directory_iterator it(path, e), end;
+    for (; !e && it != end; it.increment(e)) {
+        std::error_code fe;
+        if (it->symlink_status(fe).type() == std::filesystem::file_type::directory) size += measure(it->path());
+        else {
+            const uintmax_t n = it->file_size(fe);
+            if (!fe) size += n;
+        }
+    }
+    return size;
+}
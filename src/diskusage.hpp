@@ -0,0 +1,54 @@
+/*
+ * diskusage.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the class that keeps track of how much space a computer's
+ * data directory uses, for the space limit in standards mode.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef DISKUSAGE_HPP
+#define DISKUSAGE_HPP
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+
+/*
+ * Counts the bytes used by the files in a directory tree. It's seeded by one
+ * scan of the tree; after that, the fs API reports every change it makes with
+ * add(), so reading the count doesn't need a scan. Changes made behind its back
+ * (by other programs, or before it existed) are picked up by a rescan in the
+ * background every rescanInterval.
+ */
+class DiskUsage : public std::enable_shared_from_this<DiskUsage> {
+public:
+    static constexpr std::chrono::minutes rescanInterval {5};
+    explicit DiskUsage(const std::filesystem::path& root);
+    // Returns whether a path is inside the tree.
+    bool contains(const std::filesystem::path& path) const;
+    // Returns the number of bytes used, waiting for the first scan if it hasn't finished yet.
+    int64_t used();
+    // Records that the tree grew (or shrank) by some number of bytes.
+    void add(int64_t bytes);
+    // Starts a scan in the background, unless one is already running.
+    void rescan();
+    // Returns the size of a file, or of all files under a directory; 0 if it doesn't exist.
+    static int64_t measure(const std::filesystem::path& path);
+private:
+    std::filesystem::path root;
+    std::mutex mutex;
+    std::condition_variable scanned;
+    int64_t bytes = 0;
+    int64_t scanDelta = 0; // Changes made while the current scan runs, which it may have missed
+    bool seeded = false;
+    bool scanning = false;
+    std::chrono::steady_clock::time_point lastScan;
+    void startScan(); // Must be called with the mutex locked.
+};
+
+#endif
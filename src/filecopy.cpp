@@ -0,0 +1,139 @@
+/*
+ * filecopy.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the function that copies files and directory trees for
+ * fs.copy.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include "filecopy.hpp"
+#ifdef __linux__
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <memory>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const size_t chunkSize = 1048576;
+
+// Closes a descriptor when it goes out of scope.
+struct FileDescriptor {
+    int fd;
+    ~FileDescriptor() {if (fd >= 0) close(fd);}
+};
+
+static bool isOther(const struct stat& st) {
+    return !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode);
+}
+
+// Copies the contents of one open file to the end of another.
+static void copyContents(int in, int out, std::error_code& e, const std::atomic<bool>& cancel) {
+#ifdef FICLONE
+    // a reflink shares the blocks until either file changes, so there's nothing to copy
+    if (ioctl(out, FICLONE, in) == 0) return;
+#endif
+    bool copied = false;
+#ifdef __NR_copy_file_range
+    while (true) {
+        if (cancel) {e = std::make_error_code(std::errc::operation_canceled); return;}
+        const ssize_t n = syscall(__NR_copy_file_range, in, NULL, out, NULL, chunkSize, 0);
+        if (n > 0) copied = true;
+        else if (n == 0 && copied) return;
+        else if (n == 0 || (!copied && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EPERM))) break;
+        else if (errno != EINTR) {e.assign(errno, std::generic_category()); return;}
+    }
+#endif
+    // copy_file_range isn't supported here (or, like some special files, says there's nothing to copy)
+    std::unique_ptr<char[]> buf(new char[chunkSize]);
+    while (true) {
+        if (cancel) {e = std::make_error_code(std::errc::operation_canceled); return;}
+        const ssize_t n = read(in, buf.get(), chunkSize);
+        if (n == 0) return;
+        else if (n < 0) {
+            if (errno == EINTR) continue;
+            e.assign(errno, std::generic_category());
+            return;
+        }
+        for (ssize_t written = 0; written < n;) {
+            const ssize_t w = write(out, buf.get() + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                e.assign(errno, std::generic_category());
+                return;
+            }
+            written += w;
+        }
+    }
+}
+
+// Follows std::filesystem::copy_file with no options: the target must not exist.
+static void copyFile(const std::filesystem::path& from, const std::filesystem::path& to, const struct stat& fromStat, std::error_code& e, const std::atomic<bool>& cancel) {
+    if (!S_ISREG(fromStat.st_mode)) {e = std::make_error_code(std::errc::not_supported); return;}
+    FileDescriptor in {open(from.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (in.fd < 0) {e.assign(errno, std::generic_category()); return;}
+    FileDescriptor out {open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IWUSR)};
+    if (out.fd < 0) {e.assign(errno, std::generic_category()); return;}
+    if (fchmod(out.fd, fromStat.st_mode) != 0) {e.assign(errno, std::generic_category()); return;}
+    copyContents(in.fd, out.fd, e, cancel);
+    if (e) return;
+    const int fd = out.fd;
+    out.fd = -1;
+    if (close(fd) != 0) e.assign(errno, std::generic_category());
+}
+
+void copyTree(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& e, const std::atomic<bool>& cancel) {
+    e.clear();
+    if (cancel) {e = std::make_error_code(std::errc::operation_canceled); return;}
+    struct stat fromStat, toStat;
+    if (stat(from.c_str(), &fromStat) != 0) {e.assign(errno, std::generic_category()); return;}
+    bool toExists = true;
+    if (stat(to.c_str(), &toStat) != 0) {
+        if (errno != ENOENT && errno != ENOTDIR) {e.assign(errno, std::generic_category()); return;}
+        toExists = false;
+    }
+    if (toExists && !isOther(toStat) && !isOther(fromStat) && toStat.st_dev == fromStat.st_dev && toStat.st_ino == fromStat.st_ino)
+        e = std::make_error_code(std::errc::file_exists);
+    else if (isOther(fromStat) || (toExists && isOther(toStat))) e = std::make_error_code(std::errc::invalid_argument);
+    else if (S_ISDIR(fromStat.st_mode) && toExists && S_ISREG(toStat.st_mode)) e = std::make_error_code(std::errc::is_a_directory);
+    else if (S_ISREG(fromStat.st_mode)) {
+        if (toExists && S_ISDIR(toStat.st_mode)) {
+            const std::filesystem::path target = to / from.filename();
+            struct stat targetStat;
+            if (stat(target.c_str(), &targetStat) == 0) e = std::make_error_code(S_ISREG(targetStat.st_mode) ? std::errc::file_exists : std::errc::invalid_argument);
+            else if (errno != ENOENT && errno != ENOTDIR) e.assign(errno, std::generic_category());
+            else copyFile(from, target, fromStat, e, cancel);
+        } else if (toExists) e = std::make_error_code(std::errc::file_exists);
+        else copyFile(from, to, fromStat, e, cancel);
+    } else if (S_ISDIR(fromStat.st_mode)) {
+        if (!toExists && mkdir(to.c_str(), fromStat.st_mode) != 0) {e.assign(errno, std::generic_category()); return;}
+        DIR * dir = opendir(from.c_str());
+        if (dir == NULL) {e.assign(errno, std::generic_category()); return;}
+        struct dirent * ent;
+        while (true) {
+            errno = 0;
+            if ((ent = readdir(dir)) == NULL) {
+                if (errno != 0) e.assign(errno, std::generic_category());
+                break;
+            }
+            if (ent->d_name[0] == '.' && (ent->d_name[1] == 0 || (ent->d_name[1] == '.' && ent->d_name[2] == 0))) continue;
+            copyTree(from / ent->d_name, to / ent->d_name, e, cancel);
+            if (e) break;
+        }
+        closedir(dir);
+    }
+}
+
+#else
+
+void copyTree(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& e, const std::atomic<bool>&) {
+    std::filesystem::copy(from, to, std::filesystem::copy_options::recursive, e);
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * filecopy.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the function that copies files and directory trees for
+ * fs.copy.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef FILECOPY_HPP
+#define FILECOPY_HPP
+#include <atomic>
+#include <filesystem>
+#include <system_error>
+
+/*
+ * Copies a file or directory tree exactly like std::filesystem::copy with
+ * copy_options::recursive, including which errors it stops on. On Linux, file
+ * contents are cloned with FICLONE where the filesystem supports reflinks, and
+ * copied inside the kernel with copy_file_range otherwise, falling back to
+ * reading and writing 1 MiB at a time. Setting cancel stops the copy between
+ * two chunks with std::errc::operation_canceled, leaving whatever was already
+ * copied in place. Other platforms call std::filesystem::copy, which already
+ * uses the system's copy routine there, and can't be canceled.
+ */
+extern void copyTree(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& e, const std::atomic<bool>& cancel);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * filestream.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the stream buffers behind file handles.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+#include "filestream.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#define fsync _commit
+#define fileno _fileno
+#else
+#include <unistd.h>
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+MemoryBuffer::MemoryBuffer(const char * data, size_t size) {
+    // the get area is never written to
+    char * begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+}
+
+std::streambuf::pos_type MemoryBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+    off_type base;
+    if (dir == std::ios_base::beg) base = 0;
+    else if (dir == std::ios_base::cur) base = gptr() - eback();
+    else base = egptr() - eback();
+    const off_type pos = base + off;
+    if (pos < 0 || pos > egptr() - eback()) return pos_type(off_type(-1));
+    setg(eback(), eback() + pos, egptr());
+    return pos_type(pos);
+}
+
+std::streambuf::pos_type MemoryBuffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+FileReadBuffer::~FileReadBuffer() {
+    if (fp != NULL) fclose(fp);
+}
+
+bool FileReadBuffer::open(const std::filesystem::path& path) {
+#ifdef _WIN32
+    fp = _wfopen(path.native().c_str(), L"rb");
+#else
+    fp = fopen(path.native().c_str(), "rb");
+#endif
+    if (fp == NULL) return false;
+    // we do our own buffering, and large reads go straight into the caller's memory
+    setvbuf(fp, NULL, _IONBF, 0);
+    buffer.reset(new char[bufferSize]);
+    setg(buffer.get(), buffer.get(), buffer.get());
+    filePos = 0;
+    return true;
+}
+
+std::streambuf::int_type FileReadBuffer::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (fp == NULL) return traits_type::eof();
+    // the file may have grown since we last hit the end
+    clearerr(fp);
+    const size_t n = fread(buffer.get(), 1, bufferSize, fp);
+    filePos += n;
+    setg(buffer.get(), buffer.get(), buffer.get() + n);
+    return n == 0 ? traits_type::eof() : traits_type::to_int_type(*gptr());
+}
+
+std::streamsize FileReadBuffer::xsgetn(char * s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done < n) {
+        std::streamsize avail = egptr() - gptr();
+        if (avail == 0) {
+            if (fp == NULL) break;
+            if (n - done >= (std::streamsize)bufferSize) {
+                // big reads skip the buffer
+                clearerr(fp);
+                const size_t got = fread(s + done, 1, n - done, fp);
+                filePos += got;
+                done += got;
+                setg(buffer.get(), buffer.get(), buffer.get());
+                break;
+            }
+            if (underflow() == traits_type::eof()) break;
+            avail = egptr() - gptr();
+        }
+        const std::streamsize count = std::min(avail, n - done);
+        memcpy(s + done, gptr(), count);
+        setg(eback(), gptr() + count, egptr());
+        done += count;
+    }
+    return done;
+}
+
+std::streambuf::pos_type FileReadBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (fp == NULL || !(which & std::ios_base::in)) return pos_type(off_type(-1));
+    off_type target;
+    if (dir == std::ios_base::beg) target = off;
+    else if (dir == std::ios_base::cur) target = filePos - (egptr() - gptr()) + off;
+    else {
+        if (fseek64(fp, 0, SEEK_END) != 0) return pos_type(off_type(-1));
+        target = ftell64(fp) + off;
+        if (fseek64(fp, filePos, SEEK_SET) != 0) return pos_type(off_type(-1));
+    }
+    if (target < 0) return pos_type(off_type(-1));
+    // seeks inside the buffer (like tellg) don't touch the file
+    const off_type bufferStart = filePos - (egptr() - eback());
+    if (target >= bufferStart && target <= filePos) setg(eback(), eback() + (target - bufferStart), egptr());
+    else {
+        if (fseek64(fp, target, SEEK_SET) != 0) return pos_type(off_type(-1));
+        filePos = target;
+        setg(buffer.get(), buffer.get(), buffer.get());
+    }
+    return pos_type(target);
+}
+
+std::streambuf::pos_type FileReadBuffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+FileReadStream::FileReadStream(const std::filesystem::path& path): std::iostream(NULL) {
+    rdbuf(&buf);
+    if (!buf.open(path)) setstate(std::ios_base::failbit);
+}
+
+// Returns the size of an open file, or -1 if it's been deleted.
+static std::streamoff fileSize(FILE * fp) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(fp), &st) != 0) return -1;
+#else
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_nlink == 0) return -1;
+#endif
+    return st.st_size;
+}
+
+FileWriteBuffer::~FileWriteBuffer() {
+    if (fp == NULL) return;
+    sync();
+    if (syncOnClose && !error) fsync(fileno(fp));
+    fclose(fp);
+}
+
+bool FileWriteBuffer::open(const std::filesystem::path& path, bool append) {
+    // append mode writes every block at the current end of the file (O_APPEND), so other handles
+    // appending to the same file can't overwrite each other; it also creates the file if needed
+#ifdef _WIN32
+    fp = _wfopen(path.native().c_str(), append ? L"ab" : L"wb");
+#else
+    fp = fopen(path.native().c_str(), append ? "ab" : "wb");
+#endif
+    if (fp == NULL) return false;
+    setvbuf(fp, NULL, _IONBF, 0);
+    appending = append;
+    filePos = 0;
+    if (append) {
+        if (fseek64(fp, 0, SEEK_END) != 0) {
+            fclose(fp);
+            fp = NULL;
+            return false;
+        }
+        filePos = ftell64(fp);
+    }
+    buffer.reset(new char[bufferSize]);
+    setp(buffer.get(), buffer.get() + bufferSize);
+    return true;
+}
+
+bool FileWriteBuffer::writeOut(const char * s, size_t n) {
+    if (error) return false;
+    // another handle may have grown the file too, so ask the OS how big it is now
+    const off_type size = n > 0 && onGrow ? fileSize(fp) : -1;
+    if (n > 0 && fwrite(s, 1, n, fp) != n) {
+        error = true;
+        return false;
+    }
+    // appended data goes wherever the end of the file is now, which may have moved
+    filePos = appending && n > 0 ? ftell64(fp) : filePos + n;
+    if (n > 0 && size >= 0 && filePos > size) onGrow(filePos - size);
+    lastWrite = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool FileWriteBuffer::requestFlush() {
+    if (pptr() == pbase()) return true;
+    if (std::chrono::steady_clock::now() - lastWrite < flushInterval) return false;
+    sync();
+    return true;
+}
+
+std::streambuf::int_type FileWriteBuffer::overflow(int_type c) {
+    if (fp == NULL || !writeOut(pbase(), pptr() - pbase())) return traits_type::eof();
+    setp(buffer.get(), buffer.get() + bufferSize);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize FileWriteBuffer::xsputn(const char * s, std::streamsize n) {
+    if (fp == NULL || error) return 0;
+    if (n > epptr() - pptr()) {
+        if (!writeOut(pbase(), pptr() - pbase())) return 0;
+        setp(buffer.get(), buffer.get() + bufferSize);
+        // big writes skip the buffer
+        if (n >= (std::streamsize)bufferSize) return writeOut(s, n) ? n : 0;
+    }
+    memcpy(pptr(), s, n);
+    pbump((int)n);
+    return n;
+}
+
+int FileWriteBuffer::sync() {
+    if (fp == NULL) return -1;
+    const bool ok = writeOut(pbase(), pptr() - pbase());
+    setp(buffer.get(), buffer.get() + bufferSize);
+    return ok ? 0 : -1;
+}
+
+std::streambuf::pos_type FileWriteBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) {
+    // the handle's seek uses seekg/tellg, so either direction is accepted
+    if (fp == NULL) return pos_type(off_type(-1));
+    // tellg/tellp don't need to write anything out
+    if (dir == std::ios_base::cur && off == 0) return pos_type(filePos + (pptr() - pbase()));
+    if (sync() != 0) return pos_type(off_type(-1));
+    off_type target;
+    if (dir == std::ios_base::beg) target = off;
+    else if (dir == std::ios_base::cur) target = filePos + off;
+    else {
+        if (fseek64(fp, 0, SEEK_END) != 0) return pos_type(off_type(-1));
+        target = ftell64(fp) + off;
+    }
+    if (target < 0 || fseek64(fp, target, SEEK_SET) != 0) {
+        fseek64(fp, filePos, SEEK_SET);
+        return pos_type(off_type(-1));
+    }
+    filePos = target;
+    return pos_type(target);
+}
+
+std::streambuf::pos_type FileWriteBuffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+FileWriteStream::FileWriteStream(const std::filesystem::path& path, bool append): std::iostream(NULL) {
+    rdbuf(&buf);
+    if (!buf.open(path, append)) setstate(std::ios_base::failbit);
+}
@@ -0,0 +1,117 @@
+/*
+ * filestream.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the stream buffers behind file handles.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef FILESTREAM_HPP
+#define FILESTREAM_HPP
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+
+/*
+ * A stream buffer whose buffered data the handle functions can scan directly
+ * (e.g. with memchr), instead of pulling it out of the stream a byte at a time.
+ */
+class HandleBuffer : public std::streambuf {
+public:
+    const char * data() const {return gptr();}             // The buffered data that hasn't been read yet
+    size_t available() const {return egptr() - gptr();}    // How much of it there is
+    void consume(size_t n) {setg(eback(), gptr() + n, egptr());} // Marks n bytes of it as read
+    bool fill() {return sgetc() != traits_type::eof();}    // Buffers more data if needed; false at the end of the file
+};
+
+// Reads a block of memory in place.
+class MemoryBuffer : public HandleBuffer {
+public:
+    MemoryBuffer(const char * data, size_t size);
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
+
+// Reads a file in large blocks.
+class FileReadBuffer : public HandleBuffer {
+public:
+    static constexpr size_t bufferSize = 65536;
+    ~FileReadBuffer();
+    bool open(const std::filesystem::path& path);
+    bool is_open() const {return fp != NULL;}
+protected:
+    int_type underflow() override;
+    std::streamsize xsgetn(char * s, std::streamsize n) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+private:
+    FILE * fp = NULL;
+    std::unique_ptr<char[]> buffer;
+    off_type filePos = 0; // The file offset at the end of the buffer
+};
+
+// A read-only file stream for read handles.
+class FileReadStream : public std::iostream {
+    FileReadBuffer buf;
+public:
+    explicit FileReadStream(const std::filesystem::path& path);
+    bool is_open() const {return buf.is_open();}
+};
+
+/*
+ * Writes a file through a large buffer, so small writes don't each become a
+ * system call.
+ *
+ * Crash safety: data only reaches the OS when the buffer fills, when sync() is
+ * called (seeks do this too), or when the buffer is destroyed. requestFlush()
+ * writes the data out right away unless the last write-out was less than
+ * flushInterval ago, in which case it leaves it pending for the owner to sync
+ * later. So if the emulator crashes, anything written since the last write-out
+ * is lost, but everything before it is in the file. Nothing is forced to disk
+ * unless syncOnClose is set, in which case the file is fsync'd on close, and a
+ * closed file survives an OS crash or power loss as well.
+ */
+class FileWriteBuffer : public std::streambuf {
+public:
+    static constexpr size_t bufferSize = 65536;
+    static constexpr std::chrono::milliseconds flushInterval {100};
+    ~FileWriteBuffer();
+    bool open(const std::filesystem::path& path, bool append);
+    bool is_open() const {return fp != NULL;}
+    bool syncOnClose = false; // Whether to fsync the file when it's closed
+    std::function<void(off_type)> onGrow; // Called with how much the file grew each time data is written out
+    // Writes buffered data out if enough time has passed since the last
+    // write-out; returns false if it's been left pending instead.
+    bool requestFlush();
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char * s, std::streamsize n) override;
+    int sync() override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+private:
+    FILE * fp = NULL;
+    std::unique_ptr<char[]> buffer;
+    off_type filePos = 0; // The file offset at the start of the buffer
+    bool error = false; // Set once a write fails; every write after that fails too
+    bool appending = false; // Whether every write goes to the end of the file
+    std::chrono::steady_clock::time_point lastWrite;
+    bool writeOut(const char * s, size_t n);
+};
+
+// A write-only file stream for write handles.
+class FileWriteStream : public std::iostream {
+    FileWriteBuffer buf;
+public:
+    FileWriteStream(const std::filesystem::path& path, bool append);
+    bool is_open() const {return buf.is_open();}
+    FileWriteBuffer * buffer() {return &buf;}
+};
+
+#endif
@@ -632,16 +632,29 @@ void GifWriteChunk( FILE* f, GifBitStatus& stat )
     stat.chunkIndex = 0;
 }
 
+// writes as many bits at a time as fit in the partial byte
 void GifWriteCode( FILE* f, GifBitStatus& stat, uint32_t code, uint32_t length )
 {
-    for( uint32_t ii=0; ii<length; ++ii )
+    while( length )
     {
-        GifWriteBit(stat, code);
-        code = code >> 1;
+        uint32_t bits = 8u - stat.bitIndex;
+        if( bits > length ) bits = length;
 
-        if( stat.chunkIndex == 255 )
+        stat.byte |= (uint8_t)((code & ((1u << bits) - 1)) << stat.bitIndex);
+        stat.bitIndex += bits;
+        code >>= bits;
+        length -= bits;
+
+        if( stat.bitIndex > 7 )
         {
-            GifWriteChunk(f, stat);
+            stat.chunk[stat.chunkIndex++] = stat.byte;
+            stat.bitIndex = 0;
+            stat.byte = 0;
+
+            if( stat.chunkIndex == 255 )
+            {
+                GifWriteChunk(f, stat);
+            }
         }
     }
 }
@@ -672,17 +685,18 @@ void GifWritePalette( const GifPalette* pPal, FILE* f )
     }
 }
 
-// write the image header, LZW-compress and write out the image
-void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal)
+// write the graphics control extension and image descriptor for a frame
+// a transIndex of -1 means the frame has no transparent pixels
+void GifWriteImageHeader(FILE* f, uint32_t left, uint32_t top, uint32_t width, uint32_t height, uint32_t delay, int transIndex)
 {
     // graphics control extension
     fputc(0x21, f);
     fputc(0xf9, f);
     fputc(0x04, f);
-    fputc(0x05, f); // leave prev frame in place, this frame has transparency
+    fputc(transIndex >= 0 ? 0x05 : 0x04, f); // leave prev frame in place, maybe with transparency
     fputc(delay & 0xff, f);
     fputc((delay >> 8) & 0xff, f);
-    fputc(kGifTransIndex, f); // transparent color index
+    fputc(transIndex >= 0 ? transIndex : 0, f); // transparent color index
     fputc(0, f);
 
     fputc(0x2c, f); // image descriptor block
@@ -696,21 +710,21 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     fputc((width >> 8) & 0xff, f);
     fputc(height & 0xff, f);
     fputc((height >> 8) & 0xff, f);
+}
 
-    //fputc(0, f); // no local color table, no transparency
-    //fputc(0x80, f); // no local color table, but transparency
-
-    fputc(0x80 + pPal->bitDepth-1, f); // local color table present, 2 ^ bitDepth entries
-    GifWritePalette(pPal, f);
-
-    const int minCodeSize = pPal->bitDepth;
-    const uint32_t clearCode = 1 << pPal->bitDepth;
+// LZW-compress and write out color indices, read from every step'th byte of image
+void GifWriteLzwData(FILE* f, const uint8_t* image, uint32_t width, uint32_t height, uint32_t step, int bitDepth)
+{
+    const int minCodeSize = bitDepth;
+    const uint32_t clearCode = 1 << bitDepth;
 
     fputc(minCodeSize, f); // min code size 8 bits
 
+    // nodes are only cleared when they're used, since most frames never fill
+    // the dictionary and clearing all 2 MB of it dominated small frames
     GifLzwNode* codetree = (GifLzwNode*)GIF_TEMP_MALLOC(sizeof(GifLzwNode)*4096);
 
-    memset(codetree, 0, sizeof(GifLzwNode)*4096);
+    memset(codetree, 0, sizeof(GifLzwNode)*clearCode);
     int32_t curCode = -1;
     uint32_t codeSize = (uint32_t)minCodeSize + 1;
     uint32_t maxCode = clearCode+1;
@@ -724,15 +738,16 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
 
     for(uint32_t yy=0; yy<height; ++yy)
     {
-        for(uint32_t xx=0; xx<width; ++xx)
-        {
     #ifdef GIF_FLIP_VERT
-            // bottom-left origin image (such as an OpenGL capture)
-            uint8_t nextValue = image[((height-1-yy)*width+xx)*4+3];
+        // bottom-left origin image (such as an OpenGL capture)
+        const uint8_t* row = image + (size_t)(height-1-yy)*width*step;
     #else
-            // top-left origin
-            uint8_t nextValue = image[(yy*width+xx)*4+3];
+        // top-left origin
+        const uint8_t* row = image + (size_t)yy*width*step;
     #endif
+        for(uint32_t xx=0; xx<width; ++xx)
+        {
+            uint8_t nextValue = row[xx*step];
 
             // "loser mode" - no compression, every single code is followed immediately by a clear
             //WriteCode( f, stat, nextValue, codeSize );
@@ -755,6 +770,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
 
                 // insert the new run into the dictionary
                 codetree[curCode].m_next[nextValue] = (uint16_t)++maxCode;
+                memset(&codetree[maxCode], 0, sizeof(GifLzwNode));
 
                 if( maxCode >= (1ul << codeSize) )
                 {
@@ -767,7 +783,7 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
                     // the dictionary is full, clear it out and begin anew
                     GifWriteCode(f, stat, clearCode, codeSize); // clear tree
 
-                    memset(codetree, 0, sizeof(GifLzwNode)*4096);
+                    memset(codetree, 0, sizeof(GifLzwNode)*clearCode);
                     codeSize = (uint32_t)(minCodeSize + 1);
                     maxCode = clearCode+1;
                 }
@@ -791,6 +807,20 @@ void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uin
     GIF_TEMP_FREE(codetree);
 }
 
+// write the image header, LZW-compress and write out the image
+void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal)
+{
+    GifWriteImageHeader(f, left, top, width, height, delay, kGifTransIndex);
+
+    //fputc(0, f); // no local color table, no transparency
+    //fputc(0x80, f); // no local color table, but transparency
+
+    fputc(0x80 + pPal->bitDepth-1, f); // local color table present, 2 ^ bitDepth entries
+    GifWritePalette(pPal, f);
+
+    GifWriteLzwData(f, image + 3, width, height, 4, pPal->bitDepth);
+}
+
 struct GifWriter
 {
     FILE* f;
@@ -860,6 +890,139 @@ bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t
     return true;
 }
 
+// the color of an RGBA8 pixel, in the same format as palette entries
+static inline uint32_t GifPixelColor( const uint8_t* pixel )
+{
+    return (uint32_t)pixel[0] | ((uint32_t)pixel[1] << 8) | ((uint32_t)pixel[2] << 16);
+}
+
+// Writes out a frame whose pixels all come from a known palette, such as a
+// terminal's. Each color is looked up directly instead of being quantized, and
+// only the rectangle around the pixels that changed since the last frame is
+// written. Returns false without writing anything if a pixel isn't in the
+// palette; the frame must then be written with GifWriteFrame instead.
+bool GifWritePaletteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth, const uint32_t* palette )
+{
+    if(!writer->f) return false;
+
+    const uint32_t numColors = 1u << bitDepth;
+
+    // find the bounding box of the changed pixels
+    uint32_t left = 0, top = 0, right = width, bottom = height;
+    if( !writer->firstFrame )
+    {
+        left = width; top = height; right = 0; bottom = 0;
+        for( uint32_t yy=0; yy<height; ++yy )
+        {
+            const uint8_t* row = image + (size_t)yy*width*4;
+            const uint8_t* oldRow = writer->oldImage + (size_t)yy*width*4;
+            if( memcmp(row, oldRow, (size_t)width*4) == 0 ) continue;
+            uint32_t xx = 0;
+            while( xx < width && GifPixelColor(row + xx*4) == GifPixelColor(oldRow + xx*4) ) ++xx;
+            if( xx == width ) continue;
+            uint32_t xe = width;
+            while( GifPixelColor(row + (xe-1)*4) == GifPixelColor(oldRow + (xe-1)*4) ) --xe;
+            if( xx < left ) left = xx;
+            if( xe > right ) right = xe;
+            if( yy < top ) top = yy;
+            bottom = yy + 1;
+        }
+        // nothing changed: a single transparent pixel still carries the delay
+        if( right == 0 ) { left = 0; top = 0; right = 1; bottom = 1; }
+    }
+    const uint32_t rectWidth = right - left, rectHeight = bottom - top;
+
+    // palette lookup as an open-addressed hash table; the first entry for a color wins
+    int16_t lookupIndex[1024];
+    uint32_t lookupColor[1024];
+    for( int ii=0; ii<1024; ++ii ) lookupIndex[ii] = -1;
+    for( uint32_t ii=0; ii<numColors; ++ii )
+    {
+        const uint32_t color = palette[ii] & 0xFFFFFF;
+        uint32_t slot = (color * 2654435761u) >> 22;
+        while( lookupIndex[slot] >= 0 && lookupColor[slot] != color ) slot = (slot + 1) & 1023;
+        if( lookupIndex[slot] < 0 ) { lookupIndex[slot] = (int16_t)ii; lookupColor[slot] = color; }
+    }
+
+    // changed pixels get their palette index; unchanged ones get -3 - index, or -2
+    // if their color isn't in the palette, and become transparent if possible
+    int16_t* indices = (int16_t*)GIF_TEMP_MALLOC(sizeof(int16_t)*rectWidth*rectHeight);
+    bool used[256] = {false};
+    bool needTransparency = false;
+    uint32_t lastColor = 0xFFFFFFFF;
+    int16_t lastIndex = -1;
+    for( uint32_t yy=0; yy<rectHeight; ++yy )
+    {
+        const uint8_t* row = image + ((size_t)(top+yy)*width + left)*4;
+        const uint8_t* oldRow = writer->oldImage + ((size_t)(top+yy)*width + left)*4;
+        int16_t* out = indices + (size_t)yy*rectWidth;
+        for( uint32_t xx=0; xx<rectWidth; ++xx )
+        {
+            const uint32_t color = GifPixelColor(row + xx*4);
+            const bool unchanged = !writer->firstFrame && color == GifPixelColor(oldRow + xx*4);
+            if( color != lastColor )
+            {
+                uint32_t slot = (color * 2654435761u) >> 22;
+                while( lookupIndex[slot] >= 0 && lookupColor[slot] != color ) slot = (slot + 1) & 1023;
+                lastColor = color;
+                lastIndex = lookupIndex[slot];
+            }
+            if( unchanged )
+            {
+                // a color that has left the palette can stay on screen, but only as transparency
+                out[xx] = lastIndex < 0 ? -2 : (int16_t)(-3 - lastIndex);
+                if( lastIndex < 0 ) needTransparency = true;
+            }
+            else if( lastIndex < 0 )
+            {
+                GIF_TEMP_FREE(indices);
+                return false;
+            }
+            else
+            {
+                out[xx] = lastIndex;
+                used[lastIndex] = true;
+            }
+        }
+    }
+
+    // any index that no changed pixel uses can be the transparent one
+    int transIndex = -1;
+    for( uint32_t ii=0; ii<numColors; ++ii ) if( !used[ii] ) { transIndex = (int)ii; break; }
+    if( transIndex < 0 && needTransparency )
+    {
+        GIF_TEMP_FREE(indices);
+        return false;
+    }
+
+    uint8_t* packed = (uint8_t*)GIF_TEMP_MALLOC(rectWidth*rectHeight);
+    for( size_t ii=0; ii<(size_t)rectWidth*rectHeight; ++ii )
+    {
+        const int16_t index = indices[ii];
+        if( index >= 0 ) packed[ii] = (uint8_t)index;
+        else if( transIndex >= 0 ) packed[ii] = (uint8_t)transIndex;
+        else packed[ii] = (uint8_t)(-3 - index);
+    }
+    GIF_TEMP_FREE(indices);
+
+    GifWriteImageHeader(writer->f, left, top, rectWidth, rectHeight, delay, transIndex);
+    fputc(0x80 + bitDepth-1, writer->f); // local color table present, 2 ^ bitDepth entries
+    for( uint32_t ii=0; ii<numColors; ++ii )
+    {
+        fputc((int)(palette[ii] & 0xFF), writer->f);
+        fputc((int)((palette[ii] >> 8) & 0xFF), writer->f);
+        fputc((int)((palette[ii] >> 16) & 0xFF), writer->f);
+    }
+    GifWriteLzwData(writer->f, packed, rectWidth, rectHeight, 1, bitDepth);
+    GIF_TEMP_FREE(packed);
+
+    for( uint32_t yy=top; yy<bottom; ++yy )
+        memcpy(writer->oldImage + ((size_t)yy*width + left)*4, image + ((size_t)yy*width + left)*4, rectWidth*4);
+    writer->firstFrame = false;
+
+    return true;
+}
+
 // Writes out a new frame to a GIF in progress.
 // The GIFWriter should have been created by GIFBegin.
 // AFAIK, it is legal to use different bit depths for different frames of an image -
@@ -868,6 +1031,10 @@ bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uin
 {
     if(!writer->f) return false;
 
+    // terminal frames only use palette colors, so they rarely need quantizing
+    if (palette && !dither && GifWritePaletteFrame(writer, image, width, height, delay, bitDepth, palette))
+        return true;
+
     const uint8_t* oldImage = writer->firstFrame? NULL : writer->oldImage;
     writer->firstFrame = false;
 
@@ -884,6 +1051,9 @@ bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uin
 
     GifWriteLzwImage(writer->f, writer->oldImage, 0, 0, width, height, delay, &pal);
 
+    // GifWritePaletteFrame compares against the real colors, not the quantized ones
+    if (palette && !dither) memcpy(writer->oldImage, image, (size_t)width*height*4);
+
     return true;
 }
 
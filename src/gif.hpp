@@ -36,6 +36,7 @@ extern void GifPartitionByMedian(uint8_t* image, int left, int right, int com, i
 extern void GifSplitPalette(uint8_t* image, int numPixels, int firstElt, int lastElt, int splitElt, int splitDist, int treeNode, bool buildForDither, GifPalette* pal);
 extern int GifPickChangedPixels( const uint8_t* lastFrame, uint8_t* frame, int numPixels );
 extern void GifMakePalette( const uint8_t* lastFrame, const uint8_t* nextFrame, uint32_t width, uint32_t height, int bitDepth, bool buildForDither, GifPalette* pPal );
+extern void GifMakePaletteFromColors( const uint32_t* colors, int bitDepth, GifPalette* pPal );
 extern void GifDitherImage( const uint8_t* lastFrame, const uint8_t* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, GifPalette* pPal );
 extern void GifThresholdImage( const uint8_t* lastFrame, const uint8_t* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, GifPalette* pPal );
 
@@ -62,6 +63,8 @@ struct GifLzwNode
 };
 
 extern void GifWritePalette( const GifPalette* pPal, FILE* f );
+extern void GifWriteImageHeader(FILE* f, uint32_t left, uint32_t top, uint32_t width, uint32_t height, uint32_t delay, int transIndex);
+extern void GifWriteLzwData(FILE* f, const uint8_t* image, uint32_t width, uint32_t height, uint32_t step, int bitDepth);
 extern void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal);
 
 struct GifWriter
@@ -72,6 +75,7 @@ struct GifWriter
 };
 
 extern bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, bool dither = false );
+extern bool GifWritePaletteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth, const uint32_t* palette );
 extern bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth = 8, bool dither = false, uint32_t * palette = NULL );
 extern bool GifEnd( GifWriter* writer );
 
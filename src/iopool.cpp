@@ -0,0 +1,102 @@
+/*
+ * iopool.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the pool of threads that runs the asynchronous fs
+ * calls, so a slow disk only holds up the computer that's waiting on it.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "iopool.hpp"
+#include "platform.hpp"
+
+static std::mutex ioLock;
+static std::condition_variable ioNotify;
+static std::condition_variable ioIdle;
+static std::deque<std::pair<const void*, std::function<void()>>> ioJobs;
+static std::unordered_map<const void*, int> ioRunning; // The number of jobs each owner has running
+static std::vector<std::thread*> ioThreads;
+static int ioBusy = 0;
+static bool ioExiting = false;
+
+static void ioThread() {
+    std::unique_lock<std::mutex> lock(ioLock);
+    while (true) {
+        ioNotify.wait(lock, []()->bool {return !ioJobs.empty() || ioExiting;});
+        if (ioJobs.empty()) return;
+        const void * owner = ioJobs.front().first;
+        std::function<void()> job = std::move(ioJobs.front().second);
+        ioJobs.pop_front();
+        ioBusy++;
+        if (owner != NULL) ioRunning[owner]++;
+        lock.unlock();
+        job();
+        // the job's captures may refer to the owner too, so they have to go before it's let go
+        job = nullptr;
+        lock.lock();
+        ioBusy--;
+        if (owner != NULL && --ioRunning[owner] == 0) ioRunning.erase(owner);
+        ioIdle.notify_all();
+    }
+}
+
+void queueIOJob(const std::function<void()>& job, const void * owner) {
+#ifdef __EMSCRIPTEN__
+    // no threads to hand off to
+    job();
+#else
+    std::lock_guard<std::mutex> lock(ioLock);
+    if (ioThreads.empty()) {
+        // the threads spend most of their time waiting on the disk, so there can be more of them than cores
+        const unsigned count = std::max(2u, std::min(std::thread::hardware_concurrency(), 8u));
+        for (unsigned i = 0; i < count; i++) {
+            ioThreads.push_back(new std::thread(ioThread));
+            setThreadName(*ioThreads.back(), "I/O Thread");
+        }
+    }
+    ioJobs.emplace_back(owner, job);
+    ioNotify.notify_one();
+#endif
+}
+
+void ioPoolCancel(const void * owner) {
+#ifndef __EMSCRIPTEN__
+    // the dropped jobs are destroyed once the lock is released, in case letting go of their captures takes a while
+    std::vector<std::function<void()>> dropped;
+    std::unique_lock<std::mutex> lock(ioLock);
+    for (auto it = ioJobs.begin(); it != ioJobs.end();) {
+        if (it->first == owner) {
+            dropped.push_back(std::move(it->second));
+            it = ioJobs.erase(it);
+        } else ++it;
+    }
+    if (ioJobs.empty() && ioBusy == 0) ioIdle.notify_all();
+    ioIdle.wait(lock, [owner]()->bool {return ioRunning.find(owner) == ioRunning.end();});
+#endif
+}
+
+void ioPoolQuit() {
+    std::unique_lock<std::mutex> lock(ioLock);
+    ioIdle.wait(lock, []()->bool {return ioJobs.empty() && ioBusy == 0;});
+    ioExiting = true;
+    ioNotify.notify_all();
+    std::vector<std::thread*> threads;
+    threads.swap(ioThreads);
+    lock.unlock();
+    for (std::thread * t : threads) {
+        t->join();
+        delete t;
+    }
+    lock.lock();
+    ioExiting = false;
+}
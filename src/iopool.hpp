@@ -0,0 +1,25 @@
+/*
+ * iopool.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the pool of threads that runs the asynchronous fs calls.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef IOPOOL_HPP
+#define IOPOOL_HPP
+#include <functional>
+
+// Runs a job on one of the I/O threads, starting them if they aren't running yet.
+// owner identifies what the job works for, so its jobs can be cancelled with
+// ioPoolCancel before it goes away.
+extern void queueIOJob(const std::function<void()>& job, const void * owner = NULL);
+// Drops the queued jobs for an owner, and waits for any of its jobs that are
+// already running to finish. No job for the owner runs after this returns.
+extern void ioPoolCancel(const void * owner);
+// Waits for all queued jobs to finish, and stops the I/O threads.
+extern void ioPoolQuit();
+
+#endif
@@ -10,7 +10,7 @@
  */
 
 #include "main.hpp"
-static int runRenderer(const std::function<std::string()>& read, const std::function<void(const std::string&)>& write);
+static int runRenderer(const std::function<std::string()>& read, const std::function<void(const std::string&)>& write, bool binaryFraming = false);
 static void showReleaseNotes();
 static void* releaseNotesThread(void* data);
 #include <functional>
@@ -20,9 +20,12 @@ static void* releaseNotesThread(void* data);
 #include <Computer.hpp>
 #include <configuration.hpp>
 #include <sys/stat.h>
+#include "diskimage.hpp"
+#include "iopool.hpp"
 #include "peripheral/drive.hpp"
 #include "peripheral/speaker.hpp"
 #include "platform.hpp"
+#include "romarchive.hpp"
 #include "runtime.hpp"
 #include "terminal/CLITerminal.hpp"
 #include "terminal/RawTerminal.hpp"
@@ -30,6 +33,7 @@ static void* releaseNotesThread(void* data);
 #include "terminal/TRoRTerminal.hpp"
 #include "terminal/HardwareSDLTerminal.hpp"
 #include "termsupport.hpp"
+#include "termtrace.hpp"
 #include <Poco/Version.h>
 #include <Poco/URI.h>
 #include <Poco/Checksum.h>
@@ -54,6 +58,8 @@ extern "C" {extern int Android_JNI_SetupThread(void);}
 #endif
 
 #ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
 extern void uploadCrashDumps();
 #endif
 
@@ -266,7 +272,7 @@ static void update_thread() {
 }
 #endif
 
-static int runRenderer(const std::function<std::string()>& read, const std::function<void(const std::string&)>& write) {
+static int runRenderer(const std::function<std::string()>& read, const std::function<void(const std::string&)>& write, bool binaryFraming) {
     if (selectedRenderer == 0) SDLTerminal::init();
     else if (selectedRenderer == 5) HardwareSDLTerminal::init();
     else {
@@ -274,25 +280,50 @@ static int runRenderer(const std::function<std::string()>& read, const std::func
         return 3;
     }
     rawWriter = write;
-    std::thread inputThread([read](){
+    std::thread inputThread([read, binaryFraming](){
         while (!exiting) {
             std::string data = read();
             if (data.empty()) {
                 exiting = true;
                 break;
             }
-            long sizen;
-            size_t off = 8;
-            if (data[3] == 'C') sizen = std::stol(data.substr(4, 4), nullptr, 16);
-            else if (data[3] == 'D') {sizen = std::stol(data.substr(4, 12), nullptr, 16); off = 16;}
-            else continue;
-            std::string ddata = b64decode(data.substr(off, sizen));
-            Poco::Checksum chk;
-            if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM) chk.update(ddata);
-            else chk.update(data.substr(off, sizen));
-            if (chk.checksum() != std::stoul(data.substr(sizen + off, 8), NULL, 16)) {
-                fprintf(stderr, "Invalid checksum: expected %08X, got %08lX\n", chk.checksum(), std::stoul(data.substr(sizen + off, 8), NULL, 16));
-                continue;
+            std::string ddata;
+            if (data[3] == 'B') {
+                uint32_t size = 0, sum = 0;
+                if (data.size() < 12) continue;
+                memcpy(&size, data.c_str() + 4, 4);
+                if (data.size() < (size_t)size + 12) continue;
+                ddata = data.substr(8, size);
+                memcpy(&sum, data.c_str() + 8 + size, 4);
+                Poco::Checksum chk;
+                chk.update(ddata);
+                if (chk.checksum() != sum) {
+                    fprintf(stderr, "Invalid checksum: expected %08X, got %08X\n", chk.checksum(), sum);
+                    continue;
+                }
+            } else {
+                long sizen;
+                size_t off = 8;
+                if (data[3] == 'C') sizen = std::stol(data.substr(4, 4), nullptr, 16);
+                else if (data[3] == 'D') {sizen = std::stol(data.substr(4, 12), nullptr, 16); off = 16;}
+                else continue;
+                ddata = b64decode(data.substr(off, sizen));
+                Poco::Checksum chk;
+                if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM) chk.update(ddata);
+                else chk.update(data.substr(off, sizen));
+                if (chk.checksum() != std::stoul(data.substr(sizen + off, 8), NULL, 16)) {
+                    fprintf(stderr, "Invalid checksum: expected %08X, got %08lX\n", chk.checksum(), std::stoul(data.substr(sizen + off, 8), NULL, 16));
+                    continue;
+                }
+            }
+            if (ddata.size() < 2) continue;
+            if ((uint8_t)ddata[0] & CCPC_RAW_COMPRESSED_PACKET) {
+                try {
+                    ddata = rawDecompress(ddata);
+                } catch (std::exception &e) {
+                    fprintf(stderr, "Could not decompress packet: %s\n", e.what());
+                    continue;
+                }
             }
             std::stringstream in(ddata);
             uint8_t type = (uint8_t)in.get();
@@ -366,6 +397,64 @@ static int runRenderer(const std::function<std::string()>& read, const std::func
                     term->changed = true;
                 }
                 break;
+            } case CCPC_RAW_TERMINAL_DELTA: {
+                if (rawClientTerminals.find(id) != rawClientTerminals.end()) {
+                    Terminal * term = rawClientTerminals[id];
+                    const int mode = in.get();
+                    const bool canBlink = in.get();
+                    uint16_t width = 0, height = 0, blinkX = 0, blinkY = 0, nranges = 0;
+                    in.read((char*)&width, 2);
+                    in.read((char*)&height, 2);
+                    in.read((char*)&blinkX, 2);
+                    in.read((char*)&blinkY, 2);
+                    in.get(); // grayscale
+                    const uint8_t flags = (uint8_t)in.get();
+                    in.read((char*)&nranges, 2);
+                    std::lock_guard<std::mutex> lock(term->locked);
+                    // a delta only applies on top of the frame it was made from, so one that doesn't match what's shown is dropped; the next full frame will fix it
+                    if (!in || mode != term->mode || width != term->width || height != term->height) break;
+                    const size_t rowSize = mode == 0 ? width : width * Terminal::fontWidth;
+                    const unsigned rows = mode == 0 ? height : height * Terminal::fontHeight;
+                    // everything is decoded before any of it is applied, so a bad packet leaves the screen as it was
+                    std::vector<std::pair<uint16_t, std::vector<unsigned char> > > ranges;
+                    bool ok = true;
+                    for (uint16_t i = 0; i < nranges && ok; i++) {
+                        uint16_t start = 0, count = 0;
+                        in.read((char*)&start, 2);
+                        in.read((char*)&count, 2);
+                        if (!in || start + count > rows) {
+                            ok = false;
+                            break;
+                        }
+                        const size_t size = count * rowSize;
+                        std::vector<unsigned char> data(mode == 0 ? size * 2 : size);
+                        ok = readRLE(in, data.data(), size) && (mode != 0 || readRLE(in, data.data() + size, size));
+                        ranges.push_back(std::make_pair(start, std::move(data)));
+                    }
+                    unsigned char palette[256*3];
+                    const int paletteSize = mode == 2 ? 256 : 16;
+                    if (flags & 1) in.read((char*)palette, paletteSize * 3);
+                    if (!ok || !in) break;
+                    term->canBlink = canBlink;
+                    term->blinkX = blinkX;
+                    term->blinkY = blinkY;
+                    for (const auto& r : ranges) {
+                        const size_t size = r.second.size() / (mode == 0 ? 2 : 1);
+                        if (mode == 0) {
+                            memcpy(term->screen.data() + r.first * rowSize, r.second.data(), size);
+                            memcpy(term->colors.data() + r.first * rowSize, r.second.data() + size, size);
+                        } else memcpy(term->pixels.data() + r.first * rowSize, r.second.data(), size);
+                    }
+                    if (flags & 1) {
+                        for (int i = 0; i < paletteSize; i++) {
+                            term->palette[i].r = palette[i*3];
+                            term->palette[i].g = palette[i*3+1];
+                            term->palette[i].b = palette[i*3+2];
+                        }
+                    }
+                    term->changed = true;
+                }
+                break;
             } case CCPC_RAW_TERMINAL_CHANGE: {
                 uint8_t quit = (uint8_t)in.get();
                 if (quit == 1) {
@@ -413,14 +502,14 @@ static int runRenderer(const std::function<std::string()>& read, const std::func
                 uint32_t ef = 0;
                 in.read((char*)&f, 2);
                 if (f & CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES) in.read((char*)&ef, 4);
-                RawTerminal::supportedFeatures = f & (CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM | CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT | CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS);
+                RawTerminal::supportedFeatures = f & (CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM | CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT | CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS | CCPC_RAW_FEATURE_FLAG_DELTA_FRAMES | CCPC_RAW_FEATURE_FLAG_COMPRESSION | (binaryFraming ? CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING : 0));
                 RawTerminal::supportedExtendedFeatures = ef & (0x00000000);
             }}
             std::this_thread::yield();
         }
     });
     setThreadName(inputThread, "Input Thread");
-    RawTerminal::initClient(CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM | CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS);
+    RawTerminal::initClient(CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM | CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS | CCPC_RAW_FEATURE_FLAG_DELTA_FRAMES | CCPC_RAW_FEATURE_FLAG_COMPRESSION | (binaryFraming ? CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING : 0));
     mainLoop();
     inputThread.join();
     for (auto t : rawClientTerminals) t.second->factory->deleteTerminal(t.second);
@@ -511,6 +600,13 @@ static int id = 0;
 static bool manualID = false;
 static bool forceMigrate = false;
 static path_t customDataDir;
+static path_t traceFile;
+static path_t replayFile;
+static path_t replayImageDir;
+static double replaySpeed = 1.0;
+static path_t romArchivePath;
+static path_t packROMPath;
+static std::pair<path_t, path_t> packImagePaths, unpackImagePaths;
 
 int parseArguments(const std::vector<std::string>& argv) {
     for (int i = 0; i < argv.size(); i++) {
@@ -519,6 +615,8 @@ int parseArguments(const std::vector<std::string>& argv) {
         else if (arg == "--gui" || arg == "--sdl" || arg == "--software-sdl") selectedRenderer = 0;
         else if (arg == "--cli" || arg == "-c") { selectedRenderer = 2; checkTTY(); }
         else if (arg == "--raw") { selectedRenderer = 3; checkTTY(); }
+        else if (arg == "--raw-server") { selectedRenderer = 3; RawTerminal::serverAddress = argv[++i]; }
+        else if (arg.substr(0, 13) == "--raw-server=") { selectedRenderer = 3; RawTerminal::serverAddress = arg.substr(13); }
         else if (arg == "--raw-client") { rawClient = true; checkTTY(); }
         else if (arg == "--raw-websocket") { rawClient = true; rawWebSocketURL = argv[++i]; }
         else if (arg.substr(0, 16) == "--raw-websocket=") { rawClient = true; rawWebSocketURL = arg.substr(16); }
@@ -537,18 +635,26 @@ int parseArguments(const std::vector<std::string>& argv) {
         else if (arg == "--start-dir") customDataDir = argv[++i];
         else if (arg.substr(0, 3) == "-c=") customDataDir = arg.substr(3);
         else if (arg == "--rom") setROMPath(argv[++i].c_str());
+        else if (arg == "--rom-archive") romArchivePath = argv[++i];
+        else if (arg == "--pack-rom") packROMPath = argv[++i];
+        else if (arg == "--pack-image") { packImagePaths.first = argv[++i]; packImagePaths.second = argv[++i]; }
+        else if (arg == "--unpack-image") { unpackImagePaths.first = argv[++i]; unpackImagePaths.second = argv[++i]; }
         else if (arg == "--assets-dir" || arg == "-a") setROMPath(path_t(argv[++i])/"assets"/"computercraft"/"lua");
         else if (arg.substr(0, 3) == "-a=") setROMPath(path_t(arg.substr(3))/"assets"/"computercraft"/"lua");
         else if (arg == "--mc-save") computerDir = getMCSavePath() / argv[++i] / "computer";
         else if (arg == "-i" || arg == "--id") { manualID = true; id = std::stoi(argv[++i]); }
         else if (arg == "--migrate") forceMigrate = true;
-        else if (arg == "--mount" || arg == "--mount-ro" || arg == "--mount-rw") {
+        else if (arg == "--trace") traceFile = argv[++i];
+        else if (arg == "--replay") replayFile = argv[++i];
+        else if (arg == "--replay-images") replayImageDir = argv[++i];
+        else if (arg == "--replay-speed") replaySpeed = std::stod(argv[++i]);
+        else if (arg == "--mount" || arg == "--mount-ro" || arg == "--mount-rw" || arg == "--mount-overlay") {
             std::string mount_path = argv[++i];
             if (mount_path.find('=') == std::string::npos) {
                 std::cerr << "Could not parse mount path string\n";
                 return 1;
             }
-            customMounts.push_back(std::make_tuple(mount_path.substr(0, mount_path.find('=')), mount_path.substr(mount_path.find('=') + 1), arg == "--mount" ? -1 : (arg == "--mount-rw")));
+            customMounts.push_back(std::make_tuple(mount_path.substr(0, mount_path.find('=')), mount_path.substr(mount_path.find('=') + 1), arg == "--mount" ? -1 : arg == "--mount-overlay" ? 2 : (arg == "--mount-rw")));
         } else if (arg == "--renderer" || arg == "-r") {
             if (++i == argv.size()) {
                 checkTTY();
@@ -621,15 +727,25 @@ int parseArguments(const std::vector<std::string>& argv) {
                       << "  -d|--directory <dir>             Sets the directory that stores user data\n"
                       << "  --mc-save <name>                 Uses the selected Minecraft save name for computer data\n"
                       << "  --rom <dir>                      Sets the directory that holds the ROM & BIOS\n"
+                      << "  --rom-archive <file>             Reads the ROM & BIOS from an archive made with --pack-rom\n"
+                      << "  --pack-rom <file>                Packs the ROM & BIOS into an archive, then exits\n"
+                      << "  --pack-image <dir> <file>        Packs a computer's or disk's directory into a disk image, then exits\n"
+                      << "  --unpack-image <file> <dir>      Unpacks a disk image into a new directory, then exits\n"
                       << "  -i|--id <id>                     Sets the ID of the computer that will launch\n"
                       << "  --script <file>                  Sets a script to be run before starting the shell\n"
                       << "  --exec <code>                    Sets Lua code to be run before starting the shell\n"
                       << "  --args \"<args>\"                  Sets arguments to be passed to the file in --script\n"
-                      << "  --mount[-ro|-rw] <path>=<dir>    Automatically mounts a directory at startup\n"
+                      << "  --mount[-ro|-rw|-overlay] <path>=<dir>\n"
+                      << "                                   Automatically mounts a directory or disk image at startup\n"
                       << "    Variants:\n"
-                      << "      --mount      Uses default mount_mode in config\n"
-                      << "      --mount-ro   Forces mount to be read-only\n"
-                      << "      --mount-rw   Forces mount to be read-write\n"
+                      << "      --mount          Uses default mount_mode in config\n"
+                      << "      --mount-ro       Forces mount to be read-only\n"
+                      << "      --mount-rw       Forces mount to be read-write\n"
+                      << "      --mount-overlay  Shares the directory read-only, keeping changes per computer\n"
+                      << "  --trace <file>                   Records all terminal output and input to a trace file\n"
+                      << "  --replay <file>                  Plays back a trace file instead of starting a computer\n"
+                      << "  --replay-images <dir>            With --replay, saves the trace as images without opening a window\n"
+                      << "  --replay-speed <factor>          With --replay, sets the playback speed (0 = as fast as possible)\n"
                       << "  -h|-?|--help                     Shows this help message\n"
                       << "  -V|--version                     Shows the current version\n\n"
                       << "Renderer options:\n"
@@ -639,6 +755,7 @@ int parseArguments(const std::vector<std::string>& argv) {
 #endif
                       << "  --headless                       Outputs only text straight to stdout\n"
                       << "  --raw                            Outputs terminal contents using a binary format\n"
+                      << "  --raw-server <port|address>      Like --raw, but serves any number of viewers over a local socket\n"
                       << "  --raw-client                     Renders raw output from another terminal (GUI only)\n"
                       << "  --raw-websocket <url>            Like --raw-client, but connects to a WebSocket server\n"
                       << "  --tror                           Outputs TRoR (terminal redirect over Rednet) packets\n"
@@ -672,6 +789,24 @@ int main(int argc, char*argv[]) {
         selectedRenderer = 0;
     }
 #endif
+    if (!packROMPath.empty()) {
+        if (!romArchivePack(getROMPath(), packROMPath)) {
+            std::cerr << "Could not pack the ROM in " << getROMPath().string() << " into " << packROMPath.string() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (!packImagePaths.first.empty() || !unpackImagePaths.first.empty()) {
+        std::error_code e;
+        if (!packImagePaths.first.empty()) DiskImage::pack(packImagePaths.first, packImagePaths.second, e);
+        else DiskImage::unpack(unpackImagePaths.first, unpackImagePaths.second, e);
+        if (e) {
+            if (!packImagePaths.first.empty()) std::cerr << "Could not pack " << packImagePaths.first.string() << " into " << packImagePaths.second.string() << ": " << e.message() << "\n";
+            else std::cerr << "Could not unpack " << unpackImagePaths.first.string() << " into " << unpackImagePaths.second.string() << ": " << e.message() << "\n";
+            return 1;
+        }
+        return 0;
+    }
     if (computerDir.empty()) computerDir = getBasePath() / "computer";
     if (!customDataDir.empty()) customDataDirs[id] = customDataDir;
     mainThreadID = std::this_thread::get_id();
@@ -753,26 +888,55 @@ int main(int argc, char*argv[]) {
             delete ws;
             delete cs;
             return retval;
-        } else return runRenderer([]()->std::string {
+        }
+#ifdef _WIN32
+        // binary frames must not have their newlines translated
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return runRenderer([]()->std::string {
             while (true) {
                 unsigned char c1 = (unsigned char)std::cin.get();
-                if (c1 == '!' && std::cin.get() == 'C' && std::cin.get() == 'P' && std::cin.get() == 'C') {
-                    char size[5];
-                    std::cin.read(size, 4);
-                    const long sizen = strtol(size, NULL, 16);
-                    char * tmp = new char[(size_t)sizen+10];
-                    std::cin.read(tmp, sizen + 9);
-                    std::string retval = "!CPC" + std::string(size, 4) + std::string(tmp, sizen + 9);
-                    if (tmp[sizen + 8] == '\r') retval += '\n';
-                    delete[] tmp;
-                    return retval;
+                if (c1 == '!' && std::cin.get() == 'C' && std::cin.get() == 'P') {
+                    const char type = (char)std::cin.get();
+                    if (type == 'C') {
+                        char size[5];
+                        std::cin.read(size, 4);
+                        const long sizen = strtol(size, NULL, 16);
+                        char * tmp = new char[(size_t)sizen+10];
+                        std::cin.read(tmp, sizen + 9);
+                        std::string retval = "!CPC" + std::string(size, 4) + std::string(tmp, sizen + 9);
+                        if (tmp[sizen + 8] == '\r') retval += '\n';
+                        delete[] tmp;
+                        return retval;
+                    } else if (type == 'B') {
+                        uint32_t size = 0;
+                        std::cin.read((char*)&size, 4);
+                        if (!std::cin.good() || size > 0x4000000) continue;
+                        std::string retval(size + 12, '\0');
+                        memcpy(&retval[0], "!CPB", 4);
+                        memcpy(&retval[4], &size, 4);
+                        std::cin.read(&retval[8], size + 4);
+                        return retval;
+                    }
                 }
             }
         }, [](const std::string& str) {
             std::cout << str;
             std::cout.flush();
-        });
+        }, true);
     }
+    if (!replayFile.empty() && !replayImageDir.empty()) return traceReplayToImages(replayFile, replayImageDir);
+    else if (replayFile.empty() && !traceFile.empty() && !traceStart(traceFile)) {
+        std::cerr << "Could not open trace file " << traceFile.string() << "\n";
+        return 1;
+    }
+#ifndef STANDALONE_ROM
+    if (!romArchivePath.empty() && !romArchiveLoad(romArchivePath)) {
+        std::cerr << "Could not load ROM archive " << romArchivePath.string() << "\n";
+        return 1;
+    }
+#endif
     preloadPlugins();
     TerminalFactory * factory = selectedRenderer >= terminalFactories.size() ? NULL : terminalFactories[selectedRenderer];
     try {
@@ -784,6 +948,23 @@ int main(int argc, char*argv[]) {
         SDL_Quit();
         return 2;
     }
+    if (!replayFile.empty()) {
+        int retval = 0;
+        std::thread replayThread([&retval]() {
+            retval = traceReplay(replayFile, replaySpeed);
+            exiting = true;
+        });
+        setThreadName(replayThread, "Replay Thread");
+        while (!exiting) {
+            if (factory) factory->pollEvents();
+            else defaultPollEvents();
+            std::this_thread::yield();
+        }
+        replayThread.join();
+        if (factory) factory->quit();
+        else SDL_Quit();
+        return retval;
+    }
     driveInit();
 #ifndef NO_MIXER
     speakerInit();
@@ -849,8 +1030,12 @@ int main(int argc, char*argv[]) {
     speakerQuit();
 #endif
     driveQuit();
+    // finish any asynchronous writes still in flight
+    ioPoolQuit();
     http_server_stop();
     config_save();
+    traceStop();
+    romArchiveUnload();
 #if !defined(__EMSCRIPTEN__) && !CRAFTOSPC_INDEV
     if (!updateAtQuit.empty()) {
         updateNow(updateAtQuit, &updateAtQuitRoot);
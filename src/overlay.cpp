@@ -0,0 +1,158 @@
+/*
+ * overlay.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements overlay directories, which let many computers share one
+ * read-only directory while each keeps its own changes.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include "diskusage.hpp"
+#include "filecopy.hpp"
+#include "overlay.hpp"
+
+namespace fs = std::filesystem;
+
+static fs::path whiteout(const fs::path& dir, const fs::path& name) {
+    return dir / (".wh." + name.string());
+}
+
+bool Overlay::showsLower(const fs::path& rel) const {
+    // a whiteout on any directory along the way hides everything under it
+    std::error_code e;
+    fs::path dir = upper;
+    for (const fs::path& name : rel) {
+        if (fs::exists(whiteout(dir, name), e)) return false;
+        dir /= name;
+    }
+    return true;
+}
+
+fs::path Overlay::resolve(const fs::path& rel) const {
+    std::error_code e;
+    if (!rel.empty() && isWhiteout(rel.filename().string())) return fs::path();
+    const fs::path up = upper / rel;
+    if (fs::exists(up, e)) return up;
+    e.clear();
+    if (showsLower(rel) && fs::exists(lower / rel, e)) return lower / rel;
+    return fs::path();
+}
+
+DirectoryCache::Listing Overlay::list(const fs::path& rel, const std::function<DirectoryCache::Listing(const fs::path&)>& read) const {
+    std::error_code e;
+    const DirectoryCache::Listing up = read(upper / rel);
+    // a file in the upper directory hides a directory under it
+    if (up == NULL && fs::exists(upper / rel, e)) return NULL;
+    const DirectoryCache::Listing low = showsLower(rel) ? read(lower / rel) : NULL;
+    if (up == NULL) return low;
+    const bool hasWhiteouts = std::any_of(up->begin(), up->end(), [](const std::string& name)->bool {return isWhiteout(name);});
+    if (low == NULL && !hasWhiteouts) return up;
+    std::vector<std::string> hidden, names;
+    for (const std::string& name : *up) if (isWhiteout(name)) hidden.push_back(name.substr(4));
+    std::sort(hidden.begin(), hidden.end());
+    std::shared_ptr<std::vector<std::string> > merged = std::make_shared<std::vector<std::string> >();
+    std::copy_if(up->begin(), up->end(), std::back_inserter(names), [](const std::string& name)->bool {return !isWhiteout(name);});
+    if (low == NULL) {
+        *merged = std::move(names);
+        return merged;
+    }
+    std::vector<std::string> shown;
+    std::set_difference(low->begin(), low->end(), hidden.begin(), hidden.end(), std::back_inserter(shown));
+    std::set_union(names.begin(), names.end(), shown.begin(), shown.end(), std::back_inserter(*merged));
+    return merged;
+}
+
+void Overlay::remove(const fs::path& rel, std::error_code& e) const {
+    e.clear();
+    const bool lowerShows = showsLower(rel) && fs::exists(lower / rel, e);
+    e.clear();
+    fs::remove_all(upper / rel, e);
+    if (e || !lowerShows) return;
+    const fs::path dir = (upper / rel).parent_path();
+    fs::create_directories(dir, e);
+    if (e) return;
+    std::ofstream out(whiteout(dir, rel.filename()));
+    if (!out.is_open()) e = std::make_error_code(std::errc::permission_denied);
+}
+
+int64_t Overlay::copyUp(const fs::path& rel, std::error_code& e) const {
+    static const std::atomic<bool> cancel {false};
+    e.clear();
+    if (!showsLower(rel)) return 0;
+    const fs::path up = upper / rel, low = lower / rel;
+    if (!fs::is_directory(low, e)) {
+        // a file only needs copying if the upper directory doesn't have its own
+        e.clear();
+        if (fs::exists(up, e) || !fs::exists(low, e)) return 0;
+        fs::create_directories(up.parent_path(), e);
+        if (e) return 0;
+        copyTree(low, up, e, cancel);
+        // the lower directory is often read-only, but the copy is there to be changed
+        if (!e) fs::permissions(up, fs::perms::owner_write, fs::perm_options::add, e);
+        return DiskUsage::measure(up);
+    }
+    if (fs::exists(up, e) && !fs::is_directory(up, e)) return 0;
+    fs::create_directories(up, e);
+    if (e) return 0;
+    int64_t bytes = 0;
+    for (const auto& dir : fs::directory_iterator(low, e)) {
+        bytes += copyUp(rel / dir.path().filename(), e);
+        if (e) break;
+    }
+    return bytes;
+}
+
+int64_t Overlay::measure(const fs::path& rel) const {
+    std::error_code e;
+    const fs::path p = resolve(rel);
+    if (p.empty()) return 0;
+    // nothing is hidden in a file or a lower-only directory; anything else has to be counted name by name
+    if (p != upper / rel || !fs::is_directory(p, e)) return DiskUsage::measure(p);
+    const DirectoryCache::Listing names = list(rel, DirectoryCache::read);
+    int64_t size = 0;
+    if (names != NULL) for (const std::string& name : *names) size += measure(rel / name);
+    return size;
+}
+
+void Overlay::copy(const fs::path& rel, const fs::path& to, std::error_code& e, const std::atomic<bool>& cancel) const {
+    e.clear();
+    const fs::path from = resolve(rel);
+    if (from.empty()) {
+        e = std::make_error_code(std::errc::no_such_file_or_directory);
+        return;
+    }
+    // files, and directories that are only in the lower directory, can be copied as they are
+    if (from != upper / rel || !fs::is_directory(from, e)) {
+        e.clear();
+        copyTree(from, to, e, cancel);
+        return;
+    }
+    // directories in the upper directory follow copyTree one level at a time, so whiteouts aren't copied and lower files are
+    const fs::file_status st = fs::status(to, e);
+    e.clear();
+    if (fs::exists(st)) {
+        if (fs::is_regular_file(st)) e = std::make_error_code(std::errc::is_a_directory);
+        else if (!fs::is_directory(st)) e = std::make_error_code(std::errc::invalid_argument);
+        if (e) return;
+    } else {
+        fs::create_directory(to, e);
+        if (e) return;
+        fs::permissions(to, fs::status(from).permissions(), e);
+        if (e) return;
+    }
+    const DirectoryCache::Listing names = list(rel, DirectoryCache::read);
+    if (names == NULL) return;
+    for (const std::string& name : *names) {
+        if (cancel) {
+            e = std::make_error_code(std::errc::operation_canceled);
+            return;
+        }
+        copy(rel / name, to / name, e, cancel);
+        if (e) return;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * overlay.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines overlay directories, which let many computers share one
+ * read-only directory while each keeps its own changes.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef OVERLAY_HPP
+#define OVERLAY_HPP
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <system_error>
+#include "dircache.hpp"
+
+/*
+ * A copy-on-write view of a read-only lower directory through a writable upper
+ * directory. Anything in the upper directory hides the lower directory's copy
+ * of the same path; new files, and files that are changed, are written to the
+ * upper directory. Deleting something that's in the lower directory leaves a
+ * whiteout named ".wh.<name>" next to where it was in the upper directory,
+ * which hides the lower copy (and everything under it) for good, even once the
+ * name is used again in the upper directory - so a directory that's deleted
+ * and made again starts empty. Names starting with ".wh." are reserved for
+ * whiteouts, and don't show up in listings. Paths are given relative to the
+ * root of the overlay. None of these functions change the lower directory.
+ */
+class Overlay {
+public:
+    const std::filesystem::path upper, lower;
+    Overlay(const std::filesystem::path& upper, const std::filesystem::path& lower): upper(upper), lower(lower) {}
+    // Returns whether a name is a whiteout.
+    static bool isWhiteout(const std::string& name) {return name.compare(0, 4, ".wh.") == 0;}
+    // Returns whether the lower directory's copy of a path (if there is one) shows through.
+    bool showsLower(const std::filesystem::path& rel) const;
+    // Returns the real path of the copy of a path that shows: the upper copy if there is one, otherwise the lower copy; empty if neither exists.
+    std::filesystem::path resolve(const std::filesystem::path& rel) const;
+    // Lists a directory, merging the upper copy with what shows of the lower copy, using read to list each real directory. Returns NULL if it isn't a directory.
+    DirectoryCache::Listing list(const std::filesystem::path& rel, const std::function<DirectoryCache::Listing(const std::filesystem::path&)>& read) const;
+    // Deletes a path: the upper copy is removed, and the lower copy is hidden with a whiteout.
+    void remove(const std::filesystem::path& rel, std::error_code& e) const;
+    // Copies what shows of the lower copy of a path into the upper directory, so it can be changed in place. Returns the number of bytes copied.
+    int64_t copyUp(const std::filesystem::path& rel, std::error_code& e) const;
+    // Returns the total size of the files that show at a path, like DiskUsage::measure does for a real path.
+    int64_t measure(const std::filesystem::path& rel) const;
+    // Copies what shows at a path to a real path outside the overlay, the same way copyTree does.
+    void copy(const std::filesystem::path& rel, const std::filesystem::path& to, std::error_code& e, const std::atomic<bool>& cancel) const;
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include "drive.hpp"
+#include "../diskimage.hpp"
 #include "../platform.hpp"
 #include "../runtime.hpp"
 #include "../terminal/SDLTerminal.hpp"
@@ -98,7 +99,10 @@ int drive::ejectDisk(lua_State *L) {
         Computer * computer = get_comp(L);
         for (auto it = computer->mounts.begin(); it != computer->mounts.end(); ++it) {
             if (1 == std::get<0>(*it).size() && std::get<0>(*it).front() == mount_path) {
+                const path_t real_path = std::get<1>(*it);
                 computer->mounts.erase(it);
+                removeDiskImage(computer, real_path);
+                invalidateMountCache(computer);
                 if (mount_path == "disk") computer->usedDriveMounts.erase(0);
                 else {
                     const int n = std::stoi(mount_path.substr(4)) - 1;
@@ -139,8 +143,11 @@ int drive::insertDisk(lua_State *L, bool init) {
         comp->mounter_initializing = true;
         try {
             std::error_code e;
-            fs::create_directories(computerDir / "disk" / std::to_string(id), e);
-            if (e || !addMount(comp, computerDir / "disk" / std::to_string(id), mount_path.c_str(), false)) {
+            // a disk with no directory can keep its files in a disk image instead
+            path_t diskPath = computerDir / "disk" / std::to_string(id);
+            if (!fs::exists(diskPath, e) && fs::is_regular_file(computerDir / "disk" / (std::to_string(id) + ".img"), e)) diskPath = computerDir / "disk" / (std::to_string(id) + ".img");
+            else fs::create_directories(diskPath, e);
+            if (e || !addMount(comp, diskPath, mount_path.c_str(), false)) {
                 diskType = disk_type::DISK_TYPE_NONE;
                 comp->mounter_initializing = false;
                 error = "Could not mount";
@@ -191,7 +198,7 @@ int drive::insertDisk(lua_State *L, bool init) {
                 goto throwErrorParam;
             }
         }
-        if (fs::is_directory(path, e)) {
+        if (fs::is_directory(path, e) || DiskImage::isImage(path)) {
             diskType = disk_type::DISK_TYPE_MOUNT;
             int i;
             for (i = 0; comp->usedDriveMounts.find(i) != comp->usedDriveMounts.end(); i++) {}
@@ -11,6 +11,8 @@
 #include "monitor.hpp"
 #include "../runtime.hpp"
 #include "../termsupport.hpp"
+#include "../termtrace.hpp"
+#include "../terminal/TRoRTerminal.hpp"
 
 monitor::monitor(lua_State *L, const char * side) {
     if (SDL_GetCurrentVideoDriver() != NULL && (std::string(SDL_GetCurrentVideoDriver()) == "KMSDRM" || std::string(SDL_GetCurrentVideoDriver()) == "KMSDRM_LEGACY"))
@@ -30,53 +32,29 @@ monitor::~monitor() {term->factory->deleteTerminal(term);}
 
 int monitor::write(lua_State *L) {
     lastCFunction = __func__;
-    if (selectedRenderer == 4) printf("TW:%d;%s\n", term->id, luaL_checkstring(L, 1));
+    if (selectedRenderer == 4) TRoRTerminal::send(term->id, "TW", "%s", luaL_checkstring(L, 1));
     size_t str_sz;
     const char * str = luaL_checklstring(L, 1, &str_sz);
-    std::lock_guard<std::mutex> lock(term->locked);
-    if (term->blinkY < 0 || (term->blinkX >= 0 && (unsigned)term->blinkX >= term->width) || (unsigned)term->blinkY >= term->height) return 0;
-    for (unsigned i = 0; i < str_sz && (term->blinkX < 0 || (unsigned)term->blinkX < term->width); i++, term->blinkX++) {
-        if (term->blinkX >= 0) {
-            term->screen[term->blinkY][term->blinkX] = str[i];
-            term->colors[term->blinkY][term->blinkX] = colors;
-        }
-    }
-    term->changed = true;
+    termWrite(*term, str, str_sz, colors);
     return 0;
 }
 
 int monitor::scroll(lua_State *L) {
     lastCFunction = __func__;
-    if (selectedRenderer == 4) printf("TS:%d;%d\n", term->id, (int)luaL_checkinteger(L, 1));
-    const int lines = (int)luaL_checkinteger(L, 1);
-    std::lock_guard<std::mutex> lock(term->locked);
-    if (lines > 0 ? (unsigned)lines >= term->height : (unsigned)-lines >= term->height) {
-        // scrolling more than the height is equivalent to clearing the screen
-        memset(term->screen.data(), ' ', term->height * term->width);
-        memset(term->colors.data(), colors, term->height * term->width);
-    } else if (lines > 0) {
-        memmove(term->screen.data(), term->screen.data() + lines * term->width, (term->height - lines) * term->width);
-        memset(term->screen.data() + (term->height - lines) * term->width, ' ', lines * term->width);
-        memmove(term->colors.data(), term->colors.data() + lines * term->width, (term->height - lines) * term->width);
-        memset(term->colors.data() + (term->height - lines) * term->width, colors, lines * term->width);
-    } else if (lines < 0) {
-        memmove(term->screen.data() - lines * (int)term->width, term->screen.data(), ((int)term->height + lines) * term->width);
-        memset(term->screen.data(), ' ', -lines * term->width);
-        memmove(term->colors.data() - lines * (int)term->width, term->colors.data(), ((int)term->height + lines) * term->width);
-        memset(term->colors.data(), colors, -lines * term->width);
-    }
-    term->changed = true;
+    if (selectedRenderer == 4) TRoRTerminal::send(term->id, "TS", "%d", (int)luaL_checkinteger(L, 1));
+    termScroll(*term, luaL_checkinteger(L, 1), colors);
     return 0;
 }
 
 int monitor::setCursorPos(lua_State *L) {
     lastCFunction = __func__;
-    if (selectedRenderer == 4) printf("TC:%d;%d,%d\n", term->id, (int)luaL_checkinteger(L, 1), (int)luaL_checkinteger(L, 2));
+    if (selectedRenderer == 4) TRoRTerminal::send(term->id, "TC", "%d,%d", (int)luaL_checkinteger(L, 1), (int)luaL_checkinteger(L, 2));
     const int x = (int)luaL_checkinteger(L, 1);
     const int y = (int)luaL_checkinteger(L, 2);
     std::lock_guard<std::mutex> lock(term->locked);
     term->blinkX = x - 1;
     term->blinkY = y - 1;
+    if (traceEnabled) traceCursor(*term);
     return 0;
 }
 
@@ -85,7 +63,8 @@ int monitor::setCursorBlink(lua_State *L) {
     luaL_checktype(L, 1, LUA_TBOOLEAN);
     std::lock_guard<std::mutex> lock(term->locked);
     term->canBlink = lua_toboolean(L, 1);
-    if (selectedRenderer == 4) printf("TB:%d;%s\n", term->id, lua_toboolean(L, 1) ? "true" : "false");
+    if (traceEnabled) traceCursor(*term);
+    if (selectedRenderer == 4) TRoRTerminal::send(term->id, "TB", "%s", lua_toboolean(L, 1) ? "true" : "false");
     return 0;
 }
 
@@ -116,33 +95,22 @@ int monitor::getSize(lua_State *L) {
 
 int monitor::clear(lua_State *L) {
     lastCFunction = __func__;
-    if (selectedRenderer == 4) printf("TE:%d;\n", term->id);
-    std::lock_guard<std::mutex> lock(term->locked);
-    if (term->mode > 0) {
-        memset(term->pixels.data(), 0x0F, term->width * Terminal::fontWidth * term->height * Terminal::fontHeight);
-    } else {
-        memset(term->screen.data(), ' ', term->height * term->width);
-        memset(term->colors.data(), colors, term->height * term->width);
-    }
-    term->changed = true;
+    if (selectedRenderer == 4) TRoRTerminal::send(term->id, "TE", "");
+    termClear(*term, colors);
     return 0;
 }
 
 int monitor::clearLine(lua_State *L) {
     lastCFunction = __func__;
-    if (selectedRenderer == 4) printf("TL:%d;\n", term->id);
-    if (term->blinkY < 0 || (unsigned)term->blinkY >= term->height) return 0;
-    std::lock_guard<std::mutex> lock(term->locked);
-    memset(term->screen.data() + (term->blinkY * term->width), ' ', term->width);
-    memset(term->colors.data() + (term->blinkY * term->width), colors, term->width);
-    term->changed = true;
+    if (selectedRenderer == 4) TRoRTerminal::send(term->id, "TL", "");
+    termClearLine(*term, colors);
     return 0;
 }
 
 int monitor::setTextColor(lua_State *L) {
     lastCFunction = __func__;
     if (selectedRenderer == 4 && luaL_checkinteger(L, 1) >= 0 && luaL_checkinteger(L, 1) < 16)
-        printf("TF:%d;%c\n", term->id, ("0123456789abcdef")[lua_tointeger(L, 1)]);
+        TRoRTerminal::send(term->id, "TF", "%c", ("0123456789abcdef")[lua_tointeger(L, 1)]);
     const int c = log2i((int)luaL_checkinteger(L, 1));
     if (c < 0 || c > 15) return luaL_error(L, "bad argument #1 (invalid color %d)", c);
     colors = (colors & 0xf0) | c;
@@ -153,7 +121,7 @@ int monitor::setTextColor(lua_State *L) {
 int monitor::setBackgroundColor(lua_State *L) {
     lastCFunction = __func__;
     if (selectedRenderer == 4 && luaL_checkinteger(L, 1) >= 0 && luaL_checkinteger(L, 1) < 16)
-        printf("TK:%d;%c\n", term->id, ("0123456789abcdef")[lua_tointeger(L, 1)]);
+        TRoRTerminal::send(term->id, "TK", "%c", ("0123456789abcdef")[lua_tointeger(L, 1)]);
     const int c = log2i((int)luaL_checkinteger(L, 1));
     if (c < 0 || c > 15) return luaL_error(L, "bad argument #1 (invalid color %d)", c);
     colors = (colors & 0x0f) | (c << 4);
@@ -185,19 +153,7 @@ int monitor::blit(lua_State *L) {
     const char * fg = luaL_checklstring(L, 2, &fg_sz);
     const char * bg = luaL_checklstring(L, 3, &bg_sz);
     if (str_sz != fg_sz || fg_sz != bg_sz) luaL_error(L, "Arguments must be the same length");
-    std::lock_guard<std::mutex> lock(term->locked);
-    if (term->blinkY < 0 || (term->blinkX >= 0 && (unsigned)term->blinkX >= term->width) || (unsigned)term->blinkY >= term->height) return 0;
-    for (unsigned i = 0; i < str_sz && (term->blinkX < 0 || (unsigned)term->blinkX < term->width); i++, term->blinkX++) {
-        if (term->blinkX >= 0) {
-            colors = htoi(bg[i], 15) << 4 | htoi(fg[i], 0);
-            if (dynamic_cast<SDLTerminal*>(term) != NULL) dynamic_cast<SDLTerminal*>(term)->cursorColor = htoi(fg[i], 0);
-            if (selectedRenderer == 4)
-                printf("TF:%d;%c\nTK:%d;%c\nTW:%d;%c\n", term->id, ("0123456789abcdef")[colors & 0xf], term->id, ("0123456789abcdef")[colors >> 4], term->id, str[i]);
-            term->screen[term->blinkY][term->blinkX] = str[i];
-            term->colors[term->blinkY][term->blinkX] = colors;
-        }
-    }
-    term->changed = true;
+    termBlit(*term, str, fg, bg, str_sz, colors);
     return 0;
 }
 
@@ -236,8 +192,9 @@ int monitor::setPaletteColor(lua_State *L) {
         term->palette[color].b = (int)(lua_tonumber(L, 4) * 255);
     }
     if (selectedRenderer == 4 && color < 16) 
-        printf("TM:%d;%d,%f,%f,%f\n", term->id, color, term->palette[color].r / 255.0, term->palette[color].g / 255.0, term->palette[color].b / 255.0);
+        TRoRTerminal::send(term->id, "TM", "%d,%f,%f,%f", color, term->palette[color].r / 255.0, term->palette[color].g / 255.0, term->palette[color].b / 255.0);
     term->changed = true;
+    if (traceEnabled) tracePalette(*term, color);
     return 0;
 }
 
@@ -249,6 +206,7 @@ int monitor::setGraphicsMode(lua_State *L) {
     std::lock_guard<std::mutex> lock(term->locked);
     term->mode = lua_isboolean(L, 1) ? (lua_toboolean(L, 1) ? 1 : 0) : (int)lua_tointeger(L, 1);
     term->changed = true;
+    if (traceEnabled) traceMode(*term);
     return 0;
 }
 
@@ -275,6 +233,7 @@ int monitor::setPixel(lua_State *L) {
     if (color < 0 || color > (term->mode == 2 ? 255 : 15)) return luaL_error(L, "bad argument #3 (invalid color %d)", color);
     term->pixels[y][x] = color;
     term->changed = true;
+    if (traceEnabled) tracePixels(*term, x, y, 1, 1);
     return 0;
 }
 
@@ -308,208 +267,12 @@ int monitor::getTextScale(lua_State *L) {
 
 int monitor::drawPixels(lua_State *L) {
     lastCFunction = __func__;
-
-    const int pixelWidth = term->width * Terminal::fontWidth,
-              pixelHeight = term->height * Terminal::fontHeight;
-
-    const int init_x = (int)luaL_checkinteger(L, 1),
-              init_y = (int)luaL_checkinteger(L, 2);
-
-    if (init_x >= pixelWidth) return 0;
-    else if (init_y >= pixelHeight) return 0;
-
-    const int fillType = lua_type(L, 3);
-    const bool isSolidFill = fillType == LUA_TNUMBER;
-
-    if (!isSolidFill && fillType != LUA_TTABLE)
-        return luaL_typerror(L, 3, "table or number");
-
-    bool undefinedWidth;
-    unsigned width, height;
-    unsigned color;
-
-    {
-        int width_, height_;
-        if (isSolidFill) {
-            undefinedWidth = false;
-            width_ = luaL_checkinteger(L, 4);
-            height_ = luaL_checkinteger(L, 5);
-        } else {
-            undefinedWidth = lua_isnoneornil(L, 4);
-            width_ = luaL_optinteger(L, 4, 0);
-            height_ = luaL_optinteger(L, 5, lua_objlen(L, 3));
-        }
-
-        if (width_ < 0)
-            return luaL_argerror(L, 4, "width cannot be negative");
-        else if (height_ < 0)
-            return luaL_argerror(L, 5, "height cannot be negative");
-
-        width = (unsigned) width_;
-        height = (unsigned) height_;
-    }
-
-    if (isSolidFill) {
-        int color_ = lua_tonumber(L, 3);
-
-        if (color_ < 0) return 0;
-        else if (term->mode == 2 ? color_ > 255 : log2i(color_) > 15)
-            return luaL_argerror(L, 3, "color index out of bounds");
-
-        color = (unsigned) color_;
-    }
-
-    std::lock_guard<std::mutex> lock(term->locked);
-
-    if (isSolidFill) {
-        const unsigned char index = term->mode == 2
-            ? (unsigned char) color
-            : (unsigned char) log2i(color);
-
-        const unsigned memset_x = max(init_x, 0),
-                       memset_len = min((int) width, max(pixelWidth - init_x, 0)) + min(init_x, 0);
-
-        const int cool_height = min((int) height, pixelHeight - init_y);
-        for (int h = max(-init_y, 0); h < cool_height; h++) {
-            memset(&term->pixels[init_y + h][memset_x], index, memset_len);
-        }
-
-        term->changed = true;
-        return 0;
-    }
-
-    const int str_offset = init_x < 0 ? -init_x : 0,
-              str_maxlen = init_x > pixelWidth ? 0 : pixelWidth - init_x;
-
-    const unsigned cool_height = min((int) height, pixelHeight - init_y);
-    for (unsigned h = max(-init_y, 0); h < cool_height; h++) {
-        lua_pushinteger(L, h + 1);
-        lua_gettable(L, 3);
-
-        if (lua_isstring(L, -1)) {
-            if (str_offset >= str_maxlen) continue;
-
-            size_t len;
-            const char *str = lua_tolstring(L, -1, &len);
-            if (len > str_maxlen) len = str_maxlen;
-            if (!undefinedWidth && width < len) len = width;
-
-            if (str_offset < len)
-                memcpy(&term->pixels[init_y + h][init_x + str_offset],
-                       str + str_offset,
-                       len - str_offset
-                );
-        } else if (lua_istable(L, -1)) {
-            // lol
-            const unsigned cool_width = (unsigned) undefinedWidth
-                ? (int) min(lua_objlen(L, -1), (size_t) (max(pixelWidth - init_x, 0)))
-                : (int) min((int) width, pixelWidth - init_x);
-
-            for (unsigned w = max(-init_x, 0); w < cool_width; w++) {
-                lua_pushinteger(L, w + 1);
-                lua_gettable(L, -2);
-
-                if (lua_isnumber(L, -1)) {
-                    const int color = lua_tointeger(L, -1);
-
-                    if (color >= 0)
-                        term->pixels[init_y + h][init_x + w] = term->mode == 2
-                            ? color
-                            : log2i(color);
-                }
-
-                lua_pop(L, 1);
-            }
-        }
-
-        lua_pop(L, 1);
-    }
-
-    term->changed = true;
-    return 0;
+    return termDrawPixels(L, *term);
 }
 
-int monitor::getPixels(lua_State* L) {
+int monitor::getPixels(lua_State *L) {
     lastCFunction = __func__;
-
-    const int pixelWidth = term->width * Terminal::fontWidth,
-              pixelHeight = term->height * Terminal::fontHeight;
-
-    const int init_x = (int) luaL_checkinteger(L, 1),
-              init_y = (int) luaL_checkinteger(L, 2),
-              end_w = (int) luaL_checkinteger(L, 3),
-              end_h = (int) luaL_checkinteger(L, 4);
-
-    if (end_w < 0) return luaL_argerror(L, 3, "width cannot be negative");
-    else if (end_h < 0) return luaL_argerror(L, 4, "height cannot be negative");
-    else if (!lua_isnoneornil(L, 5) && !lua_isboolean(L, 5))
-        return luaL_typerror(L, 5, "boolean");
-
-    const bool use_strings = lua_toboolean(L, 5);
-
-    lua_createtable(L, 0, end_h);
-
-    const int cool_min_h = max(-init_y, 0);
-    const int cool_max_h = min(end_h, pixelHeight - init_y);
-    const int cool_min_w = max(-init_x, 0);
-    const int cool_max_w = min(end_w, pixelWidth - init_x);
-
-    // scratch space for drawing background color from
-    char* bg = new char[end_w];
-    memset(bg, 15, end_w);
-
-    for (int h = 0; h < end_h; h++) {
-        lua_pushnumber(L, h + 1);
-
-        if (use_strings) {
-            if (h < cool_min_h || h >= cool_max_h || cool_min_w >= cool_max_w) {
-                lua_pushlstring(L, bg, end_w);
-            } else {
-                int concats = 1;
-
-                if (cool_min_w > 0) {
-                    lua_pushlstring(L, bg, cool_min_w);
-                    concats++;
-                }
-
-                lua_pushlstring(L,
-                    (const char *) &term->pixels[init_y + h][init_x + cool_min_w],
-                    max(cool_max_w - cool_min_w, 0)
-                );
-
-                if (cool_max_w < end_w) {
-                    lua_pushlstring(L, bg, end_w - cool_max_w);
-                    concats++;
-                }
-
-                lua_concat(L, concats);
-            }
-        } else {
-            lua_createtable(L, end_w, 0);
-
-            for (int w = 0; w < end_w; w++) {
-                lua_pushnumber(L, w + 1);
-
-                const int x = init_x + w,
-                          y = init_y + h;
-
-                if (h < cool_min_h || h >= cool_max_h ||
-                    w < cool_min_w || w >= cool_max_w)
-                    lua_pushinteger(L, -1);
-                else if (term->mode == 2)
-                    lua_pushinteger(L, term->pixels[y][x]);
-                else
-                    lua_pushinteger(L, 1 << term->pixels[y][x]);
-
-                lua_settable(L, -3);
-            }
-        }
-
-        lua_settable(L, -3);
-    }
-
-    delete[] bg;
-    return 1;
+    return termGetPixels(L, *term);
 }
 
 int monitor::screenshot(lua_State *L) {
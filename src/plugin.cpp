@@ -67,13 +67,14 @@ static _path_t _getBasePath() {return getBasePath().native();}
 static _path_t _getROMPath() {return getROMPath().native();}
 static bool _addMount(Computer *comp, const _path_t& real_path, const char * comp_path, bool read_only) {return addMount(comp, real_path, comp_path, read_only);}
 static bool _addVirtualMount(Computer * comp, const FileEntry& vfs, const char * comp_path) {return addVirtualMount(comp, vfs, comp_path);}
+static void invalidateVirtualMount(const FileEntry& vfs) {VirtualFS::invalidate(vfs);}
 #ifdef __IPHONEOS__
 extern bool checkIAPEligibility(const char * identifier);
 #endif
 
 static const PluginFunctions function_map = {
     PLUGIN_VERSION,
-    8,
+    10,
     CRAFTOSPC_VERSION,
     selectedRenderer,
     &config,
@@ -106,7 +107,8 @@ static const PluginFunctions function_map = {
 #ifdef __IPHONEOS__
     &checkIAPEligibility,
 #endif
-    &pumpTaskQueue
+    &pumpTaskQueue,
+    &invalidateVirtualMount
 };
 
 void preloadPlugins() {
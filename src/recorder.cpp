@@ -0,0 +1,299 @@
+/*
+ * recorder.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the background encoder used for screenshots and
+ * recordings.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <configuration.hpp>
+#include "gif.hpp"
+#include "platform.hpp"
+#include "recorder.hpp"
+#include "runtime.hpp"
+#ifndef NO_WEBP
+#include <webp/mux.h>
+#include <webp/encode.h>
+#endif
+#ifndef NO_PNG
+#include <png++/png.hpp>
+#endif
+
+// Frames waiting to be encoded per recording; more than this and new frames are dropped.
+static constexpr size_t maxQueuedFrames = 4;
+// Screenshots waiting to be encoded; more than this and new ones are skipped.
+static constexpr int maxQueuedScreenshots = 8;
+
+static std::mutex encoderLock;
+static std::condition_variable encoderNotify;
+static std::condition_variable encoderIdle;
+static std::queue<std::function<void()>> encoderJobs;
+static std::vector<std::thread*> encoderThreads;
+static int encoderBusy = 0;
+static bool encoderExiting = false;
+static std::atomic_int queuedScreenshots(0);
+
+static void encoderThread() {
+    std::unique_lock<std::mutex> lock(encoderLock);
+    while (true) {
+        encoderNotify.wait(lock, []()->bool {return !encoderJobs.empty() || encoderExiting;});
+        if (encoderJobs.empty()) return;
+        std::function<void()> job = std::move(encoderJobs.front());
+        encoderJobs.pop();
+        encoderBusy++;
+        lock.unlock();
+        job();
+        lock.lock();
+        encoderBusy--;
+        if (encoderJobs.empty() && encoderBusy == 0) encoderIdle.notify_all();
+    }
+}
+
+static void queueEncoderJob(const std::function<void()>& job) {
+#ifdef __EMSCRIPTEN__
+    // no threads to hand off to
+    job();
+#else
+    std::lock_guard<std::mutex> lock(encoderLock);
+    if (encoderThreads.empty()) {
+        // encoding is mostly compression, so leave most cores to the computers and the renderer
+        const unsigned count = std::max(1u, std::min(std::thread::hardware_concurrency() / 2, 4u));
+        for (unsigned i = 0; i < count; i++) {
+            encoderThreads.push_back(new std::thread(encoderThread));
+            setThreadName(*encoderThreads.back(), "Encoder Thread");
+        }
+    }
+    encoderJobs.push(job);
+    encoderNotify.notify_one();
+#endif
+}
+
+void recorderQuit() {
+    std::unique_lock<std::mutex> lock(encoderLock);
+    encoderIdle.wait(lock, []()->bool {return encoderJobs.empty() && encoderBusy == 0;});
+    encoderExiting = true;
+    encoderNotify.notify_all();
+    std::vector<std::thread*> threads;
+    threads.swap(encoderThreads);
+    lock.unlock();
+    for (std::thread * t : threads) {
+        t->join();
+        delete t;
+    }
+    lock.lock();
+    encoderExiting = false;
+}
+
+std::shared_ptr<CapturedFrame> captureSurface(SDL_Surface * surf) {
+    if (surf == NULL || SDL_MUSTLOCK(surf)) return NULL;
+    std::shared_ptr<CapturedFrame> frame = std::make_shared<CapturedFrame>();
+    frame->width = surf->w;
+    frame->height = surf->h;
+    frame->format = surf->format->format;
+    frame->pitch = surf->w * surf->format->BytesPerPixel;
+    frame->pixels.resize((size_t)frame->pitch * surf->h);
+    for (int y = 0; y < surf->h; y++)
+        memcpy(frame->pixels.data() + (size_t)y * frame->pitch, (uint8_t*)surf->pixels + (size_t)y * surf->pitch, frame->pitch);
+    return frame;
+}
+
+std::shared_ptr<CapturedFrame> captureRenderer(SDL_Renderer * ren) {
+    int w, h;
+    if (SDL_GetRendererOutputSize(ren, &w, &h) != 0) return NULL;
+    std::shared_ptr<CapturedFrame> frame = std::make_shared<CapturedFrame>();
+    frame->width = w;
+    frame->height = h;
+    frame->format = SDL_PIXELFORMAT_ARGB8888;
+    frame->pitch = w * 4;
+    frame->pixels.resize((size_t)frame->pitch * h);
+    if (SDL_RenderReadPixels(ren, NULL, frame->format, frame->pixels.data(), frame->pitch) != 0) return NULL;
+    return frame;
+}
+
+// Converts a captured frame to another pixel format. The result must be freed with SDL_FreeSurface.
+static SDL_Surface * convertFrame(CapturedFrame& frame, uint32_t format) {
+    SDL_Surface * src = SDL_CreateRGBSurfaceWithFormatFrom(frame.pixels.data(), frame.width, frame.height, SDL_BITSPERPIXEL(frame.format), frame.pitch, frame.format);
+    if (src == NULL) return NULL;
+    SDL_Surface * retval = SDL_ConvertSurfaceFormat(src, format, 0);
+    SDL_FreeSurface(src);
+    return retval;
+}
+
+void saveScreenshot(std::shared_ptr<CapturedFrame> frame, const path_t& path, bool webp) {
+    if (queuedScreenshots >= maxQueuedScreenshots) {
+        fprintf(stderr, "Skipping screenshot %s: too many screenshots are waiting to be saved\n", path.string().c_str());
+        return;
+    }
+    queuedScreenshots++;
+    queueEncoderJob([frame, path, webp]() {
+        SDL_Surface * temp = convertFrame(*frame, SDL_PIXELFORMAT_RGB24);
+        if (temp != NULL) {
+#ifndef NO_WEBP
+            if (webp) {
+                uint8_t * data = NULL;
+                size_t size = WebPEncodeLosslessRGB((uint8_t*)temp->pixels, temp->w, temp->h, temp->pitch, &data);
+                if (size) {
+                    std::ofstream out(path, std::ios::binary);
+                    out.write((char*)data, size);
+                    out.close();
+                    WebPFree(data);
+                }
+            } else {
+#endif
+#ifndef NO_PNG
+                png::solid_pixel_buffer<png::rgb_pixel> pixbuf(temp->w, temp->h);
+                for (int i = 0; i < temp->h; i++)
+                    memcpy((void*)&pixbuf.get_bytes()[i * temp->w * 3], (char*)temp->pixels + (i * temp->pitch), temp->w * 3);
+                png::image<png::rgb_pixel, png::solid_pixel_buffer<png::rgb_pixel> > img(temp->w, temp->h);
+                img.set_pixbuf(pixbuf);
+                std::ofstream out(path, std::ios::binary);
+                img.write_stream(out);
+                out.close();
+#else
+                SDL_SaveBMP(temp, path.string().c_str());
+#endif
+#ifndef NO_WEBP
+            }
+#endif
+            SDL_FreeSurface(temp);
+        }
+#ifdef __EMSCRIPTEN__
+        queueTask([](void*)->void*{syncfs(); return NULL;}, NULL, true);
+#endif
+        queuedScreenshots--;
+    });
+}
+
+bool Recording::addFrame(std::shared_ptr<CapturedFrame> frame, const Color * palette, int bitDepth) {
+    std::unique_lock<std::mutex> lk(lock);
+    const int index = frameCount++;
+    if (frames.size() >= maxQueuedFrames) {
+        frames.back().length++;
+        droppedFrames++;
+        return false;
+    }
+    frames.emplace_back();
+    QueuedFrame& f = frames.back();
+    f.frame = frame;
+    for (int i = 0; i < 256; i++) f.palette[i] = palette[i].r | (palette[i].g << 8) | (palette[i].b << 16);
+    f.bitDepth = bitDepth;
+    f.index = index;
+    f.length = 1;
+    if (!draining) {
+        draining = true;
+        // the job may run (and finish) right away, so don't hold the lock
+        lk.unlock();
+        queueEncoderJob([this]() {drain();});
+    }
+    return true;
+}
+
+void Recording::finish() {
+    std::unique_lock<std::mutex> lk(lock);
+    finished = true;
+    if (!draining) {
+        draining = true;
+        lk.unlock();
+        queueEncoderJob([this]() {drain();});
+    }
+}
+
+// Runs on one encoder thread at a time, since frames have to be encoded in order.
+void Recording::drain() {
+    std::unique_lock<std::mutex> lk(lock);
+    while (!frames.empty()) {
+        QueuedFrame frame = std::move(frames.front());
+        frames.pop_front();
+        lk.unlock();
+        encode(frame);
+        lk.lock();
+    }
+    draining = false;
+    if (finished) {
+        lk.unlock();
+        close();
+        delete this;
+    }
+}
+
+void Recording::encode(QueuedFrame& f) {
+#ifndef NO_WEBP
+    if (webp) {
+        if (handle == NULL) {
+            WebPAnimEncoderOptions enc_options;
+            WebPAnimEncoderOptionsInit(&enc_options);
+            handle = WebPAnimEncoderNew(f.frame->width, f.frame->height, &enc_options);
+            if (handle == NULL) return;
+        }
+        SDL_Surface * temp = convertFrame(*f.frame, SDL_PIXELFORMAT_BGRA32);
+        if (temp == NULL) return;
+        WebPConfig config;
+        WebPConfigInit(&config);
+        config.lossless = true;
+        WebPPicture frame;
+        WebPPictureInit(&frame);
+        frame.width = temp->w;
+        frame.height = temp->h;
+        frame.use_argb = true;
+        frame.argb = (uint32_t*)temp->pixels;
+        frame.argb_stride = temp->pitch / 4;
+        WebPAnimEncoderAdd((WebPAnimEncoder*)handle, &frame, (1000 / fps) * f.index, &config);
+        SDL_FreeSurface(temp);
+        return;
+    }
+#endif
+    if (handle == NULL) {
+        GifWriter * g = new GifWriter;
+#ifdef _WIN32
+        g->f = _wfopen(path.native().c_str(), L"wb");
+#else
+        g->f = fopen(path.native().c_str(), "wb");
+#endif
+        if (g->f == NULL) {
+            delete g;
+            return;
+        }
+        GifBegin(g, NULL, f.frame->width, f.frame->height, 100 / fps);
+        handle = g;
+    }
+    SDL_Surface * temp = convertFrame(*f.frame, SDL_PIXELFORMAT_RGBA32);
+    if (temp == NULL) return;
+    GifWriteFrame((GifWriter*)handle, (uint8_t*)temp->pixels, temp->w, temp->h, 100 / fps * f.length, f.bitDepth, false, f.palette);
+    SDL_FreeSurface(temp);
+}
+
+void Recording::close() {
+    if (droppedFrames) fprintf(stderr, "Recording %s dropped %d of %d frames because encoding fell behind\n", path.string().c_str(), droppedFrames, frameCount);
+    if (handle == NULL) return;
+#ifndef NO_WEBP
+    if (webp) {
+        WebPAnimEncoderAdd((WebPAnimEncoder*)handle, NULL, (1000 / fps) * frameCount, NULL);
+        WebPData webp_data;
+        WebPDataInit(&webp_data);
+        WebPAnimEncoderAssemble((WebPAnimEncoder*)handle, &webp_data);
+        std::ofstream out(path, std::ios::binary);
+        out.write((char*)webp_data.bytes, webp_data.size);
+        out.close();
+        WebPDataClear(&webp_data);
+        WebPAnimEncoderDelete((WebPAnimEncoder*)handle);
+    } else {
+#endif
+        GifEnd((GifWriter*)handle);
+        delete (GifWriter*)handle;
+#ifndef NO_WEBP
+    }
+#endif
+    handle = NULL;
+#ifdef __EMSCRIPTEN__
+    queueTask([](void*)->void*{syncfs(); return NULL;}, NULL, true);
+#endif
+}
@@ -0,0 +1,73 @@
+/*
+ * recorder.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the background encoder used for screenshots and
+ * recordings, so the render thread only has to copy the frame.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef RECORDER_HPP
+#define RECORDER_HPP
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <Terminal.hpp>
+#include "util.hpp"
+
+// A copy of a rendered frame, in any SDL pixel format.
+struct CapturedFrame {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+    uint32_t format = 0;
+};
+
+// A recording in progress. Frames are encoded in order on the encoder threads;
+// if the encoder falls behind, new frames are dropped and the last queued
+// frame is shown for longer instead.
+class Recording {
+public:
+    Recording(const path_t& path, bool webp, int fps): path(path), webp(webp), fps(fps) {}
+    // Queues a frame, returning false if it was dropped. palette and bitDepth are used for GIFs.
+    bool addFrame(std::shared_ptr<CapturedFrame> frame, const Color * palette, int bitDepth);
+    // Writes the file once the queued frames are encoded, then deletes the recording.
+    void finish();
+private:
+    struct QueuedFrame {
+        std::shared_ptr<CapturedFrame> frame;
+        uint32_t palette[256];
+        int bitDepth;
+        int index; // the frame number, counting dropped frames
+        int length; // how many frame periods the frame is shown for
+    };
+    path_t path;
+    bool webp;
+    int fps;
+    std::mutex lock;
+    std::deque<QueuedFrame> frames;
+    bool draining = false;
+    bool finished = false;
+    int frameCount = 0;
+    int droppedFrames = 0;
+    void * handle = NULL;
+    void drain();
+    void encode(QueuedFrame& frame);
+    void close();
+};
+
+// Copies the pixels of a surface. Returns NULL if the surface can't be read.
+extern std::shared_ptr<CapturedFrame> captureSurface(SDL_Surface * surf);
+// Reads the pixels of a renderer's output. Returns NULL if the read fails.
+extern std::shared_ptr<CapturedFrame> captureRenderer(SDL_Renderer * ren);
+// Encodes a frame as a PNG, WebP or BMP image and saves it in the background.
+extern void saveScreenshot(std::shared_ptr<CapturedFrame> frame, const path_t& path, bool webp);
+// Waits for all queued screenshots and recordings to be written, and stops the encoder threads.
+extern void recorderQuit();
+
+#endif
@@ -0,0 +1,271 @@
+/*
+ * romarchive.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements packed ROM archives, which hold the whole ROM in one
+ * file that's mapped into memory once and shared by every computer.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+/*
+ * Archive format
+ *
+ * All integers are little-endian.
+ *
+ *   header       "CCROMPK" + version byte (1), u32 entry count, u32 name
+ *                table size
+ *   entries      per entry: u64 data offset (from the start of the file), u64
+ *                size, u32 name offset (into the name table), u16 name length,
+ *                u16 flags (1 = directory)
+ *   name table   entry names, relative to the ROM directory with "/" between
+ *                components (e.g. "rom/programs/shell.lua")
+ *   data         file contents
+ *
+ * A directory's entry always comes before the entries inside it, so empty
+ * directories are kept too.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "romarchive.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char archiveMagic[8] = {'C', 'C', 'R', 'O', 'M', 'P', 'K', 1};
+static constexpr size_t headerSize = 16, entrySize = 24;
+
+const FileEntry * romArchive = NULL;
+static FileEntry * archiveRoot = NULL;
+// The mapped archive. The indexes over it hold a reference, so it stays mapped while any file in it is open.
+struct ArchiveMapping {
+    const uint8_t * data = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE handle = NULL;
+#elif defined(__EMSCRIPTEN__)
+    std::vector<uint8_t> buffer;
+#endif
+    ~ArchiveMapping();
+};
+// The indexes for the root, rom and debug trees, which point straight into the mapping
+static std::vector<std::shared_ptr<const VirtualFS> > archiveIndexes;
+
+static uint16_t read16(const uint8_t * p) {return p[0] | (p[1] << 8);}
+static uint32_t read32(const uint8_t * p) {return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);}
+static uint64_t read64(const uint8_t * p) {return read32(p) | ((uint64_t)read32(p + 4) << 32);}
+
+static void write16(std::ostream& out, uint16_t n) {const char b[2] = {(char)n, (char)(n >> 8)}; out.write(b, 2);}
+static void write32(std::ostream& out, uint32_t n) {write16(out, n & 0xFFFF); write16(out, n >> 16);}
+static void write64(std::ostream& out, uint64_t n) {write32(out, n & 0xFFFFFFFF); write32(out, n >> 32);}
+
+static std::shared_ptr<const ArchiveMapping> mapFile(const path_t& path) {
+    std::shared_ptr<ArchiveMapping> map = std::make_shared<ArchiveMapping>();
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {CloseHandle(file); return NULL;}
+    map->handle = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (map->handle == NULL) return NULL;
+    map->data = (const uint8_t*)MapViewOfFile(map->handle, FILE_MAP_READ, 0, 0, 0);
+    if (map->data == NULL) return NULL;
+    map->size = (size_t)size.QuadPart;
+#elif defined(__EMSCRIPTEN__)
+    // no mmap on the virtual filesystem; just read it in
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return NULL;
+    map->buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (map->buffer.empty()) return NULL;
+    map->data = map->buffer.data();
+    map->size = map->buffer.size();
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {close(fd); return NULL;}
+    void * ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) return NULL;
+    map->data = (const uint8_t*)ptr;
+    map->size = st.st_size;
+#endif
+    return map;
+}
+
+ArchiveMapping::~ArchiveMapping() {
+#ifdef _WIN32
+    if (data != NULL) UnmapViewOfFile(data);
+    if (handle != NULL) CloseHandle(handle);
+#elif !defined(__EMSCRIPTEN__)
+    if (data != NULL) munmap((void*)data, size);
+#endif
+}
+
+// Builds the directory tree from the mapped archive, leaving files' data empty, and records where
+// each file's contents are in the mapping. Returns NULL if the archive is malformed.
+static FileEntry * indexArchive(const ArchiveMapping& map, std::unordered_map<const FileEntry*, std::pair<const char*, size_t> >& contents) {
+    const uint8_t * const mapping = map.data;
+    const size_t mappingSize = map.size;
+    if (mappingSize < headerSize || memcmp(mapping, archiveMagic, sizeof(archiveMagic)) != 0) return NULL;
+    const uint32_t count = read32(mapping + 8), namesSize = read32(mapping + 12);
+    if ((uint64_t)count * entrySize + namesSize > mappingSize - headerSize) return NULL;
+    const uint8_t * entries = mapping + headerSize;
+    const char * names = (const char*)entries + (size_t)count * entrySize;
+    FileEntry * root = new FileEntry(std::map<std::string, FileEntry>());
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t * e = entries + (size_t)i * entrySize;
+        const uint64_t offset = read64(e), size = read64(e + 8);
+        const uint32_t nameOffset = read32(e + 16);
+        const uint16_t nameLength = read16(e + 20), flags = read16(e + 22);
+        if ((uint64_t)nameOffset + nameLength > namesSize || offset > mappingSize || size > mappingSize - offset) {delete root; return NULL;}
+        const std::vector<std::string> components = split(std::string(names + nameOffset, nameLength), "/");
+        if (components.empty() || components.back().empty()) {delete root; return NULL;}
+        FileEntry * dir = root;
+        for (size_t j = 0; j + 1 < components.size(); j++) {
+            const auto it = dir->dir.find(components[j]);
+            if (it == dir->dir.end() || !it->second.isDir) {delete root; return NULL;}
+            dir = &it->second;
+        }
+        if (flags & 1) dir->dir.emplace(components.back(), FileEntry(std::map<std::string, FileEntry>()));
+        else {
+            const auto it = dir->dir.emplace(components.back(), FileEntry(std::string())).first;
+            contents[&it->second] = std::make_pair((const char*)mapping + offset, (size_t)size);
+        }
+    }
+    const auto bios = root->dir.find("bios.lua"), rom = root->dir.find("rom");
+    if (bios == root->dir.end() || bios->second.isDir || rom == root->dir.end() || !rom->second.isDir) {delete root; return NULL;}
+    return root;
+}
+
+bool romArchiveLoad(const path_t& path) {
+    romArchiveUnload();
+    std::shared_ptr<const ArchiveMapping> map = mapFile(path);
+    if (map == NULL) return false;
+    std::unordered_map<const FileEntry*, std::pair<const char*, size_t> > contents;
+    archiveRoot = indexArchive(*map, contents);
+    if (archiveRoot == NULL) return false;
+    // index each tree that's read from (the root for bios.lua, and the rom and debug mounts) so
+    // their files are read straight out of the mapping
+    const auto lookup = [&contents](const FileEntry& file) {return contents.at(&file);};
+    std::vector<const FileEntry*> trees = {archiveRoot, &archiveRoot->dir.at("rom")};
+    const auto debug = archiveRoot->dir.find("debug");
+    if (debug != archiveRoot->dir.end() && debug->second.isDir) trees.push_back(&debug->second);
+    for (const FileEntry * tree : trees) {
+        std::shared_ptr<const VirtualFS> index = std::make_shared<const VirtualFS>(*tree, lookup, map);
+        VirtualFS::set(*tree, index);
+        archiveIndexes.push_back(std::move(index));
+    }
+    romArchive = archiveRoot;
+    return true;
+}
+
+void romArchiveUnload() {
+    romArchive = NULL;
+    if (archiveRoot != NULL) {
+        // open files keep their index, and so the mapping, alive; only the lookups by tree go
+        VirtualFS::invalidate(*archiveRoot);
+        for (const auto& tree : archiveRoot->dir)
+            if (tree.second.isDir) VirtualFS::invalidate(tree.second);
+    }
+    archiveIndexes.clear();
+    delete archiveRoot;
+    archiveRoot = NULL;
+}
+
+static void collectEntries(const path_t& dir, const std::string& name, std::vector<std::pair<std::string, path_t> >& entries) {
+    std::error_code e;
+    std::vector<path_t> children;
+    for (const auto& child : fs::directory_iterator(dir, e)) {
+        if (child.path().filename() == ".DS_Store" || child.path().filename() == "desktop.ini") continue;
+        children.push_back(child.path());
+    }
+    // sorted so the same ROM always packs to the same archive
+    std::sort(children.begin(), children.end());
+    for (const path_t& child : children) {
+        const std::string childName = name + "/" + child.filename().string();
+        if (fs::is_directory(child, e)) {
+            entries.push_back(std::make_pair(childName, path_t()));
+            collectEntries(child, childName, entries);
+        } else entries.push_back(std::make_pair(childName, child));
+    }
+}
+
+static bool writeArchive(std::ofstream& out, const std::vector<std::pair<std::string, path_t> >& entries, const std::vector<uint64_t>& sizes, const std::string& names) {
+    out.write(archiveMagic, sizeof(archiveMagic));
+    write32(out, entries.size());
+    write32(out, names.size());
+    uint64_t offset = headerSize + entries.size() * entrySize + names.size();
+    uint32_t nameOffset = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        write64(out, entries[i].second.empty() ? 0 : offset);
+        write64(out, sizes[i]);
+        write32(out, nameOffset);
+        write16(out, entries[i].first.size());
+        write16(out, entries[i].second.empty() ? 1 : 0);
+        offset += sizes[i];
+        nameOffset += entries[i].first.size();
+    }
+    out << names;
+    char buf[65536];
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].second.empty()) continue;
+        std::ifstream in(entries[i].second, std::ios::binary);
+        if (!in.is_open()) return false;
+        uint64_t written = 0;
+        while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+            out.write(buf, in.gcount());
+            written += in.gcount();
+        }
+        // the size was recorded up front, so the file mustn't change while packing
+        if (written != sizes[i]) return false;
+    }
+    out.close();
+    return !out.fail();
+}
+
+bool romArchivePack(const path_t& romDir, const path_t& path) {
+    std::error_code e;
+    // name, real path (empty for directories)
+    std::vector<std::pair<std::string, path_t> > entries;
+    if (!fs::is_regular_file(romDir / "bios.lua", e) || !fs::is_directory(romDir / "rom", e)) return false;
+    entries.push_back(std::make_pair("bios.lua", romDir / "bios.lua"));
+    for (const char * dir : {"rom", "debug"}) {
+        if (!fs::is_directory(romDir / dir, e)) continue;
+        entries.push_back(std::make_pair(dir, path_t()));
+        collectEntries(romDir / dir, dir, entries);
+    }
+    std::vector<uint64_t> sizes;
+    std::string names;
+    for (const auto& entry : entries) {
+        uint64_t size = 0;
+        if (!entry.second.empty()) {
+            size = fs::file_size(entry.second, e);
+            if (e) return false;
+        }
+        sizes.push_back(size);
+        names += entry.first;
+    }
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) return false;
+    if (!writeArchive(out, entries, sizes, names)) {
+        // don't leave a truncated archive behind
+        out.close();
+        fs::remove(path, e);
+        return false;
+    }
+    return true;
+}
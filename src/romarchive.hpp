@@ -0,0 +1,30 @@
+/*
+ * romarchive.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the functions that pack the ROM into a single archive and
+ * serve it from memory.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef ROMARCHIVE_HPP
+#define ROMARCHIVE_HPP
+#include <FileEntry.hpp>
+#include "util.hpp"
+
+// The root of the loaded ROM archive (holding bios.lua, rom and debug), or
+// NULL if the ROM is read from the ROM directory. It's shared by every
+// computer and never changes once loaded. Its files' data is left empty: the
+// contents are read from the mapping through VirtualFS::get on the root, rom
+// or debug trees.
+extern const FileEntry * romArchive;
+
+// Maps a ROM archive and indexes it; call before any computers start.
+extern bool romArchiveLoad(const path_t& path);
+extern void romArchiveUnload();
+// Packs bios.lua, rom and debug from a ROM directory into an archive.
+extern bool romArchivePack(const path_t& romDir, const path_t& path);
+
+#endif
@@ -20,6 +20,8 @@
 #include <configuration.hpp>
 #include <dirent.h>
 #include <sys/stat.h>
+#include "contentstore.hpp"
+#include "diskimage.hpp"
 #include "main.hpp"
 #include "runtime.hpp"
 #include "platform.hpp"
@@ -28,6 +30,9 @@
 #include "terminal/RawTerminal.hpp"
 #include "terminal/HardwareSDLTerminal.hpp"
 #include "termsupport.hpp"
+#include "termtrace.hpp"
+#include "apis/handles/fs_handle.hpp"
+#include "iopool.hpp"
 #ifdef WIN32
 #define R_OK 0x04
 #define W_OK 0x02
@@ -235,6 +240,7 @@ int getNextEvent(lua_State *L, const std::string& filter) {
     Computer * computer = get_comp(L);
     if (computer->running != 1) return 0;
     computer->timeoutCheckCount = 0;
+    flushPendingWrites(computer);
     std::string ev;
     computer->getting_event = true;
     lua_State *param;
@@ -245,6 +251,7 @@ int getNextEvent(lua_State *L, const std::string& filter) {
             while (termHasEvent(computer) && computer->eventQueue.size() < QUEUE_LIMIT) {
                 if (!lua_checkstack(param, 4)) fprintf(stderr, "Could not allocate event\n");
                 std::string name = termGetEvent(param);
+                if (traceEnabled && !name.empty() && computer->term != NULL) traceEvent(*computer->term, name, param);
                 if (!name.empty() && computer->eventHooks.find(name) != computer->eventHooks.end()) {
                     for (const auto& h : computer->eventHooks[name]) {
                         name = h.first(L, name, h.second);
@@ -319,8 +326,10 @@ bool addMount(Computer *comp, const path_t& real_path, const std::string& comp_p
     }
 #endif
     std::error_code e;
-    if (std::regex_search((*real_path.begin()).native(), std::basic_regex<path_t::value_type>(path_t("^\\d+:").native()))) return false;
-    if (!fs::is_directory(real_path, e) || access(real_path.c_str(), R_OK | (read_only ? 0 : W_OK)) != 0) return false;
+    if (FileEntry::hasMountID((*real_path.begin()).native())) return false;
+    // a disk image is mounted like the directory it holds
+    const bool isImage = fs::is_regular_file(real_path, e) && DiskImage::isImage(real_path);
+    if ((!isImage && !fs::is_directory(real_path, e)) || access(real_path.c_str(), R_OK | (read_only ? 0 : W_OK)) != 0) return false;
     std::vector<std::string> elems = split(comp_path, "/\\");
     std::list<std::string> pathc;
     for (const std::string& s : elems) {
@@ -391,10 +400,55 @@ bool addMount(Computer *comp, const path_t& real_path, const std::string& comp_p
         }
         if (!selected) return false;
     }
+    if (isImage) {
+        const std::shared_ptr<DiskImage> image = DiskImage::open(real_path, false, e);
+        if (e) return false;
+        addDiskImage(comp, real_path, image);
+    }
     comp->mounts.push_back(std::make_tuple(std::list<std::string>(pathc), real_path, read_only));
+    invalidateMountCache(comp);
     return true;
 }
 
+bool addOverlayMount(Computer * comp, const path_t& lower, const std::string& comp_path) {
+    std::error_code e;
+    if (!fs::is_directory(lower, e) || access(lower.c_str(), R_OK) != 0) return false;
+    std::vector<std::string> elems = split(comp_path, "/\\");
+    std::list<std::string> pathc;
+    for (const std::string& s : elems) {
+        if (s == "..") { if (pathc.empty()) return false; else pathc.pop_back(); }
+        else if (!s.empty() && !std::all_of(s.begin(), s.end(), [](const char c)->bool{return c == '.';})) pathc.push_back(s);
+    }
+    // the root keeps its changes in the data directory; anywhere else gets its own directory for them
+    if (pathc.empty()) {
+        if (findDiskImage(comp, comp->dataDir) != NULL) return false;
+        addOverlay(comp, comp->dataDir, lower);
+        return true;
+    }
+    path_t upper = computerDir / "overlay" / std::to_string(comp->id);
+    for (const std::string& s : pathc) upper /= s;
+    fs::create_directories(upper, e);
+    if (e || !addMount(comp, upper, comp_path, false)) return false;
+    addOverlay(comp, upper, lower);
+    return true;
+}
+
+std::shared_ptr<ContentStore> getContentStore() {
+    // a store that's been used stays in use after dedupStorage is turned off, as its files still can't be changed in place
+    static const std::shared_ptr<ContentStore> store = []()->std::shared_ptr<ContentStore> {
+        std::error_code e;
+        if (!config.dedupStorage && !fs::is_directory(computerDir / "store", e)) return NULL;
+        std::shared_ptr<ContentStore> retval = std::make_shared<ContentStore>(computerDir / "store");
+        // objects whose files were changed or deleted during the last run are freed in the background
+        queueIOJob([retval]() {
+            std::error_code e;
+            retval->collect(e);
+        });
+        return retval;
+    }();
+    return store;
+}
+
 bool operator==(const FileEntry& lhs, const FileEntry& rhs) {
     if (lhs.isDir != rhs.isDir) return false;
     if (lhs.isDir) {
@@ -422,10 +476,11 @@ bool addVirtualMount(Computer * comp, const FileEntry& vfs, const std::string& c
             else if (!std::isdigit(c)) {end = -1; break;}
             end++;
         }
-        if (end > 0 && std::get<0>(v) == pathc && *comp->virtualMounts[std::stoi(path.native().substr(0, end))] == vfs) return false;
+        if (end > 0 && std::get<0>(v) == pathc && (comp->virtualMounts[std::stoi(path.native().substr(0, end))] == &vfs || *comp->virtualMounts[std::stoi(path.native().substr(0, end))] == vfs)) return false;
     }
     comp->virtualMounts[idx] = &vfs;
     comp->mounts.push_back(std::make_tuple(std::list<std::string>(pathc), path_t(std::to_string(idx) + ":", path_t::format::generic_format), true));
+    invalidateMountCache(comp);
     return true;
 }
 
@@ -26,6 +26,8 @@ struct TaskQueueItem {
     std::exception_ptr exception = nullptr;
 };
 
+class ContentStore;
+
 extern ProtectedObject<std::vector<Computer*> > computers;
 extern ProtectedObject<std::unordered_set<SDL_TimerID> > freedTimers;
 extern ProtectedObject<std::queue<TaskQueueItem*> > taskQueue;
@@ -52,6 +54,9 @@ extern Computer* startComputer(int id);
 extern void queueEvent(Computer *comp, const event_provider& p, void* data);
 extern bool addMount(Computer *comp, const path_t& real_path, const std::string& comp_path, bool read_only);
 extern bool addVirtualMount(Computer * comp, const FileEntry& vfs, const std::string& comp_path);
+extern bool addOverlayMount(Computer * comp, const path_t& lower, const std::string& comp_path);
+// Returns the store that deduplicated files are kept in, or NULL if deduplication has never been turned on.
+extern std::shared_ptr<ContentStore> getContentStore();
 extern void registerPeripheral(const std::string& name, const peripheral_init_fn& initializer);
 extern void registerSDLEvent(SDL_EventType type, const sdl_event_handler& handler, void* userdata);
 extern void pumpTaskQueue();
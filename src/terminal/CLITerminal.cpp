@@ -39,6 +39,7 @@ int width, height;
 bool CLITerminal::stopRender = false;
 bool CLITerminal::forceRender = false;
 unsigned short CLITerminal::lastPaletteChecksum = 0;
+std::vector<unsigned short> CLITerminal::lastCells;
 
 static wchar_t charsetConversion[256] = {
     // lower CP437 characters
@@ -119,7 +120,11 @@ bool CLITerminal::drawChar(char c, int x, int y, Color fg, Color bg, bool transp
 }
 
 void CLITerminal::render() {
-    if (forceRender) changed = true;
+    // the render loop clears forceRender after the tick, so every window drawn in it repaints in full
+    if (forceRender) {
+        changed = true;
+        lastCells.clear();
+    }
     if (gotResizeEvent) {
         gotResizeEvent = false;
         this->screen.resize(newWidth, newHeight, ' ');
@@ -132,10 +137,8 @@ void CLITerminal::render() {
     if (changed) {
         changed = false;
         std::lock_guard<std::mutex> locked_g(locked);
-        move(0, 0);
-        if (stopRender) {stopRender = false; return;}
-        clear();
-        if (stopRender) {stopRender = false; return;}
+        // if a draw was interrupted, the screen doesn't match the last frame anymore
+        if (stopRender) {stopRender = false; lastCells.clear(); changed = true; return;}
         if (can_change_color()) {
             unsigned short checksum = grayscale;
             for (int i = 0; i < 48; i++) 
@@ -151,26 +154,54 @@ void CLITerminal::render() {
             }
             lastPaletteChecksum = checksum;
         }
+        // only cells that differ from the last frame are drawn, in runs of the same color
+        const bool full = lastCells.size() != width * height;
+        if (full) {
+            clear();
+            if (stopRender) {stopRender = false; lastCells.clear(); changed = true; return;}
+            lastCells.assign(width * height, 0);
+        }
+        const unsigned char * scr = screen.data();
+        const unsigned char * col = colors.data();
         for (unsigned y = 0; y < height; y++) {
-            for (unsigned x = 0; x < width; x++) {
-                move(y, x);
-                wchar_t ch[2] = {charsetConversion[screen[y][x]], 0};
+            unsigned short * last = &lastCells[y * width];
+            for (unsigned x = 0; x < width; ) {
+                const unsigned short cell = scr[y * width + x] | (col[y * width + x] << 8);
+                if (!full && last[x] == cell) {x++; continue;}
+                const unsigned char pair = col[y * width + x];
+                const unsigned start = x;
+#ifdef WACS_ULCORNER
+                cchar_t run[256];
+#else
+                chtype run[256];
+#endif
+                int n = 0;
+                while (x < width && n < 256 && col[y * width + x] == pair) {
+                    const unsigned short c = scr[y * width + x] | (pair << 8);
+                    if (!full && last[x] == c) break;
+                    last[x] = c;
+                    const wchar_t ch[2] = {charsetConversion[scr[y * width + x]], 0};
+#ifdef WACS_ULCORNER
+                    setcchar(&run[n++], ch, 0, pair, NULL);
+#else
+                    run[n++] = (ch[0] < 0x100 ? ch[0] : '?') | COLOR_PAIR(pair);
+#endif
+                    x++;
+                }
 #ifdef WACS_ULCORNER
-                cchar_t cc;
-                setcchar(&cc, ch, 0, colors[y][x], NULL);
-                add_wch(&cc);
+                mvadd_wchnstr(y, start, run, n);
 #else
-                addch((ch[0] < 0x100 ? ch[0] : '?') | COLOR_PAIR(colors[y][x]));
+                mvaddchnstr(y, start, run, n);
 #endif
-                if (stopRender) {stopRender = false; return;}
+                if (stopRender) {stopRender = false; lastCells.clear(); changed = true; return;}
             }
         }
         renderNavbar(title);
-        if (stopRender) {stopRender = false; return;}
+        if (stopRender) {stopRender = false; lastCells.clear(); changed = true; return;}
         move(blinkY, blinkX);
-        if (stopRender) {stopRender = false; return;}
+        if (stopRender) {stopRender = false; lastCells.clear(); changed = true; return;}
         curs_set(canBlink);
-        if (stopRender) {stopRender = false; return;}
+        if (stopRender) {stopRender = false; lastCells.clear(); changed = true; return;}
         refresh();
     }
 }
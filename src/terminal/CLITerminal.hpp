@@ -13,6 +13,7 @@
 #define TERMINAL_CLITERMINAL_HPP
 #include <set>
 #include <string>
+#include <vector>
 #include <Terminal.hpp>
 #undef scroll
 
@@ -22,6 +23,7 @@ class CLITerminal: public Terminal {
     friend void pressAlt(int sig);
     unsigned last_pair;
     static unsigned short lastPaletteChecksum;
+    static std::vector<unsigned short> lastCells; // character | colors << 8 of each cell on screen, empty if unknown
 public:
     static void init();
     static void quit();
@@ -12,17 +12,10 @@
 #include <configuration.hpp>
 #include "HardwareSDLTerminal.hpp"
 #include "RawTerminal.hpp"
-#include "../gif.hpp"
 #include "../main.hpp"
+#include "../recorder.hpp"
 #include "../runtime.hpp"
 #include "../termsupport.hpp"
-#ifndef NO_WEBP
-#include <webp/mux.h>
-#include <webp/encode.h>
-#endif
-#ifndef NO_PNG
-#include <png++/png.hpp>
-#endif
 #define rgb(color) (((color).r << 16) | ((color).g << 8) | (color).b)
 
 extern "C" {
@@ -265,96 +258,18 @@ void HardwareSDLTerminal::render() {
             copyImage(temp, win);
             SDL_FreeSurface(temp);
         } else {
-#ifndef NO_WEBP
-            if (config.useWebP) {
-                SDL_Surface *sshot = SDL_CreateRGBSurface(0, w, h, 24, 0x00ff0000, 0x0000ff00, 0x000000ff, 0);
-                if (gotResizeEvent) return;
-                if (SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_RGB24, sshot->pixels, sshot->pitch) != 0) return;
-                uint8_t * data = NULL;
-                size_t size = WebPEncodeLosslessRGB((uint8_t*)sshot->pixels, sshot->w, sshot->h, sshot->pitch, &data);
-                if (size) {
-                    std::ofstream out(screenshotPath, std::ios::binary);
-                    out.write((char*)data, size);
-                    out.close();
-                    WebPFree(data);
-                }
-                SDL_FreeSurface(sshot);
-            } else {
-#endif
-#ifndef NO_PNG
-                png::solid_pixel_buffer<png::rgb_pixel> pixbuf(w, h);
-                if (gotResizeEvent) return;
-                if (SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_RGB24, (void*)&pixbuf.get_bytes()[0], w * 3) != 0) return;
-                png::image<png::rgb_pixel, png::solid_pixel_buffer<png::rgb_pixel> > img(w, h);
-                img.set_pixbuf(pixbuf);
-                std::ofstream out(screenshotPath, std::ios::binary);
-                img.write_stream(out);
-                out.close();
-#else
-                SDL_Surface *sshot = SDL_CreateRGBSurface(0, w, h, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
-                if (gotResizeEvent) return;
-                if (SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_ARGB8888, sshot->pixels, sshot->pitch) != 0) return;
-                SDL_Surface *conv = SDL_ConvertSurfaceFormat(sshot, SDL_PIXELFORMAT_RGB888, 0);
-                SDL_FreeSurface(sshot);
-                SDL_SaveBMP(conv, screenshotPath.c_str());
-                SDL_FreeSurface(conv);
-#endif
-#ifndef NO_WEBP
-            }
-#endif
+            std::shared_ptr<CapturedFrame> frame = captureRenderer(ren);
+            if (frame != NULL) saveScreenshot(frame, screenshotPath, config.useWebP);
         }
-#ifdef __EMSCRIPTEN__
-        queueTask([](void*)->void* {syncfs(); return NULL; }, NULL, true);
-#endif
     }
     if (shouldRecord) {
         if (recordedFrames >= config.maxRecordingTime * config.recordingFPS) stopRecording();
         else if (--frameWait < 1) {
+            // only the readback happens here; the encoder threads do the rest
             std::lock_guard<std::mutex> lock(recorderMutex);
-            int w, h;
-            if (SDL_GetRendererOutputSize(ren, &w, &h) != 0) return;
-#ifndef NO_WEBP
-            if (isRecordingWebP) {
-                if (recorderHandle == NULL) {
-                    WebPAnimEncoderOptions enc_options;
-                    WebPAnimEncoderOptionsInit(&enc_options);
-                    recorderHandle = WebPAnimEncoderNew(surf->w, surf->h, &enc_options);
-                }
-                SDL_Surface *temp = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_BGRA32);
-                if (SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_BGRA32, temp->pixels, temp->pitch) != 0) return;
-                WebPConfig config;
-                WebPConfigInit(&config);
-                config.lossless = true;
-                WebPPicture frame;
-                WebPPictureInit(&frame);
-                frame.width = temp->w;
-                frame.height = temp->h;
-                frame.use_argb = true;
-                frame.argb = (uint32_t*)temp->pixels;
-                frame.argb_stride = temp->pitch / 4;
-                WebPAnimEncoderAdd((WebPAnimEncoder*)recorderHandle, &frame, (1000 / ::config.recordingFPS) * recordedFrames, &config);
-                SDL_FreeSurface(temp);
-            } else {
-#endif
-                if (recorderHandle == NULL) {
-                    GifWriter * g = new GifWriter;
-#ifdef _WIN32
-                    g->f = _wfopen(recordingPath.native().c_str(), L"wb");
-#else
-                    g->f = fopen(recordingPath.native().c_str(), "wb");
-#endif
-                    GifBegin(g, NULL, surf->w, surf->h, 100 / config.recordingFPS);
-                    recorderHandle = g;
-                }
-                SDL_Surface *temp = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGBA32);
-                if (SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_RGBA32, temp->pixels, temp->pitch) != 0) return;
-                uint32_t pal[256];
-                for (int i = 0; i < 256; i++) pal[i] = newpalette[i].r | (newpalette[i].g << 8) | (newpalette[i].b << 16);
-                GifWriteFrame((GifWriter*)recorderHandle, (uint8_t*)temp->pixels, temp->w, temp->h, 100 / config.recordingFPS, newmode == 2 ? 8 : 5, false, pal);
-                SDL_FreeSurface(temp);
-#ifndef NO_WEBP
-            }
-#endif
+            std::shared_ptr<CapturedFrame> frame = captureRenderer(ren);
+            if (frame == NULL) return;
+            if (recorderHandle != NULL) ((Recording*)recorderHandle)->addFrame(frame, newpalette, newmode == 2 ? 8 : 5);
             recordedFrames++;
             frameWait = ::config.clockSpeed / ::config.recordingFPS;
             if (gotResizeEvent) return;
@@ -463,6 +378,7 @@ void HardwareSDLTerminal::init() {
 void HardwareSDLTerminal::quit() {
     renderThread->join();
     delete renderThread;
+    recorderQuit();
     SDL_FreeSurface(bmp);
     if (bmp != origfont) SDL_FreeSurface(origfont);
     SDL_Quit();
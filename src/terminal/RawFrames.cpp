@@ -0,0 +1,221 @@
+/*
+ * terminal/RawFrames.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the functions that encode terminal contents for raw
+ * mode packets.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <Poco/Checksum.h>
+#include <Poco/DeflatingStream.h>
+#include <Poco/InflatingStream.h>
+#include "RawFrames.hpp"
+#include "RawPacketParser.hpp"
+
+void RawFrameState::save(Terminal& term) {
+    if (term.mode == 0) {
+        screen.assign(term.screen.data(), term.screen.data() + (size_t)term.width * term.height);
+        colors.assign(term.colors.data(), term.colors.data() + (size_t)term.width * term.height);
+    } else pixels.assign(term.pixels.data(), term.pixels.data() + (size_t)term.width * Terminal::fontWidth * term.height * Terminal::fontHeight);
+    memcpy(palette, term.palette, sizeof(palette));
+    mode = term.mode;
+    width = term.width;
+    height = term.height;
+}
+
+void writeRLE(std::ostream& output, const unsigned char * data, size_t len) {
+    if (len == 0) return;
+    unsigned char c = data[0];
+    unsigned char n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != c || n == 255) {
+            output.put(c);
+            output.put(n);
+            c = data[i];
+            n = 0;
+        }
+        n++;
+    }
+    output.put(c);
+    output.put(n);
+}
+
+bool readRLE(std::istream& in, unsigned char * data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        const unsigned char c = (unsigned char)in.get();
+        const unsigned char n = (unsigned char)in.get();
+        if (n == 0 || !in.good()) break;
+        memset(data + i, c, n < len - i ? n : len - i);
+        i += n;
+    }
+    return i >= len;
+}
+
+void writeTerminalFrame(std::ostream& output, Terminal& term) {
+    output.put((char)term.mode);
+    output.put((char)term.canBlink);
+    output.write((char*)&term.width, 2);
+    output.write((char*)&term.height, 2);
+    output.write((char*)&term.blinkX, 2);
+    output.write((char*)&term.blinkY, 2);
+    output.put(term.grayscale ? 1 : 0);
+    for (int i = 0; i < 3; i++) output.put(0);
+    if (term.mode == 0) {
+        writeRLE(output, term.screen.data(), (size_t)term.width * term.height);
+        writeRLE(output, term.colors.data(), (size_t)term.width * term.height);
+    } else writeRLE(output, term.pixels.data(), (size_t)term.width * Terminal::fontWidth * term.height * Terminal::fontHeight);
+    for (int i = 0; i < (term.mode == 2 ? 256 : 16); i++) {
+        output.put(term.palette[i].r);
+        output.put(term.palette[i].g);
+        output.put(term.palette[i].b);
+    }
+}
+
+void writeTerminalDelta(std::ostream& output, Terminal& term, const RawFrameState& last) {
+    const size_t rowSize = term.mode == 0 ? term.width : term.width * Terminal::fontWidth;
+    const unsigned rows = term.mode == 0 ? term.height : term.height * Terminal::fontHeight;
+    const int paletteSize = term.mode == 2 ? 256 : 16;
+    // find the ranges of rows that changed since the last frame
+    std::vector<std::pair<unsigned, unsigned> > ranges;
+    for (unsigned y = 0; y < rows; y++) {
+        bool rowChanged;
+        if (term.mode == 0) rowChanged = memcmp(term.screen.data() + y * rowSize, last.screen.data() + y * rowSize, rowSize) || memcmp(term.colors.data() + y * rowSize, last.colors.data() + y * rowSize, rowSize);
+        else rowChanged = memcmp(term.pixels.data() + y * rowSize, last.pixels.data() + y * rowSize, rowSize);
+        if (!rowChanged) continue;
+        if (!ranges.empty() && ranges.back().first + ranges.back().second == y) ranges.back().second++;
+        else ranges.push_back(std::make_pair(y, 1));
+    }
+    const bool paletteChanged = memcmp(term.palette, last.palette, paletteSize * sizeof(Color)) != 0;
+    output.put((char)term.mode);
+    output.put((char)term.canBlink);
+    output.write((char*)&term.width, 2);
+    output.write((char*)&term.height, 2);
+    output.write((char*)&term.blinkX, 2);
+    output.write((char*)&term.blinkY, 2);
+    output.put(term.grayscale ? 1 : 0);
+    output.put(paletteChanged ? 1 : 0);
+    const uint16_t nranges = (uint16_t)ranges.size();
+    output.write((char*)&nranges, 2);
+    for (const auto& r : ranges) {
+        const uint16_t start = (uint16_t)r.first, count = (uint16_t)r.second;
+        output.write((char*)&start, 2);
+        output.write((char*)&count, 2);
+        if (term.mode == 0) {
+            writeRLE(output, term.screen.data() + start * rowSize, count * rowSize);
+            writeRLE(output, term.colors.data() + start * rowSize, count * rowSize);
+        } else writeRLE(output, term.pixels.data() + start * rowSize, count * rowSize);
+    }
+    if (paletteChanged) {
+        for (int i = 0; i < paletteSize; i++) {
+            output.put(term.palette[i].r);
+            output.put(term.palette[i].g);
+            output.put(term.palette[i].b);
+        }
+    }
+}
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Encodes data as Base64 with no line breaks, straight into the end of out.
+static void appendBase64(std::string& out, const std::string& data) {
+    const unsigned char * p = (const unsigned char*)data.data();
+    size_t n = data.size();
+    for (; n >= 3; p += 3, n -= 3) {
+        const uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+        const char quad[4] = {base64Chars[v >> 18], base64Chars[(v >> 12) & 63], base64Chars[(v >> 6) & 63], base64Chars[v & 63]};
+        out.append(quad, 4);
+    }
+    if (n) {
+        const uint32_t v = (uint32_t)p[0] << 16 | (n > 1 ? (uint32_t)p[1] << 8 : 0);
+        const char quad[4] = {base64Chars[v >> 18], base64Chars[(v >> 12) & 63], n > 1 ? base64Chars[(v >> 6) & 63] : '=', '='};
+        out.append(quad, 4);
+    }
+}
+
+std::string frameRawPacket(const std::string& data, bool binary, bool binaryChecksum, bool largePackets) {
+    Poco::Checksum chk;
+    std::string frame;
+    if (binary) {
+        chk.update(data);
+        const uint32_t size = (uint32_t)data.size(), sum = chk.checksum();
+        frame.reserve(data.size() + 12);
+        frame.append("!CPB", 4);
+        frame.append((const char*)&size, 4);
+        frame.append(data);
+        frame.append((const char*)&sum, 4);
+        return frame;
+    }
+    const size_t encodedSize = (data.size() + 2) / 3 * 4;
+    if (encodedSize > 65535 && !largePackets) return frame;
+    const size_t header = encodedSize > 65535 ? 16 : 8;
+    frame.reserve(header + encodedSize + 9);
+    frame.append(header, '\0');
+    appendBase64(frame, data);
+    if (binaryChecksum) chk.update(data);
+    else chk.update(frame.data() + header, encodedSize);
+    char tmpdata[21];
+    if (encodedSize > 65535) snprintf(tmpdata, 21, "!CPD%012zX", encodedSize);
+    else snprintf(tmpdata, 21, "!CPC%04X", (unsigned)encodedSize);
+    memcpy(&frame[0], tmpdata, header);
+    snprintf(tmpdata, 21, "%08x", chk.checksum());
+    frame.append(tmpdata, 8);
+    frame.push_back('\n');
+    return frame;
+}
+
+std::string rawCompress(const std::string& data) {
+    std::stringstream out;
+    out.put((char)(data[0] | CCPC_RAW_COMPRESSED_PACKET));
+    out.put(data[1]);
+    const uint32_t size = (uint32_t)data.size() - 2;
+    out.write((const char*)&size, 4);
+    Poco::DeflatingOutputStream deflater(out, Poco::DeflatingStreamBuf::STREAM_ZLIB, 1); // fastest level - most of the gain comes from long runs anyway
+    deflater.write(data.c_str() + 2, size);
+    deflater.close();
+    return out.str();
+}
+
+std::string rawDecompress(const std::string& data) {
+    if (data.size() < 6) throw std::runtime_error("Compressed packet is too short");
+    uint32_t size = 0;
+    memcpy(&size, data.c_str() + 2, 4);
+    // the size comes from the other side, so it's held to what a frame could carry,
+    // and inflating stops as soon as the output goes past it
+    if (size > RawPacketParser::maxPacketSize) throw std::runtime_error("Compressed packet is too large");
+    std::string retval;
+    retval.push_back((char)(data[0] & ~CCPC_RAW_COMPRESSED_PACKET));
+    retval.push_back(data[1]);
+    std::istringstream in(data.substr(6));
+    Poco::InflatingInputStream inflater(in, Poco::InflatingStreamBuf::STREAM_ZLIB);
+    char buf[65536];
+    while (inflater.read(buf, sizeof(buf)) || inflater.gcount() > 0) {
+        if (retval.size() - 2 + (size_t)inflater.gcount() > size) throw std::runtime_error("Compressed packet is larger than its header says");
+        retval.append(buf, (size_t)inflater.gcount());
+    }
+    if (retval.size() != (size_t)size + 2) throw std::runtime_error("Compressed packet has the wrong size");
+    return retval;
+}
+
+bool RawCompressor::compress(std::string& data) {
+    const size_t threshold = minSize.load();
+    if (data.size() < threshold) return false;
+    std::string compressed = rawCompress(data);
+    // require at least 1/8 savings to keep compressing packets of this size
+    if (compressed.size() + compressed.size() / 8 < data.size()) {
+        minSize.store(std::max(threshold / 2, (size_t)256));
+        data = std::move(compressed);
+        return true;
+    }
+    minSize.store(std::min(threshold * 2, (size_t)65536));
+    return false;
+}
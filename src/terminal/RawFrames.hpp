@@ -0,0 +1,69 @@
+/*
+ * terminal/RawFrames.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the functions that encode terminal contents for raw mode
+ * packets.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef TERMINAL_RAWFRAMES_HPP
+#define TERMINAL_RAWFRAMES_HPP
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <Terminal.hpp>
+
+#define CCPC_RAW_COMPRESSED_PACKET                   0x80
+
+// A copy of what a terminal showed when its last frame was sent, which the
+// next frame can be sent as a delta against.
+struct RawFrameState {
+    int mode = -1;
+    unsigned width = 0, height = 0;
+    std::vector<unsigned char> screen, colors, pixels;
+    Color palette[256];
+
+    // Returns whether a delta against this state can describe the terminal, i.e. it has the same mode and size.
+    bool matches(const Terminal& term) const {return mode == term.mode && width == term.width && height == term.height;}
+    void save(Terminal& term);
+};
+
+// Writes data as runs of (value, count) byte pairs.
+extern void writeRLE(std::ostream& output, const unsigned char * data, size_t len);
+// Reads runs into a buffer. Returns whether they filled all of it.
+extern bool readRLE(std::istream& in, unsigned char * data, size_t len);
+// Writes the body of a Type 0 packet, with all of the terminal's contents.
+extern void writeTerminalFrame(std::ostream& output, Terminal& term);
+// Writes the body of a Type 10 packet, with the rows and palette that have
+// changed since last. last must match the terminal.
+extern void writeTerminalDelta(std::ostream& output, Terminal& term, const RawFrameState& last);
+// Wraps a packet in a frame: "!CPB" with a binary length and CRC32 if binary is
+// set, otherwise Base64 in "!CPC" (or "!CPD" if it's too big for that and
+// largePackets is set). The Base64 framing checksums the decoded data if
+// binaryChecksum is set. Returns an empty string if the packet doesn't fit.
+extern std::string frameRawPacket(const std::string& data, bool binary, bool binaryChecksum, bool largePackets);
+// Compresses packets that are worth it. Packets smaller than the threshold are
+// not compressed; it adapts to the data being sent, going up when compression
+// doesn't help much and back down when it does. Safe to share between threads.
+class RawCompressor {
+public:
+    // Replaces a packet (with its type and ID bytes) with its compressed form if
+    // that saves at least 1/8. Returns whether it did.
+    bool compress(std::string& data);
+    size_t threshold() const {return minSize.load();}
+private:
+    std::atomic<size_t> minSize {256};
+};
+
+// Compresses a packet (with its type and ID bytes) into a compressed packet.
+extern std::string rawCompress(const std::string& data);
+// Decompresses a compressed packet. Throws std::runtime_error if it's invalid
+// or inflates to more than its header says.
+extern std::string rawDecompress(const std::string& data);
+
+#endif
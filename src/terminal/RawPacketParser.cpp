@@ -0,0 +1,187 @@
+/*
+ * terminal/RawPacketParser.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the RawPacketParser class.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <Poco/Checksum.h>
+#include "RawPacketParser.hpp"
+
+#define B64_INVALID 0xFF
+#define B64_SKIP    0xFE
+#define B64_PAD     0xFD
+
+static const struct b64table_t {
+    unsigned char values[256];
+    b64table_t() {
+        memset(values, B64_INVALID, 256);
+        for (int i = 0; i < 26; i++) {
+            values['A' + i] = i;
+            values['a' + i] = 26 + i;
+        }
+        for (int i = 0; i < 10; i++) values['0' + i] = 52 + i;
+        values['+'] = 62;
+        values['/'] = 63;
+        values['='] = B64_PAD;
+        values['\r'] = values['\n'] = values[' '] = values['\t'] = B64_SKIP;
+    }
+} b64table;
+
+// Decodes Base64 text straight from the input buffer into out, reusing its storage.
+static bool b64decodeInto(const char * str, size_t len, std::string& out) {
+    out.resize(len / 4 * 3 + 3);
+    char * dest = &out[0];
+    uint32_t bits = 0;
+    int count = 0;
+    size_t i = 0;
+    for (; i < len; i++) {
+        const unsigned char v = b64table.values[(unsigned char)str[i]];
+        if (v < 64) {
+            bits = (bits << 6) | v;
+            if (++count == 4) {
+                *dest++ = (char)(bits >> 16);
+                *dest++ = (char)(bits >> 8);
+                *dest++ = (char)bits;
+                bits = 0;
+                count = 0;
+            }
+        } else if (v == B64_PAD) break;
+        else if (v == B64_INVALID) return false;
+    }
+    // only whitespace and padding may follow the first '='
+    for (; i < len; i++) {
+        const unsigned char v = b64table.values[(unsigned char)str[i]];
+        if (v != B64_PAD && v != B64_SKIP) return false;
+    }
+    if (count == 1) return false;
+    else if (count == 2) *dest++ = (char)(bits >> 4);
+    else if (count == 3) {
+        *dest++ = (char)(bits >> 10);
+        *dest++ = (char)(bits >> 2);
+    }
+    out.resize(dest - out.data());
+    return true;
+}
+
+static bool parseHex(const char * str, size_t len, uint64_t& retval) {
+    retval = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char c = str[i];
+        retval <<= 4;
+        if (c >= '0' && c <= '9') retval |= c - '0';
+        else if (c >= 'A' && c <= 'F') retval |= c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f') retval |= c - 'a' + 10;
+        else return false;
+    }
+    return true;
+}
+
+void RawPacketParser::feed(const char * data, size_t len) {
+    // drop consumed input before growing the buffer, so it stays about one frame long
+    if (pos == buffer.size()) {
+        buffer.clear();
+        pos = 0;
+    } else if (pos > 4096 && pos > buffer.size() / 2) {
+        buffer.erase(0, pos);
+        pos = 0;
+    }
+    buffer.append(data, len);
+}
+
+void RawPacketParser::error(const std::string& message) {
+    errors++;
+    if (errorHandler) errorHandler(message);
+}
+
+const std::string * RawPacketParser::next() {
+    while (true) {
+        const size_t avail = buffer.size() - pos;
+        const char * start = buffer.data() + pos;
+        switch (state) {
+        case STATE_MAGIC: {
+            // skip anything that isn't the start of a frame
+            const char * bang = (const char*)memchr(start, '!', avail);
+            if (bang == NULL) {
+                pos = buffer.size();
+                return NULL;
+            }
+            pos += bang - start;
+            if (buffer.size() - pos < 4) return NULL;
+            if (memcmp(bang, "!CP", 3) != 0) {
+                pos++;
+                break;
+            }
+            mode = bang[3];
+            pos += 4;
+            state = STATE_SIZE;
+            break;
+        } case STATE_SIZE: {
+            uint64_t sizen = 0;
+            if (mode == 'B') {
+                if (avail < 4) return NULL;
+                uint32_t size32 = 0;
+                memcpy(&size32, start, 4);
+                pos += 4;
+                sizen = size32;
+            } else if (mode == 'C' || (mode == 'D' && largePackets)) {
+                const size_t len = mode == 'C' ? 4 : 12;
+                if (avail < len) return NULL;
+                pos += len;
+                if (!parseHex(start, len, sizen)) {
+                    state = STATE_MAGIC;
+                    error("Invalid frame size");
+                    break;
+                }
+            } else {
+                state = STATE_MAGIC;
+                break;
+            }
+            if (sizen > (mode == 'B' ? maxPacketSize : 0x5600000)) {
+                state = STATE_MAGIC;
+                error("Frame is too large");
+                break;
+            }
+            size = (size_t)sizen;
+            state = STATE_BODY;
+            break;
+        } case STATE_BODY: {
+            const size_t sumlen = mode == 'B' ? 4 : 8;
+            if (avail < size + sumlen) return NULL;
+            pos += size + sumlen;
+            state = STATE_MAGIC;
+            uint32_t expected = 0;
+            Poco::Checksum chk;
+            if (mode == 'B') {
+                packet.assign(start, size);
+                chk.update(packet);
+                memcpy(&expected, start + size, 4);
+            } else {
+                if (!b64decodeInto(start, size, packet)) {
+                    error("Could not decode Base64");
+                    break;
+                }
+                uint64_t sum = 0;
+                if (!parseHex(start + size, 8, sum)) {
+                    error("Invalid checksum");
+                    break;
+                }
+                expected = (uint32_t)sum;
+                if (binaryChecksum) chk.update(packet);
+                else chk.update(start, (unsigned)size);
+            }
+            if (chk.checksum() != expected) {
+                char msg[64];
+                snprintf(msg, 64, "Invalid checksum: expected %08X, got %08X", chk.checksum(), expected);
+                error(msg);
+                break;
+            }
+            return &packet;
+        }}
+    }
+}
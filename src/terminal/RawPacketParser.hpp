@@ -0,0 +1,50 @@
+/*
+ * terminal/RawPacketParser.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the RawPacketParser class, which splits raw mode input
+ * into packets.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef TERMINAL_RAWPACKETPARSER_HPP
+#define TERMINAL_RAWPACKETPARSER_HPP
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Incremental parser for "!CPC", "!CPD" and "!CPB" frames. Input may be fed in
+// chunks of any size, and complete packets are taken out with next(). Nothing
+// is copied except the decoded payload, which lives in a buffer that's reused
+// between packets.
+class RawPacketParser {
+public:
+    static constexpr size_t maxPacketSize = 0x4000000; // the largest payload a frame may carry
+    bool binaryChecksum = false; // whether Base64 frames are checksummed over the decoded data
+    bool largePackets = false; // whether "!CPD" frames are accepted (protocol version 1.1)
+    std::function<void(const std::string&)> errorHandler; // called with a message whenever a frame is dropped
+    size_t errors = 0;
+
+    // Appends more input to the parse buffer.
+    void feed(const char * data, size_t size);
+    // Returns the next complete packet, or NULL if more input is needed. The
+    // returned string is overwritten by the next call.
+    const std::string * next();
+private:
+    enum {
+        STATE_MAGIC,
+        STATE_SIZE,
+        STATE_BODY
+    } state = STATE_MAGIC;
+    std::string buffer;
+    size_t pos = 0;
+    char mode = 0;
+    size_t size = 0;
+    std::string packet;
+    void error(const std::string& message);
+};
+
+#endif
@@ -9,10 +9,26 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iomanip>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <sstream>
-#include <Poco/Checksum.h>
+#include <Poco/MemoryStream.h>
+#ifndef __EMSCRIPTEN__
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/StreamSocket.h>
+#endif
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "RawPacketParser.hpp"
 #include "RawTerminal.hpp"
 #include "SDLTerminal.hpp"
 #include "../apis.hpp"
@@ -40,6 +56,15 @@ Note: As of version 1.1, headers for payloads >65535 bytes in size will have the
   0x00       4          Header ("!CPD")
   0x04       12         Size (hex string)
 
+If binary framing is supported by both sides (see Type 6), all packets except Type 6 are sent
+without Base64 encoding, using this header instead:
+
+  Offset     Bytes      Purpose
+  0x00       4          Header ("!CPB")
+  0x04       4          Size of the binary payload (32-bit integer)
+  ===================== Binary payload (same contents as the Base64 payload)
+  END-4      4          CRC32 of the binary payload (32-bit integer; no newline follows)
+
 * Type 0: Terminal contents (server -> client)
 
   Offset     Bytes      Purpose
@@ -121,7 +146,11 @@ Note: As of version 1.1, headers for payloads >65535 bytes in size will have the
   0x02       2          Standard flags as a bitfield - each bit represents a supported feature
                         0: Binary data CRC-32 checksum support (as opposed to checksumming the Base64 data)
                         1: Filesystem support extension
-                        2-14: Currently reserved, set to 0
+                        2: Send all windows on connection
+                        3: Delta terminal frames (Type 10)
+                        4: Binary framing ("!CPB" header, no Base64)
+                        5: Compressed packets
+                        6-14: Currently reserved, set to 0
                         15: Set if the extended flags are present
   [0x04]    [4]         Extended flags as a bitfield - only available if bit 15 of standard flags is set
                         0-31: Currently reserved, set to 0
@@ -191,6 +220,64 @@ Once the server sends back a response, both the server and client MUST communica
 
 == End filesystem support extension ==
 
+== Compression extension ==
+
+If compression is supported by both sides, any packet except Type 6 may be sent compressed.
+Compressed packets have bit 7 of the frame type ID set, and the payload is replaced with:
+
+  Offset     Bytes      Purpose
+  0x00       1          Frame type ID | 0x80
+  0x01       1          Window ID
+  0x02       4          Size of the uncompressed data following the window ID
+  0x06       *x*        zlib stream containing the rest of the original payload
+
+The checksum is calculated over the compressed payload. Small packets and packets that do
+not get smaller when compressed are sent as-is, so receivers must accept both.
+
+== End compression extension ==
+
+== Delta frames extension ==
+
+* Type 10: Terminal contents delta (server -> client)
+
+  Only sent if both sides support delta frames. The server sends a full Type 0 frame
+  first, and again whenever the size or graphics mode changes; otherwise it may send
+  this frame, which only contains the rows that changed since the last frame sent.
+
+  Offset     Bytes      Purpose
+  0x02       1          Graphics mode
+  0x03       1          Cursor blinking?
+  0x04       2          Width
+  0x06       2          Height
+  0x08       2          Cursor X
+  0x0A       2          Cursor Y
+  0x0C       1          Grayscale?
+  0x0D       1          Flags: bit 0 = palette included
+  0x0E       2          Number of row ranges
+  ===================== Row ranges (repeated for each range)
+  0x00       2          First row (character rows in mode 0, pixel rows in modes 1/2)
+  0x02       2          Number of rows
+  --------------------- Text mode (mode 0)
+  0x04       *x*        RLE-encoded text (length of expanded RLE = width * rows)
+  0x04 + x   *y*        RLE-encoded background pairs
+  --------------------- Graphics modes (modes 1/2)
+  0x04       *x*        RLE-encoded pixel data (length of expanded RLE = width * 6 * rows)
+  ===================== End row ranges
+  ===================== Palette (only if bit 0 of flags is set; same format as Type 0)
+
+== End delta frames extension ==
+
+== Socket server ==
+
+When started with --raw-server, the same stream is served to any number of viewers over a
+local TCP or Unix socket instead of stdio. Each frame is encoded once and sent to every
+viewer. Since all viewers share the encoding, the server only negotiates the base protocol
+(version 1.1, no feature flags besides "send all windows"). Windows are announced to each
+new viewer when it connects. Viewers that fall behind skip Type 0 frames until they catch
+up, and then get a full redraw. Input from all viewers is handled in order of arrival.
+
+== End socket server ==
+
 * Common Footer
 
   ===================== End Base64 payload
@@ -201,6 +288,7 @@ Once the server sends back a response, both the server and client MUST communica
 
 uint16_t RawTerminal::supportedFeatures = 0;
 uint32_t RawTerminal::supportedExtendedFeatures = 0;
+std::string RawTerminal::serverAddress;
 std::function<void(const std::string&)> rawWriter = [](const std::string& data){
     std::cout << data;
     std::cout.flush();
@@ -209,27 +297,40 @@ static std::thread * inputThread;
 static bool isVersion1_1 = false;
 static std::string fileWriteRequests[256];
 
+// shared by every thread that sends packets
+static RawCompressor compressor;
+
+#ifndef __EMSCRIPTEN__
+struct RawServerClient;
+// While set, packets sent from this thread are replies that go only to this viewer.
+static thread_local std::shared_ptr<RawServerClient> rawServerReplyTarget;
+static void rawServerBroadcast(const std::string& frame, bool droppable);
+static void rawServerReply(const std::shared_ptr<RawServerClient>& client, const std::string& frame);
+#endif
+
+static void writeRawFrame(uint8_t type, const std::string& frame) {
+#ifndef __EMSCRIPTEN__
+    if (!RawTerminal::serverAddress.empty()) {
+        if (rawServerReplyTarget) rawServerReply(rawServerReplyTarget, frame);
+        // full terminal frames are superseded by the next one, so slow viewers may skip them
+        else rawServerBroadcast(frame, type == CCPC_RAW_TERMINAL_DATA);
+    } else
+#endif
+    rawWriter(frame);
+}
+
 static void sendRawData(const uint8_t type, const uint8_t id, const std::function<void(std::ostream&)>& callback) {
     std::stringstream output;
     output.put(type);
     output.put(id);
     callback(output);
-    std::string str = b64encode(output.str());
-    str.erase(std::remove_if(str.begin(), str.end(), [](char c)->bool {return c == '\n' || c == '\r'; }), str.end());
-    Poco::Checksum chk;
-    if (type != CCPC_RAW_FEATURE_FLAGS && (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM)) chk.update(output.str());
-    else chk.update(str);
-    const uint32_t sum = chk.checksum();
-    char tmpdata[21];
-    if (str.length() > 65535) {
-        if (isVersion1_1) {
-            snprintf(tmpdata, 21, "%012zX%08x", str.length(), sum);
-            rawWriter("!CPD" + std::string(tmpdata, 12) + str + std::string(tmpdata + 12, 8) + "\n");
-        } else fprintf(stderr, "Attempted to send raw packet that's too large to a client that doesn't support large packets (%zu bytes); dropping packet.", str.length());
-    } else {
-        snprintf(tmpdata, 13, "%04X%08x", (unsigned)str.length(), sum);
-        rawWriter("!CPC" + std::string(tmpdata, 4) + str + std::string(tmpdata + 4, 8) + "\n");
-    }
+    std::string data = output.str();
+    if (type != CCPC_RAW_FEATURE_FLAGS && (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_COMPRESSION)) compressor.compress(data);
+    // the handshake itself always uses the text framing, so it works with any client
+    const bool negotiated = type != CCPC_RAW_FEATURE_FLAGS;
+    const std::string frame = frameRawPacket(data, negotiated && (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING), negotiated && (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM), isVersion1_1);
+    if (frame.empty()) fprintf(stderr, "Attempted to send raw packet that's too large to a client that doesn't support large packets (%zu bytes); dropping packet.", (data.size() + 2) / 3 * 4);
+    else writeRawFrame(type, frame);
 }
 
 static void parseIBTTag(std::istream& in, lua_State *L) {
@@ -443,537 +544,798 @@ static lua_CFunction findLibraryFunction(luaL_Reg * lib, const char * name) {
     return NULL;
 }
 
-static void rawInputLoop() {
-    while (!exiting) {
-        unsigned char cc = std::cin.get();
-        if (cc == '!' && std::cin.get() == 'C' && std::cin.get() == 'P') {
-            char protocol_type = std::cin.get();
-            size_t sizen;
-            if (protocol_type == 'C') {
-                char size[5];
-                size[4] = 0;
-                std::cin.read(size, 4);
-                sizen = strtoul(size, NULL, 16);
-            } else if (isVersion1_1 && protocol_type == 'D') {
-                char size[13];
-                size[12] = 0;
-                std::cin.read(size, 12);
-                sizen = strtoul(size, NULL, 16);
-            } else continue;
-            char * tmp = new char[sizen+1];
-            tmp[sizen] = 0;
-            std::cin.read(tmp, sizen);
-            std::string ddata;
-            try {
-                ddata = b64decode(std::string(tmp, sizen));
-            } catch (std::exception &e) {
-                fprintf(stderr, "Could not decode Base64: %s\n", e.what());
-                delete[] tmp;
-                continue;
-            } 
-            Poco::Checksum chk;
-            if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM) chk.update(ddata);
-            else chk.update(tmp, sizen);
-            delete[] tmp;
-            char hexstr[9];
-            std::cin.read(hexstr, 8);
-            hexstr[8] = 0;
-            if (chk.checksum() != strtoul(hexstr, NULL, 16)) {
-                fprintf(stderr, "Invalid checksum: expected %08X, got %08lX\n", chk.checksum(), strtoul(hexstr, NULL, 16));
-                continue;
-            }
-            std::stringstream in(ddata);
-
-            SDL_Event e;
-            memset(&e, 0, sizeof(SDL_Event));
-            std::string tmps;
-            uint8_t type = in.get();
-            uint8_t id = in.get();
-            switch (type) {
-            case CCPC_RAW_KEY_DATA: {
-                uint8_t key = in.get();
-                uint8_t flags = in.get();
-                if (flags & 8) {
-                    e.type = SDL_TEXTINPUT;
-                    e.text.windowID = id;
-                    e.text.text[0] = key;
-                    e.text.text[1] = '\0';
-                    LockGuard lockc(computers);
-                    for (Computer * c : *computers) {
-                        if (checkWindowID(c, e.key.windowID)) {
-                            std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
-                            e.text.windowID = c->term->id;
-                            c->termEventQueue.push(e);
-                            c->event_lock.notify_all();
-                        }
-                    }
-                } else if ((flags & 9) == 1) {
-                    e.type = SDL_KEYUP;
-                    e.key.windowID = id;
-                    e.key.keysym.sym = (SDL_Keycode)key;
-                    if (flags & 4) e.key.keysym.mod = KMOD_CTRL;
-                    LockGuard lockc(computers);
-                    for (Computer * c : *computers) {
-                        if (checkWindowID(c, e.key.windowID)) {
-                            std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
-                            e.key.windowID = c->term->id;
-                            c->termEventQueue.push(e);
-                            c->event_lock.notify_all();
-                        }
-                    }
-                } else {
-                    e.type = SDL_KEYDOWN;
-                    e.key.windowID = id;
-                    e.key.keysym.sym = (SDL_Keycode)key;
-                    if (flags & 4) e.key.keysym.mod = KMOD_CTRL;
-                    LockGuard lockc(computers);
-                    for (Computer * c : *computers) {
-                        if (checkWindowID(c, e.key.windowID)) {
-                            std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
-                            e.key.windowID = c->term->id;
-                            c->termEventQueue.push(e);
-                            c->event_lock.notify_all();
-                        }
-                    }
+// Makes every raw terminal send a full frame on its next render.
+static void forceFullFrames() {
+    std::lock_guard<std::mutex> rlock(renderTargetsLock);
+    for (Terminal * t : renderTargets) {
+        RawTerminal * term = dynamic_cast<RawTerminal*>(t);
+        if (term != NULL) {
+            std::lock_guard<std::mutex> lock(term->locked);
+            term->forceFullFrame = true;
+            term->changed = true;
+        }
+    }
+}
+
+// Announces every raw terminal to the client. renderTargetsLock must be held.
+static void sendAllWindows(uint8_t id) {
+    for (Terminal * t : renderTargets) {
+        RawTerminal * term = dynamic_cast<RawTerminal*>(t);
+        if (term != NULL) {
+            sendRawData(CCPC_RAW_TERMINAL_CHANGE, id, [term](std::ostream& output) {
+                output.put(0);
+                output.put(term->computerID);
+                output.write((char*)&term->width, 2);
+                output.write((char*)&term->height, 2);
+                output.write(term->title.c_str(), term->title.size());
+                output.put(0);
+            });
+        }
+    }
+}
+
+static void handleRawPacket(const std::string& packet) {
+    if (packet.size() < 2) return;
+    std::string decompressed;
+    const std::string * data = &packet;
+    if ((uint8_t)packet[0] & CCPC_RAW_COMPRESSED_PACKET) {
+        try {
+            decompressed = rawDecompress(packet);
+        } catch (std::exception &e) {
+            fprintf(stderr, "Could not decompress packet: %s\n", e.what());
+            return;
+        }
+        data = &decompressed;
+    }
+    Poco::MemoryInputStream in(data->data(), data->size());
+
+    SDL_Event e;
+    memset(&e, 0, sizeof(SDL_Event));
+    std::string tmps;
+    uint8_t type = in.get();
+    uint8_t id = in.get();
+    switch (type) {
+    case CCPC_RAW_KEY_DATA: {
+        uint8_t key = in.get();
+        uint8_t flags = in.get();
+        if (flags & 8) {
+            e.type = SDL_TEXTINPUT;
+            e.text.windowID = id;
+            e.text.text[0] = key;
+            e.text.text[1] = '\0';
+            LockGuard lockc(computers);
+            for (Computer * c : *computers) {
+                if (checkWindowID(c, e.key.windowID)) {
+                    std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
+                    e.text.windowID = c->term->id;
+                    c->termEventQueue.push(e);
+                    c->event_lock.notify_all();
                 }
-                break;
-            } case CCPC_RAW_MOUSE_DATA: {
-                uint8_t evtype = in.get();
-                uint8_t button = in.get();
-                uint32_t x = 0, y = 0;
-                in.read((char*)&x, 4);
-                in.read((char*)&y, 4);
-                LockGuard lockc(computers);
-                for (Computer * c : *computers) {
-                    if (checkWindowID(c, id)) {
-                        struct rawMouseProviderData * d = new struct rawMouseProviderData;
-                        d->id = id;
-                        d->evtype = evtype;
-                        d->button = button;
-                        d->x = x;
-                        d->y = y;
-                        queueEvent(c, rawMouseProvider, d);
-                    }
+            }
+        } else if ((flags & 9) == 1) {
+            e.type = SDL_KEYUP;
+            e.key.windowID = id;
+            e.key.keysym.sym = (SDL_Keycode)key;
+            if (flags & 4) e.key.keysym.mod = KMOD_CTRL;
+            LockGuard lockc(computers);
+            for (Computer * c : *computers) {
+                if (checkWindowID(c, e.key.windowID)) {
+                    std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
+                    e.key.windowID = c->term->id;
+                    c->termEventQueue.push(e);
+                    c->event_lock.notify_all();
                 }
-                break;
-            } case CCPC_RAW_EVENT_DATA: {
-                LockGuard lockc(computers);
-                for (Computer * c : *computers) {
-                    if (checkWindowID(c, id)) {
-                        std::stringstream * ss = new std::stringstream(in.str().substr(2));
-                        queueEvent(c, rawEventProvider, ss);
-                    }
+            }
+        } else {
+            e.type = SDL_KEYDOWN;
+            e.key.windowID = id;
+            e.key.keysym.sym = (SDL_Keycode)key;
+            if (flags & 4) e.key.keysym.mod = KMOD_CTRL;
+            LockGuard lockc(computers);
+            for (Computer * c : *computers) {
+                if (checkWindowID(c, e.key.windowID)) {
+                    std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
+                    e.key.windowID = c->term->id;
+                    c->termEventQueue.push(e);
+                    c->event_lock.notify_all();
                 }
-                break;
-            } case CCPC_RAW_TERMINAL_CHANGE: {
-                int isClosing = in.get();
-                if (isClosing == 1) {
-                    e.type = SDL_WINDOWEVENT;
-                    e.window.event = SDL_WINDOWEVENT_CLOSE;
-                    LockGuard lockc(computers);
-                    for (Computer * c : *computers) {
-                        if (checkWindowID(c, id)) {
-                            std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
-                            e.window.windowID = id;
-                            c->termEventQueue.push(e);
-                            c->event_lock.notify_all();
-                        }
-                    }
-                    for (Terminal * t : orphanedTerminals) {
-                        if (t->id == id) {
-                            orphanedTerminals.erase(t);
-                            t->factory->deleteTerminal(t);
-                            break;
-                        }
-                    }
-                } else if (isClosing == 2) {
-                    e.type = SDL_QUIT;
-                    LockGuard lockc(computers);
-                    for (Computer * c : *computers) {
-                        std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
-                        c->termEventQueue.push(e);
-                        c->event_lock.notify_all();
-                    }
-                } else {
-                    in.get(); // reserved
-                    uint16_t w = 0, h = 0;
-                    in.read((char*)&w, 2);
-                    in.read((char*)&h, 2);
-                    e.type = SDL_WINDOWEVENT;
+            }
+        }
+        break;
+    } case CCPC_RAW_MOUSE_DATA: {
+        uint8_t evtype = in.get();
+        uint8_t button = in.get();
+        uint32_t x = 0, y = 0;
+        in.read((char*)&x, 4);
+        in.read((char*)&y, 4);
+        LockGuard lockc(computers);
+        for (Computer * c : *computers) {
+            if (checkWindowID(c, id)) {
+                struct rawMouseProviderData * d = new struct rawMouseProviderData;
+                d->id = id;
+                d->evtype = evtype;
+                d->button = button;
+                d->x = x;
+                d->y = y;
+                queueEvent(c, rawMouseProvider, d);
+            }
+        }
+        break;
+    } case CCPC_RAW_EVENT_DATA: {
+        LockGuard lockc(computers);
+        for (Computer * c : *computers) {
+            if (checkWindowID(c, id)) {
+                std::stringstream * ss = new std::stringstream(data->substr(2));
+                queueEvent(c, rawEventProvider, ss);
+            }
+        }
+        break;
+    } case CCPC_RAW_TERMINAL_CHANGE: {
+        int isClosing = in.get();
+        if (isClosing == 1) {
+            e.type = SDL_WINDOWEVENT;
+            e.window.event = SDL_WINDOWEVENT_CLOSE;
+            LockGuard lockc(computers);
+            for (Computer * c : *computers) {
+                if (checkWindowID(c, id)) {
+                    std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
                     e.window.windowID = id;
-                    e.window.event = SDL_WINDOWEVENT_RESIZED;
-                    e.window.data1 = w;
-                    e.window.data2 = h;
-                    LockGuard lockc(computers);
-                    for (Computer * c : *computers) {
-                        if (checkWindowID(c, e.window.windowID)) {
-                            std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
-                            c->termEventQueue.push(e);
-                            c->event_lock.notify_all();
-                        }
-                    }
+                    c->termEventQueue.push(e);
+                    c->event_lock.notify_all();
                 }
-                break;
-            } case CCPC_RAW_FEATURE_FLAGS: {
-                isVersion1_1 = true;
-                in.read((char*)&RawTerminal::supportedFeatures, 2);
-                RawTerminal::supportedFeatures &= CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM | CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT | CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS;
-                if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES) {
-                    in.read((char*)&RawTerminal::supportedExtendedFeatures, 4);
-                    RawTerminal::supportedExtendedFeatures &= 0x00000000;
+            }
+            for (Terminal * t : orphanedTerminals) {
+                if (t->id == id) {
+                    orphanedTerminals.erase(t);
+                    t->factory->deleteTerminal(t);
+                    break;
                 }
-                sendRawData(CCPC_RAW_FEATURE_FLAGS, id, [](std::ostream& out) {
-                    out.write((char*)&RawTerminal::supportedFeatures, 2);
-                    if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES) out.write((char*)&RawTerminal::supportedExtendedFeatures, 4);
-                });
-                if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS) {
-                    std::lock_guard<std::mutex> rlock(renderTargetsLock);
-                    for (Terminal * t : renderTargets) {
-                        RawTerminal * term = dynamic_cast<RawTerminal*>(t);
-                        if (term != NULL) {
-                            sendRawData(CCPC_RAW_TERMINAL_CHANGE, id, [term](std::ostream& output) {
-                                output.put(0);
-                                output.put(term->computerID);
-                                output.write((char*)&term->width, 2);
-                                output.write((char*)&term->height, 2);
-                                output.write(term->title.c_str(), term->title.size());
-                                output.put(0);
-                            });
-                        }
-                    }
+            }
+        } else if (isClosing == 2) {
+            e.type = SDL_QUIT;
+            LockGuard lockc(computers);
+            for (Computer * c : *computers) {
+                std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
+                c->termEventQueue.push(e);
+                c->event_lock.notify_all();
+            }
+        } else {
+            in.get(); // reserved
+            uint16_t w = 0, h = 0;
+            in.read((char*)&w, 2);
+            in.read((char*)&h, 2);
+            e.type = SDL_WINDOWEVENT;
+            e.window.windowID = id;
+            e.window.event = SDL_WINDOWEVENT_RESIZED;
+            e.window.data1 = w;
+            e.window.data2 = h;
+            LockGuard lockc(computers);
+            for (Computer * c : *computers) {
+                if (checkWindowID(c, e.window.windowID)) {
+                    std::lock_guard<std::mutex> lock(c->termEventQueueMutex);
+                    c->termEventQueue.push(e);
+                    c->event_lock.notify_all();
                 }
+            }
+        }
+        break;
+    } case CCPC_RAW_FEATURE_FLAGS: {
+        isVersion1_1 = true;
+        in.read((char*)&RawTerminal::supportedFeatures, 2);
+        // every viewer of the socket server gets the same encoded frames, so it only speaks the base protocol
+        if (!RawTerminal::serverAddress.empty()) RawTerminal::supportedFeatures &= CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS;
+        else RawTerminal::supportedFeatures &= CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM | CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT | CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS | CCPC_RAW_FEATURE_FLAG_DELTA_FRAMES | CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING | CCPC_RAW_FEATURE_FLAG_COMPRESSION;
+#ifdef _WIN32
+        if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING) {
+            // binary frames must not have their newlines translated
+            _setmode(_fileno(stdin), _O_BINARY);
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+#endif
+        if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES) {
+            in.read((char*)&RawTerminal::supportedExtendedFeatures, 4);
+            RawTerminal::supportedExtendedFeatures &= 0x00000000;
+        }
+        sendRawData(CCPC_RAW_FEATURE_FLAGS, id, [](std::ostream& out) {
+            out.write((char*)&RawTerminal::supportedFeatures, 2);
+            if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES) out.write((char*)&RawTerminal::supportedExtendedFeatures, 4);
+        });
+        // the client may not have the previous frames, so start over with full frames
+        forceFullFrames();
+        if (RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS) {
+            std::lock_guard<std::mutex> rlock(renderTargetsLock);
+            sendAllWindows(id);
+        }
+        break;
+    } case CCPC_RAW_FILE_REQUEST: {
+        if (!(RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT)) break;
+        uint8_t reqtype = in.get();
+        uint8_t reqid = in.get();
+        std::string path, path2;
+        char c;
+        while ((c = (char)in.get())) path += c;
+        if (reqtype == CCPC_RAW_FILE_REQUEST_COPY || reqtype == CCPC_RAW_FILE_REQUEST_MOVE) while ((c = (char)in.get())) path2 += c;
+        Computer * comp = NULL;
+        LockGuard lockc(computers);
+        for (Computer * c : *computers) {
+            if (checkWindowID(c, id)) {
+                comp = c;
                 break;
-            } case CCPC_RAW_FILE_REQUEST: {
-                if (!(RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT)) break;
-                uint8_t reqtype = in.get();
-                uint8_t reqid = in.get();
-                std::string path, path2;
-                char c;
-                while ((c = (char)in.get())) path += c;
-                if (reqtype == CCPC_RAW_FILE_REQUEST_COPY || reqtype == CCPC_RAW_FILE_REQUEST_MOVE) while ((c = (char)in.get())) path2 += c;
-                Computer * comp = NULL;
-                LockGuard lockc(computers);
-                for (Computer * c : *computers) {
-                    if (checkWindowID(c, id)) {
-                        comp = c;
-                        break;
-                    }
-                }
-                if (comp == NULL || comp->rawFileStack == NULL) {
-                    if ((reqtype & 0xF0) == CCPC_RAW_FILE_REQUEST_OPEN && !(reqtype & CCPC_RAW_FILE_REQUEST_OPEN_WRITE)) sendRawData(CCPC_RAW_FILE_DATA, id, [reqid](std::ostream& out) {
-                        out.put(1);
-                        out.put(reqid);
-                        out.put(39); out.put(0); out.put(0); out.put(0);
-                        out.write("Could not find computer for this window", 39);
-                    }); else sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid](std::ostream& out) {
-                        out.put(reqtype);
-                        out.put(reqid);
-                        switch (reqtype) {
-                            case CCPC_RAW_FILE_REQUEST_MAKEDIR:
-                            case CCPC_RAW_FILE_REQUEST_DELETE:
-                            case CCPC_RAW_FILE_REQUEST_COPY:
-                            case CCPC_RAW_FILE_REQUEST_MOVE:
-                            case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE:
-                            case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE | CCPC_RAW_FILE_REQUEST_OPEN_APPEND:
-                            case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE | CCPC_RAW_FILE_REQUEST_OPEN_BINARY:
-                            case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE | CCPC_RAW_FILE_REQUEST_OPEN_APPEND | CCPC_RAW_FILE_REQUEST_OPEN_BINARY:
-                                out.write("Could not find computer for this window", 40);
-                                break;
-                            case CCPC_RAW_FILE_REQUEST_EXISTS:
-                            case CCPC_RAW_FILE_REQUEST_ISDIR:
-                            case CCPC_RAW_FILE_REQUEST_ISREADONLY:
-                                out.put(2);
-                                break;
-                            case CCPC_RAW_FILE_REQUEST_GETSIZE:
-                            case CCPC_RAW_FILE_REQUEST_GETCAPACITY:
-                            case CCPC_RAW_FILE_REQUEST_GETFREESPACE:
-                            case CCPC_RAW_FILE_REQUEST_LIST:
-                            case CCPC_RAW_FILE_REQUEST_FIND:
-                                out.put(0xFF); out.put(0xFF); out.put(0xFF); out.put(0xFF);
-                                break;
-                            case CCPC_RAW_FILE_REQUEST_GETDRIVE:
-                                out.put(0);
-                                break;
-                            case CCPC_RAW_FILE_REQUEST_ATTRIBUTES:
-                                for (int i = 0; i < 22; i++) out.put(0);
-                                out.put(2);
-                                out.put(0);
-                                break;
-                        }
-                    });
-                    break;
-                }
-                std::lock_guard<std::mutex> lock(comp->rawFileStackMutex);
-                if ((reqtype & 0xF0) == CCPC_RAW_FILE_REQUEST_OPEN) {
-                    if (!(reqtype & CCPC_RAW_FILE_REQUEST_OPEN_WRITE)) sendRawData(CCPC_RAW_FILE_DATA, id, [reqtype, reqid, comp, &path](std::ostream &out) {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "open"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        lua_pushstring(comp->rawFileStack, (reqtype & CCPC_RAW_FILE_REQUEST_OPEN_BINARY) ? "rb" : "r");
-                        std::string data;
-                        bool err = false;
-                        if (lua_pcall(comp->rawFileStack, 2, 2, 0)) {
-                            err = true;
-                            data = lua_tostring(comp->rawFileStack, -1);
-                            lua_pop(comp->rawFileStack, 1);
-                        } else if (lua_isnil(comp->rawFileStack, -2)) {
-                            err = true;
-                            data = lua_tostring(comp->rawFileStack, -1);
-                            lua_pop(comp->rawFileStack, 2);
-                        } else {
-                            lua_pop(comp->rawFileStack, 1);
-                            lua_getfield(comp->rawFileStack, -1, "readAll");
-                            lua_call(comp->rawFileStack, 0, 1);
-                            if (lua_isnil(comp->rawFileStack, -1)) data = ""; // shouldn't happen
-                            else data = std::string(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                            lua_getfield(comp->rawFileStack, -1, "close");
-                            lua_call(comp->rawFileStack, 0, 0);
-                            lua_pop(comp->rawFileStack, 1);
-                        }
-                        out.put(err);
-                        out.put(reqid);
-                        uint32_t size = data.size();
-                        out.write((char*)&size, 4);
-                        out.write(data.c_str(), size);
-                    }); else fileWriteRequests[reqid] = (char)reqtype + path;
-                } else sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid, comp, &path, &path2](std::ostream& out) {
-                    out.put(reqtype);
-                    out.put(reqid);
-                    switch (reqtype) {
-                    case CCPC_RAW_FILE_REQUEST_EXISTS: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "exists"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) out.put(2);
-                        else out.put(lua_toboolean(comp->rawFileStack, -1));
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_ISDIR: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "isDir"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) out.put(2);
-                        else out.put(lua_toboolean(comp->rawFileStack, -1));
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_ISREADONLY: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "isReadOnly"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) out.put(2);
-                        else out.put(lua_toboolean(comp->rawFileStack, -1));
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_GETSIZE: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getSize"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        uint32_t size;
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
-                        else size = lua_tointeger(comp->rawFileStack, -1);
-                        out.write((char*)&size, 4);
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_GETDRIVE: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getDrive"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        std::string str;
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) str = "";
-                        else str = lua_tostring(comp->rawFileStack, -1);
-                        out.write(str.c_str(), str.size());
-                        out.put(0);
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_GETCAPACITY: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getCapacity"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        uint32_t size;
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
-                        else size = lua_tointeger(comp->rawFileStack, -1);
-                        out.write((char*)&size, 4);
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_GETFREESPACE: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getFreeSpace"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        uint32_t size;
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
-                        else size = lua_tointeger(comp->rawFileStack, -1);
-                        out.write((char*)&size, 4);
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_LIST: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "list"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        uint32_t size;
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
-                        else size = lua_objlen(comp->rawFileStack, -1);
-                        out.write((char*)&size, 4);
-                        if (size != 0xFFFFFFFF) for (uint32_t i = 0; i < size; i++) {
-                            lua_rawgeti(comp->rawFileStack, -1, i + 1);
-                            out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            out.put(0);
-                            lua_pop(comp->rawFileStack, 1);
-                        }
-                        lua_pop(comp->rawFileStack, 1);
-                        break;
-                    } case CCPC_RAW_FILE_REQUEST_ATTRIBUTES: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "attributes"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) {
-                            for (int i = 0; i < 22; i++) out.put(0);
-                            out.put(2);
-                            out.put(0);
-                        } else if (lua_isnil(comp->rawFileStack, -1)) {
-                            for (int i = 0; i < 22; i++) out.put(0);
-                            out.put(1);
-                            out.put(0);
-                        } else {
-                            uint32_t t32;
-                            uint64_t t64;
-                            lua_getfield(comp->rawFileStack, -1, "size");
-                            t32 = lua_tointeger(comp->rawFileStack, -1);
-                            out.write((char*)&t32, 4);
-                            lua_pop(comp->rawFileStack, 1);
-                            lua_getfield(comp->rawFileStack, -1, "created");
-                            t64 = lua_tointeger(comp->rawFileStack, -1);
-                            out.write((char*)&t64, 8);
-                            lua_pop(comp->rawFileStack, 1);
-                            lua_getfield(comp->rawFileStack, -1, "modified");
-                            t64 = lua_tointeger(comp->rawFileStack, -1);
-                            out.write((char*)&t64, 8);
-                            lua_pop(comp->rawFileStack, 1);
-                            lua_getfield(comp->rawFileStack, -1, "isDir");
-                            out.put(lua_toboolean(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                            lua_getfield(comp->rawFileStack, -1, "isReadOnly");
-                            out.put(lua_toboolean(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                            out.put(0); out.put(0);
-                        }
-                        lua_pop(comp->rawFileStack, 1);
+            }
+        }
+        if (comp == NULL || comp->rawFileStack == NULL) {
+            if ((reqtype & 0xF0) == CCPC_RAW_FILE_REQUEST_OPEN && !(reqtype & CCPC_RAW_FILE_REQUEST_OPEN_WRITE)) sendRawData(CCPC_RAW_FILE_DATA, id, [reqid](std::ostream& out) {
+                out.put(1);
+                out.put(reqid);
+                out.put(39); out.put(0); out.put(0); out.put(0);
+                out.write("Could not find computer for this window", 39);
+            }); else sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid](std::ostream& out) {
+                out.put(reqtype);
+                out.put(reqid);
+                switch (reqtype) {
+                    case CCPC_RAW_FILE_REQUEST_MAKEDIR:
+                    case CCPC_RAW_FILE_REQUEST_DELETE:
+                    case CCPC_RAW_FILE_REQUEST_COPY:
+                    case CCPC_RAW_FILE_REQUEST_MOVE:
+                    case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE:
+                    case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE | CCPC_RAW_FILE_REQUEST_OPEN_APPEND:
+                    case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE | CCPC_RAW_FILE_REQUEST_OPEN_BINARY:
+                    case CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE | CCPC_RAW_FILE_REQUEST_OPEN_APPEND | CCPC_RAW_FILE_REQUEST_OPEN_BINARY:
+                        out.write("Could not find computer for this window", 40);
                         break;
-                    } case CCPC_RAW_FILE_REQUEST_FIND: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "find"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        uint32_t size;
-                        if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
-                        else size = lua_objlen(comp->rawFileStack, -1);
-                        out.write((char*)&size, 4);
-                        if (size != 0xFFFFFFFF) for (uint32_t i = 0; i < size; i++) {
-                            lua_rawgeti(comp->rawFileStack, -1, i + 1);
-                            out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            out.put(0);
-                            lua_pop(comp->rawFileStack, 1);
-                        }
-                        lua_pop(comp->rawFileStack, 1);
+                    case CCPC_RAW_FILE_REQUEST_EXISTS:
+                    case CCPC_RAW_FILE_REQUEST_ISDIR:
+                    case CCPC_RAW_FILE_REQUEST_ISREADONLY:
+                        out.put(2);
                         break;
-                    } case CCPC_RAW_FILE_REQUEST_MAKEDIR: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "makeDir"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        if (lua_pcall(comp->rawFileStack, 1, 0, 0)) {
-                            out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                        }
-                        out.put(0);
+                    case CCPC_RAW_FILE_REQUEST_GETSIZE:
+                    case CCPC_RAW_FILE_REQUEST_GETCAPACITY:
+                    case CCPC_RAW_FILE_REQUEST_GETFREESPACE:
+                    case CCPC_RAW_FILE_REQUEST_LIST:
+                    case CCPC_RAW_FILE_REQUEST_FIND:
+                        out.put(0xFF); out.put(0xFF); out.put(0xFF); out.put(0xFF);
                         break;
-                    } case CCPC_RAW_FILE_REQUEST_DELETE: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "delete"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        if (lua_pcall(comp->rawFileStack, 1, 0, 0)) {
-                            out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                        }
+                    case CCPC_RAW_FILE_REQUEST_GETDRIVE:
                         out.put(0);
                         break;
-                    } case CCPC_RAW_FILE_REQUEST_COPY: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "copy"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        lua_pushstring(comp->rawFileStack, path2.c_str());
-                        if (lua_pcall(comp->rawFileStack, 2, 0, 0)) {
-                            out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                        }
+                    case CCPC_RAW_FILE_REQUEST_ATTRIBUTES:
+                        for (int i = 0; i < 22; i++) out.put(0);
+                        out.put(2);
                         out.put(0);
                         break;
-                    } case CCPC_RAW_FILE_REQUEST_MOVE: {
-                        lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "move"));
-                        lua_pushstring(comp->rawFileStack, path.c_str());
-                        lua_pushstring(comp->rawFileStack, path2.c_str());
-                        if (lua_pcall(comp->rawFileStack, 2, 0, 0)) {
-                            out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
-                            lua_pop(comp->rawFileStack, 1);
-                        }
-                        out.put(0);
-                        break;
-                    }}
-                });
+                }
+            });
+            break;
+        }
+        std::lock_guard<std::mutex> lock(comp->rawFileStackMutex);
+        if ((reqtype & 0xF0) == CCPC_RAW_FILE_REQUEST_OPEN) {
+            if (!(reqtype & CCPC_RAW_FILE_REQUEST_OPEN_WRITE)) sendRawData(CCPC_RAW_FILE_DATA, id, [reqtype, reqid, comp, &path](std::ostream &out) {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "open"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                lua_pushstring(comp->rawFileStack, (reqtype & CCPC_RAW_FILE_REQUEST_OPEN_BINARY) ? "rb" : "r");
+                std::string data;
+                bool err = false;
+                if (lua_pcall(comp->rawFileStack, 2, 2, 0)) {
+                    err = true;
+                    data = lua_tostring(comp->rawFileStack, -1);
+                    lua_pop(comp->rawFileStack, 1);
+                } else if (lua_isnil(comp->rawFileStack, -2)) {
+                    err = true;
+                    data = lua_tostring(comp->rawFileStack, -1);
+                    lua_pop(comp->rawFileStack, 2);
+                } else {
+                    lua_pop(comp->rawFileStack, 1);
+                    lua_getfield(comp->rawFileStack, -1, "readAll");
+                    lua_call(comp->rawFileStack, 0, 1);
+                    if (lua_isnil(comp->rawFileStack, -1)) data = ""; // shouldn't happen
+                    else data = std::string(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                    lua_getfield(comp->rawFileStack, -1, "close");
+                    lua_call(comp->rawFileStack, 0, 0);
+                    lua_pop(comp->rawFileStack, 1);
+                }
+                out.put(err);
+                out.put(reqid);
+                uint32_t size = data.size();
+                out.write((char*)&size, 4);
+                out.write(data.c_str(), size);
+            }); else fileWriteRequests[reqid] = (char)reqtype + path;
+        } else sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid, comp, &path, &path2](std::ostream& out) {
+            out.put(reqtype);
+            out.put(reqid);
+            switch (reqtype) {
+            case CCPC_RAW_FILE_REQUEST_EXISTS: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "exists"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) out.put(2);
+                else out.put(lua_toboolean(comp->rawFileStack, -1));
+                lua_pop(comp->rawFileStack, 1);
                 break;
-            } case CCPC_RAW_FILE_DATA: {
-                if (!(RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT)) break;
-                in.get();
-                uint8_t reqid = in.get();
-                if (fileWriteRequests[reqid].empty()) {
-                    sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqid](std::ostream &out) {
-                        out.put(CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE);
-                        out.put(reqid);
-                        out.write("Could not find request for given ID", 36);
-                    });
-                    break;
+            } case CCPC_RAW_FILE_REQUEST_ISDIR: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "isDir"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) out.put(2);
+                else out.put(lua_toboolean(comp->rawFileStack, -1));
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_ISREADONLY: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "isReadOnly"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) out.put(2);
+                else out.put(lua_toboolean(comp->rawFileStack, -1));
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_GETSIZE: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getSize"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                uint32_t size;
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
+                else size = lua_tointeger(comp->rawFileStack, -1);
+                out.write((char*)&size, 4);
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_GETDRIVE: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getDrive"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                std::string str;
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) str = "";
+                else str = lua_tostring(comp->rawFileStack, -1);
+                out.write(str.c_str(), str.size());
+                out.put(0);
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_GETCAPACITY: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getCapacity"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                uint32_t size;
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
+                else size = lua_tointeger(comp->rawFileStack, -1);
+                out.write((char*)&size, 4);
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_GETFREESPACE: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "getFreeSpace"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                uint32_t size;
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
+                else size = lua_tointeger(comp->rawFileStack, -1);
+                out.write((char*)&size, 4);
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_LIST: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "list"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                uint32_t size;
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
+                else size = lua_objlen(comp->rawFileStack, -1);
+                out.write((char*)&size, 4);
+                if (size != 0xFFFFFFFF) for (uint32_t i = 0; i < size; i++) {
+                    lua_rawgeti(comp->rawFileStack, -1, i + 1);
+                    out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    out.put(0);
+                    lua_pop(comp->rawFileStack, 1);
                 }
-                uint8_t reqtype = fileWriteRequests[reqid][0];
-                std::string path = fileWriteRequests[reqid].substr(1);
-                fileWriteRequests[reqid] = "";
-                Computer * comp = NULL;
-                LockGuard lockc(computers);
-                for (Computer * c : *computers) {
-                    if (checkWindowID(c, id)) {
-                        comp = c;
-                        break;
-                    }
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_ATTRIBUTES: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "attributes"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) {
+                    for (int i = 0; i < 22; i++) out.put(0);
+                    out.put(2);
+                    out.put(0);
+                } else if (lua_isnil(comp->rawFileStack, -1)) {
+                    for (int i = 0; i < 22; i++) out.put(0);
+                    out.put(1);
+                    out.put(0);
+                } else {
+                    uint32_t t32;
+                    uint64_t t64;
+                    lua_getfield(comp->rawFileStack, -1, "size");
+                    t32 = lua_tointeger(comp->rawFileStack, -1);
+                    out.write((char*)&t32, 4);
+                    lua_pop(comp->rawFileStack, 1);
+                    lua_getfield(comp->rawFileStack, -1, "created");
+                    t64 = lua_tointeger(comp->rawFileStack, -1);
+                    out.write((char*)&t64, 8);
+                    lua_pop(comp->rawFileStack, 1);
+                    lua_getfield(comp->rawFileStack, -1, "modified");
+                    t64 = lua_tointeger(comp->rawFileStack, -1);
+                    out.write((char*)&t64, 8);
+                    lua_pop(comp->rawFileStack, 1);
+                    lua_getfield(comp->rawFileStack, -1, "isDir");
+                    out.put(lua_toboolean(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                    lua_getfield(comp->rawFileStack, -1, "isReadOnly");
+                    out.put(lua_toboolean(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                    out.put(0); out.put(0);
                 }
-                if (comp == NULL || comp->rawFileStack == NULL) {
-                    sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid](std::ostream &out) {
-                        out.put(reqtype);
-                        out.put(reqid);
-                        out.write("Could not find computer for this window", 40);
-                    });
-                    break;
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_FIND: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "find"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                uint32_t size;
+                if (lua_pcall(comp->rawFileStack, 1, 1, 0)) size = 0xFFFFFFFF;
+                else size = lua_objlen(comp->rawFileStack, -1);
+                out.write((char*)&size, 4);
+                if (size != 0xFFFFFFFF) for (uint32_t i = 0; i < size; i++) {
+                    lua_rawgeti(comp->rawFileStack, -1, i + 1);
+                    out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    out.put(0);
+                    lua_pop(comp->rawFileStack, 1);
                 }
-                std::lock_guard<std::mutex> lock(comp->rawFileStackMutex);
-                sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid, comp, &path, &in](std::ostream& out) {
-                    out.put(reqtype);
-                    out.put(reqid);
-                    lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "open"));
-                    lua_pushstring(comp->rawFileStack, path.c_str());
-                    lua_pushstring(comp->rawFileStack, (std::string((reqtype & CCPC_RAW_FILE_REQUEST_OPEN_APPEND) ? "a" : "w") + ((reqtype & CCPC_RAW_FILE_REQUEST_OPEN_BINARY) ? "b" : "")).c_str());
-                    if (lua_pcall(comp->rawFileStack, 2, 2, 0)) {
-                        out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1) + 1);
-                        lua_pop(comp->rawFileStack, 1);
-                    } else if (lua_isnil(comp->rawFileStack, -2)) {
-                        out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1) + 1);
-                        lua_pop(comp->rawFileStack, 2);
-                    } else {
-                        lua_pop(comp->rawFileStack, 1);
-                        uint32_t size = 0;
-                        in.read((char*)&size, 4);
-                        char * data = new char[size];
-                        in.read(data, size);
-                        lua_getfield(comp->rawFileStack, -1, "write");
-                        lua_pushlstring(comp->rawFileStack, data, size);
-                        delete[] data;
-                        lua_call(comp->rawFileStack, 1, 0);
-                        lua_getfield(comp->rawFileStack, -1, "close");
-                        lua_call(comp->rawFileStack, 0, 0);
-                        lua_pop(comp->rawFileStack, 1);
-                        out.put(0);
-                    }
-                });
+                lua_pop(comp->rawFileStack, 1);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_MAKEDIR: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "makeDir"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                if (lua_pcall(comp->rawFileStack, 1, 0, 0)) {
+                    out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                }
+                out.put(0);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_DELETE: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "delete"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                if (lua_pcall(comp->rawFileStack, 1, 0, 0)) {
+                    out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                }
+                out.put(0);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_COPY: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "copy"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                lua_pushstring(comp->rawFileStack, path2.c_str());
+                if (lua_pcall(comp->rawFileStack, 2, 0, 0)) {
+                    out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                }
+                out.put(0);
+                break;
+            } case CCPC_RAW_FILE_REQUEST_MOVE: {
+                lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "move"));
+                lua_pushstring(comp->rawFileStack, path.c_str());
+                lua_pushstring(comp->rawFileStack, path2.c_str());
+                if (lua_pcall(comp->rawFileStack, 2, 0, 0)) {
+                    out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1));
+                    lua_pop(comp->rawFileStack, 1);
+                }
+                out.put(0);
                 break;
             }}
+        });
+        break;
+    } case CCPC_RAW_FILE_DATA: {
+        if (!(RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT)) break;
+        in.get();
+        uint8_t reqid = in.get();
+        if (fileWriteRequests[reqid].empty()) {
+            sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqid](std::ostream &out) {
+                out.put(CCPC_RAW_FILE_REQUEST_OPEN | CCPC_RAW_FILE_REQUEST_OPEN_WRITE);
+                out.put(reqid);
+                out.write("Could not find request for given ID", 36);
+            });
+            break;
+        }
+        uint8_t reqtype = fileWriteRequests[reqid][0];
+        std::string path = fileWriteRequests[reqid].substr(1);
+        fileWriteRequests[reqid] = "";
+        Computer * comp = NULL;
+        LockGuard lockc(computers);
+        for (Computer * c : *computers) {
+            if (checkWindowID(c, id)) {
+                comp = c;
+                break;
+            }
+        }
+        if (comp == NULL || comp->rawFileStack == NULL) {
+            sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid](std::ostream &out) {
+                out.put(reqtype);
+                out.put(reqid);
+                out.write("Could not find computer for this window", 40);
+            });
+            break;
+        }
+        std::lock_guard<std::mutex> lock(comp->rawFileStackMutex);
+        sendRawData(CCPC_RAW_FILE_RESPONSE, id, [reqtype, reqid, comp, &path, &in](std::ostream& out) {
+            out.put(reqtype);
+            out.put(reqid);
+            lua_pushcfunction(comp->rawFileStack, findLibraryFunction(fs_lib.functions, "open"));
+            lua_pushstring(comp->rawFileStack, path.c_str());
+            lua_pushstring(comp->rawFileStack, (std::string((reqtype & CCPC_RAW_FILE_REQUEST_OPEN_APPEND) ? "a" : "w") + ((reqtype & CCPC_RAW_FILE_REQUEST_OPEN_BINARY) ? "b" : "")).c_str());
+            if (lua_pcall(comp->rawFileStack, 2, 2, 0)) {
+                out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1) + 1);
+                lua_pop(comp->rawFileStack, 1);
+            } else if (lua_isnil(comp->rawFileStack, -2)) {
+                out.write(lua_tostring(comp->rawFileStack, -1), lua_strlen(comp->rawFileStack, -1) + 1);
+                lua_pop(comp->rawFileStack, 2);
+            } else {
+                lua_pop(comp->rawFileStack, 1);
+                uint32_t size = 0;
+                in.read((char*)&size, 4);
+                char * data = new char[size];
+                in.read(data, size);
+                lua_getfield(comp->rawFileStack, -1, "write");
+                lua_pushlstring(comp->rawFileStack, data, size);
+                delete[] data;
+                lua_call(comp->rawFileStack, 1, 0);
+                lua_getfield(comp->rawFileStack, -1, "close");
+                lua_call(comp->rawFileStack, 0, 0);
+                lua_pop(comp->rawFileStack, 1);
+                out.put(0);
+            }
+        });
+        break;
+    }}
+}
+
+static void rawInputLoop() {
+    RawPacketParser parser;
+    parser.errorHandler = [](const std::string& message) {fprintf(stderr, "%s\n", message.c_str());};
+    char * buf = new char[65536];
+    while (!exiting) {
+#ifdef _WIN32
+        const int n = _read(_fileno(stdin), buf, 65536);
+#else
+        const ssize_t n = read(STDIN_FILENO, buf, 65536);
+#endif
+        if (n <= 0) {
+            // stdin was closed - there won't be any more input
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        parser.feed(buf, n);
+        while (true) {
+            // feature flags can change between two packets in the same chunk
+            parser.binaryChecksum = RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM;
+            parser.largePackets = isVersion1_1;
+            const std::string * packet = parser.next();
+            if (packet == NULL) break;
+            handleRawPacket(*packet);
+        }
+    }
+    delete[] buf;
+}
+
+#ifndef __EMSCRIPTEN__
+// Viewers whose send queue is over the soft limit skip full terminal frames;
+// over the hard limit they are disconnected, since nothing else can be dropped.
+#define RAW_SERVER_SOFT_LIMIT 0x100000
+#define RAW_SERVER_HARD_LIMIT 0x4000000
+
+struct RawServerClient {
+    Poco::Net::StreamSocket socket;
+    std::thread * reader = NULL;
+    std::thread * writer = NULL;
+    std::mutex lock;
+    std::condition_variable notify;
+    std::deque<std::shared_ptr<const std::string>> queue;
+    size_t queuedBytes = 0;
+    size_t dropped = 0;
+    bool stale = false; // a frame was skipped, so the screen needs a redraw once the queue drains
+    bool finishing = false; // the server is quitting; close after sending what's queued
+    bool closed = false;
+    RawServerClient(const Poco::Net::StreamSocket& sock): socket(sock) {}
+};
+
+static Poco::Net::ServerSocket * rawServerSocket = NULL;
+static std::list<std::shared_ptr<RawServerClient>> rawServerClients;
+static std::list<std::shared_ptr<RawServerClient>> rawServerClosedClients; // disconnected, waiting for their threads to be joined
+static std::mutex rawServerClientsLock;
+static std::mutex rawServerInputLock; // packets from all viewers are handled one at a time
+
+// Adds a frame to a viewer's send queue. The viewer's lock must be held.
+static void rawServerQueue(RawServerClient& client, const std::shared_ptr<const std::string>& data, bool droppable) {
+    if (client.closed) return;
+    if (droppable && client.queuedBytes >= RAW_SERVER_SOFT_LIMIT) {
+        client.dropped++;
+        client.stale = true;
+        return;
+    } else if (client.queuedBytes >= RAW_SERVER_HARD_LIMIT) {
+        fprintf(stderr, "Raw viewer %s is too far behind; disconnecting\n", client.socket.peerAddress().toString().c_str());
+        client.closed = true;
+        client.notify.notify_all();
+        try {client.socket.shutdown();} catch (std::exception &e) {}
+        return;
+    }
+    client.queue.push_back(data);
+    client.queuedBytes += data->size();
+    client.notify.notify_all();
+}
+
+static void rawServerBroadcast(const std::string& frame, bool droppable) {
+    // the frame is encoded once and shared by every viewer's queue
+    const std::shared_ptr<const std::string> data = std::make_shared<const std::string>(frame);
+    std::lock_guard<std::mutex> lock(rawServerClientsLock);
+    for (const auto& client : rawServerClients) {
+        std::lock_guard<std::mutex> clock(client->lock);
+        rawServerQueue(*client, data, droppable);
+    }
+}
+
+static void rawServerReply(const std::shared_ptr<RawServerClient>& client, const std::string& frame) {
+    std::lock_guard<std::mutex> lock(client->lock);
+    rawServerQueue(*client, std::make_shared<const std::string>(frame), false);
+}
+
+// Stops sending to a viewer whose connection failed. Its threads are joined by rawServerReap.
+static void rawServerDisconnect(const std::shared_ptr<RawServerClient>& client) {
+    {
+        std::lock_guard<std::mutex> lock(rawServerClientsLock);
+        const auto it = std::find(rawServerClients.begin(), rawServerClients.end(), client);
+        // the reader and writer both end up here; only the first one moves it
+        if (it != rawServerClients.end()) {
+            rawServerClients.erase(it);
+            rawServerClosedClients.push_back(client);
+        }
+    }
+    std::lock_guard<std::mutex> lock(client->lock);
+    client->closed = true;
+    client->notify.notify_all();
+    try {client->socket.shutdown();} catch (std::exception &e) {}
+}
+
+static void rawServerReap() {
+    std::list<std::shared_ptr<RawServerClient>> closed;
+    {
+        std::lock_guard<std::mutex> lock(rawServerClientsLock);
+        closed.swap(rawServerClosedClients);
+    }
+    for (const auto& c : closed) {
+        c->reader->join();
+        c->writer->join();
+        delete c->reader;
+        delete c->writer;
+    }
+}
+
+static void rawServerWriter(std::shared_ptr<RawServerClient> client) {
+    std::unique_lock<std::mutex> lock(client->lock);
+    while (!client->closed) {
+        if (client->queue.empty()) {
+            if (client->finishing) break;
+            if (client->stale) {
+                // caught up after skipping frames - redraw everything so the viewer isn't left with an old screen
+                client->stale = false;
+                lock.unlock();
+                forceFullFrames();
+                lock.lock();
+                continue;
+            }
+            client->notify.wait(lock);
+            continue;
+        }
+        const std::shared_ptr<const std::string> data = client->queue.front();
+        client->queue.pop_front();
+        lock.unlock();
+        try {
+            for (size_t sent = 0; sent < data->size(); ) {
+#ifdef MSG_NOSIGNAL
+                const int n = client->socket.sendBytes(data->c_str() + sent, (int)(data->size() - sent), MSG_NOSIGNAL);
+#else
+                const int n = client->socket.sendBytes(data->c_str() + sent, (int)(data->size() - sent));
+#endif
+                if (n <= 0) throw std::runtime_error("Connection closed");
+                sent += n;
+            }
+        } catch (std::exception &e) {
+            lock.lock();
+            client->closed = true;
+            break;
+        }
+        lock.lock();
+        client->queuedBytes -= data->size();
+    }
+    client->queue.clear();
+    client->queuedBytes = 0;
+    const bool failed = !client->finishing;
+    lock.unlock();
+    if (failed) rawServerDisconnect(client);
+}
+
+static void rawServerReader(std::shared_ptr<RawServerClient> client) {
+    RawPacketParser parser;
+    parser.errorHandler = [](const std::string& message) {fprintf(stderr, "%s\n", message.c_str());};
+    char * buf = new char[65536];
+    while (!exiting) {
+        int n;
+        try {
+            n = client->socket.receiveBytes(buf, 65536);
+        } catch (std::exception &e) {
+            n = 0;
+        }
+        if (n <= 0) break;
+        parser.feed(buf, n);
+        std::lock_guard<std::mutex> lock(rawServerInputLock);
+        // anything sent while handling this viewer's packets answers it alone
+        rawServerReplyTarget = client;
+        while (true) {
+            parser.binaryChecksum = RawTerminal::supportedFeatures & CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM;
+            parser.largePackets = isVersion1_1;
+            const std::string * packet = parser.next();
+            if (packet == NULL) break;
+            handleRawPacket(*packet);
+        }
+        rawServerReplyTarget.reset();
+    }
+    delete[] buf;
+    rawServerDisconnect(client);
+}
+
+static void rawServerLoop() {
+    while (!exiting) {
+        rawServerReap();
+        Poco::Net::StreamSocket sock;
+        try {
+            // poll so quitting doesn't have to wake up a blocked accept
+            if (!rawServerSocket->poll(Poco::Timespan(0, 100000), Poco::Net::Socket::SELECT_READ)) continue;
+            sock = rawServerSocket->acceptConnection();
+        } catch (std::exception &e) {
+            fprintf(stderr, "Could not accept raw viewer: %s\n", e.what());
+            continue;
+        }
+        sock.setNoDelay(true);
+        // a viewer that can't take any data for this long is considered gone
+        sock.setSendTimeout(Poco::Timespan(5, 0));
+        std::shared_ptr<RawServerClient> client = std::make_shared<RawServerClient>(sock);
+        isVersion1_1 = true;
+        {
+            // hold off rendering until the new viewer knows about all windows
+            std::lock_guard<std::mutex> rlock(renderTargetsLock);
+            {
+                std::lock_guard<std::mutex> lock(rawServerClientsLock);
+                client->reader = new std::thread(rawServerReader, client);
+                client->writer = new std::thread(rawServerWriter, client);
+                rawServerClients.push_back(client);
+            }
+            // the viewers that were already connected know these windows
+            rawServerReplyTarget = client;
+            sendAllWindows(0);
+            rawServerReplyTarget.reset();
+        }
+        forceFullFrames();
+    }
+}
+
+static Poco::Net::SocketAddress rawServerSocketAddress(const std::string& address) {
+    if (address.find_first_not_of("0123456789") == std::string::npos) {
+        if (address.empty() || address.size() > 5 || std::stoul(address) > 65535) throw std::invalid_argument("Port must be between 0 and 65535");
+        return Poco::Net::SocketAddress("127.0.0.1", (Poco::UInt16)std::stoul(address));
+    }
+#ifdef POCO_HAS_UNIX_SOCKET
+    if (address.find(':') == std::string::npos) {
+        // a socket left over from an earlier run is replaced, but nothing else is
+        std::error_code e;
+        const fs::file_status st = fs::symlink_status(address, e);
+        if (fs::exists(st)) {
+            if (st.type() != fs::file_type::socket) throw std::invalid_argument("File exists and is not a socket");
+            fs::remove(address, e);
         }
+        return Poco::Net::SocketAddress(Poco::Net::SocketAddress::UNIX_LOCAL, address);
     }
+#endif
+    return Poco::Net::SocketAddress(address);
 }
+#endif
 
 void RawTerminal::init() {
     SDL_Init(SDL_INIT_TIMER);
     renderThread = new std::thread(termRenderLoop);
+#ifndef __EMSCRIPTEN__
+    if (!serverAddress.empty()) {
+        try {
+            rawServerSocket = new Poco::Net::ServerSocket(rawServerSocketAddress(serverAddress));
+        } catch (std::exception &e) {
+            fprintf(stderr, "Could not start raw server on %s: %s\n", serverAddress.c_str(), e.what());
+            exit(1);
+        }
+        inputThread = new std::thread(rawServerLoop);
+    } else
+#endif
     inputThread = new std::thread(rawInputLoop);
     setThreadName(*renderThread, "Render Thread");
 }
@@ -985,6 +1347,36 @@ void RawTerminal::quit() {
     });
     renderThread->join();
     delete renderThread;
+#ifndef __EMSCRIPTEN__
+    if (rawServerSocket != NULL) {
+        inputThread->join();
+        delete inputThread;
+        rawServerSocket->close();
+        delete rawServerSocket;
+        rawServerSocket = NULL;
+        std::list<std::shared_ptr<RawServerClient>> clients;
+        {
+            std::lock_guard<std::mutex> lock(rawServerClientsLock);
+            clients.swap(rawServerClients);
+        }
+        for (const auto& client : clients) {
+            {
+                // let the close message go out first
+                std::lock_guard<std::mutex> clock(client->lock);
+                client->finishing = true;
+                client->notify.notify_all();
+            }
+            client->writer->join();
+            try {client->socket.shutdown();} catch (std::exception &e) {}
+            client->reader->join();
+            delete client->reader;
+            delete client->writer;
+        }
+        rawServerReap();
+        SDL_Quit();
+        return;
+    }
+#endif
     inputThread->join();
     delete inputThread;
     SDL_Quit();
@@ -1058,75 +1450,15 @@ void RawTerminal::render() {
     }
     if (!changed) return;
     changed = false;
-    sendRawData(CCPC_RAW_TERMINAL_DATA, (uint8_t)id, [this](std::ostream& output) {
-        output.put((char)mode);
-        output.put((char)canBlink);
-        output.write((char*)&width, 2);
-        output.write((char*)&height, 2);
-        output.write((char*)&blinkX, 2);
-        output.write((char*)&blinkY, 2);
-        output.put(grayscale ? 1 : 0);
-        for (int i = 0; i < 3; i++) output.put(0);
-        if (mode == 0) {
-            unsigned char c = screen[0][0];
-            unsigned char n = 0;
-            for (unsigned y = 0; y < height; y++) {
-                for (unsigned x = 0; x < width; x++) {
-                    if (screen[y][x] != c || n == 255) {
-                        output.put(c);
-                        output.put(n);
-                        c = screen[y][x];
-                        n = 0;
-                    }
-                    n++;
-                }
-            }
-            if (n > 0) {
-                output.put(c);
-                output.put(n);
-            }
-            c = colors[0][0];
-            n = 0;
-            for (unsigned y = 0; y < height; y++) {
-                for (unsigned x = 0; x < width; x++) {
-                    if (colors[y][x] != c || n == 255) {
-                        output.put(c);
-                        output.put(n);
-                        c = colors[y][x];
-                        n = 0;
-                    }
-                    n++;
-                }
-            }
-            if (n > 0) {
-                output.put(c);
-                output.put(n);
-            }
-        } else {
-            unsigned char c = pixels[0][0];
-            unsigned char n = 0;
-            for (unsigned y = 0; y < height * 9; y++) {
-                for (unsigned x = 0; x < width * 6; x++) {
-                    if (pixels[y][x] != c || n == 255) {
-                        output.put(c);
-                        output.put(n);
-                        c = pixels[y][x];
-                        n = 0;
-                    }
-                    n++;
-                }
-            }
-            if (n > 0) {
-                output.put(c);
-                output.put(n);
-            }
-        }
-        for (int i = 0; i < (mode == 2 ? 256 : 16); i++) {
-            output.put(palette[i].r);
-            output.put(palette[i].g);
-            output.put(palette[i].b);
-        }
-    });
+    if (!(supportedFeatures & CCPC_RAW_FEATURE_FLAG_DELTA_FRAMES)) {
+        sendRawData(CCPC_RAW_TERMINAL_DATA, (uint8_t)id, [this](std::ostream& output) {writeTerminalFrame(output, *this);});
+        return;
+    }
+    if (forceFullFrame || !lastFrame.matches(*this)) {
+        sendRawData(CCPC_RAW_TERMINAL_DATA, (uint8_t)id, [this](std::ostream& output) {writeTerminalFrame(output, *this);});
+        forceFullFrame = false;
+    } else sendRawData(CCPC_RAW_TERMINAL_DELTA, (uint8_t)id, [this](std::ostream& output) {writeTerminalDelta(output, *this, lastFrame);});
+    lastFrame.save(*this);
 }
 
 void RawTerminal::showMessage(uint32_t flags, const char * title, const char * message) {
@@ -13,6 +13,7 @@
 #include <set>
 #include <SDL2/SDL.h>
 #include <Terminal.hpp>
+#include "RawFrames.hpp"
 #include "../runtime.hpp"
 
 enum {
@@ -25,7 +26,8 @@ enum {
     CCPC_RAW_FEATURE_FLAGS,
     CCPC_RAW_FILE_REQUEST,
     CCPC_RAW_FILE_RESPONSE,
-    CCPC_RAW_FILE_DATA
+    CCPC_RAW_FILE_DATA,
+    CCPC_RAW_TERMINAL_DELTA
 };
 
 enum {
@@ -53,12 +55,19 @@ enum {
 #define CCPC_RAW_FEATURE_FLAG_BINARY_CHECKSUM        0x0001
 #define CCPC_RAW_FEATURE_FLAG_FILESYSTEM_SUPPORT     0x0002
 #define CCPC_RAW_FEATURE_FLAG_SEND_ALL_WINDOWS       0x0004
+#define CCPC_RAW_FEATURE_FLAG_DELTA_FRAMES           0x0008
+#define CCPC_RAW_FEATURE_FLAG_BINARY_FRAMING         0x0010
+#define CCPC_RAW_FEATURE_FLAG_COMPRESSION            0x0020
+
 #define CCPC_RAW_FEATURE_FLAG_HAS_EXTENDED_FEATURES  0x8000
 
 class RawTerminal: public Terminal {
+    RawFrameState lastFrame; // The last contents sent to the client, used to build delta frames
 public:
+    bool forceFullFrame = true; // Set to send the next frame as a full frame even if delta frames are supported
     static uint16_t supportedFeatures;
     static uint32_t supportedExtendedFeatures;
+    static std::string serverAddress; // If set, viewers connect to this socket instead of using stdio
     uint8_t computerID;
     static void init();
     static void quit();
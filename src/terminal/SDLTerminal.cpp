@@ -13,17 +13,10 @@
 #include <configuration.hpp>
 #include "RawTerminal.hpp"
 #include "SDLTerminal.hpp"
-#include "../gif.hpp"
 #include "../main.hpp"
+#include "../recorder.hpp"
 #include "../runtime.hpp"
 #include "../termsupport.hpp"
-#ifndef NO_WEBP
-#include <webp/mux.h>
-#include <webp/encode.h>
-#endif
-#ifndef NO_PNG
-#include <png++/png.hpp>
-#endif
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
 #include <emscripten/html5.h>
@@ -348,87 +341,22 @@ void SDLTerminal::render() {
     if (shouldScreenshot && !screenshotPath.empty()) {
         shouldScreenshot = false;
         if (gotResizeEvent) return;
-        SDL_Surface * temp = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGB24, 0);
         if (screenshotPath == "clipboard") {
+            SDL_Surface * temp = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGB24, 0);
             copyImage(temp, win);
+            SDL_FreeSurface(temp);
         } else {
-#ifndef NO_WEBP
-            if (config.useWebP) {
-                uint8_t * data = NULL;
-                size_t size = WebPEncodeLosslessRGB((uint8_t*)temp->pixels, temp->w, temp->h, temp->pitch, &data);
-                if (size) {
-                    std::ofstream out(screenshotPath, std::ios::binary);
-                    out.write((char*)data, size);
-                    out.close();
-                    WebPFree(data);
-                }
-            } else {
-#endif
-#ifndef NO_PNG
-                png::solid_pixel_buffer<png::rgb_pixel> pixbuf(temp->w, temp->h);
-                for (int i = 0; i < temp->h; i++)
-                    memcpy((void*)&pixbuf.get_bytes()[i * temp->w * 3], (char*)temp->pixels + (i * temp->pitch), temp->w * 3);
-                png::image<png::rgb_pixel, png::solid_pixel_buffer<png::rgb_pixel> > img(temp->w, temp->h);
-                img.set_pixbuf(pixbuf);
-                std::ofstream out(screenshotPath, std::ios::binary);
-                img.write_stream(out);
-                out.close();
-#else
-                SDL_SaveBMP(temp, screenshotPath.c_str());
-#endif
-#ifndef NO_WEBP
-            }
-#endif
+            std::shared_ptr<CapturedFrame> frame = captureSurface(surf);
+            if (frame != NULL) saveScreenshot(frame, screenshotPath, config.useWebP);
         }
-        SDL_FreeSurface(temp);
-#ifdef __EMSCRIPTEN__
-        queueTask([](void*)->void*{syncfs(); return NULL;}, NULL, true);
-#endif
     }
     if (shouldRecord) {
         if (recordedFrames >= config.maxRecordingTime * config.recordingFPS) stopRecording();
         else if (--frameWait < 1) {
+            // only the copy happens here; the encoder threads do the rest
             std::lock_guard<std::mutex> recorderlock(recorderMutex);
-#ifndef NO_WEBP
-            if (isRecordingWebP) {
-                if (recorderHandle == NULL) {
-                    WebPAnimEncoderOptions enc_options;
-                    WebPAnimEncoderOptionsInit(&enc_options);
-                    recorderHandle = WebPAnimEncoderNew(surf->w, surf->h, &enc_options);
-                }
-                SDL_Surface * temp = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_BGRA32, 0);
-                WebPConfig config;
-                WebPConfigInit(&config);
-                config.lossless = true;
-                WebPPicture frame;
-                WebPPictureInit(&frame);
-                frame.width = temp->w;
-                frame.height = temp->h;
-                frame.use_argb = true;
-                frame.argb = (uint32_t*)temp->pixels;
-                frame.argb_stride = temp->pitch / 4;
-                WebPAnimEncoderAdd((WebPAnimEncoder*)recorderHandle, &frame, (1000 / ::config.recordingFPS) * recordedFrames, &config);
-                SDL_FreeSurface(temp);
-            } else {
-#endif
-                if (recorderHandle == NULL) {
-                    GifWriter * g = new GifWriter;
-#ifdef _WIN32
-                    g->f = _wfopen(recordingPath.native().c_str(), L"wb");
-#else
-                    g->f = fopen(recordingPath.native().c_str(), "wb");
-#endif
-                    GifBegin(g, NULL, surf->w, surf->h, 100 / config.recordingFPS);
-                    recorderHandle = g;
-                }
-                SDL_Surface * temp = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGBA32, 0);
-                uint32_t pal[256];
-                for (int i = 0; i < 256; i++) pal[i] = newpalette[i].r | (newpalette[i].g << 8) | (newpalette[i].b << 16);
-                GifWriteFrame((GifWriter*)recorderHandle, (uint8_t*)temp->pixels, temp->w, temp->h, 100 / config.recordingFPS, newmode == 2 ? 8 : 5, false, pal);
-                SDL_FreeSurface(temp);
-#ifndef NO_WEBP
-            }
-#endif
+            std::shared_ptr<CapturedFrame> frame = captureSurface(surf);
+            if (recorderHandle != NULL && frame != NULL) ((Recording*)recorderHandle)->addFrame(frame, newpalette, newmode == 2 ? 8 : 5);
             recordedFrames++;
             frameWait = ::config.clockSpeed / ::config.recordingFPS;
             if (gotResizeEvent) return;
@@ -535,7 +463,8 @@ void SDLTerminal::record(std::string path) {
 #endif
         recordingPath /= std::string(tstr) + ".gif";
     }
-    recorderHandle = NULL;
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    recorderHandle = new Recording(recordingPath, isRecordingWebP, config.recordingFPS);
     changed = true;
 }
 
@@ -543,26 +472,9 @@ void SDLTerminal::stopRecording() {
     shouldRecord = false;
     std::lock_guard<std::mutex> lock(recorderMutex);
     if (recorderHandle == NULL) return;
-#ifndef NO_WEBP
-    if (isRecordingWebP) {
-        WebPAnimEncoderAdd((WebPAnimEncoder*)recorderHandle, NULL, (1000 / ::config.recordingFPS) * recordedFrames, NULL);
-        WebPData webp_data;
-        WebPDataInit(&webp_data);
-        WebPAnimEncoderAssemble((WebPAnimEncoder*)recorderHandle, &webp_data);
-        std::ofstream out(recordingPath.c_str(), std::ios::binary);
-        out.write((char*)webp_data.bytes, webp_data.size);
-        out.close();
-        WebPAnimEncoderDelete((WebPAnimEncoder*)recorderHandle);
-    } else {
-#endif
-        GifEnd((GifWriter*)recorderHandle);
-#ifndef NO_WEBP
-    }
-#endif
+    // the recording is written and freed once the encoder catches up
+    ((Recording*)recorderHandle)->finish();
     recorderHandle = NULL;
-#ifdef __EMSCRIPTEN__
-    queueTask([](void*)->void*{syncfs(); return NULL;}, NULL, true);
-#endif
     changed = true;
 }
 
@@ -652,6 +564,7 @@ void SDLTerminal::init() {
 void SDLTerminal::quit() {
     renderThread->join();
     delete renderThread;
+    recorderQuit();
     SDL_FreeSurface(bmp);
     if (bmp != origfont) SDL_FreeSurface(origfont);
     SDL_Quit();
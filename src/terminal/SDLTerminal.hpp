@@ -56,6 +56,8 @@ public:
     int currentFPS = 0;
     time_t lastSecond = time(0);
     std::chrono::system_clock::time_point lastScreenshotTime;
+    double renderTime = 0; // ms spent rendering changed frames since the last benchmark() call (guarded by renderlock)
+    int renderedFrames = 0; // Changed frames rendered since the last benchmark() call (guarded by renderlock)
     unsigned char cursorColor = 0;
     bool useOrigFont = false;
     bool isOnTop = false;
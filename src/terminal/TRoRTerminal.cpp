@@ -9,8 +9,10 @@
  */
 
 #include <iostream>
+#include <cstdarg>
 #include <cstdio>
 #include <thread>
+#include <unordered_map>
 #include "TRoRTerminal.hpp"
 #include "SDLTerminal.hpp"
 #include "../peripheral/monitor.hpp"
@@ -35,6 +37,83 @@ is assumed to be meant for the first window (ID 0).
 static std::unordered_set<std::string> trorExtensions;
 static std::thread * inputThread;
 
+// Packets are collected here and written once per render tick, since a
+// program writing a lot would otherwise spend most of its time in write().
+static std::mutex outputLock;
+static std::string output;
+static size_t lastPacket = std::string::npos; // where the last queued packet starts
+static std::string lastCode;
+static unsigned lastID = 0;
+// the colors each client window was last told about
+static std::unordered_map<unsigned, std::pair<std::string, std::string>> sentColors;
+static const size_t maxOutputSize = 1048576;
+
+static void writeOutput(const std::string& str) {
+    fwrite(str.data(), 1, str.size(), stdout);
+    fflush(stdout);
+}
+
+void TRoRTerminal::send(unsigned id, const char * code, const char * format, ...) {
+    char buf[256];
+    va_list va;
+    va_start(va, format);
+    const int len = vsnprintf(buf, sizeof(buf), format, va);
+    va_end(va);
+    std::string payload;
+    if (len < 0) return;
+    else if ((size_t)len < sizeof(buf)) payload.assign(buf, len);
+    else {
+        payload.resize(len + 1);
+        va_start(va, format);
+        vsnprintf(&payload[0], len + 1, format, va);
+        va_end(va);
+        payload.resize(len);
+    }
+    std::lock_guard<std::mutex> lock(outputLock);
+    const bool sameAsLast = lastPacket != std::string::npos && lastID == id && lastCode == code;
+    if (code[0] == 'T' && (code[1] == 'F' || code[1] == 'K')) {
+        // the client keeps the colors, so only changes need to be sent
+        std::string& sent = code[1] == 'F' ? sentColors[id].first : sentColors[id].second;
+        if (sent == payload) return;
+        sent = payload;
+        if (sameAsLast) output.resize(lastPacket);
+    } else if (sameAsLast && code[0] == 'T' && code[1] == 'C') {
+        // only the last cursor move before something is drawn matters
+        output.resize(lastPacket);
+    } else if (sameAsLast && code[0] == 'T' && code[1] == 'W') {
+        // consecutive writes are the same as one longer write
+        output.pop_back();
+        output += payload;
+        output += '\n';
+        return;
+    } else if (code[0] == 'T' && code[1] == 'Q') sentColors.erase(id);
+    lastPacket = output.size();
+    lastCode = code;
+    lastID = id;
+    output += code;
+    output += ':';
+    output += std::to_string(id);
+    output += ';';
+    output += payload;
+    output += '\n';
+    if (output.size() > maxOutputSize) {
+        writeOutput(output);
+        output.clear();
+        lastPacket = std::string::npos;
+    }
+}
+
+void TRoRTerminal::flush() {
+    std::string str;
+    {
+        std::lock_guard<std::mutex> lock(outputLock);
+        if (output.empty()) return;
+        str.swap(output);
+        lastPacket = std::string::npos;
+    }
+    writeOutput(str);
+}
+
 static std::string trorEvent(lua_State *L, void* userp) {
     std::string * str = (std::string*)userp;
     if (luaL_loadstring(L, ("return " + *str).c_str())) {
@@ -54,8 +133,8 @@ static std::string trorEvent(lua_State *L, void* userp) {
 static void trorInputLoop() {
     while (!exiting) {
         std::string line;
-        std::getline(std::cin, line);
-        if (line[2] != ':') continue;
+        if (!std::getline(std::cin, line)) break;
+        if (line.size() < 3 || line[2] != ':') continue;
         std::string code = line.substr(0, 2);
         std::string meta = line.substr(3, line.find(';') - 3);
         std::string payload = line.substr(line.find(';') + 1);
@@ -132,10 +211,13 @@ void TRoRTerminal::init() {
     inputThread = new std::thread(trorInputLoop);
     setThreadName(*renderThread, "Render Thread");
     printf("SP:;-ccpcTerm-\n");
+    fflush(stdout);
 }
 
 void TRoRTerminal::quit() {
+    flush();
     printf("SC:;Server closed\n");
+    fflush(stdout);
     renderThread->join();
     delete renderThread;
     inputThread->join();
@@ -145,20 +227,22 @@ void TRoRTerminal::quit() {
 
 void TRoRTerminal::showGlobalMessage(Uint32 flags, const char * title, const char * message) {
     // This may be called before initialization, so we're always sending it
+    flush();
     printf("TA:;\"%s\",\"%s\"\n", title, message);
+    fflush(stdout);
 }
 
 TRoRTerminal::TRoRTerminal(std::string title): Terminal(config.defaultWidth, config.defaultHeight) {
     this->title = title;
     for (id = 0; currentWindowIDs.find(id) != currentWindowIDs.end(); id++) ;
-    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) printf("TN:%d;%s\n", id, title.c_str());
+    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) send(id, "TN", "%s", title.c_str());
     renderTargets.push_back(this);
     renderTarget = --renderTargets.end();
     onActivate();
 }
 
 TRoRTerminal::~TRoRTerminal() {
-    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) printf("TQ:%d;\n", id);
+    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) send(id, "TQ", "");
     const auto pos = currentWindowIDs.find(id);
     if (pos != currentWindowIDs.end()) currentWindowIDs.erase(pos);
     if (singleWindowMode && *renderTarget == this) previousRenderTarget();
@@ -172,10 +256,10 @@ TRoRTerminal::~TRoRTerminal() {
 }
 
 void TRoRTerminal::showMessage(Uint32 flags, const char * title, const char * message) {
-    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) printf("TA:%d;\"%s\",\"%s\"\n", id, title, message);
+    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) send(id, "TA", "\"%s\",\"%s\"", title, message);
 }
 
 void TRoRTerminal::setLabel(std::string label) {
     this->title = label;
-    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) printf("TZ:%d;%s\n", id, label.c_str());
+    if (trorExtensions.find("ccpcTerm") != trorExtensions.end()) send(id, "TZ", "%s", label.c_str());
 }
\ No newline at end of file
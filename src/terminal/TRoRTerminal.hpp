@@ -20,6 +20,10 @@ public:
     static void quit();
     static void pollEvents() {defaultPollEvents();}
     static void showGlobalMessage(uint32_t flags, const char * title, const char * message);
+    // Queues a packet for the next render tick, merging or dropping it if it's redundant.
+    static void send(unsigned id, const char * code, const char * format, ...);
+    // Writes all queued packets to stdout in one go.
+    static void flush();
     TRoRTerminal(std::string title);
     ~TRoRTerminal() override;
     void render() override {}
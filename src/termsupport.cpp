@@ -30,11 +30,13 @@
 #include <Terminal.hpp>
 #include "apis.hpp"
 #include "apis/handles/fs_handle.hpp"
+#include "filestream.hpp"
 #include "main.hpp"
 #include "runtime.hpp"
 #include "peripheral/monitor.hpp"
 #include "peripheral/debugger.hpp"
 #include "termsupport.hpp"
+#include "termtrace.hpp"
 #include "terminal/SDLTerminal.hpp"
 #include "terminal/HardwareSDLTerminal.hpp"
 #include "terminal/RawTerminal.hpp"
@@ -592,7 +594,16 @@ static bool renderTerminal(Terminal * term, bool& pushEvent) {
         changed = term->changed;
     }
     try {
+        const auto start = std::chrono::high_resolution_clock::now();
         term->render();
+        SDLTerminal * sdlterm = dynamic_cast<SDLTerminal*>(term);
+        if (changed && sdlterm != NULL) {
+            const double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            // term.benchmark reads and resets these on the computer thread
+            std::lock_guard<std::mutex> lock(sdlterm->renderlock);
+            sdlterm->renderTime += time;
+            sdlterm->renderedFrames++;
+        }
     } catch (std::exception &ex) {
         fprintf(stderr, "Warning: Render on term %d threw an error: %s (%d)\n", term->id, ex.what(), term->errorcount);
         if (term->errorcount++ > 10) {
@@ -633,6 +644,7 @@ void termRenderLoop() {
             else for (Terminal* term : renderTargets) if (renderTerminal(term, pushEvent)) {errored = true; break;}
         }
         if (errored) continue;
+        if (selectedRenderer == 4) TRoRTerminal::flush();
         if (pushEvent) {
             SDL_Event ev;
             ev.type = render_event_type;
@@ -962,9 +974,9 @@ std::string termGetEvent(lua_State *L) {
             lua_createtable(L, 0, 1);
             lua_createtable(L, computer->droppedFiles.size(), 0);
             for (int i = 0; i < computer->droppedFiles.size(); i++) {
-                std::fstream ** fp = (std::fstream**)lua_newuserdata(L, sizeof(std::fstream*));
+                FileReadStream ** fp = (FileReadStream**)lua_newuserdata(L, sizeof(FileReadStream*));
                 int fpid = lua_gettop(L);
-                *fp = new std::fstream(computer->droppedFiles[i], std::ios::in | std::ios::binary);
+                *fp = new FileReadStream(computer->droppedFiles[i]);
                 if (!(*fp)->is_open()) {
                     delete *fp;
                     lua_pop(L, 1);
@@ -1098,3 +1110,307 @@ Terminal * createTerminal(const std::string& title) {
     if (factory == NULL) return NULL;
     return factory->createTerminal(title);
 }
+
+/*
+ * Shared drawing kernel
+ * These functions implement the drawing operations shared by the term API and
+ * monitor peripherals. They work directly on the terminal's buffers instead of
+ * going through vector2d's per-cell proxies, so keep any changes to drawing
+ * behavior in here instead of in the API functions.
+ */
+
+// Clips a run of `len` characters starting at the cursor to the visible line.
+// Returns false if the cursor is off-screen (in which case nothing happens).
+// Otherwise, [start, end) is the range of visible columns, offset is the index
+// in the source string of the first visible character, and newX is where the
+// cursor should end up.
+static bool clipCursorRun(const Terminal& term, size_t len, unsigned& start, unsigned& end, size_t& offset, int& newX) {
+    if (term.blinkY < 0 || (term.blinkX >= 0 && (unsigned)term.blinkX >= term.width) || (unsigned)term.blinkY >= term.height) return false;
+    long long last = (long long)term.blinkX + (long long)len;
+    if (last > term.width) last = term.width;
+    newX = (int)last;
+    start = term.blinkX < 0 ? 0 : term.blinkX;
+    end = last < (long long)start ? start : (unsigned)last;
+    offset = (size_t)((long long)start - term.blinkX);
+    return true;
+}
+
+void termWrite(Terminal& term, const char * str, size_t len, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(term.locked);
+    unsigned start, end;
+    size_t offset;
+    int newX;
+    if (!clipCursorRun(term, len, start, end, offset, newX)) return;
+    const size_t pos = (size_t)term.blinkY * term.width + start;
+    memcpy(term.screen.data() + pos, str + offset, end - start);
+    memset(term.colors.data() + pos, colors, end - start);
+    term.blinkX = newX;
+    term.changed = true;
+    if (traceEnabled) traceCells(term, start, term.blinkY, end - start);
+}
+
+void termBlit(Terminal& term, const char * str, const char * fg, const char * bg, size_t len, unsigned char& colors) {
+    std::lock_guard<std::mutex> lock(term.locked);
+    unsigned start, end;
+    size_t offset;
+    int newX;
+    if (!clipCursorRun(term, len, start, end, offset, newX)) return;
+    const size_t pos = (size_t)term.blinkY * term.width + start;
+    unsigned char * screen = term.screen.data() + pos;
+    unsigned char * cols = term.colors.data() + pos;
+    for (size_t i = offset; i < offset + (end - start); i++) {
+        colors = (unsigned char)(htoi(bg[i], 15) << 4) | htoi(fg[i], 0);
+        if (selectedRenderer == 4) {
+            TRoRTerminal::send(term.id, "TF", "%c", ("0123456789abcdef")[colors & 0xf]);
+            TRoRTerminal::send(term.id, "TK", "%c", ("0123456789abcdef")[colors >> 4]);
+            TRoRTerminal::send(term.id, "TW", "%c", str[i]);
+        }
+        *screen++ = str[i];
+        *cols++ = colors;
+    }
+    if (end > start) {
+        SDLTerminal * sdlterm = dynamic_cast<SDLTerminal*>(&term);
+        if (sdlterm != NULL) sdlterm->cursorColor = colors & 0x0f;
+    }
+    term.blinkX = newX;
+    term.changed = true;
+    if (traceEnabled) traceCells(term, start, term.blinkY, end - start);
+}
+
+void termScroll(Terminal& term, lua_Integer lines, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(term.locked);
+    const size_t size = (size_t)term.width * term.height;
+    if (lines > 0 ? (unsigned long long)lines >= term.height : (unsigned long long)-lines >= term.height) {
+        // scrolling more than the height is equivalent to clearing the screen
+        memset(term.screen.data(), ' ', size);
+        memset(term.colors.data(), colors, size);
+    } else if (lines > 0) {
+        const size_t off = (size_t)lines * term.width;
+        memmove(term.screen.data(), term.screen.data() + off, size - off);
+        memset(term.screen.data() + (size - off), ' ', off);
+        memmove(term.colors.data(), term.colors.data() + off, size - off);
+        memset(term.colors.data() + (size - off), colors, off);
+    } else if (lines < 0) {
+        const size_t off = (size_t)-lines * term.width;
+        memmove(term.screen.data() + off, term.screen.data(), size - off);
+        memset(term.screen.data(), ' ', off);
+        memmove(term.colors.data() + off, term.colors.data(), size - off);
+        memset(term.colors.data(), colors, off);
+    }
+    term.changed = true;
+    if (traceEnabled) traceScroll(term, lines, colors);
+}
+
+void termClear(Terminal& term, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(term.locked);
+    if (term.mode > 0) {
+        memset(term.pixels.data(), 0x0F, (size_t)term.width * Terminal::fontWidth * term.height * Terminal::fontHeight);
+    } else {
+        memset(term.screen.data(), ' ', (size_t)term.height * term.width);
+        memset(term.colors.data(), colors, (size_t)term.height * term.width);
+    }
+    term.changed = true;
+    if (traceEnabled) traceClear(term, colors);
+}
+
+void termClearLine(Terminal& term, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(term.locked);
+    if (term.blinkY < 0 || (unsigned)term.blinkY >= term.height) return;
+    memset(term.screen.data() + ((size_t)term.blinkY * term.width), ' ', term.width);
+    memset(term.colors.data() + ((size_t)term.blinkY * term.width), colors, term.width);
+    term.changed = true;
+    if (traceEnabled) traceClearLine(term, colors);
+}
+
+int termDrawPixels(lua_State *L, Terminal& term) {
+    const int pixelWidth = term.width * Terminal::fontWidth,
+              pixelHeight = term.height * Terminal::fontHeight;
+
+    const int init_x = (int)luaL_checkinteger(L, 1),
+              init_y = (int)luaL_checkinteger(L, 2);
+
+    if (init_x >= pixelWidth || init_y >= pixelHeight) return 0;
+
+    const int fillType = lua_type(L, 3);
+    const bool isSolidFill = fillType == LUA_TNUMBER;
+
+    if (!isSolidFill && fillType != LUA_TTABLE)
+        return luaL_typerror(L, 3, "table or number");
+
+    bool undefinedWidth;
+    unsigned width, height;
+    unsigned color = 0;
+
+    {
+        int width_, height_;
+        if (isSolidFill) {
+            undefinedWidth = false;
+            width_ = luaL_checkinteger(L, 4);
+            height_ = luaL_checkinteger(L, 5);
+        } else {
+            undefinedWidth = lua_isnoneornil(L, 4);
+            width_ = luaL_optinteger(L, 4, 0);
+            height_ = luaL_optinteger(L, 5, lua_objlen(L, 3));
+        }
+
+        if (width_ < 0)
+            return luaL_argerror(L, 4, "width cannot be negative");
+        else if (height_ < 0)
+            return luaL_argerror(L, 5, "height cannot be negative");
+
+        width = (unsigned) width_;
+        height = (unsigned) height_;
+    }
+
+    if (isSolidFill) {
+        int color_ = lua_tonumber(L, 3);
+
+        if (color_ < 0) return 0;
+        else if (term.mode == 2 ? color_ > 255 : log2i(color_) > 15)
+            return luaL_argerror(L, 3, "color index out of bounds");
+
+        color = (unsigned) color_;
+    }
+
+    std::lock_guard<std::mutex> lock(term.locked);
+    unsigned char * pixels = term.pixels.data();
+
+    if (isSolidFill) {
+        const unsigned char index = term.mode == 2
+            ? (unsigned char) color
+            : (unsigned char) log2i(color);
+
+        const unsigned memset_x = max((int)init_x, 0),
+                       memset_len = max(min((int) width, max(pixelWidth - init_x, 0)) + min((int)init_x, 0), 0);
+        if (memset_len == 0) return 0;
+
+        const int cool_height = min((int) height, pixelHeight - init_y);
+        for (int h = max(-init_y, 0); h < cool_height; h++)
+            memset(pixels + (size_t)(init_y + h) * pixelWidth + memset_x, index, memset_len);
+
+        term.changed = true;
+        if (traceEnabled && init_y + cool_height > max(init_y, 0))
+            tracePixels(term, memset_x, max(init_y, 0), memset_len, init_y + cool_height - max(init_y, 0));
+        return 0;
+    }
+
+    const size_t str_offset = init_x < 0 ? (size_t)-init_x : 0,
+                 str_maxlen = init_x > pixelWidth ? 0 : (size_t)(pixelWidth - init_x);
+
+    const int cool_height = min((int) height, pixelHeight - init_y);
+    for (int h = max(-init_y, 0); h < cool_height; h++) {
+        unsigned char * row = pixels + (size_t)(init_y + h) * pixelWidth;
+        lua_pushinteger(L, h + 1);
+        lua_gettable(L, 3);
+
+        if (lua_isstring(L, -1)) {
+            if (str_offset >= str_maxlen) {
+                lua_pop(L, 1);
+                continue;
+            }
+
+            size_t len;
+            const char *str = lua_tolstring(L, -1, &len);
+            if (len > str_maxlen) len = str_maxlen;
+            if (!undefinedWidth && width < len) len = width;
+
+            if (str_offset < len)
+                memcpy(row + init_x + str_offset, str + str_offset, len - str_offset);
+        } else if (lua_istable(L, -1)) {
+            const int cool_width = undefinedWidth
+                ? (int) min(lua_objlen(L, -1), (size_t) (max(pixelWidth - init_x, 0)))
+                : min((int) width, pixelWidth - init_x);
+
+            for (int w = max(-init_x, 0); w < cool_width; w++) {
+                lua_pushinteger(L, w + 1);
+                lua_gettable(L, -2);
+
+                if (lua_isnumber(L, -1)) {
+                    const int c = lua_tointeger(L, -1);
+                    if (c >= 0) row[init_x + w] = term.mode == 2 ? c : log2i(c);
+                }
+
+                lua_pop(L, 1);
+            }
+        }
+
+        lua_pop(L, 1);
+    }
+
+    term.changed = true;
+    if (traceEnabled && init_y + cool_height > max(init_y, 0))
+        tracePixels(term, 0, max(init_y, 0), pixelWidth, init_y + cool_height - max(init_y, 0));
+    return 0;
+}
+
+int termGetPixels(lua_State *L, Terminal& term) {
+    const int pixelWidth = term.width * Terminal::fontWidth,
+              pixelHeight = term.height * Terminal::fontHeight;
+
+    const int init_x = (int) luaL_checkinteger(L, 1),
+              init_y = (int) luaL_checkinteger(L, 2),
+              end_w = (int) luaL_checkinteger(L, 3),
+              end_h = (int) luaL_checkinteger(L, 4);
+
+    if (end_w < 0) return luaL_argerror(L, 3, "width cannot be negative");
+    else if (end_h < 0) return luaL_argerror(L, 4, "height cannot be negative");
+    else if (!lua_isnoneornil(L, 5) && !lua_isboolean(L, 5))
+        return luaL_typerror(L, 5, "boolean");
+
+    const bool use_strings = lua_toboolean(L, 5);
+    const unsigned char * pixels = term.pixels.data();
+
+    lua_createtable(L, end_h, 0);
+
+    const int cool_min_h = max(-init_y, 0);
+    const int cool_max_h = min(end_h, pixelHeight - init_y);
+    const int cool_min_w = max(-init_x, 0);
+    const int cool_max_w = min(end_w, pixelWidth - init_x);
+
+    // scratch space for drawing background color from
+    const std::string bg(end_w, (char)15);
+
+    for (int h = 0; h < end_h; h++) {
+        const bool rowVisible = h >= cool_min_h && h < cool_max_h && cool_min_w < cool_max_w;
+        const unsigned char * row = rowVisible ? pixels + (size_t)(init_y + h) * pixelWidth : NULL;
+
+        if (use_strings) {
+            if (!rowVisible) {
+                lua_pushlstring(L, bg.c_str(), end_w);
+            } else {
+                int concats = 1;
+
+                if (cool_min_w > 0) {
+                    lua_pushlstring(L, bg.c_str(), cool_min_w);
+                    concats++;
+                }
+
+                lua_pushlstring(L, (const char *) row + init_x + cool_min_w, cool_max_w - cool_min_w);
+
+                if (cool_max_w < end_w) {
+                    lua_pushlstring(L, bg.c_str(), end_w - cool_max_w);
+                    concats++;
+                }
+
+                lua_concat(L, concats);
+            }
+        } else {
+            lua_createtable(L, end_w, 0);
+
+            for (int w = 0; w < end_w; w++) {
+                if (!rowVisible || w < cool_min_w || w >= cool_max_w)
+                    lua_pushinteger(L, -1);
+                else if (term.mode == 2)
+                    lua_pushinteger(L, row[init_x + w]);
+                else
+                    lua_pushinteger(L, 1 << row[init_x + w]);
+
+                lua_rawseti(L, -2, w + 1);
+            }
+        }
+
+        lua_rawseti(L, -2, h + 1);
+    }
+
+    return 1;
+}
@@ -49,6 +49,13 @@ extern void termHook(lua_State *L, lua_Debug *ar);
 extern int termPanic(lua_State *L);
 extern monitor * findMonitorFromWindowID(Computer *comp, unsigned id, std::string* sideReturn);
 extern void displayFailure(Terminal * term, const std::string& message, const std::string& extra = "");
+extern void termWrite(Terminal& term, const char * str, size_t len, unsigned char colors);
+extern void termBlit(Terminal& term, const char * str, const char * fg, const char * bg, size_t len, unsigned char& colors);
+extern void termScroll(Terminal& term, lua_Integer lines, unsigned char colors);
+extern void termClear(Terminal& term, unsigned char colors);
+extern void termClearLine(Terminal& term, unsigned char colors);
+extern int termDrawPixels(lua_State *L, Terminal& term);
+extern int termGetPixels(lua_State *L, Terminal& term);
 
 inline bool checkWindowID(Computer * c, unsigned wid) {
     if (singleWindowMode) return c->term == *renderTarget || findMonitorFromWindowID(c, (*renderTarget)->id, NULL) != NULL;
@@ -0,0 +1,668 @@
+/*
+ * termtrace.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements terminal session traces, which log every change made
+ * to a terminal plus the input it received, and the replayer for them.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+/*
+ * Trace format
+ *
+ * A trace starts with the magic "CCTRACE" and a version byte (1), followed by
+ * records of the form
+ *
+ *   [type: u8] [time: v] [terminal ID: v] [payload]
+ *
+ * where time is the number of microseconds since the previous record. "v" is
+ * an unsigned LEB128 varint, and "s" is a zigzag-encoded signed varint.
+ *
+ *   0 SNAPSHOT   v width, v height, u8 mode, u8 canBlink, s blinkX, s blinkY,
+ *                u8 parts, then screen + colors if parts & 1, pixels if
+ *                parts & 2, then the palette (256 * RGB)
+ *   1 CELLS      v x, v y, v count, count chars, count colors, s blinkX
+ *   2 SCROLL     s lines, u8 colors
+ *   3 CLEAR      u8 colors
+ *   4 CLEARLINE  u8 colors
+ *   5 PIXELS     v x, v y, v width, v height, width * height pixels
+ *   6 PALETTE    u8 index, u8 r, u8 g, u8 b
+ *   7 MODE       u8 mode
+ *   8 CURSOR     s blinkX, s blinkY, u8 canBlink
+ *   9 EVENT      v name length, name, u8 argc, then per argument a u8 tag and
+ *                its value: 0 nil, 1 false, 2 true, 3 number (f64), 4 string
+ *                (v length, bytes)
+ *
+ * A terminal's first record is always a full SNAPSHOT. Resizes are written as
+ * full snapshots too, and a snapshot of the current mode's buffers is written
+ * every 30 seconds so that replays recover from changes made outside of the
+ * traced functions (e.g. the error screen).
+ */
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <configuration.hpp>
+#include "runtime.hpp"
+#include "termsupport.hpp"
+#include "termtrace.hpp"
+#ifndef NO_PNG
+#include <png++/png.hpp>
+#endif
+
+extern "C" {
+    struct font_image {
+        unsigned int 	 width;
+        unsigned int 	 height;
+        unsigned int 	 bytes_per_pixel; /* 2:RGB16, 3:RGB, 4:RGBA */
+        unsigned char	 pixel_data[128 * 175 * 2 + 1];
+    };
+    extern struct font_image font_image;
+}
+
+enum {
+    TRACE_SNAPSHOT,
+    TRACE_CELLS,
+    TRACE_SCROLL,
+    TRACE_CLEAR,
+    TRACE_CLEARLINE,
+    TRACE_PIXELS,
+    TRACE_PALETTE,
+    TRACE_MODE,
+    TRACE_CURSOR,
+    TRACE_EVENT
+};
+
+static const char traceMagic[8] = {'C', 'C', 'T', 'R', 'A', 'C', 'E', 1};
+static constexpr size_t traceFlushSize = 65536;
+static constexpr std::chrono::seconds traceKeyframeInterval(30);
+
+struct TracedTerminal {
+    unsigned width;
+    unsigned height;
+    std::chrono::steady_clock::time_point lastSnapshot;
+};
+
+std::atomic_bool traceEnabled(false);
+static std::mutex traceLock;
+static std::ofstream traceFile;
+static std::string traceBuffer;
+static std::chrono::steady_clock::time_point traceLastTime;
+static std::unordered_map<unsigned, TracedTerminal> tracedTerminals;
+static const std::unordered_set<std::string> tracedEvents = {
+    "key", "key_up", "char", "paste", "terminate", "mouse_click", "mouse_up", "mouse_drag", "mouse_scroll",
+    "mouse_move", "monitor_touch", "term_resize", "monitor_resize"
+};
+
+static void putByte(unsigned char c) {traceBuffer += (char)c;}
+static void putBytes(const unsigned char * data, size_t size) {traceBuffer.append((const char*)data, size);}
+
+static void putVarint(uint64_t n) {
+    while (n >= 0x80) {
+        traceBuffer += (char)(n | 0x80);
+        n >>= 7;
+    }
+    traceBuffer += (char)n;
+}
+
+static void putSigned(int64_t n) {putVarint(((uint64_t)n << 1) ^ (uint64_t)(n >> 63));}
+
+static void beginRecord(unsigned char type, unsigned id) {
+    const auto now = std::chrono::steady_clock::now();
+    putByte(type);
+    putVarint(std::chrono::duration_cast<std::chrono::microseconds>(now - traceLastTime).count());
+    putVarint(id);
+    traceLastTime = now;
+}
+
+static void endRecord() {
+    if (traceBuffer.size() >= traceFlushSize) {
+        traceFile.write(traceBuffer.data(), traceBuffer.size());
+        traceBuffer.clear();
+    }
+}
+
+static void writeSnapshot(Terminal& term, bool full) {
+    beginRecord(TRACE_SNAPSHOT, term.id);
+    putVarint(term.width);
+    putVarint(term.height);
+    putByte(term.mode);
+    putByte(term.canBlink);
+    putSigned(term.blinkX);
+    putSigned(term.blinkY);
+    const unsigned char parts = full ? 3 : (term.mode == 0 ? 1 : 2);
+    putByte(parts);
+    const size_t cells = (size_t)term.width * term.height;
+    if (parts & 1) {
+        putBytes(term.screen.data(), cells);
+        putBytes(term.colors.data(), cells);
+    }
+    if (parts & 2) putBytes(term.pixels.data(), cells * Terminal::fontWidth * Terminal::fontHeight);
+    for (int i = 0; i < 256; i++) {
+        putByte(term.palette[i].r);
+        putByte(term.palette[i].g);
+        putByte(term.palette[i].b);
+    }
+}
+
+// Writes a snapshot of a terminal if the replayer's copy may be out of date. The hooks run after
+// the change was made, so this returns true if the snapshot already includes it.
+static bool syncTerminal(Terminal& term) {
+    const auto now = std::chrono::steady_clock::now();
+    const auto it = tracedTerminals.find(term.id);
+    if (it == tracedTerminals.end() || it->second.width != term.width || it->second.height != term.height) {
+        writeSnapshot(term, true);
+        tracedTerminals[term.id] = {term.width, term.height, now};
+        return true;
+    } else if (now - it->second.lastSnapshot >= traceKeyframeInterval) {
+        writeSnapshot(term, false);
+        it->second.lastSnapshot = now;
+        return true;
+    }
+    return false;
+}
+
+static void beginTerminalRecord(Terminal& term, unsigned char type) {
+    syncTerminal(term);
+    beginRecord(type, term.id);
+}
+
+bool traceStart(const path_t& path) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (traceFile.is_open()) return false;
+    traceFile.open(path, std::ios::binary);
+    if (!traceFile.is_open()) return false;
+    traceFile.write(traceMagic, sizeof(traceMagic));
+    traceBuffer.reserve(traceFlushSize * 2);
+    traceLastTime = std::chrono::steady_clock::now();
+    traceEnabled = true;
+    return true;
+}
+
+void traceStop() {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    traceEnabled = false;
+    traceFile.write(traceBuffer.data(), traceBuffer.size());
+    traceFile.close();
+    traceBuffer.clear();
+    tracedTerminals.clear();
+}
+
+void traceCells(Terminal& term, unsigned x, unsigned y, unsigned count) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_CELLS);
+    putVarint(x);
+    putVarint(y);
+    putVarint(count);
+    const size_t pos = (size_t)y * term.width + x;
+    putBytes(term.screen.data() + pos, count);
+    putBytes(term.colors.data() + pos, count);
+    putSigned(term.blinkX);
+    endRecord();
+}
+
+void traceScroll(Terminal& term, lua_Integer lines, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    if (syncTerminal(term)) {
+        endRecord();
+        return; // scrolling isn't idempotent like the other records, so it can't be applied twice
+    }
+    beginRecord(TRACE_SCROLL, term.id);
+    putSigned(lines);
+    putByte(colors);
+    endRecord();
+}
+
+void traceClear(Terminal& term, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_CLEAR);
+    putByte(colors);
+    endRecord();
+}
+
+void traceClearLine(Terminal& term, unsigned char colors) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_CLEARLINE);
+    putByte(colors);
+    endRecord();
+}
+
+void tracePixels(Terminal& term, unsigned x, unsigned y, unsigned w, unsigned h) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_PIXELS);
+    putVarint(x);
+    putVarint(y);
+    putVarint(w);
+    putVarint(h);
+    const size_t pitch = (size_t)term.width * Terminal::fontWidth;
+    for (unsigned i = 0; i < h; i++) putBytes(term.pixels.data() + (y + i) * pitch + x, w);
+    endRecord();
+}
+
+void tracePalette(Terminal& term, unsigned index) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_PALETTE);
+    putByte(index);
+    putByte(term.palette[index].r);
+    putByte(term.palette[index].g);
+    putByte(term.palette[index].b);
+    endRecord();
+}
+
+void traceMode(Terminal& term) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_MODE);
+    putByte(term.mode);
+    endRecord();
+}
+
+void traceCursor(Terminal& term) {
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginTerminalRecord(term, TRACE_CURSOR);
+    putSigned(term.blinkX);
+    putSigned(term.blinkY);
+    putByte(term.canBlink);
+    endRecord();
+}
+
+void traceEvent(Terminal& term, const std::string& name, lua_State *param) {
+    if (tracedEvents.find(name) == tracedEvents.end()) return;
+    std::lock_guard<std::mutex> lock(traceLock);
+    if (!traceFile.is_open()) return;
+    beginRecord(TRACE_EVENT, term.id);
+    putVarint(name.size());
+    putBytes((const unsigned char*)name.c_str(), name.size());
+    const int argc = lua_gettop(param) > 255 ? 255 : lua_gettop(param);
+    putByte(argc);
+    for (int i = 1; i <= argc; i++) {
+        switch (lua_type(param, i)) {
+            case LUA_TBOOLEAN: putByte(lua_toboolean(param, i) ? 2 : 1); break;
+            case LUA_TNUMBER: {
+                const double n = lua_tonumber(param, i);
+                putByte(3);
+                putBytes((const unsigned char*)&n, sizeof(n));
+                break;
+            } case LUA_TSTRING: {
+                size_t len = 0;
+                const char * str = lua_tolstring(param, i, &len);
+                putByte(4);
+                putVarint(len);
+                putBytes((const unsigned char*)str, len);
+                break;
+            } default: putByte(0); break;
+        }
+    }
+    endRecord();
+}
+
+class TraceReader {
+public:
+    const unsigned char * ptr;
+    const unsigned char * end;
+    bool ok = true;
+    TraceReader(const std::string& data): ptr((const unsigned char*)data.data()), end(ptr + data.size()) {}
+    unsigned char byte() {
+        if (ptr >= end) {
+            ok = false;
+            return 0;
+        }
+        return *ptr++;
+    }
+    uint64_t varint() {
+        uint64_t n = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const unsigned char b = byte();
+            n |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return n;
+        }
+        ok = false;
+        return 0;
+    }
+    int64_t svarint() {
+        const uint64_t n = varint();
+        return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+    }
+    const unsigned char * bytes(size_t size) {
+        if ((size_t)(end - ptr) < size) {
+            ok = false;
+            ptr = end;
+            return NULL;
+        }
+        const unsigned char * retval = ptr;
+        ptr += size;
+        return retval;
+    }
+};
+
+// Reads a trace and applies every record to the terminals returned by getTerminal, which is called
+// with the size of each snapshot and may return NULL to skip a terminal. beforeRecord is called
+// with the time of each record in microseconds, and stops the replay if it returns false.
+static int replayTrace(const path_t& path, const std::function<Terminal*(unsigned, unsigned, unsigned)>& getTerminal, const std::function<bool(uint64_t)>& beforeRecord) {
+    std::string data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) {
+            fprintf(stderr, "Could not open trace file %s\n", path.string().c_str());
+            return 1;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        data = ss.str();
+    }
+    if (data.size() < sizeof(traceMagic) || memcmp(data.data(), traceMagic, sizeof(traceMagic)) != 0) {
+        fprintf(stderr, "%s is not a CraftOS-PC trace file\n", path.string().c_str());
+        return 1;
+    }
+    TraceReader r(data);
+    r.bytes(sizeof(traceMagic));
+    std::unordered_map<unsigned, Terminal*> terminals;
+    uint64_t time = 0;
+    size_t records = 0;
+    while (r.ptr < r.end) {
+        const unsigned char type = r.byte();
+        time += r.varint();
+        const unsigned id = (unsigned)r.varint();
+        if (!r.ok || !beforeRecord(time)) break;
+        const auto it = terminals.find(id);
+        Terminal * term = it == terminals.end() ? NULL : it->second;
+        switch (type) {
+        case TRACE_SNAPSHOT: {
+            const unsigned w = (unsigned)r.varint(), h = (unsigned)r.varint();
+            const int mode = r.byte();
+            const bool canBlink = r.byte();
+            const int blinkX = (int)r.svarint(), blinkY = (int)r.svarint();
+            const unsigned char parts = r.byte();
+            if (w == 0 || h == 0 || w > 0xFFFF || h > 0xFFFF) {
+                r.ok = false;
+                break;
+            }
+            const size_t cells = (size_t)w * h;
+            const unsigned char * screen = NULL, * colors = NULL, * pixels = NULL;
+            if (parts & 1) {
+                screen = r.bytes(cells);
+                colors = r.bytes(cells);
+            }
+            if (parts & 2) pixels = r.bytes(cells * Terminal::fontWidth * Terminal::fontHeight);
+            const unsigned char * palette = r.bytes(768);
+            if (!r.ok) break;
+            term = terminals[id] = getTerminal(id, w, h);
+            if (term == NULL) break;
+            std::lock_guard<std::mutex> lock(term->locked);
+            if (term->width != w || term->height != h) break; // the renderer refused the resize
+            term->mode = mode;
+            term->canBlink = canBlink;
+            term->blinkX = blinkX;
+            term->blinkY = blinkY;
+            if (screen) {
+                memcpy(term->screen.data(), screen, cells);
+                memcpy(term->colors.data(), colors, cells);
+            }
+            if (pixels) memcpy(term->pixels.data(), pixels, cells * Terminal::fontWidth * Terminal::fontHeight);
+            for (int i = 0; i < 256; i++) term->palette[i] = {palette[i*3], palette[i*3+1], palette[i*3+2]};
+            term->changed = true;
+            break;
+        } case TRACE_CELLS: {
+            const unsigned x = (unsigned)r.varint(), y = (unsigned)r.varint(), count = (unsigned)r.varint();
+            const unsigned char * screen = r.bytes(count), * colors = r.bytes(count);
+            const int blinkX = (int)r.svarint();
+            if (!r.ok || term == NULL) break;
+            std::lock_guard<std::mutex> lock(term->locked);
+            if (y >= term->height || count > term->width || x > term->width - count) break;
+            memcpy(term->screen.data() + (size_t)y * term->width + x, screen, count);
+            memcpy(term->colors.data() + (size_t)y * term->width + x, colors, count);
+            term->blinkX = blinkX;
+            term->changed = true;
+            break;
+        } case TRACE_SCROLL: {
+            const lua_Integer lines = (lua_Integer)r.svarint();
+            const unsigned char colors = r.byte();
+            if (r.ok && term != NULL) termScroll(*term, lines, colors);
+            break;
+        } case TRACE_CLEAR: {
+            const unsigned char colors = r.byte();
+            if (r.ok && term != NULL) termClear(*term, colors);
+            break;
+        } case TRACE_CLEARLINE: {
+            const unsigned char colors = r.byte();
+            if (r.ok && term != NULL) termClearLine(*term, colors);
+            break;
+        } case TRACE_PIXELS: {
+            const unsigned x = (unsigned)r.varint(), y = (unsigned)r.varint(), w = (unsigned)r.varint(), h = (unsigned)r.varint();
+            if (w > 0xFFFFF || h > 0xFFFFF) {
+                r.ok = false;
+                break;
+            }
+            const unsigned char * pixels = r.bytes((size_t)w * h);
+            if (!r.ok || term == NULL) break;
+            std::lock_guard<std::mutex> lock(term->locked);
+            const unsigned pw = term->width * Terminal::fontWidth, ph = term->height * Terminal::fontHeight;
+            if (w > pw || x > pw - w || h > ph || y > ph - h) break;
+            for (unsigned i = 0; i < h; i++) memcpy(term->pixels.data() + (size_t)(y + i) * pw + x, pixels + (size_t)i * w, w);
+            term->changed = true;
+            break;
+        } case TRACE_PALETTE: {
+            const unsigned char index = r.byte(), red = r.byte(), green = r.byte(), blue = r.byte();
+            if (!r.ok || term == NULL) break;
+            std::lock_guard<std::mutex> lock(term->locked);
+            term->palette[index] = {red, green, blue};
+            term->changed = true;
+            break;
+        } case TRACE_MODE: {
+            const unsigned char mode = r.byte();
+            if (!r.ok || term == NULL) break;
+            std::lock_guard<std::mutex> lock(term->locked);
+            term->mode = mode > 2 ? 0 : mode;
+            term->changed = true;
+            break;
+        } case TRACE_CURSOR: {
+            const int blinkX = (int)r.svarint(), blinkY = (int)r.svarint();
+            const bool canBlink = r.byte();
+            if (!r.ok || term == NULL) break;
+            std::lock_guard<std::mutex> lock(term->locked);
+            term->blinkX = blinkX;
+            term->blinkY = blinkY;
+            term->canBlink = canBlink;
+            term->changed = true;
+            break;
+        } case TRACE_EVENT: {
+            // events are only kept for inspection; replaying them would need the original computer
+            r.bytes((size_t)r.varint());
+            const unsigned char argc = r.byte();
+            for (int i = 0; i < argc && r.ok; i++) {
+                const unsigned char tag = r.byte();
+                if (tag == 3) r.bytes(sizeof(double));
+                else if (tag == 4) r.bytes((size_t)r.varint());
+            }
+            break;
+        } default:
+            r.ok = false;
+            break;
+        }
+        if (!r.ok) break;
+        records++;
+    }
+    if (!r.ok) fprintf(stderr, "Trace is truncated or corrupt after %zu records\n", records);
+    return 0;
+}
+
+int traceReplay(const path_t& path, double speed) {
+    std::unordered_map<unsigned, Terminal*> terminals;
+    const auto start = std::chrono::steady_clock::now();
+    const int retval = replayTrace(path, [&terminals](unsigned id, unsigned w, unsigned h) -> Terminal* {
+        Terminal * term;
+        if (terminals.find(id) == terminals.end()) {
+            std::string title = "CraftOS-PC Replay: Terminal " + std::to_string(id);
+            term = terminals[id] = (Terminal*)queueTask([](void* t)->void*{return createTerminal(*(std::string*)t);}, &title);
+        } else term = terminals[id];
+        if (term == NULL) return NULL;
+        if (term->width != w || term->height != h) term->resize(w, h);
+        return term;
+    }, [start, speed](uint64_t time) -> bool {
+        if (speed > 0) std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t)(time / speed)));
+        return !exiting;
+    });
+    queueTask([&terminals](void*)->void*{
+        for (auto t : terminals) if (t.second) t.second->factory->deleteTerminal(t.second);
+        return NULL;
+    }, NULL);
+    return retval;
+}
+
+// Terminal that only holds buffers, used for rendering traces to images.
+class TraceImageTerminal: public Terminal {
+public:
+    TraceImageTerminal(unsigned w, unsigned h): Terminal(w, h) {}
+    void render() override {}
+    void showMessage(uint32_t flags, const char * title, const char * message) override {}
+    void setLabel(std::string label) override {}
+    bool resize(unsigned w, unsigned h) override {
+        screen.resize(w, h, ' ');
+        colors.resize(w, h, 0xF0);
+        pixels.resize(w * fontWidth, h * fontHeight, 0x0F);
+        width = w;
+        height = h;
+        return true;
+    }
+    void onActivate() override {}
+};
+
+// One bitmask per glyph row, read from the built-in font (bit x is set if column x is lit).
+static const struct glyph_table_t {
+    unsigned char rows[256][Terminal::fontHeight];
+    glyph_table_t() {
+        for (int c = 0; c < 256; c++) {
+            const unsigned ox = (Terminal::fontWidth + 2) * (c & 0x0F) + 1, oy = (Terminal::fontHeight + 2) * (c >> 4) + 1;
+            for (unsigned y = 0; y < Terminal::fontHeight; y++) {
+                rows[c][y] = 0;
+                for (unsigned x = 0; x < Terminal::fontWidth; x++) {
+                    const size_t off = ((size_t)(oy + y) * font_image.width + ox + x) * font_image.bytes_per_pixel;
+                    if (font_image.pixel_data[off] || font_image.pixel_data[off+1]) rows[c][y] |= 1 << x;
+                }
+            }
+        }
+    }
+} glyphTable;
+
+// Draws a terminal at 1x scale with the same 2 pixel border as the GUI renderers.
+static void rasterize(Terminal& term, std::vector<unsigned char>& image, unsigned& width, unsigned& height) {
+    width = term.width * Terminal::fontWidth + 4;
+    height = term.height * Terminal::fontHeight + 4;
+    image.resize((size_t)width * height * 3);
+    const Color border = term.mode == 0 ? term.palette[15] : defaultPalette[15];
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        image[i*3] = border.r;
+        image[i*3+1] = border.g;
+        image[i*3+2] = border.b;
+    }
+    auto put = [&image, width](unsigned x, unsigned y, const Color& c) {
+        unsigned char * p = &image[((size_t)(y + 2) * width + x + 2) * 3];
+        p[0] = c.r;
+        p[1] = c.g;
+        p[2] = c.b;
+    };
+    if (term.mode == 0) {
+        for (unsigned cy = 0; cy < term.height; cy++) {
+            for (unsigned cx = 0; cx < term.width; cx++) {
+                const size_t pos = (size_t)cy * term.width + cx;
+                const unsigned char * glyph = glyphTable.rows[term.screen.data()[pos]];
+                const unsigned char color = term.colors.data()[pos];
+                const bool cursor = term.canBlink && term.blinkX == (int)cx && term.blinkY == (int)cy;
+                for (unsigned y = 0; y < Terminal::fontHeight; y++) {
+                    const unsigned char bits = glyph[y] | (cursor ? glyphTable.rows['_'][y] : 0);
+                    for (unsigned x = 0; x < Terminal::fontWidth; x++)
+                        put(cx * Terminal::fontWidth + x, cy * Terminal::fontHeight + y, term.palette[bits & (1 << x) ? color & 0x0F : color >> 4]);
+                }
+            }
+        }
+    } else {
+        const unsigned pw = term.width * Terminal::fontWidth, ph = term.height * Terminal::fontHeight;
+        const unsigned char * pixels = term.pixels.data();
+        for (unsigned y = 0; y < ph; y++)
+            for (unsigned x = 0; x < pw; x++)
+                put(x, y, term.palette[pixels[(size_t)y * pw + x]]);
+    }
+}
+
+static void writeImage(const path_t& path, const std::vector<unsigned char>& image, unsigned width, unsigned height) {
+#ifndef NO_PNG
+    png::solid_pixel_buffer<png::rgb_pixel> pixbuf(width, height);
+    memcpy((void*)&pixbuf.get_bytes()[0], image.data(), image.size());
+    png::image<png::rgb_pixel, png::solid_pixel_buffer<png::rgb_pixel> > img(width, height);
+    img.set_pixbuf(pixbuf);
+    std::ofstream out(path, std::ios::binary);
+    img.write_stream(out);
+    out.close();
+#else
+    SDL_Surface * surf = SDL_CreateRGBSurfaceWithFormatFrom((void*)image.data(), (int)width, (int)height, 24, (int)width * 3, SDL_PIXELFORMAT_RGB24);
+    if (surf == NULL) return;
+    SDL_SaveBMP(surf, path.string().c_str());
+    SDL_FreeSurface(surf);
+#endif
+}
+
+int traceReplayToImages(const path_t& path, const path_t& dir) {
+    std::error_code e;
+    fs::create_directories(dir, e);
+    if (e) {
+        fprintf(stderr, "Could not create %s: %s\n", dir.string().c_str(), e.message().c_str());
+        return 1;
+    }
+    std::unordered_map<unsigned, std::unique_ptr<TraceImageTerminal>> terminals;
+    const uint64_t interval = 1000000 / (config.recordingFPS > 0 ? config.recordingFPS : 10);
+    uint64_t nextFrame = 0, lastTime = 0;
+    size_t frames = 0;
+    std::vector<unsigned char> image;
+    auto writeFrames = [&](uint64_t time) {
+        for (auto& t : terminals) {
+            if (!t.second->changed) continue;
+            unsigned width, height;
+            rasterize(*t.second, image, width, height);
+            char name[48];
+            snprintf(name, 48, "term%u_%010llu.%s", t.first, (unsigned long long)(time / 1000),
+#ifndef NO_PNG
+                "png"
+#else
+                "bmp"
+#endif
+            );
+            writeImage(dir / name, image, width, height);
+            t.second->changed = false;
+            frames++;
+        }
+    };
+    const auto start = std::chrono::steady_clock::now();
+    const int retval = replayTrace(path, [&terminals](unsigned id, unsigned w, unsigned h) -> Terminal* {
+        std::unique_ptr<TraceImageTerminal>& term = terminals[id];
+        if (!term) term.reset(new TraceImageTerminal(w, h));
+        else if (term->width != w || term->height != h) term->resize(w, h);
+        return term.get();
+    }, [&](uint64_t time) -> bool {
+        // a frame shows the state just before the first record past its timestamp
+        if (time >= nextFrame) {
+            writeFrames(lastTime);
+            nextFrame = time - time % interval + interval;
+        }
+        lastTime = time;
+        return true;
+    });
+    writeFrames(lastTime);
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Wrote %zu frames covering %.1f s of trace in %.2f s\n", frames, lastTime / 1000000.0, secs);
+    return retval;
+}
@@ -0,0 +1,41 @@
+/*
+ * termtrace.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the functions that record terminal sessions to trace files
+ * and replay them.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef TERMTRACE_HPP
+#define TERMTRACE_HPP
+#include <atomic>
+#include "util.hpp"
+
+// Whether a trace is being recorded. The hooks below must only be called when
+// this is set, and with term.locked held.
+extern std::atomic_bool traceEnabled;
+
+extern bool traceStart(const path_t& path);
+extern void traceStop();
+extern void traceCells(Terminal& term, unsigned x, unsigned y, unsigned count);
+extern void traceScroll(Terminal& term, lua_Integer lines, unsigned char colors);
+extern void traceClear(Terminal& term, unsigned char colors);
+extern void traceClearLine(Terminal& term, unsigned char colors);
+extern void tracePixels(Terminal& term, unsigned x, unsigned y, unsigned w, unsigned h);
+extern void tracePalette(Terminal& term, unsigned index);
+extern void traceMode(Terminal& term);
+extern void traceCursor(Terminal& term);
+// This one doesn't need the terminal lock; param holds the event's arguments.
+extern void traceEvent(Terminal& term, const std::string& name, lua_State *param);
+
+// Plays a trace back into terminals from the current renderer. speed scales
+// the original timing; 0 plays it as fast as possible.
+extern int traceReplay(const path_t& path, double speed);
+// Renders a trace to one image per changed terminal per frame (at the
+// recording FPS) without opening any windows.
+extern int traceReplayToImages(const path_t& path, const path_t& dir);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * unicode.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the functions that convert text between UTF-8 and the
+ * 8-bit character set computers use.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "unicode.hpp"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+
+// Returns how many bytes at the start of str are ASCII.
+static size_t asciiLength(const char * str, size_t len) {
+    size_t i = 0;
+#if defined(HAVE_SSE2)
+    for (; i + 16 <= len; i += 16)
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(str + i))) != 0) break;
+#elif defined(HAVE_NEON)
+    for (; i + 16 <= len; i += 16)
+        if (vmaxvq_u8(vld1q_u8((const uint8_t*)str + i)) >= 0x80) break;
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, str + i, 8);
+        if (word & 0x8080808080808080ULL) break;
+    }
+    while (i < len && (unsigned char)str[i] < 0x80) i++;
+    return i;
+}
+
+// Decodes the multi-byte sequence at the start of str, returning its length,
+// 0 if it's invalid, or -1 if the text ends before the sequence does. This
+// follows std::codecvt_utf8_utf16 exactly: overlong forms and anything past
+// U+10FFFF are invalid, surrogates aren't, and a short sequence at the end is
+// only checked for its lead byte.
+static int decodeUTF8(const unsigned char * str, size_t len, uint32_t& codepoint) {
+    int n;
+    unsigned char min = 0x80, max = 0xBF; // the range of the second byte
+    if (str[0] < 0xC2) return 0;
+    else if (str[0] < 0xE0) {n = 2; codepoint = str[0] & 0x1F;}
+    else if (str[0] < 0xF0) {n = 3; codepoint = str[0] & 0x0F; if (str[0] == 0xE0) min = 0xA0;}
+    else if (str[0] < 0xF5) {
+        n = 4;
+        codepoint = str[0] & 0x07;
+        if (str[0] == 0xF0) min = 0x90;
+        else if (str[0] == 0xF4) max = 0x8F;
+    } else return 0;
+    if (len < (size_t)n) return -1;
+    if (str[1] < min || str[1] > max) return 0;
+    for (int i = 1; i < n; i++) {
+        if ((str[i] & 0xC0) != 0x80) return 0;
+        codepoint = (codepoint << 6) | (str[i] & 0x3F);
+    }
+    return n;
+}
+
+std::string makeASCIISafe(const char * retval, size_t len) {
+    size_t i = asciiLength(retval, len);
+    if (i == len) return std::string(retval, len);
+    const unsigned char * str = (const unsigned char*)retval;
+    // the output is never longer than the input
+    std::string out(retval, len);
+    char * o = &out[i];
+    while (i < len) {
+        const unsigned char c = str[i];
+        if (c < 0x80) {
+            *o++ = c;
+            i++;
+            // skip through long ASCII runs in bulk
+            uint64_t word;
+            if (i + 8 <= len && (memcpy(&word, str + i, 8), (word & 0x8080808080808080ULL) == 0)) {
+                const size_t n = asciiLength(retval + i, len - i);
+                memmove(o, retval + i, n);
+                o += n;
+                i += n;
+            }
+            continue;
+        } else if (c >= 0xC2 && c < 0xE0 && i + 1 < len && (str[i+1] & 0xC0) == 0x80) {
+            // two-byte sequences (which include all of Latin-1) are by far the most common
+            *o++ = c < 0xC4 ? (char)(((c & 0x1F) << 6) | (str[i+1] & 0x3F)) : '?';
+            i += 2;
+            continue;
+        }
+        uint32_t codepoint;
+        const int n = decodeUTF8(str + i, len - i, codepoint);
+        if (n < 0) break; // a sequence cut off at the end is dropped
+        else if (n == 0) {
+            fprintf(stderr, "fs_handle_readAll: Error decoding UTF-8: invalid sequence at byte %zu\n", i);
+            out.assign(retval, len);
+            for (char& ch : out) if ((unsigned char)ch >= 0x80) ch = '?';
+            return out;
+        }
+        if (codepoint < 0x100) *o++ = (char)codepoint;
+        else if (codepoint < 0x10000) *o++ = '?';
+        else {
+            // was a surrogate pair in UTF-16
+            *o++ = '?';
+            *o++ = '?';
+        }
+        i += n;
+    }
+    out.resize(o - out.data());
+    return out;
+}
+
+bool isASCII(const char * str, size_t len) {
+    return asciiLength(str, len) == len;
+}
+
+std::string latin1ToUTF8(const char * str, size_t len) {
+    size_t i = asciiLength(str, len);
+    if (i == len) return std::string(str, len);
+    // the output is never more than twice as long as the input
+    std::string out(len * 2, '\0');
+    memcpy(&out[0], str, i);
+    char * o = &out[i];
+    for (; i < len; i++) {
+        const unsigned char c = str[i];
+        if (c < 0x80) *o++ = c;
+        else {
+            *o++ = (char)(0xC0 | (c >> 6));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    out.resize(o - out.data());
+    return out;
+}
@@ -0,0 +1,28 @@
+/*
+ * unicode.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the functions that convert text between UTF-8 and the
+ * 8-bit character set computers use.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef UNICODE_HPP
+#define UNICODE_HPP
+#include <cstddef>
+#include <string>
+
+// Decodes UTF-8 text into 8-bit characters, replacing anything past U+00FF
+// with '?' (twice for characters outside the BMP). If the text isn't valid
+// UTF-8, every non-ASCII byte is replaced instead.
+extern std::string makeASCIISafe(const char * retval, size_t len);
+
+// Returns whether the text is plain ASCII, which is the same in both encodings.
+extern bool isASCII(const char * str, size_t len);
+
+// Encodes 8-bit characters as UTF-8.
+extern std::string latin1ToUTF8(const char * str, size_t len);
+
+#endif
@@ -9,13 +9,17 @@
  */
 
 #include <atomic>
+#include <memory>
 #include <sstream>
+#include <tuple>
 #include <Computer.hpp>
 #include <dirent.h>
 #include <Poco/Base64Decoder.h>
 #include <Poco/Base64Encoder.h>
 #include <sys/stat.h>
 #include <FileEntry.hpp>
+#include "diskimage.hpp"
+#include "overlay.hpp"
 #include "platform.hpp"
 #include "runtime.hpp"
 #include "terminal/SDLTerminal.hpp"
@@ -153,29 +157,26 @@ path_t fixpath_mkdir(Computer * comp, const std::string& path, bool md, std::str
     if (!md) return maxPath;
     for (const std::string& s : append) maxPath /= s;
     std::error_code e;
-    fs::create_directories(maxPath, e);
+    std::string rel;
+    const std::shared_ptr<DiskImage> image = findDiskImage(comp, maxPath, &rel);
+    if (image != NULL) image->makeDir(rel, e);
+    else fs::create_directories(maxPath, e);
     if (e) return path_t();
     return fixpath(comp, path, false, true, mountPath);
 }
 
-static bool _nothrow(std::function<void()> f) { try { f(); return true; } catch (...) { return false; } }
-#define nothrow(expr) _nothrow([&](){ expr ;})
-
-inline bool isVFSPath(path_t path) {
-    if (!std::isdigit(path.native()[0])) return false;
-    for (const path_t::value_type& c : path.native()) {
-        if (c == ':') return true;
-        else if (!std::isdigit(c)) return false;
-    }
-    return false;
+inline bool isVFSPath(const path_t& path) {
+    return FileEntry::hasMountID(path.native());
 }
 
-path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt, std::string * mountPath, bool * isRoot) {
+// Splits a computer path into components, cleaning up each one the same way
+// CraftOS does. Returns false if the path goes above the root and dotdot isn't
+// set; otherwise leading ".."s are kept.
+static bool splitPath(const std::string& path, std::list<std::string>& pathc, bool dotdot) {
     std::vector<std::string> elems = split(path, "/\\");
-    std::list<std::string> pathc;
     for (std::string s : elems) {
         if (s == "..") {
-            if (pathc.empty() && addExt) return path_t();
+            if (pathc.empty() && !dotdot) return false;
             else if (pathc.empty()) pathc.push_back("..");
             else pathc.pop_back();
         } else if (!s.empty() && s.find_first_not_of(' ') != std::string::npos && !std::all_of(s.begin(), s.end(), [](const char c)->bool{return c == '.';})) {
@@ -191,38 +192,338 @@ path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt
         s = s.substr(0, s.find_last_not_of(' '));
         pathc.push_back(s);
     }
-    if (comp->isDebugger && addExt && pathc.size() == 1 && pathc.front() == "bios.lua")
-#ifdef STANDALONE_ROM
-        return path_t(":bios.lua", path_t::format::generic_format);
-#else
-        return getROMPath()/"bios.lua";
-#endif
+    return true;
+}
+
+/*
+ * Almost every filesystem call goes through fixpath, so instead of comparing
+ * the path against every mount on the computer, mounts are indexed by path
+ * component in a trie, and the last few paths resolved against it are kept in
+ * an LRU cache. Only the mount lookup is cached - whether the file exists is
+ * still checked on every call. The index is rebuilt on the next lookup after
+ * invalidateMountCache is called, which anything that changes comp->mounts
+ * must do (a changed mount count is caught as well, for plugins).
+ */
+
+static constexpr size_t mountCacheSize = 256;
+
+struct MountNode {
+    std::unordered_map<std::string, std::unique_ptr<MountNode> > children;
+    std::vector<size_t> mounts; // Indexes into comp->mounts of the mounts on this node, in mount order
+    std::vector<std::shared_ptr<const Overlay> > overlays; // The overlay each of those mounts is (or NULL), if the computer has any
+    std::vector<std::shared_ptr<DiskImage> > images;       // The disk image each of those mounts is (or NULL), if the computer has any
+};
+
+struct ResolvedPath {
+    bool valid = true;                 // Whether the path stays inside the root
+    std::list<std::string> components; // The cleaned-up path components
+    size_t depth = 0;                  // The number of components that make up the mount point
+    std::vector<_path_t> realPaths;    // The real paths mounted there (the data directory is left out at the root)
+    std::string mountPath;             // The mount point, or "hdd" for the root
+    bool readOnly = false;             // Whether the first mount there is read-only
+    std::vector<std::shared_ptr<const Overlay> > overlays; // The overlay on each real path (or NULL), with the data directory's first at the root
+    std::vector<std::shared_ptr<DiskImage> > images;       // The disk image each real path is (or NULL), in the same order
+};
+
+struct MountIndex {
+    std::mutex lock;
+    MountNode root;
+    size_t mountCount = 0;
+    bool stale = true;
+    std::list<std::pair<std::string, std::shared_ptr<const ResolvedPath> > > lru;
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::shared_ptr<const ResolvedPath> > >::iterator> cache;
+    std::unordered_map<unsigned, std::tuple<const FileEntry*, unsigned, std::shared_ptr<const VirtualFS> > > virtualFS; // Indexes of the virtual mounts, with the tree and generation each was built for
+    std::unordered_map<path_t::string_type, std::shared_ptr<const Overlay> > overlays; // Each overlay, by the real path of its upper and of its lower directory
+    std::unordered_map<path_t::string_type, std::shared_ptr<DiskImage> > images;       // Each disk image, by the real path it's mounted from
+    std::shared_ptr<const Overlay> dataOverlay; // The overlay the data directory is, if any
+    std::shared_ptr<DiskImage> dataImage;       // The disk image the data directory is, if any
+    std::atomic<bool> hasKinds {false}; // Whether there are any overlays or images, so computers without them can skip looking
+};
+
+static MountIndex * getMountIndex(Computer * comp) {
+    // the first mount (the ROM) is added in the constructor, so this is created before any other thread sees the computer
+    if (!comp->mountIndex) comp->mountIndex = std::make_shared<MountIndex>();
+    return (MountIndex*)comp->mountIndex.get();
+}
+
+// Must be called with the index locked.
+static std::shared_ptr<const Overlay> overlayAt(const MountIndex * index, const path_t& upper);
+static std::shared_ptr<DiskImage> imageAt(const MountIndex * index, const path_t& path);
+
+// Must be called with the index locked.
+static void updateMountIndex(Computer * comp, MountIndex * index) {
+    if (!index->stale && index->mountCount == comp->mounts.size()) return;
+    index->root = MountNode();
+    for (size_t i = 0; i < comp->mounts.size(); i++) {
+        MountNode * node = &index->root;
+        for (const std::string& s : std::get<0>(comp->mounts[i])) {
+            std::unique_ptr<MountNode>& child = node->children[s];
+            if (!child) child = std::make_unique<MountNode>();
+            node = child.get();
+        }
+        node->mounts.push_back(i);
+        // what each mount is is worked out here, so resolving a path doesn't have to look
+        if (!index->overlays.empty()) node->overlays.push_back(overlayAt(index, std::get<1>(comp->mounts[i])));
+        if (!index->images.empty()) node->images.push_back(imageAt(index, std::get<1>(comp->mounts[i])));
+    }
+    index->dataOverlay = overlayAt(index, comp->dataDir);
+    index->dataImage = imageAt(index, comp->dataDir);
+    index->mountCount = comp->mounts.size();
+    index->lru.clear();
+    index->cache.clear();
+    index->stale = false;
+}
+
+// Finds the deepest node along pathc that has anything mounted on it, or the root.
+static const MountNode * findMountNode(const MountIndex * index, const std::list<std::string>& pathc, size_t& depth) {
+    const MountNode * node = &index->root, * found = &index->root;
+    size_t d = 0;
+    depth = 0;
+    for (const std::string& s : pathc) {
+        const auto it = node->children.find(s);
+        if (it == node->children.end()) break;
+        node = it->second.get();
+        d++;
+        if (!node->mounts.empty()) {
+            found = node;
+            depth = d;
+        }
+    }
+    return found;
+}
+
+// Returns the key a real path has in MountIndex::overlays and images. It's built a component at a
+// time, the same way findInside builds each of a path's parents, so the two always match.
+static path_t::string_type mountKey(const path_t& path) {
+    path_t key;
+    for (const path_t& c : path) key /= c;
+    return key.native();
+}
+
+// Finds the entry for the first of a path's parents (or the path itself) that's in a map of real
+// paths, and sets rest to the components after it. Must be called with the index locked.
+template<typename T>
+static T findInside(const std::unordered_map<path_t::string_type, T>& map, const path_t& path, std::vector<path_t>& rest) {
+    path_t prefix;
+    for (auto it = path.begin(); it != path.end(); ++it) {
+        prefix /= *it;
+        const auto found = map.find(prefix.native());
+        if (found == map.end()) continue;
+        rest.assign(std::next(it), path.end());
+        return found->second;
+    }
+    return NULL;
+}
+
+// Must be called with the index locked.
+static std::shared_ptr<const Overlay> overlayAt(const MountIndex * index, const path_t& upper) {
+    const auto it = index->overlays.find(mountKey(upper));
+    return it != index->overlays.end() && it->second->upper == upper ? it->second : NULL;
+}
+
+void addOverlay(Computer * comp, const path_t& upper, const path_t& lower) {
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    const std::shared_ptr<const Overlay> overlay = std::make_shared<Overlay>(upper, lower);
+    index->overlays.emplace(mountKey(upper), overlay);
+    index->overlays.emplace(mountKey(lower), overlay);
+    index->hasKinds = true;
+    index->stale = true;
+}
+
+std::shared_ptr<const Overlay> findOverlay(Computer * comp, const path_t& path, path_t * rel) {
+    MountIndex * index = getMountIndex(comp);
+    if (!index->hasKinds) return NULL;
+    std::lock_guard<std::mutex> lock(index->lock);
+    std::vector<path_t> rest;
+    const std::shared_ptr<const Overlay> overlay = findInside(index->overlays, path, rest);
+    if (overlay != NULL && rel != NULL) {
+        rel->clear();
+        for (const path_t& c : rest) *rel /= c;
+    }
+    return overlay;
+}
+
+// Must be called with the index locked.
+static std::shared_ptr<DiskImage> imageAt(const MountIndex * index, const path_t& path) {
+    const auto it = index->images.find(mountKey(path));
+    return it != index->images.end() ? it->second : NULL;
+}
+
+void addDiskImage(Computer * comp, const path_t& path, const std::shared_ptr<DiskImage>& image) {
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    index->images.emplace(mountKey(path), image);
+    index->hasKinds = true;
+    index->stale = true;
+}
+
+void removeDiskImage(Computer * comp, const path_t& path) {
+    if (path == comp->dataDir) return;
+    for (const auto& m : comp->mounts) if (path_t(std::get<1>(m)) == path) return;
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    index->images.erase(mountKey(path));
+    index->hasKinds = !index->overlays.empty() || !index->images.empty();
+    index->stale = true;
+}
+
+std::shared_ptr<DiskImage> findDiskImage(Computer * comp, const path_t& path, std::string * rel) {
+    MountIndex * index = getMountIndex(comp);
+    if (!index->hasKinds) return NULL;
+    std::lock_guard<std::mutex> lock(index->lock);
+    std::vector<path_t> rest;
+    const std::shared_ptr<DiskImage> image = findInside(index->images, path, rest);
+    if (image != NULL && rel != NULL) {
+        rel->clear();
+        for (const path_t& c : rest) {
+            if (!rel->empty()) *rel += "/";
+            *rel += c.string();
+        }
+    }
+    return image;
+}
+
+void invalidateMountCache(Computer * comp) {
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    index->stale = true;
+}
+
+size_t findMount(Computer * comp, const std::list<std::string>& pathc, std::vector<_path_t>& realPaths) {
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    updateMountIndex(comp, index);
+    size_t depth;
+    const MountNode * node = findMountNode(index, pathc, depth);
+    realPaths.clear();
+    if (depth == 0) realPaths.push_back(comp->dataDir);
+    for (size_t i : node->mounts) realPaths.push_back(std::get<1>(comp->mounts[i]));
+    return depth;
+}
+
+std::shared_ptr<const VirtualFS> getVirtualFS(Computer * comp, const path_t& path) {
+    const path_t::string_type& str = path.native();
+    if (!FileEntry::hasMountID(str)) return NULL;
+    unsigned id = 0;
+    for (size_t i = 0; str[i] != ':'; i++) id = id * 10 + (str[i] - '0');
+    const auto mount = comp->virtualMounts.find(id);
+    if (mount == comp->virtualMounts.end()) return NULL;
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    std::tuple<const FileEntry*, unsigned, std::shared_ptr<const VirtualFS> >& entry = index->virtualFS[id];
+    // plugins may replace a virtual mount's tree directly, or invalidate it after changing it, so check it's still current
+    const unsigned generation = VirtualFS::generation();
+    if (std::get<0>(entry) != mount->second || std::get<1>(entry) != generation || std::get<2>(entry) == NULL)
+        entry = std::make_tuple(mount->second, generation, VirtualFS::get(*mount->second));
+    return std::get<2>(entry);
+}
+
+const VirtualFS::Node * findVirtualPath(Computer * comp, const path_t& path, std::shared_ptr<const VirtualFS> * vfs) {
+    std::shared_ptr<const VirtualFS> found = getVirtualFS(comp, path);
+    if (found == NULL) return NULL;
+    const VirtualFS::Node * node = found->find(path);
+    if (vfs != NULL) *vfs = std::move(found);
+    return node;
+}
+
+static std::shared_ptr<const ResolvedPath> resolvePath(Computer * comp, const std::string& path) {
+    MountIndex * index = getMountIndex(comp);
+    std::lock_guard<std::mutex> lock(index->lock);
+    updateMountIndex(comp, index);
+    const auto it = index->cache.find(path);
+    if (it != index->cache.end()) {
+        index->lru.splice(index->lru.begin(), index->lru, it->second);
+        return it->second->second;
+    }
+    std::shared_ptr<ResolvedPath> res = std::make_shared<ResolvedPath>();
+    if (!splitPath(path, res->components, false)) res->valid = false;
+    else {
+        const MountNode * node = findMountNode(index, res->components, res->depth);
+        for (size_t i : node->mounts) res->realPaths.push_back(std::get<1>(comp->mounts[i]));
+        if (!index->overlays.empty()) {
+            if (res->depth == 0) res->overlays.push_back(index->dataOverlay);
+            res->overlays.insert(res->overlays.end(), node->overlays.begin(), node->overlays.end());
+        }
+        if (!index->images.empty()) {
+            if (res->depth == 0) res->images.push_back(index->dataImage);
+            res->images.insert(res->images.end(), node->images.begin(), node->images.end());
+        }
+        if (res->depth == 0) res->mountPath = "hdd";
+        else {
+            res->readOnly = std::get<2>(comp->mounts[node->mounts.front()]);
+            auto c = res->components.begin();
+            for (size_t i = 0; i < res->depth; i++, ++c) {
+                if (i) res->mountPath += "/";
+                res->mountPath += *c;
+            }
+        }
+    }
+    index->lru.emplace_front(path, res);
+    index->cache[path] = index->lru.begin();
+    if (index->lru.size() > mountCacheSize) {
+        index->cache.erase(index->lru.back().first);
+        index->lru.pop_back();
+    }
+    return res;
+}
+
+path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt, std::string * mountPath, bool * isRoot, MountKind * kind) {
     path_t ss;
     std::error_code e;
+    if (kind != NULL) *kind = MountKind();
     if (addExt) {
-        std::pair<size_t, std::vector<_path_t> > max_path = std::make_pair(0, std::vector<_path_t>(1, comp->dataDir));
-        std::list<std::string> * mount_list = NULL;
-        for (auto& m : comp->mounts) {
-            std::list<std::string> &pathlist = std::get<0>(m);
-            if (pathc.size() >= pathlist.size() && std::equal(pathlist.begin(), pathlist.end(), pathc.begin())) {
-                if (pathlist.size() > max_path.first) {
-                    max_path = std::make_pair(pathlist.size(), std::vector<_path_t>(1, std::get<1>(m)));
-                    mount_list = &pathlist;
-                } else if (pathlist.size() == max_path.first) {
-                    max_path.second.push_back(std::get<1>(m));
-                }
-            }
-        }
-        for (size_t i = 0; i < max_path.first; i++) pathc.pop_front();
+        const std::shared_ptr<const ResolvedPath> res = resolvePath(comp, path);
+        if (!res->valid) return path_t();
+        if (comp->isDebugger && res->components.size() == 1 && res->components.front() == "bios.lua")
+#ifdef STANDALONE_ROM
+            return path_t(":bios.lua", path_t::format::generic_format);
+#else
+            return getROMPath()/"bios.lua";
+#endif
+        std::list<std::string> pathc(std::next(res->components.begin(), res->depth), res->components.end());
+        // the data directory comes before anything mounted on the root
+        const size_t count = res->realPaths.size() + (res->depth == 0);
+        const auto candidate = [&res, comp](size_t i)->const _path_t& {return res->depth > 0 ? res->realPaths[i] : i == 0 ? comp->dataDir : res->realPaths[i-1];};
         if (isRoot != NULL) *isRoot = pathc.empty();
+        // in an overlay, the path may be in either of its directories
+        path_t rel;
+        if (!res->overlays.empty()) for (const std::string& s : pathc) rel /= s;
+        const auto overlay = [&res](size_t i)->const Overlay* {return res->overlays.empty() ? NULL : res->overlays[i].get();};
+        // in a disk image, the path is looked up in its index
+        std::string imagePath;
+        if (!res->images.empty()) for (const std::string& s : pathc) imagePath += (imagePath.empty() ? "" : "/") + s;
+        const auto image = [&res](size_t i)->const DiskImage* {return res->images.empty() ? NULL : res->images[i].get();};
+        // the overlay or image the path ends up in is handed back, so callers don't have to look for it again
+        const auto setKind = [&res, &rel, &imagePath, kind](size_t i) {
+            if (kind == NULL) return;
+            if (!res->overlays.empty() && res->overlays[i] != NULL) {
+                kind->overlay = res->overlays[i];
+                kind->overlayRel = rel;
+            }
+            if (!res->images.empty() && res->images[i] != NULL) {
+                kind->image = res->images[i];
+                kind->imageRel = imagePath;
+            }
+        };
         if (exists) {
             bool found = false;
-            for (const _path_t& p : max_path.second) {
+            for (size_t i = 0; i < count; i++) {
+                const _path_t& p = candidate(i);
                 path_t sstmp = p;
+                if (overlay(i) != NULL) {
+                    sstmp = overlay(i)->resolve(rel);
+                    if (sstmp.empty()) continue;
+                    ss /= sstmp;
+                    setKind(i);
+                    found = true;
+                    break;
+                }
                 for (const std::string& s : pathc) sstmp /= s;
                 e.clear();
-                if ((isVFSPath(p) && nothrow(comp->virtualMounts[(unsigned)std::stoul(p.substr(0, p.size()-1))]->path(sstmp))) || (fs::exists(sstmp, e))) {
+                if (image(i) != NULL ? image(i)->exists(imagePath) : ((isVFSPath(p) && findVirtualPath(comp, sstmp) != NULL) || fs::exists(sstmp, e))) {
                     ss /= sstmp;
+                    setKind(i);
                     found = true;
                     break;
                 }
@@ -232,13 +533,35 @@ path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt
             bool found = false;
             std::string back = pathc.back();
             pathc.pop_back();
-            for (const _path_t& p : max_path.second) {
+            for (size_t i = 0; i < count; i++) {
+                const _path_t& p = candidate(i);
                 path_t sstmp = p;
                 for (const std::string& s : pathc) sstmp /= s;
                 e.clear();
+                // new files in an overlay always go in the upper directory
+                if (overlay(i) != NULL) {
+                    if (Overlay::isWhiteout(back)) continue;
+                    const path_t parent = overlay(i)->resolve(rel.parent_path());
+                    if (!overlay(i)->resolve(rel).empty() || (!parent.empty() && fs::is_directory(parent, e))) {
+                        ss /= sstmp/back;
+                        setKind(i);
+                        found = true;
+                        break;
+                    }
+                    continue;
+                }
+                if (image(i) != NULL) {
+                    if (image(i)->exists(imagePath) || image(i)->isDir(imagePath.substr(0, imagePath.rfind('/')))) {
+                        ss /= sstmp/back;
+                        setKind(i);
+                        found = true;
+                        break;
+                    }
+                    continue;
+                }
+                const VirtualFS::Node * node;
                 if (
-                    (isVFSPath(p) && (nothrow(comp->virtualMounts[(unsigned)std::stoul(p.substr(0, p.size()-1))]->path(ss/back)) ||
-                    (nothrow(comp->virtualMounts[(unsigned)std::stoul(p.substr(0, p.size()-1))]->path(sstmp)) && comp->virtualMounts[(unsigned)std::stoul(p.substr(0, p.size()-1))]->path(sstmp).isDir))) ||
+                    (isVFSPath(p) && (findVirtualPath(comp, sstmp/back) != NULL || ((node = findVirtualPath(comp, sstmp)) != NULL && node->isDir))) ||
                     (fs::exists(sstmp/back, e)) || (fs::is_directory(sstmp, e))) {
                     ss /= sstmp/back;
                     found = true;
@@ -247,21 +570,18 @@ path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt
             }
             if (!found) return path_t();
         } else {
-            ss /= max_path.second.front();
+            // whiteout names can't be used in an overlay
+            if (overlay(0) != NULL && !pathc.empty() && Overlay::isWhiteout(pathc.back())) return path_t();
+            ss /= candidate(0);
             for (const std::string& s : pathc) ss /= s;
+            setKind(0);
         }
-        if (mountPath != NULL) {
-            if (mount_list == NULL) *mountPath = "hdd";
-            else {
-                std::stringstream ss2;
-                for (auto it = mount_list->begin(); it != mount_list->end(); ++it) {
-                    if (it != mount_list->begin()) ss2 << "/";
-                    ss2 << *it;
-                }
-                *mountPath = ss2.str();
-            }
-        }
-    } else for (const std::string& s : pathc) ss /= s;
+        if (mountPath != NULL) *mountPath = res->mountPath;
+    } else {
+        std::list<std::string> pathc;
+        splitPath(path, pathc, true);
+        for (const std::string& s : pathc) ss /= s;
+    }
     if (path_t::preferred_separator != (path_t::value_type)'/' && (!addExt || isVFSPath(ss))) {
         path_t::string_type str = ss.native();
         std::replace(str.begin(), str.end(), path_t::preferred_separator, (path_t::value_type)'/');
@@ -271,28 +591,8 @@ path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt
 }
 
 bool fixpath_ro(Computer *comp, const std::string& path) {
-    std::vector<std::string> elems = split(path, "/\\");
-    std::list<std::string> pathc;
-    for (std::string s : elems) {
-        if (s == "..") { if (pathc.empty()) return false; else pathc.pop_back(); }
-        else if (!s.empty() && !std::all_of(s.begin(), s.end(), [](const char c)->bool{return c == '.';})) {
-            s = s.substr(s.find_first_not_of(' '), s.find_last_not_of(' ') - s.find_first_not_of(' ') + 1);
-            s.erase(std::remove_if(s.begin(), s.end(), [](char c)->bool{return c=='"'||c==':'||c=='<'||c=='>'||c=='?'||c=='|';}), s.end());
-            pathc.push_back(s);
-        }
-    }
-    while (!pathc.empty() && pathc.front().empty()) pathc.pop_front();
-    if (!pathc.empty() && pathc.back().size() > 255) {
-        std::string s = pathc.back().substr(0, 255);
-        pathc.pop_back();
-        s = s.substr(0, s.find_last_not_of(' '));
-        pathc.push_back(s);
-    }
-    std::pair<size_t, bool> max_path = std::make_pair(0, false);
-    for (const auto& m : comp->mounts)
-        if (pathc.size() >= std::get<0>(m).size() && std::get<0>(m).size() > max_path.first && std::equal(std::get<0>(m).begin(), std::get<0>(m).end(), pathc.begin()))
-            max_path = std::make_pair(std::get<0>(m).size(), std::get<2>(m));
-    return max_path.second;
+    const std::shared_ptr<const ResolvedPath> res = resolvePath(comp, path);
+    return res->valid && res->readOnly;
 }
 
 std::set<std::string> getMounts(Computer * computer, const std::string& comp_path) {
@@ -306,9 +606,17 @@ std::set<std::string> getMounts(Computer * computer, const std::string& comp_pat
             pathc.push_back(s);
         }
     }
-    for (const auto& m : computer->mounts)
-        if (pathc.size() + 1 == std::get<0>(m).size() && std::equal(pathc.begin(), pathc.end(), std::get<0>(m).begin()))
-            retval.insert(std::get<0>(m).back());
+    MountIndex * index = getMountIndex(computer);
+    std::lock_guard<std::mutex> lock(index->lock);
+    updateMountIndex(computer, index);
+    const MountNode * node = &index->root;
+    for (const std::string& s : pathc) {
+        const auto it = node->children.find(s);
+        if (it == node->children.end()) return retval;
+        node = it->second.get();
+    }
+    for (const auto& c : node->children)
+        if (!c.second->mounts.empty()) retval.insert(c.first);
     return retval;
 }
 
@@ -356,21 +664,6 @@ void xcopy(lua_State *from, lua_State *to, int n) {
     lua_remove(to, cslot);
 }
 
-std::string makeASCIISafe(const char * retval, size_t len) {
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-    std::wstring wstr;
-    try {wstr = converter.from_bytes(retval, retval + len);} 
-    catch (std::exception &e) {
-        fprintf(stderr, "fs_handle_readAll: Error decoding UTF-8: %s\n", e.what());
-        std::string out;
-        for (size_t i = 0; i < len; i++) {if ((unsigned char)retval[i] < 128) out += retval[i]; else out += '?';}
-        return out;
-    }
-    std::string out;
-    for (wchar_t c : wstr) {if (c < 256) out += (char)c; else out += '?';}
-    return out;
-}
-
 struct IPv6 {uint16_t a, b, c, d, e, f, g, h;};
 
 static constexpr uint32_t makeIP(int a, int b, int c, int d) {return (a << 24) | (b << 16) | (c << 8) | d;}
@@ -25,6 +25,8 @@ extern "C" {
 #include <Poco/Net/HTTPResponse.h>
 #include <Computer.hpp>
 #include <Terminal.hpp>
+#include "unicode.hpp"
+#include "vfs.hpp"
 
 #define CRAFTOSPC_VERSION    "v2.7.6"
 #define CRAFTOSPC_CC_VERSION "1.108.0"
@@ -221,17 +223,42 @@ extern std::vector<std::wstring> split(const std::wstring& strToSplit, const wch
 extern std::vector<path_t> split(const path_t& strToSplit, const path_t::value_type * delimeter);
 extern void load_library(Computer *comp, lua_State *L, const library_t& lib);
 extern void HTTPDownload(const std::string& url, const std::function<void(std::istream*, Poco::Exception*, Poco::Net::HTTPResponse*)>& callback);
-extern path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt = true, std::string * mountPath = NULL, bool * isRoot = NULL);
+class Overlay;
+class DiskImage;
+// What a real path fixpath returns is in: the overlay or disk image its mount is, with the path
+// inside it, or neither for a plain directory. It's the same as findOverlay and findDiskImage give.
+struct MountKind {
+    std::shared_ptr<const Overlay> overlay;
+    path_t overlayRel;
+    std::shared_ptr<DiskImage> image;
+    std::string imageRel;
+};
+extern path_t fixpath(Computer *comp, const std::string& path, bool exists, bool addExt = true, std::string * mountPath = NULL, bool * isRoot = NULL, MountKind * kind = NULL);
 extern bool fixpath_ro(Computer *comp, const std::string& path);
 extern path_t fixpath_mkdir(Computer * comp, const std::string& path, bool md = true, std::string * mountPath = NULL);
 extern std::set<std::string> getMounts(Computer * computer, const std::string& comp_path);
+extern size_t findMount(Computer * comp, const std::list<std::string>& pathc, std::vector<_path_t>& realPaths);
+extern void invalidateMountCache(Computer * comp);
+// Layers a real directory over a read-only lower directory wherever it's used, as the data directory or a mount. The mounts using it don't need to be added yet.
+extern void addOverlay(Computer * comp, const path_t& upper, const path_t& lower);
+// Returns the overlay a real path is in (in either of its directories), and sets rel to the path inside it; NULL if it isn't in one.
+extern std::shared_ptr<const Overlay> findOverlay(Computer * comp, const path_t& path, path_t * rel = NULL);
+// Serves a real path (the data directory or a mount) from a disk image, which is the file at that path. The mounts using it don't need to be added yet.
+extern void addDiskImage(Computer * comp, const path_t& path, const std::shared_ptr<DiskImage>& image);
+// Stops serving a real path from a disk image, unless the data directory or another mount still uses it.
+extern void removeDiskImage(Computer * comp, const path_t& path);
+// Returns the disk image a real path is in, and sets rel to the path inside it; NULL if it isn't in one.
+extern std::shared_ptr<DiskImage> findDiskImage(Computer * comp, const path_t& path, std::string * rel = NULL);
+// Returns the index of the virtual mount a path ("<id>:/...") is on, or NULL if it isn't on one.
+extern std::shared_ptr<const VirtualFS> getVirtualFS(Computer * comp, const path_t& path);
+// Looks up a path on a virtual mount; returns NULL if it doesn't exist. vfs is set to the mount's index, which keeps the node alive.
+extern const VirtualFS::Node * findVirtualPath(Computer * comp, const path_t& path, std::shared_ptr<const VirtualFS> * vfs = NULL);
 extern void peripheral_update(Computer *comp);
 extern struct computer_configuration getComputerConfig(int id);
 extern void setComputerConfig(int id, const computer_configuration& cfg);
 extern void config_init();
 extern void config_save();
 extern void xcopy(lua_State *from, lua_State *to, int n);
-extern std::string makeASCIISafe(const char * retval, size_t len);
 extern bool matchIPClass(const std::string& address, const std::string& pattern);
 inline std::string checkstring(lua_State *L, int idx) {
     size_t sz = 0;
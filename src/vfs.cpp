@@ -0,0 +1,106 @@
+/*
+ * vfs.cpp
+ * CraftOS-PC 2
+ *
+ * This file implements the flat index used to read virtual mounts.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include "vfs.hpp"
+
+static std::mutex sharedIndexesLock;
+static std::unordered_map<const FileEntry*, std::weak_ptr<const VirtualFS> > sharedIndexes;
+static std::atomic<unsigned> indexGeneration {0};
+
+VirtualFS::VirtualFS(const FileEntry& root) {
+    std::vector<std::pair<Node*, size_t> > offsets;
+    addTree("", root, [this, &offsets](Node& node, const FileEntry& file) {
+        node.size = file.data.size();
+        offsets.emplace_back(&node, contents.size());
+        contents += file.data;
+    });
+    // the contents are only pointed to once they're all in, as appending may move them
+    for (const auto& o : offsets) o.first->data = contents.data() + o.second;
+}
+
+VirtualFS::VirtualFS(const FileEntry& root, const std::function<std::pair<const char*, size_t>(const FileEntry&)>& contents, std::shared_ptr<const void> owner): owner(std::move(owner)) {
+    addTree("", root, [&contents](Node& node, const FileEntry& file) {
+        std::tie(node.data, node.size) = contents(file);
+    });
+}
+
+VirtualFS::~VirtualFS() {
+    // indexes are looked up by their tree's address, so entries for indexes that are gone have to
+    // be dropped before another tree can be allocated at the same address
+    std::lock_guard<std::mutex> lock(sharedIndexesLock);
+    for (auto it = sharedIndexes.begin(); it != sharedIndexes.end();) {
+        if (it->second.expired()) it = sharedIndexes.erase(it);
+        else ++it;
+    }
+}
+
+void VirtualFS::addTree(const std::string& path, const FileEntry& entry, const std::function<void(Node&, const FileEntry&)>& addFile) {
+    Node& node = nodes[path];
+    if (!entry.isDir) {
+        // mounting a single file works with FileEntry::path, so keep it working
+        node.isDir = false;
+        addFile(node, entry);
+        return;
+    }
+    node.children.reserve(entry.dir.size());
+    // std::map keeps the names sorted already
+    for (const auto& child : entry.dir) node.children.push_back(child.first);
+    for (const auto& child : entry.dir)
+        addTree(path.empty() ? child.first : path + "/" + child.first, child.second, addFile);
+}
+
+const VirtualFS::Node * VirtualFS::find(const std::string& path) const {
+    const auto it = nodes.find(path);
+    return it == nodes.end() ? NULL : &it->second;
+}
+
+const VirtualFS::Node * VirtualFS::find(const std::filesystem::path& path) const {
+    std::string key;
+    for (const auto& item : path) {
+        const std::filesystem::path::string_type& name = item.native();
+        if ((name.size() == 1 && name[0] == '.') || FileEntry::isMountID(name)) continue;
+        if (!key.empty()) key += '/';
+        key += item.string();
+    }
+    return find(key);
+}
+
+std::shared_ptr<const VirtualFS> VirtualFS::get(const FileEntry& root) {
+    std::lock_guard<std::mutex> lock(sharedIndexesLock);
+    std::shared_ptr<const VirtualFS> fs = sharedIndexes[&root].lock();
+    if (fs == NULL) {
+        fs = std::make_shared<const VirtualFS>(root);
+        sharedIndexes[&root] = fs;
+    }
+    return fs;
+}
+
+void VirtualFS::set(const FileEntry& root, const std::shared_ptr<const VirtualFS>& fs) {
+    std::lock_guard<std::mutex> lock(sharedIndexesLock);
+    sharedIndexes[&root] = fs;
+}
+
+void VirtualFS::invalidate(const FileEntry& root) {
+    std::lock_guard<std::mutex> lock(sharedIndexesLock);
+    sharedIndexes.erase(&root);
+    indexGeneration++;
+}
+
+unsigned VirtualFS::generation() {
+    return indexGeneration.load();
+}
+
+VFSFileStream::VFSFileStream(const std::shared_ptr<const VirtualFS>& fs, const VirtualFS::Node * node): std::iostream(NULL), buf(node->data, node->size), fs(fs) {
+    rdbuf(&buf);
+}
@@ -0,0 +1,79 @@
+/*
+ * vfs.hpp
+ * CraftOS-PC 2
+ *
+ * This file defines the flat index used to read virtual mounts.
+ *
+ * This code is licensed under the MIT license.
+ * Copyright (c) 2019-2023 JackMacWindows.
+ */
+
+#ifndef VFS_HPP
+#define VFS_HPP
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <FileEntry.hpp>
+#include "filestream.hpp"
+
+/*
+ * Virtual mounts are handed to addVirtualMount as FileEntry trees, which are
+ * slow to walk (a map lookup per component). A VirtualFS flattens a tree into
+ * one hash table keyed by full path, and keeps its own copy of the file
+ * contents in one block, so it stays valid whatever happens to the tree (an
+ * index can also point at contents kept elsewhere, like the mapped ROM
+ * archive, as long as it holds whatever keeps them alive). The
+ * index for a tree is shared by every computer that mounts it, and is only
+ * rebuilt after invalidate is called for the tree (see invalidateVirtualMount
+ * in the plugin API).
+ */
+class VirtualFS {
+public:
+    struct Node {
+        bool isDir = true;
+        const char * data = NULL;          // File contents, in the index's copy or its owner
+        size_t size = 0;                   // File size
+        std::vector<std::string> children; // Sorted entry names, for directories
+    };
+
+    explicit VirtualFS(const FileEntry& root);
+    // Indexes a tree without copying it: contents gives each file's data, which owner keeps alive.
+    VirtualFS(const FileEntry& root, const std::function<std::pair<const char*, size_t>(const FileEntry&)>& contents, std::shared_ptr<const void> owner);
+    ~VirtualFS();
+
+    // Looks up a path. "." and virtual mount ID components (e.g. "0:") are skipped, like FileEntry::path.
+    const Node * find(const std::filesystem::path& path) const;
+    const Node * find(const std::string& path) const;
+
+    // Returns the shared index for a FileEntry tree, building it if no mount is using one yet.
+    static std::shared_ptr<const VirtualFS> get(const FileEntry& root);
+    // Makes get return fs for a tree while fs is alive, instead of building a copying index.
+    static void set(const FileEntry& root, const std::shared_ptr<const VirtualFS>& fs);
+    // Makes the next get for a tree build a new index, after the tree has changed.
+    static void invalidate(const FileEntry& root);
+    // Goes up each time an index is invalidated, so cached indexes can be checked cheaply.
+    static unsigned generation();
+private:
+    std::unordered_map<std::string, Node> nodes;
+    std::string contents; // Every file's contents, one after another (unless owner holds them)
+    std::shared_ptr<const void> owner;
+    void addTree(const std::string& path, const FileEntry& entry, const std::function<void(Node&, const FileEntry&)>& addFile);
+};
+
+/*
+ * A read-only stream over a virtual file's contents. It reads the data in
+ * place, and keeps the index, which owns the data, alive until it's closed.
+ */
+class VFSFileStream : public std::iostream {
+    MemoryBuffer buf;
+    std::shared_ptr<const VirtualFS> fs;
+public:
+    VFSFileStream(const std::shared_ptr<const VirtualFS>& fs, const VirtualFS::Node * node);
+};
+
+#endif